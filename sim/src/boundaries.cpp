@@ -244,13 +244,16 @@ bool ParticleBoundaryConditions::checkBoundaries(TLinkedParticle& p,fastreal rAv
         outside = true;
     }
     if(outside == true) {
-        errorlog
-                << "Boundaries returned particle that is outside the domain:  pop = " << Params::pops[p.popid]->getIdStr()
-                << ", r = [" << (int(p.x/Params::R_P*100))/100.0 << ", "
-                << (int(p.y/Params::R_P*100))/100.0 << ", "
-                << (int(p.z/Params::R_P*100))/100.0
-                << "], v = " << sqrt(sqr(p.vx)+sqr(p.vy)+sqr(p.vz)) << " m/s"
-                << ", rave = " << rAverageFlag << "\n";
+        static LogRateLimit outsideLog(errorlog,__FILE__,__LINE__);
+        if(outsideLog.allow() == true) {
+            errorlog
+                    << "Boundaries returned particle that is outside the domain:  pop = " << Params::pops[p.popid]->getIdStr()
+                    << ", r = [" << (int(p.x/Params::R_P*100))/100.0 << ", "
+                    << (int(p.y/Params::R_P*100))/100.0 << ", "
+                    << (int(p.z/Params::R_P*100))/100.0
+                    << "], v = " << sqrt(sqr(p.vx)+sqr(p.vy)+sqr(p.vz)) << " m/s"
+                    << ", rave = " << rAverageFlag << "\n";
+        }
         return false;
     }
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
@@ -269,12 +272,15 @@ bool ParticleBoundaryConditions::checkBoundaries(TLinkedParticle& p,fastreal rAv
             rAverage[1] < Params::box_ymin_tight || rAverage[1] > Params::box_ymax_tight ||
             rAverage[2] < Params::box_zmin_tight || rAverage[2] > Params::box_zmax_tight) {
             // outside
-            errorlog << "Boundaries: rAverage outside the domain (may be raveflag issue) \n"
-                     << " pop = " << Params::pops[p.popid]->getIdStr()
-                     << ", rA = [" << (int(rAverage[0]/Params::R_P*100))/100.0 << ", "
-                     << (int(rAverage[1]/Params::R_P*100))/100.0 << ", "
-                     << (int(rAverage[2]/Params::R_P*100))/100.0
-                     << "], v = [" << p.vx << ", " << p.vy << ", " << p.vz << "] m/s" << "\n";
+            static LogRateLimit raveLog(errorlog,__FILE__,__LINE__);
+            if(raveLog.allow() == true) {
+                errorlog << "Boundaries: rAverage outside the domain (may be raveflag issue) \n"
+                         << " pop = " << Params::pops[p.popid]->getIdStr()
+                         << ", rA = [" << (int(rAverage[0]/Params::R_P*100))/100.0 << ", "
+                         << (int(rAverage[1]/Params::R_P*100))/100.0 << ", "
+                         << (int(rAverage[2]/Params::R_P*100))/100.0
+                         << "], v = [" << p.vx << ", " << p.vy << ", " << p.vz << "] m/s" << "\n";
+            }
             rAverage[0] = p.x;
             rAverage[1] = p.y;
             rAverage[2] = p.z;
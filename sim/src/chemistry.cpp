@@ -436,7 +436,10 @@ void ParticleProcesses::doChargeExchange(TLinkedParticle& part)
                 // prob cannot be large, otherwise the probability of next loop is not correct (P2*(1-P1)~P2 when P1<<1)
                 if(prob > CX.probLimitHeavyReactions[i][j]) {
                     CX.heavyReactionCounter[i][j] += 1.0;
-                    errorlog << "ChargeExchange " << CX.processIdStr[i][j] << ": heavy reaction happens, counter = " << CX.heavyReactionCounter[i][j] << endl;
+                    static LogRateLimit heavyReactionLog(errorlog,__FILE__,__LINE__);
+                    if(heavyReactionLog.allow() == true) {
+                        errorlog << "ChargeExchange " << CX.processIdStr[i][j] << ": heavy reaction happens, counter = " << CX.heavyReactionCounter[i][j] << endl;
+                    }
                     if(CX.heavyReactionCounter[i][j] > CX.N_limitHeavyReactions[i][j]) {
                         ERRORMSG2("ChargeExchange: too many heavy reactions happened. Reduce the time step!",CX.processIdStr[i][j]);
                         doabort();
@@ -675,7 +678,10 @@ void ParticleProcesses::doElectronImpactIonization(TLinkedParticle& part)
                 // prob cannot be large, otherwise the probability of next loop is not correct (P2*(1-P1)~P2 when P1<<1)
                 if(prob > EI.probLimitHeavyReactions[i][j]) {
                     EI.heavyReactionCounter[i][j] += 1.0;
-                    errorlog << "ElectronImpactIonization " << EI.processIdStr[i][j] << ": heavy reaction, counter = " << EI.heavyReactionCounter[i][j] << endl;
+                    static LogRateLimit heavyReactionLog(errorlog,__FILE__,__LINE__);
+                    if(heavyReactionLog.allow() == true) {
+                        errorlog << "ElectronImpactIonization " << EI.processIdStr[i][j] << ": heavy reaction, counter = " << EI.heavyReactionCounter[i][j] << endl;
+                    }
                     if(EI.heavyReactionCounter[i][j] > EI.N_limitHeavyReactions[i][j]) {
                         ERRORMSG2("ElectronImpactIonization: too many heavy reactions happened. Reduce the time step!",EI.processIdStr[i][j]);
                         doabort();
@@ -49,6 +49,8 @@ void doabort()
 {
     errorlog << "ABORT: doabort() called\n";
     cerr     << "ABORT: doabort() called\n";
+    LogRateLimit::writeSummaries();
+    Logger::flushAll();
     abort();
 }
 
@@ -30,13 +30,19 @@ typedef float shortreal; //!< Simulation shortreal type
 typedef float fastreal; //!< Simulation fastreal type
 typedef double real; //!< Simulation real type
 typedef shortreal gridreal; //!< Simulation gridreal type
+#ifdef USE_FLOAT_FIELD_DATA
+typedef float datareal; //!< Simulation datareal type (grid data storage, arithmetic is done in real)
+#else
 typedef real datareal; //!< Simulation datareal type
+#endif
 typedef int TPDF_ID; //!< Simulation TPDF_ID type
 
 #define ERRORMSG(msg) errorlog << "ERROR [" << __FILE__ << "/" << __LINE__ << "]: " << msg << "\n";
 #define ERRORMSG2(msgA,msgB) errorlog << "ERROR [" << __FILE__ << "/" << __LINE__ << "]: " << msgA << " (" << msgB << ")\n";
 #define WARNINGMSG(msg) errorlog << "WARNING [" << __FILE__ << "/" << __LINE__ << "]: " << msg << "\n";
 #define WARNINGMSG2(msgA,msgB) errorlog << "WARNING [" << __FILE__ << "/" << __LINE__ << "]: " << msgA << " (" << msgB << ")\n";
+// Rate limited versions for messages from particle and cell loops (see LogRateLimit)
+#define ERRORMSG_LIMITED(msg) { static LogRateLimit rateLimit_(errorlog,__FILE__,__LINE__); if (rateLimit_.allow()) { ERRORMSG(msg) } }
 #define MSGFUNCTIONCALL(name) mainlog << "\n==== FUNCTION CALL [" << name << "]\n";
 #define MSGFUNCTIONEND(name) mainlog << "==== FUNCTION END  [" << name << "]\n\n";
 
@@ -22,6 +22,9 @@
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <map>
+#include <limits>
+#include <algorithm>
 #include "detector.h"
 #include "simulation.h"
 #include "params.h"
@@ -101,7 +104,7 @@ Detector::Detector(DetectorArgs args)
     detectionTime[1] = args.detectionTime.value[1];
     fieldDetects.clear();
     partDetects.clear();
-    testParts.clear();
+    Ntestparticles = 0;
     detectionFiles.clear();
     currentCounts.clear();
     if (args.detectorFUNC.given == true) {
@@ -149,8 +152,22 @@ string Detector::toString()
             ss << detectionFiles[i] << "\n";
         }
     }
+    if (detectorType.compare("probe")==0) {
+        ss << "Detection time:  from " << detectionTime[0] << " s to "
+           << detectionTime[1] << " s\n";
+        ss << "Coordinate file: " << coordinateFile << "\n";
+        ss << "Detection file: " << detectionFile << "\n";
+    }
+    if (detectorType.compare("slice")==0) {
+        ss << "Detection time:  from " << detectionTime[0] << " s to "
+           << detectionTime[1] << " s\n";
+        ss << "Detection files: \n";
+        for (unsigned int i=0; i<detectionFiles.size(); i++) {
+            ss << detectionFiles[i] << "\n";
+        }
+    }
     if (detectorType.compare("testparticle")==0) {
-        ss << "Number of test particles: " << testParts.size() << "\n";
+        ss << "Number of test particles: " << Ntestparticles << "\n";
         ss << "Insertion time: " << detectionTime[0] << "\n";
         ss << "Test particle propagation ends at "<< detectionTime[1] << " s\n";
         ss << "Charge of test particles: " << charge/Params::e << " e\n";
@@ -186,7 +203,7 @@ unsigned int Detector::getNumberOfPartDetects()
 }
 
 //! Number of field and particle detectors and test particles
-unsigned int DetectorFactory::numberOfDetectors[3] = {0, 0, 0};
+unsigned int DetectorFactory::numberOfDetectors[5] = {0, 0, 0, 0, 0};
 
 // Construction functions for detector factory
 Detector* newFieldDetector(DetectorArgs args)
@@ -201,6 +218,14 @@ Detector* newTestParticleSet(DetectorArgs args)
 {
     return new TestParticleSet(args);
 }
+Detector* newProbeDetector(DetectorArgs args)
+{
+    return new ProbeDetectorSet(args);
+}
+Detector* newSliceDetector(DetectorArgs args)
+{
+    return new SliceDetectorSet(args);
+}
 
 //! Constructor
 DetectorFactory::DetectorFactory() { }
@@ -231,6 +256,12 @@ Detector* DetectorFactory::createDetector(const string detectorType, DetectorArg
     } else if (detectorType.compare("testparticle") == 0) {
         temp = newTestParticleSet(args);
         numberOfDetectors[2]++;
+    } else if (detectorType.compare("probe") == 0) {
+        temp = newProbeDetector(args);
+        numberOfDetectors[3]++;
+    } else if (detectorType.compare("slice") == 0) {
+        temp = newSliceDetector(args);
+        numberOfDetectors[4]++;
     } else {
         ERRORMSG2("cannot find detector type",detectorType);
         doabort();
@@ -241,7 +272,7 @@ Detector* DetectorFactory::createDetector(const string detectorType, DetectorArg
 //! Return total number of detectors
 int DetectorFactory::getNumberOfDetectors()
 {
-    return numberOfDetectors[0]+numberOfDetectors[1];
+    return numberOfDetectors[0]+numberOfDetectors[1]+numberOfDetectors[3]+numberOfDetectors[4];
 }
 
 //! Return number of detectors of a certain type
@@ -253,6 +284,10 @@ int DetectorFactory::getNumberOfDetectors(const string detectorType)
         return numberOfDetectors[1];
     } else if (detectorType.compare("testparticle") == 0) {
         return numberOfDetectors[1];
+    } else if (detectorType.compare("probe") == 0) {
+        return numberOfDetectors[3];
+    } else if (detectorType.compare("slice") == 0) {
+        return numberOfDetectors[4];
     } else {
         ERRORMSG2("cannot find detector type",detectorType);
         doabort();
@@ -520,6 +555,863 @@ void FieldDetectorSet::readCoordinateFile(const string coordinateFile, vector <T
     fclose(coordFile);
 }
 
+//! Byte order of the binary detector files
+static const char *binaryByteOrder()
+{
+    float one = 1.0;
+    ByteConversion(sizeof(float),(unsigned char*)&one,1);
+    return (reinterpret_cast<unsigned char*>(&one)[0] == 0) ? "little" : "big";
+}
+
+// PROBE DETECTORS
+
+//! Values of one cell for the current time step, shared by all probe sets
+struct TProbeCellValues {
+    std::vector<real> fluid; //!< n,vx,vy,vz,P of each population
+    std::vector<bool> done; //!< Fluid values of a population computed
+    real ue[3],j[3],B[3];
+};
+
+//! Cell values computed during the time step probeCacheStep (probe and slice sets)
+static map<Tgrid::TCellPtr,TProbeCellValues> probeCellCache;
+static int probeCacheStep = -1;
+
+/** \brief Sample the cell values of points sorted by cell
+ *
+ * order has the cell and the index of each point, sorted by cell. The
+ * values n,vx,vy,vz,P of each population of popIds followed by ue, j and B
+ * in the cell of point i are written to vals[i*pointStride + q*quantityStride].
+ * Each cell is evaluated once per time step and shared by all probe and
+ * slice sets.
+ */
+static void sampleCells(const vector< pair<Tgrid::TCellPtr,unsigned int> >& order, const vector<int>& popIds,
+                        float *vals, unsigned int pointStride, unsigned int quantityStride)
+{
+    if (probeCacheStep != Params::cnt_dt) {
+        probeCellCache.clear();
+        probeCacheStep = Params::cnt_dt;
+    }
+    const unsigned int npops = popIds.size();
+    const unsigned int nv = 5*npops + 9;
+    vector<int> popId(1, 0);
+    vector<float> cellvals(nv);
+    unsigned int k = 0;
+    while (k < order.size()) {
+        const Tgrid::TCellPtr c = order[k].first;
+        TProbeCellValues& cv = probeCellCache[c];
+        if (cv.done.empty() == true) {
+            cv.fluid.assign(5*Params::POPULATIONS, 0.0);
+            cv.done.assign(Params::POPULATIONS, false);
+            g.cellintpol(c, Tgrid::CELLDATA_UE, cv.ue);
+            g.cellintpol(c, Tgrid::CELLDATA_J, cv.j);
+            g.cellintpol(c, Tgrid::CELLDATA_B, cv.B);
+        }
+        for (unsigned int p=0; p<npops; p++) {
+            const int popi = popIds[p];
+            if (cv.done[popi] == false) {
+                popId[0] = popi;
+                g.cellintpol_fluid(c, cv.fluid[5*popi], cv.fluid[5*popi + 1], cv.fluid[5*popi + 2], cv.fluid[5*popi + 3], cv.fluid[5*popi + 4], popId);
+                cv.done[popi] = true;
+            }
+            for (int q=0; q<5; q++) cellvals[5*p + q] = cv.fluid[5*popi + q];
+        }
+        for (int d=0; d<3; d++) {
+            cellvals[5*npops + d] = cv.ue[d];
+            cellvals[5*npops + 3 + d] = cv.j[d];
+            cellvals[5*npops + 6 + d] = cv.B[d];
+        }
+        for (; k < order.size() && order[k].first == c; k++) {
+            float *const v = vals + order[k].second*pointStride;
+            for (unsigned int q=0; q<nv; q++) v[q*quantityStride] = cellvals[q];
+        }
+    }
+}
+
+/** \brief Constructor for ProbeDetectorSet
+ * Probes are given as detectorFUNC points (point x y z) and/or in
+ * coordinateFile. A coordinateFile with lines "x y z" gives fixed probes, one
+ * with lines "t x y z" gives the trajectory of one moving probe.
+ */
+ProbeDetectorSet::ProbeDetectorSet(DetectorArgs args)
+    : Detector(args), out(0), outbuf(0), nrecords(0)
+{
+    if (args.detectorFUNC.given == false && args.coordinateFile.given == false) {
+        ERRORMSG ("coordinates for a ProbeDetectorSet must be given "
+                  "in detectorFUNC or in coordinateFile");
+        doabort();
+    }
+    if (args.maxCounts.given == true) {
+        WARNINGMSG ("ProbeDetectorSet doesn't use maxCounts");
+    }
+    if (args.m.given == true) {
+        WARNINGMSG ("ProbeDetectorSet doesn't use mass");
+    }
+    if (args.q.given == true) {
+        WARNINGMSG ("ProbeDetectorSet doesn't use charge");
+    }
+    if (args.testParticleFile.given == true) {
+        WARNINGMSG2 ("ProbeDetectorSet doesn't use testParticleFile",
+                     args.testParticleFile.value);
+    }
+    detectorType = "probe";
+    popIdStr = args.popIdStr.given ? args.popIdStr.value : "-";
+    for (int popi=0; popi<Params::POPULATIONS; popi++) {
+        if (popIdStr.compare("-") == 0 || popIdStr.compare(Params::pops[popi]->getIdStr()) == 0) {
+            popIds.push_back(popi);
+        }
+    }
+    if (args.detectorFUNC.given == true) {
+        for (unsigned int i=0; i<args.detectorFUNC.name.size(); i++) {
+            if (args.detectorFUNC.name[i].compare("point") != 0 || args.detectorFUNC.funcArgs[i].size() != 3) {
+                ERRORMSG2 ("probes are given as 'point x y z' - not created",
+                           args.detectorFUNC.name[i]);
+                continue;
+            }
+            const gridreal coords[3] = {static_cast<gridreal>(args.detectorFUNC.funcArgs[i][0]),
+                                        static_cast<gridreal>(args.detectorFUNC.funcArgs[i][1]),
+                                        static_cast<gridreal>(args.detectorFUNC.funcArgs[i][2])
+                                       };
+            probePoints.push_back(Tgr3v(coords));
+        }
+    }
+    if (args.coordinateFile.given == true) {
+        coordinateFile = args.coordinateFile.value;
+        readCoordinateFile(coordinateFile);
+    }
+    if (trajectoryTime.empty() == false && probePoints.empty() == false) {
+        ERRORMSG ("a ProbeDetectorSet cannot have both fixed probes and a trajectory");
+        doabort();
+    }
+    if (Nprobes() == 0) {
+        ERRORMSG2 ("no probes in ProbeDetectorSet", detectionFile);
+        doabort();
+    }
+    int outside = 0;
+    for (unsigned int i=0; i<probePoints.size(); i++) {
+        const gridreal r[3] = {probePoints[i][0], probePoints[i][1], probePoints[i][2]};
+        if (Params::insideBox(r) == false) {
+            outside++;
+        }
+    }
+    if (outside > 0) {
+        WARNINGMSG2 ("probes outside the simulation box (values will be NaN)", outside);
+    }
+    // Large stream buffer: the records are written without flushing
+    const int bufsize = 1 << 20;
+    outbuf = new char[bufsize];
+    out = new ofstream;
+    out->rdbuf()->pubsetbuf(outbuf, bufsize);
+    out->open(detectionFile.c_str(), fstream::out | fstream::binary);
+    if (!out->good()) {
+        ERRORMSG2 ("unable to open detectionFile", detectionFile);
+        doabort();
+    }
+    detectionFiles.push_back(detectionFile);
+    writeHeader();
+}
+
+//! Destructor
+ProbeDetectorSet::~ProbeDetectorSet()
+{
+    close();
+}
+
+//! Number of probes
+unsigned int ProbeDetectorSet::Nprobes() const
+{
+    return trajectoryTime.empty() ? probePoints.size() : 1;
+}
+
+//! Position of probe i at Params::t, false (and NaN) if outside the trajectory time range
+bool ProbeDetectorSet::probePosition(unsigned int i, gridreal r[3])
+{
+    if (trajectoryTime.empty() == true) {
+        for (int d=0; d<3; d++) r[d] = probePoints[i][d];
+        return true;
+    }
+    const real t = Params::t;
+    if (t < trajectoryTime.front() || t > trajectoryTime.back()) {
+        for (int d=0; d<3; d++) r[d] = numeric_limits<gridreal>::quiet_NaN();
+        return false;
+    }
+    unsigned int n = upper_bound(trajectoryTime.begin(), trajectoryTime.end(), t) - trajectoryTime.begin();
+    if (n >= trajectoryTime.size()) n = trajectoryTime.size() - 1;
+    if (n == 0) n = 1;
+    const real dt = trajectoryTime[n] - trajectoryTime[n-1];
+    const real a = (dt > 0) ? (t - trajectoryTime[n-1])/dt : 0;
+    for (int d=0; d<3; d++) r[d] = (1-a)*trajectoryPoints[n-1][d] + a*trajectoryPoints[n][d];
+    return true;
+}
+
+//! Read probe coordinates (x y z) or a trajectory (t x y z) from a file, '%' and '#' start comment lines
+void ProbeDetectorSet::readCoordinateFile(const string fileName)
+{
+    ifstream in(fileName.c_str());
+    if (!in.good()) {
+        ERRORMSG2 ("unable to open coordinateFile for a ProbeDetectorSet", fileName);
+        doabort();
+    }
+    int ncols = 0;
+    int lineno = 0;
+    string line;
+    while (getline(in, line)) {
+        lineno++;
+        const string::size_type first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '%' || line[first] == '#') {
+            continue;
+        }
+        istringstream ls(line);
+        vector<real> v;
+        real x;
+        while (ls >> x) v.push_back(x);
+        if (ncols == 0) {
+            ncols = v.size();
+            if (ncols != 3 && ncols != 4) {
+                ERRORMSG2 ("coordinateFile of a ProbeDetectorSet must have lines 'x y z' or 't x y z'", fileName);
+                doabort();
+            }
+        }
+        if (int(v.size()) != ncols) {
+            errorlog << "ERROR [ProbeDetectorSet::readCoordinateFile]: bad line " << lineno << " in " << fileName << "\n";
+            doabort();
+        }
+        if (ncols == 3) {
+            const gridreal coords[3] = {gridreal(v[0]), gridreal(v[1]), gridreal(v[2])};
+            probePoints.push_back(Tgr3v(coords));
+        } else {
+            if (trajectoryTime.empty() == false && v[0] <= trajectoryTime.back()) {
+                errorlog << "ERROR [ProbeDetectorSet::readCoordinateFile]: trajectory times must increase (line " << lineno << " in " << fileName << ")\n";
+                doabort();
+            }
+            const gridreal coords[3] = {gridreal(v[1]), gridreal(v[2]), gridreal(v[3])};
+            trajectoryTime.push_back(v[0]);
+            trajectoryPoints.push_back(Tgr3v(coords));
+        }
+    }
+}
+
+//! Write the ASCII header of the probe file
+void ProbeDetectorSet::writeHeader()
+{
+    (*out) << "% HYB probe set " << detectionFile << "\n"
+           << "% probes = " << Nprobes() << "\n"
+           << "% trajectory = " << (trajectoryTime.empty() ? 0 : 1) << "\n"
+           << "% populations =";
+    for (unsigned int i=0; i<popIds.size(); i++) {
+        (*out) << " " << Params::pops[popIds[i]]->getIdStr();
+    }
+    (*out) << "\n% quantities = x y z";
+    for (unsigned int i=0; i<popIds.size(); i++) {
+        (*out) << " n" << i+1 << " vx" << i+1 << " vy" << i+1 << " vz" << i+1 << " P" << i+1;
+    }
+    (*out) << " uex uey uez jx jy jz Bx By Bz\n"
+           << "% units = SI base units: t in s, x in m, n in m-3, v in m/s, P in Pa, etc.\n"
+           << "% record = float64 t, then probes x quantities float32 values (probe by probe)\n"
+           << "% byteorder = " << binaryByteOrder() << "\n"
+           << "% values of probes outside the grid or the trajectory time range are NaN\n"
+           << "% end\n";
+}
+
+//! Flush and close the probe file
+void ProbeDetectorSet::close()
+{
+    if (out == 0) {
+        return;
+    }
+    out->close();
+    delete out;
+    delete [] outbuf;
+    out = 0;
+    outbuf = 0;
+    mainlog << "ProbeDetectorSet: " << nrecords << " records written to " << detectionFile << "\n";
+}
+
+//! Evaluate all probes in one pass and write one record
+void ProbeDetectorSet::runFieldDetects()
+{
+    if (out == 0 || Params::t < detectionTime[0]) {
+        return;
+    }
+    if (Params::t > detectionTime[1]) {
+        close();
+        return;
+    }
+    const unsigned int N = Nprobes();
+    const unsigned int npops = popIds.size();
+    const unsigned int nq = 3 + 5*npops + 9;
+    const float nan = numeric_limits<float>::quiet_NaN();
+    record.assign(N*nq, nan);
+    // Sort probes by cell so that each cell is visited once
+    vector< pair<Tgrid::TCellPtr,unsigned int> > order;
+    order.reserve(N);
+    for (unsigned int i=0; i<N; i++) {
+        gridreal r[3];
+        const bool valid = probePosition(i, r);
+        for (int d=0; d<3; d++) record[i*nq + d] = r[d];
+        if (valid == false) {
+            continue;
+        }
+        Tgrid::TCellPtr c = g.findcell(r);
+        if (c != 0) {
+            order.push_back(make_pair(c, i));
+        }
+    }
+    sort(order.begin(), order.end());
+    sampleCells(order, popIds, &record[3], nq, 1);
+    double t = Params::t;
+    ByteConversion(sizeof(double),(unsigned char*)&t,1);
+    WriteDoublesToFile(*out,&t,1);
+    if (record.empty() == false) {
+        ByteConversion(sizeof(float),(unsigned char*)&record[0],record.size());
+        WriteFloatsToFile(*out,&record[0],record.size());
+    }
+    nrecords++;
+}
+
+// SLICE DETECTORS
+
+/** \brief Constructor for SliceDetectorSet
+ * detectorFUNC input for a slice detector is
+ * xy z0 xmin xmax ymin ymax nx ny (plane z = z0, nx*ny raster)
+ * xz y0 xmin xmax zmin zmax nx nz (plane y = y0)
+ * yz x0 ymin ymax zmin zmax ny nz (plane x = x0)
+ * line x1 y1 z1 x2 y2 z2 n (n points from (x1,y1,z1) to (x2,y2,z2))
+ * saveInterval T (sampling interval [s], default every time step)
+ * Plane rasters are sampled at pixel centres.
+ */
+SliceDetectorSet::SliceDetectorSet(DetectorArgs args)
+    : Detector(args), saveInterval(0), nrecords(0), closed(false)
+{
+    if (args.detectorFUNC.given == false) {
+        ERRORMSG ("cuts of a SliceDetectorSet must be given in detectorFUNC");
+        doabort();
+    }
+    if (args.maxCounts.given == true) {
+        WARNINGMSG ("SliceDetectorSet doesn't use maxCounts");
+    }
+    if (args.m.given == true) {
+        WARNINGMSG ("SliceDetectorSet doesn't use mass");
+    }
+    if (args.q.given == true) {
+        WARNINGMSG ("SliceDetectorSet doesn't use charge");
+    }
+    if (args.coordinateFile.given == true) {
+        WARNINGMSG2 ("SliceDetectorSet doesn't use coordinateFile",
+                     args.coordinateFile.value);
+    }
+    if (args.testParticleFile.given == true) {
+        WARNINGMSG2 ("SliceDetectorSet doesn't use testParticleFile",
+                     args.testParticleFile.value);
+    }
+    detectorType = "slice";
+    popIdStr = args.popIdStr.given ? args.popIdStr.value : "-";
+    for (int popi=0; popi<Params::POPULATIONS; popi++) {
+        if (popIdStr.compare("-") == 0 || popIdStr.compare(Params::pops[popi]->getIdStr()) == 0) {
+            popIds.push_back(popi);
+        }
+    }
+    for (unsigned int i=0; i<args.detectorFUNC.name.size(); i++) {
+        const string& name = args.detectorFUNC.name[i];
+        const vector<real>& a = args.detectorFUNC.funcArgs[i];
+        if (name.compare("saveInterval") == 0 && a.size() == 1 && a[0] >= 0) {
+            saveInterval = a[0];
+            continue;
+        }
+        TCut cut;
+        cut.type = name;
+        cut.out = 0;
+        cut.outbuf = 0;
+        if ((name.compare("xy") == 0 || name.compare("xz") == 0 || name.compare("yz") == 0) && a.size() == 7 && a[5] >= 1 && a[6] >= 1) {
+            // plane normal n, raster axes u and v
+            const int n = (name[0] == 'y') ? 0 : (name[1] == 'y' ? 2 : 1);
+            const int u = (name[0] == 'x') ? 0 : 1;
+            const int v = (name[1] == 'y') ? 1 : 2;
+            cut.nu = int(a[5] + 0.5);
+            cut.nv = int(a[6] + 0.5);
+            for (int d=0; d<3; d++) cut.du[d] = cut.dv[d] = 0;
+            cut.du[u] = (a[2] - a[1])/cut.nu;
+            cut.dv[v] = (a[4] - a[3])/cut.nv;
+            cut.origin[n] = a[0];
+            cut.origin[u] = a[1] + 0.5*cut.du[u];
+            cut.origin[v] = a[3] + 0.5*cut.dv[v];
+        } else if (name.compare("line") == 0 && a.size() == 7 && a[6] >= 1) {
+            cut.nu = int(a[6] + 0.5);
+            cut.nv = 1;
+            for (int d=0; d<3; d++) {
+                cut.origin[d] = a[d];
+                cut.du[d] = (cut.nu > 1) ? (a[3+d] - a[d])/(cut.nu - 1) : 0;
+                cut.dv[d] = 0;
+            }
+        } else {
+            ERRORMSG2 ("bad slice detectorFUNC entry (xy z0 xmin xmax ymin ymax nx ny, xz ..., yz ..., "
+                       "line x1 y1 z1 x2 y2 z2 n or saveInterval T)", name);
+            doabort();
+        }
+        stringstream nameStr;
+        nameStr << detectionFile1st << "_" << cuts.size()+1 << "_" << name;
+        if (detectionFile2nd.compare("") != 0) {
+            nameStr << "." << detectionFile2nd;
+        }
+        cut.fileName = nameStr.str();
+        const int bufsize = 1 << 20;
+        cut.outbuf = new char[bufsize];
+        cut.out = new ofstream;
+        cut.out->rdbuf()->pubsetbuf(cut.outbuf, bufsize);
+        cut.out->open(cut.fileName.c_str(), fstream::out | fstream::binary);
+        if (!cut.out->good()) {
+            ERRORMSG2 ("unable to open slice file", cut.fileName);
+            doabort();
+        }
+        detectionFiles.push_back(cut.fileName);
+        writeHeader(cut);
+        cuts.push_back(cut);
+    }
+    if (cuts.empty() == true) {
+        ERRORMSG2 ("no cuts in SliceDetectorSet", detectionFile);
+        doabort();
+    }
+}
+
+//! Destructor
+SliceDetectorSet::~SliceDetectorSet()
+{
+    close();
+}
+
+//! Write the ASCII header of a cut file
+void SliceDetectorSet::writeHeader(TCut& cut)
+{
+    ofstream& o = *cut.out;
+    o << "% HYB slice " << cut.fileName << "\n"
+      << "% type = " << cut.type << "\n"
+      << "% nu = " << cut.nu << "\n"
+      << "% nv = " << cut.nv << "\n"
+      << "% origin = " << cut.origin[0] << " " << cut.origin[1] << " " << cut.origin[2] << "\n"
+      << "% du = " << cut.du[0] << " " << cut.du[1] << " " << cut.du[2] << "\n"
+      << "% dv = " << cut.dv[0] << " " << cut.dv[1] << " " << cut.dv[2] << "\n"
+      << "% point(iu,iv) = origin + iu*du + iv*dv\n"
+      << "% populations =";
+    for (unsigned int i=0; i<popIds.size(); i++) {
+        o << " " << Params::pops[popIds[i]]->getIdStr();
+    }
+    o << "\n% quantities =";
+    for (unsigned int i=0; i<popIds.size(); i++) {
+        o << " n" << i+1 << " vx" << i+1 << " vy" << i+1 << " vz" << i+1 << " P" << i+1;
+    }
+    o << " uex uey uez jx jy jz Bx By Bz\n"
+      << "% units = SI base units: t in s, n in m-3, v in m/s, P in Pa, etc.\n"
+      << "% record = float64 t, then quantities x nv x nu float32 values (quantity by quantity, iu fastest)\n"
+      << "% byteorder = " << binaryByteOrder() << "\n"
+      << "% values of points outside the grid are NaN\n"
+      << "% end\n";
+}
+
+//! Flush and close the cut files
+void SliceDetectorSet::close()
+{
+    if (closed == true) {
+        return;
+    }
+    for (unsigned int i=0; i<cuts.size(); i++) {
+        cuts[i].out->close();
+        delete cuts[i].out;
+        delete [] cuts[i].outbuf;
+        cuts[i].out = 0;
+        cuts[i].outbuf = 0;
+    }
+    closed = true;
+    mainlog << "SliceDetectorSet: " << nrecords << " records written to " << cuts.size() << " cut files of " << detectionFile << "\n";
+}
+
+//! Sample all cuts and write one record of each
+void SliceDetectorSet::runFieldDetects()
+{
+    if (closed == true || Params::t < detectionTime[0]) {
+        return;
+    }
+    if (Params::t > detectionTime[1]) {
+        close();
+        return;
+    }
+    if (saveInterval > 0 && Params::cnt_dt % max(int(saveInterval/Params::dt+0.5), 1) != 0) {
+        return;
+    }
+    const unsigned int nq = 5*popIds.size() + 9;
+    const float nan = numeric_limits<float>::quiet_NaN();
+    vector< pair<Tgrid::TCellPtr,unsigned int> > order;
+    for (unsigned int i=0; i<cuts.size(); i++) {
+        const TCut& cut = cuts[i];
+        const unsigned int N = cut.nu*cut.nv;
+        record.assign(N*nq, nan);
+        // Sort points by cell so that each cell is visited once
+        order.clear();
+        for (int iv=0; iv<cut.nv; iv++) for (int iu=0; iu<cut.nu; iu++) {
+                const gridreal r[3] = {cut.origin[0] + iu*cut.du[0] + iv*cut.dv[0],
+                                       cut.origin[1] + iu*cut.du[1] + iv*cut.dv[1],
+                                       cut.origin[2] + iu*cut.du[2] + iv*cut.dv[2]
+                                      };
+                Tgrid::TCellPtr c = g.findcell(r);
+                if (c != 0) {
+                    order.push_back(make_pair(c, iv*cut.nu + iu));
+                }
+            }
+        sort(order.begin(), order.end());
+        sampleCells(order, popIds, &record[0], 1, N);
+        double t = Params::t;
+        ByteConversion(sizeof(double),(unsigned char*)&t,1);
+        WriteDoublesToFile(*cut.out,&t,1);
+        ByteConversion(sizeof(float),(unsigned char*)&record[0],record.size());
+        WriteFloatsToFile(*cut.out,&record[0],record.size());
+    }
+    nrecords++;
+}
+
+// TEST PARTICLES
+
+//! Cell of each active test particle during a push, shared by all test particle sets
+static vector< pair<Tgrid::TCellPtr,unsigned int> > testPartCells;
+
+static void testParticleV(gridreal r[3], gridreal v[3], const real B[3], const real Ue[3], const real Efield[3], real half_alpha);
+static void testParticleX(gridreal r[3], const gridreal v[3], real dt);
+
+/** \brief TestParticleSet constructor
+ * testParticleFile has lines "x y z vx vy vz" or "x y z vx vy vz tmax" (SI
+ * units, tmax is the flight time limit of the particle). detectorFUNC may
+ * have the entries
+ * saveEvery N (write a trajectory record every N time steps)
+ * stopSphere R x0 y0 z0 (stop particles entering the sphere)
+ * stopTime T (flight time limit of particles without their own tmax)
+ */
+TestParticleSet::TestParticleSet(DetectorArgs args)
+    : Detector(args), saveEvery(1), nsteps(0), out(0), outbuf(0), endout(0), nrecords(0)
+{
+    if (args.popIdStr.given == true) {
+        ERRORMSG2 ("testparticle 'detector' doesn't use popIdStr",
+                   args.popIdStr.value);
+    }
+    if (args.maxCounts.given == true) {
+        ERRORMSG ("testparticle 'detector' doesn't use maxCounts");
+    }
+    if (args.testParticleFile.given == false) {
+        ERRORMSG ("testParticleFile not given for testparticle 'detector'");
+        doabort();
+    }
+    if (args.q.given == false) {
+        ERRORMSG ("charge q not given for testparticle 'detector'");
+        doabort();
+    }
+    if (args.m.given == false) {
+        ERRORMSG ("mass m not given for testparticle 'detector'");
+        doabort();
+    }
+    detectorType = "testparticle";
+    testParticleFile = args.testParticleFile.value;
+    charge = args.q.value;
+    mass = args.m.value;
+    real stopTime = 0;
+    if (args.detectorFUNC.given == true) {
+        for (unsigned int i=0; i<args.detectorFUNC.name.size(); i++) {
+            const string& name = args.detectorFUNC.name[i];
+            const vector<real>& a = args.detectorFUNC.funcArgs[i];
+            if (name.compare("saveEvery") == 0 && a.size() == 1 && a[0] >= 1) {
+                saveEvery = int(a[0] + 0.5);
+            } else if (name.compare("stopSphere") == 0 && a.size() == 4 && a[0] > 0) {
+                stopSpheres.insert(stopSpheres.end(), a.begin(), a.end());
+            } else if (name.compare("stopTime") == 0 && a.size() == 1 && a[0] > 0) {
+                stopTime = a[0];
+            } else {
+                ERRORMSG2 ("bad testparticle detectorFUNC entry (saveEvery N, stopSphere R x0 y0 z0 or stopTime T)", name);
+                doabort();
+            }
+        }
+    }
+    readTestParticleFile(testParticleFile, stopTime);
+    Ntestparticles = x.size();
+    //open the trajectory file (detectionFile) and the end state file
+    const int bufsize = 1 << 20;
+    outbuf = new char[bufsize];
+    out = new ofstream;
+    out->rdbuf()->pubsetbuf(outbuf, bufsize);
+    out->open(detectionFile.c_str(), fstream::out | fstream::binary);
+    if (!out->good()) {
+        ERRORMSG2 ("unable to open detectionFile",detectionFile);
+        doabort();
+    }
+    endFile = detectionFile1st + "_end.txt";
+    endout = new ofstream(endFile.c_str(),fstream::out);
+    if (!endout->good()) {
+        ERRORMSG2 ("unable to open test particle end state file",endFile);
+        doabort();
+    }
+    detectionFiles.push_back(detectionFile);
+    detectionFiles.push_back(endFile);
+    (*out) << "% HYB test particle trajectories " << detectionFile << "\n"
+           << "% particles = " << Ntestparticles << "\n"
+           << "% mass = " << mass/Params::amu << " amu, charge = " << charge/Params::e << " e\n"
+           << "% quantities = x y z vx vy vz\n"
+           << "% units = m, m/s\n"
+           << "% record = float64 t, then particles x quantities float32 values (particle by particle)\n"
+           << "% records every " << saveEvery << " time steps, stopped particles keep their final values\n"
+           << "% byteorder = " << binaryByteOrder() << "\n"
+           << "% end states in " << endFile << "\n"
+           << "% end\n";
+    (*endout) << "% Test particle end states (" << Ntestparticles << " testparticles, trajectories in " << detectionFile << ")\n"
+              << "% status: " << ACTIVE << " = propagating when the detection ended, " << LEFT_BOX << " = left the box, "
+              << HIT_SPHERE << " = entered a stopSphere, " << FLIGHT_TIME << " = flight time limit\n"
+              << "% particle status tflight[s] x[m] y[m] z[m] vx[m/s] vy[m/s] vz[m/s]\n";
+    // check all testparticles with Params::insideBox
+    int outofBounds = 0;
+    for (unsigned int i=0; i<Ntestparticles; i++) {
+        if (terminated(i) == true) {
+            writeEndState(i);
+            outofBounds += (status[i] == LEFT_BOX);
+        } else {
+            active.push_back(i);
+        }
+    }
+    if (outofBounds > 0) {
+        WARNINGMSG2 ("test particles inserted outside the simulation domain (see end state file)", outofBounds);
+    }
+}
+
+//! Destructor
+TestParticleSet::~TestParticleSet()
+{
+    close();
+}
+
+//! Read the test particles, '%' and '#' start comment lines
+void TestParticleSet::readTestParticleFile(const string fileName, real stopTime)
+{
+    ifstream in(fileName.c_str());
+    if (!in.good()) {
+        ERRORMSG2 ("unable to open testParticleFile for a test particle 'detector'", fileName);
+        doabort();
+    }
+    int lineno = 0;
+    string line;
+    while (getline(in, line)) {
+        lineno++;
+        const string::size_type first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '%' || line[first] == '#') {
+            continue;
+        }
+        istringstream ls(line);
+        vector<real> v;
+        real val;
+        while (ls >> val) v.push_back(val);
+        if (v.size() != 6 && v.size() != 7) {
+            errorlog << "ERROR [TestParticleSet::readTestParticleFile]: bad line " << lineno << " in " << fileName
+                     << " (x y z vx vy vz [tmax] expected)\n";
+            doabort();
+        }
+        x.push_back(v[0]);
+        y.push_back(v[1]);
+        z.push_back(v[2]);
+        vx.push_back(v[3]);
+        vy.push_back(v[4]);
+        vz.push_back(v[5]);
+        tflight.push_back(0);
+        maxFlightTime.push_back(v.size() == 7 ? v[6] : stopTime);
+        status.push_back(ACTIVE);
+    }
+    if (x.empty() == true) {
+        ERRORMSG2 ("no test particles in testParticleFile", fileName);
+        doabort();
+    }
+}
+
+//! Check the termination conditions of particle i and set its status
+bool TestParticleSet::terminated(unsigned int i)
+{
+    const gridreal r[3] = {x[i], y[i], z[i]};
+    if (Params::insideBox(r) == false) {
+        status[i] = LEFT_BOX;
+        return true;
+    }
+    for (unsigned int s=0; s<stopSpheres.size(); s+=4) {
+        if (sqr(r[0]-stopSpheres[s+1]) + sqr(r[1]-stopSpheres[s+2]) + sqr(r[2]-stopSpheres[s+3]) < sqr(stopSpheres[s])) {
+            status[i] = HIT_SPHERE;
+            return true;
+        }
+    }
+    if (maxFlightTime[i] > 0 && tflight[i] >= maxFlightTime[i]) {
+        status[i] = FLIGHT_TIME;
+        return true;
+    }
+    return false;
+}
+
+//! Write the end state of particle i
+void TestParticleSet::writeEndState(unsigned int i)
+{
+    (*endout) << i+1 << " " << status[i] << " " << tflight[i] << " "
+              << x[i] << " " << y[i] << " " << z[i] << " "
+              << vx[i] << " " << vy[i] << " " << vz[i] << "\n";
+}
+
+//! Write positions and velocities of all particles
+void TestParticleSet::writeRecord()
+{
+    record.resize(6*Ntestparticles);
+    for (unsigned int i=0; i<Ntestparticles; i++) {
+        float *const p = &record[6*i];
+        p[0] = x[i];
+        p[1] = y[i];
+        p[2] = z[i];
+        p[3] = vx[i];
+        p[4] = vy[i];
+        p[5] = vz[i];
+    }
+    double t = Params::t;
+    ByteConversion(sizeof(double),(unsigned char*)&t,1);
+    WriteDoublesToFile(*out,&t,1);
+    ByteConversion(sizeof(float),(unsigned char*)&record[0],record.size());
+    WriteFloatsToFile(*out,&record[0],record.size());
+    nrecords++;
+}
+
+//! Write the end states of the still active particles and close the files
+void TestParticleSet::close()
+{
+    if (out == 0) {
+        return;
+    }
+    for (unsigned int k=0; k<active.size(); k++) {
+        writeEndState(active[k]);
+    }
+    int counts[4] = {0, 0, 0, 0};
+    for (unsigned int i=0; i<Ntestparticles; i++) {
+        counts[status[i]]++;
+    }
+    active.clear();
+    out->close();
+    endout->close();
+    delete out;
+    delete endout;
+    delete [] outbuf;
+    out = 0;
+    endout = 0;
+    outbuf = 0;
+    mainlog << "TestParticleSet: " << nrecords << " records written to " << detectionFile
+            << ", end states (active/left box/stopSphere/flight time) " << counts[ACTIVE] << "/"
+            << counts[LEFT_BOX] << "/" << counts[HIT_SPHERE] << "/" << counts[FLIGHT_TIME]
+            << " in " << endFile << "\n";
+}
+
+/** \brief Advance all active test particles by one time step
+ *
+ * The particles are sorted by cell and the fields of a cell are gathered
+ * once for all particles in it. After the step active is in cell order,
+ * which keeps the next sort cheap and the particle arrays cache friendly.
+ */
+void TestParticleSet::propagate()
+{
+    const real dt = Params::dt;
+    const real half_alpha = 0.5*charge*dt/mass;
+    testPartCells.clear();
+    for (unsigned int k=0; k<active.size(); k++) {
+        const unsigned int i = active[k];
+        const gridreal r[3] = {x[i], y[i], z[i]};
+        const Tgrid::TCellPtr c = g.findcell(r);
+        if (c == 0) {
+            status[i] = LEFT_BOX;
+            writeEndState(i);
+            continue;
+        }
+        testPartCells.push_back(make_pair(c, i));
+    }
+    sort(testPartCells.begin(), testPartCells.end());
+    active.clear();
+    // Particles of one cell are interpolated in batches of at most NB
+    const int NB = 64;
+    shortreal rb[NB][3];
+    real Bb[NB][3];
+    unsigned int k = 0;
+    while (k < testPartCells.size()) {
+        const Tgrid::TCellPtr c = testPartCells[k].first;
+        unsigned int kend = k;
+        while (kend < testPartCells.size() && testPartCells[kend].first == c) kend++;
+        real Ue[3], Efield[3];
+        g.cellintpol(c, Tgrid::CELLDATA_UE, Ue);
+        if (Params::electronPressure == true) {
+            g.cellintpol(c, Tgrid::CELLDATA_TEMP2, Efield);
+        } else {
+            Efield[0] = Efield[1] = Efield[2] = 0;
+        }
+        gridreal lowercorner[3];
+        {
+            const unsigned int i = testPartCells[k].second;
+            const gridreal r[3] = {x[i], y[i], z[i]};
+            g.findcell(r, lowercorner);
+        }
+        for (; k < kend; ) {
+            const int n = min(int(kend - k), NB);
+            for (int j=0; j<n; j++) {
+                const unsigned int i = testPartCells[k+j].second;
+                rb[j][0] = x[i];
+                rb[j][1] = y[i];
+                rb[j][2] = z[i];
+            }
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+            // Self-consistent B1 field from cell faces + constant B0 field => B(r) = B1(r) + B0(r)
+            if (Params::useFaceB0 == true) {
+                g.faceintpol_cell(c, lowercorner, n, rb, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B0, Bb);
+            } else {
+                g.faceintpol_cell(c, lowercorner, n, rb, Tgrid::FACEDATA_B, Bb);
+                for (int j=0; j<n; j++) addConstantMagneticField(rb[j], Bb[j]);
+            }
+#else
+            for (int j=0; j<n; j++) {
+                g.sph_faceintpol(rb[j], Tgrid::FACEDATA_B, Bb[j]);
+                addConstantMagneticField(rb[j], Bb[j]);
+            }
+#endif
+            for (int j=0; j<n; j++) {
+                const unsigned int i = testPartCells[k+j].second;
+                gridreal r[3] = {x[i], y[i], z[i]};
+                gridreal v[3] = {vx[i], vy[i], vz[i]};
+                testParticleV(r, v, Bb[j], Ue, Efield, half_alpha);
+                testParticleX(r, v, dt);
+                x[i] = r[0];
+                y[i] = r[1];
+                z[i] = r[2];
+                vx[i] = v[0];
+                vy[i] = v[1];
+                vz[i] = v[2];
+                tflight[i] += dt;
+                if (terminated(i) == true) {
+                    writeEndState(i);
+                } else {
+                    active.push_back(i);
+                }
+            }
+            k += n;
+        }
+    }
+}
+
+//! Propagate the test particles and write the trajectory records
+void TestParticleSet::runTestParticles()
+{
+    //test particles are initialized but will start moving at detectionTime[0]
+    if (out == 0 || Params::t < detectionTime[0]) {
+        return;
+    }
+    if (Params::t > detectionTime[1]) {
+        close();
+        return;
+    }
+    propagate();
+    nsteps++;
+    if (nsteps % saveEvery == 0 || active.empty() == true) {
+        writeRecord();
+    }
+    if (active.empty() == true) {
+        close();
+    }
+}
+
 // PARTICLE DETECTORS
 
 //! Particle detector: Into a sphere
@@ -828,92 +1720,6 @@ ParticleDetectorSet::ParticleDetectorSet(DetectorArgs args)
     }
 }
 
-//! TestParticleSet constructor
-TestParticleSet::TestParticleSet(DetectorArgs args)
-    : Detector(args)
-{
-    stillPropagating = true;
-    if (args.popIdStr.given == true) {
-        ERRORMSG2 ("testparticle 'detector' doesn't use popIdStr",
-                   args.popIdStr.value);
-    }
-    if (args.maxCounts.given == true) {
-        ERRORMSG ("testparticle 'detector' doesn't use maxCounts");
-    }
-    if (args.detectorFUNC.given == true) {
-        ERRORMSG2 ("testparticle 'detector' doesn't use detectorFUNC",
-                   args.detectorFUNC.name[0]);
-    }
-    if (args.testParticleFile.given == false) {
-        ERRORMSG ("testParticleFile not given for testparticle 'detector'");
-        doabort();
-    }
-    if (args.q.given == false) {
-        ERRORMSG ("charge q not given for testparticle 'detector'");
-        doabort();
-    }
-    if (args.m.given == false) {
-        ERRORMSG ("mass m not given for testparticle 'detector'");
-        doabort();
-    }
-    detectorType = "testparticle";
-    testParticleFile = args.testParticleFile.value;
-    charge = args.q.value;
-    mass = args.m.value;
-    //read testPartFile and create the TestParticle objects
-    FILE *testPartFile = fopen(testParticleFile.c_str(), "r");
-    string detType = "testparticle";
-    if (testPartFile == NULL) {
-        ERRORMSG2 ("unable to open testParticleFile for a test particle 'detector'",
-                   testParticleFile);
-        doabort();
-    }
-    gridreal r[3], v[3];
-    //check all testparticles with Params::insideBox
-    vector <int> outofBounds;
-    outofBounds.clear();
-    unsigned int tpcount = 0;
-    //testParticleFile has lines with values x y z vx vy vz in meters and meters per second
-    int q = fscanf(testPartFile, "%f %f %f %f %f %f\n", &r[0],&r[1],&r[2], &v[0],&v[1],&v[2]);
-    while (q==6) { //if all assigned and within simulation box
-        TestParticle *testpart = new TestParticle(r,v,charge,mass);
-        testParts.push_back(testpart);
-        if (Params::insideBox(r) == false) {
-            outofBounds.push_back(tpcount);
-            testParts[testParts.size()-1]->propagate = false;
-        }
-        tpcount++;
-        q = fscanf(testPartFile, "%f %f %f %f %f %f\n", &r[0],&r[1],&r[2], &v[0],&v[1],&v[2]);
-    }
-    fclose(testPartFile);
-    // listing all lines with incorrect (i.e. out of boundaries) testparticle positions
-    if (outofBounds.empty() == false) {
-        errorlog << "WARNING: Test particles inserted outside the simulation domain\n"
-                 << "They are in file " << testParticleFile << " on rows: \n";
-        for (unsigned int i=0; i<outofBounds.size(); i++) {
-            errorlog << " " << outofBounds[i]+1;
-        }
-        errorlog << "\n" << flush;
-    }
-    //open testparticle save file (detectionFile)
-    files = new ofstream(detectionFile.c_str(),fstream::out);
-    if (!files->good()) {
-        ERRORMSG2 ("unable to open detectionFile",detectionFile);
-        doabort();
-    }
-    //Write Header
-    // output file format: t x1 y1 z1 vx1 vy1 vz1 x2 y2 z2 vx2 vy2 vz2...
-    (*files) << "% Testparticle detectionFile (" << testParts.size()
-             << " testparticles)\n% particle mass is "
-             << mass/Params::amu << " amu, electric charge is "
-             << charge/Params::e << " e\n% t";
-    for (unsigned int i=1; i<testParts.size()+1; i++) {
-        (*files) << " x"<<i<<", y"<<i<<", z"<<i
-                 << ", vx"<<i<<", vy"<<i<<", vz"<<i;
-    }
-    (*files) << "\n" << flush;
-}
-
 //! Store field values for all field detects
 void Detector::runFieldDetects()
 {
@@ -963,31 +1769,9 @@ void Detector::runPartDetects(const TLinkedParticle* part, const gridreal r_new[
     }
 }
 
-//! Run test particles
-void Detector::runTestParticles(void)
+//! Run test particles (only TestParticleSet has them)
+void Detector::runTestParticles()
 {
-    if (detectorType.compare("testparticle") != 0) {
-        return;
-    }
-    if (Params::t>=detectionTime[0]) { //test particles are initialized but will start moving at this point
-        if (Params::t<=detectionTime[1] && stillPropagating == true) { // propagating testparticles
-            (*files) << Params::t; //saving time
-            bool check = false; //check if any of the testparticles are still active
-            for (unsigned int i=0; i<testParts.size(); i++) {
-                if (testParts[i]->propagate == true) { //is the maxCounts already reached
-                    testParts[i]->run();
-                    check = true;
-                }
-                (*files) <<" "<<testParts[i]->x<<" "<<testParts[i]->y<<" "
-                         <<testParts[i]->z<<" "<<testParts[i]->vx<<" "
-                         <<testParts[i]->vy<<" "<<testParts[i]->vz;
-            }
-            (*files) << "\n" << flush;
-            if (check == false) { //no testParts propagating
-                stillPropagating = false;
-            }
-        }
-    }
 }
 
 //! Sphere detect constructor: inputs are Radius and point of origin r[3] (Upper class)
@@ -1395,70 +2179,24 @@ inline bool PartDetect_EllipseInside::InsideDetector2(const gridreal x, const gr
 }
 
 
-//! Constructor
-TestParticle::TestParticle(gridreal r[3], gridreal v[3], real charge, real mass)
-{
-    x = r[0];
-    y = r[1];
-    z = r[2];
-    vx = v[0];
-    vy = v[1];
-    vz = v[2];
-    propagate = true;
-    q = charge;
-    m = mass;
-}
-
-//! Boundary conditions for test particle
-inline bool TestParticle::boundaries(void)
-{
-    const gridreal coords[3] = {x,y,z};
-    return Params::insideBox(coords);
-}
-
-#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-
-//! propagate position and check boundaries
-inline bool TestParticle::run(void)
-{
-    PropagateV();
-    x += vx*Params::dt;
-    y += vy*Params::dt;
-    z += vz*Params::dt;
-    if (boundaries() == false) {
-        propagate = false;
-    }
-    return propagate;
-}
-
-//! Accelerate particle (Lorentz force) taken from simulation.cpp (modified lines: ***)
-void TestParticle::PropagateV(void)
+/** \brief Accelerate a test particle (Lorentz force), as in Simulation::PropagateV
+ *
+ * B, Ue and Efield are the fields at r (Efield is used only with
+ * electronPressure), half_alpha = q*dt/(2*m).
+ */
+static void testParticleV(gridreal r[3], gridreal v[3], const real B[3], const real Ue[3], const real Efield[3], real half_alpha)
 {
-    // Particle's centroid coordinates and velocity vectors
-    fastreal r[3] = {x, y, z};  //***
-    fastreal v[3] = {vx, vy, vz};  //***
-    real B[3],Ue[3];
-    // Self-consistent B1 field from cell faces + constant B0 field => B(r) = B1(r) + B0(r)
-    g.faceintpol(r, Tgrid::FACEDATA_B, B);
-    addConstantMagneticField(r, B);
-    // Velocity field of the electron fluid from cells
-    // Do not pass r => uses saved_cellptr and avoids findcell call
-    g.cellintpol(Tgrid::CELLDATA_UE,Ue);
     if(Params::electronPressure==true) {
-        real Efield[3],tx,ty,tz,sx,sy,sz,dvx,dvy,dvz,vmx,vmy,vmz,v0x,v0y,v0z,vpx,vpy,vpz,qmideltT2,t2,b2;
-        // get the NGP electric field
-        // Do not pass r => uses saved_cellptr and avoids findcell call
-        g.cellintpol(Tgrid::CELLDATA_TEMP2,Efield);
-        Efield[0] += B[1]*Ue[2] - B[2]*Ue[1];
-        Efield[1] += B[2]*Ue[0] - B[0]*Ue[2];
-        Efield[2] += B[0]*Ue[1] - B[1]*Ue[0];
-        qmideltT2= 0.5*q*Params::dt/m; //***
-        dvx=qmideltT2*Efield[0];
-        dvy=qmideltT2*Efield[1];
-        dvz=qmideltT2*Efield[2];
-        tx=qmideltT2*B[0];
-        ty=qmideltT2*B[1];
-        tz=qmideltT2*B[2];
+        real E[3],tx,ty,tz,sx,sy,sz,dvx,dvy,dvz,vmx,vmy,vmz,v0x,v0y,v0z,vpx,vpy,vpz,t2,b2;
+        E[0] = Efield[0] + (B[1]*Ue[2] - B[2]*Ue[1]);
+        E[1] = Efield[1] + (B[2]*Ue[0] - B[0]*Ue[2]);
+        E[2] = Efield[2] + (B[0]*Ue[1] - B[1]*Ue[0]);
+        dvx=half_alpha*E[0];
+        dvy=half_alpha*E[1];
+        dvz=half_alpha*E[2];
+        tx=half_alpha*B[0];
+        ty=half_alpha*B[1];
+        tz=half_alpha*B[2];
         t2=tx*tx+ty*ty+tz*tz;
         b2=2./(1.+t2);
         sx=b2*tx;
@@ -1479,8 +2217,6 @@ void TestParticle::PropagateV(void)
     } else {
         // Vector: dU = v_i - U_e
         real dU[3] = { v[0]-Ue[0], v[1]-Ue[1], v[2]-Ue[2] };
-        // Constant: alpha/2 = q*dt/(2*m)
-        const real half_alpha = 0.5*q*Params::dt/m; //***
         // Vector: W = q*dt*B/(2*m)
         real b[3] = {half_alpha*B[0], half_alpha*B[1], half_alpha*B[2]};
         // |W|^2
@@ -1496,13 +2232,14 @@ void TestParticle::PropagateV(void)
         v[1] += beta*( dUxb[1] + dUxbxb[1] );
         v[2] += beta*( dUxb[2] + dUxbxb[2] );
     }
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
     // Gravity correction
     if(Params::useGravitationalAcceleration == true) {
-        real rLength = sqrt( sqr(x) + sqr(y) + sqr(z) ); //***
+        real rLength = sqrt( sqr(r[0]) + sqr(r[1]) + sqr(r[2]) );
         real s = -Params::GMdt/cube(rLength);
-        v[0] += s*x; //***
-        v[1] += s*y; //***
-        v[2] += s*z; //***
+        v[0] += s*r[0];
+        v[1] += s*r[1];
+        v[2] += s*r[2];
     }
     const real v2 = sqr(v[0]) + sqr(v[1]) + sqr(v[2]);
     // Check particle maximum speed (CONSTRAINT)
@@ -1511,116 +2248,17 @@ void TestParticle::PropagateV(void)
         v[0] *= norm;
         v[1] *= norm;
         v[2] *= norm;
-        // Increase particle speed cutting rate counter
-        //Params::pops[part.popid]->counter.cutRateV += 1.0; //***
-    }
-    vx = v[0]; //***
-    vy = v[1]; //***
-    vz = v[2]; //***
-}
-
-#else // spherical version
-
-//! (SPHERICAL)
-inline bool TestParticle::run(void)
-{
-    PropagateV();
-    x += vx*Params::dt;
-    y += vy*Params::dt;
-    z += vz*Params::dt;
-    // Transformation positions from hybrid to shperical coordinates
-    gridreal r[3] = {x,y,z};
-    sph_transf_H2S_R(r);
-    // Cyclic condition for phi
-    if (r[2] < 0.0)    r[2] = r[2] + 2.0*pi;
-    if (r[2] > 2.0*pi) r[2] = r[2] - 2.0*pi;
-    // Back to hybrid coordinates and velocities
-    sph_transf_S2H_R(r);
-    x = r[0];
-    y = r[1];
-    z = r[2];
-    if (boundaries() == false) {
-        propagate = false;
-    }
-    return propagate;
-}
-
-//! (SPHERICAL) Accelerate particle (Lorentz force) taken from simulation.cpp (modified lines: ***)
-void TestParticle::PropagateV(void)
-{
-    // Particle's centroid coordinates and velocity vectors
-    fastreal r[3] = {x, y, z};  //***
-    fastreal v[3] = {vx, vy, vz};  //***
-    real B[3],Ue[3];
-    // Self-consistent B1 field from cell faces + constant B0 field => B(r) = B1(r) + B0(r)
-    //!g.faceintpol(r, Tgrid::FACEDATA_B, B);
-    g.sph_faceintpol(r, Tgrid::FACEDATA_B, B);
-    addConstantMagneticField(r, B);
-    // Velocity field of the electron fluid from cells
-    // Do not pass r => uses saved_cellptr and avoids findcell call
-    g.cellintpol(Tgrid::CELLDATA_UE,Ue);
-    if(Params::electronPressure==true) {
-        real Efield[3],tx,ty,tz,sx,sy,sz,dvx,dvy,dvz,vmx,vmy,vmz,v0x,v0y,v0z,vpx,vpy,vpz,qmideltT2,t2,b2;
-        // get the NGP electric field
-        // Do not pass r => uses saved_cellptr and avoids findcell call
-        g.cellintpol(Tgrid::CELLDATA_TEMP2,Efield);
-        Efield[0] += B[1]*Ue[2] - B[2]*Ue[1];
-        Efield[1] += B[2]*Ue[0] - B[0]*Ue[2];
-        Efield[2] += B[0]*Ue[1] - B[1]*Ue[0];
-        qmideltT2= 0.5*q*Params::dt/m; //***
-        dvx=qmideltT2*Efield[0];
-        dvy=qmideltT2*Efield[1];
-        dvz=qmideltT2*Efield[2];
-        tx=qmideltT2*B[0];
-        ty=qmideltT2*B[1];
-        tz=qmideltT2*B[2];
-        t2=tx*tx+ty*ty+tz*tz;
-        b2=2./(1.+t2);
-        sx=b2*tx;
-        sy=b2*ty;
-        sz=b2*tz;
-        vmx=v[0]+dvx;
-        vmy=v[1]+dvy;
-        vmz=v[2]+dvz;
-        v0x=vmx+vmy*tz-vmz*ty;
-        v0y=vmy+vmz*tx-vmx*tz;
-        v0z=vmz+vmx*ty-vmy*tx;
-        vpx=vmx+v0y*sz-v0z*sy;
-        vpy=vmy+v0z*sx-v0x*sz;
-        vpz=vmz+v0x*sy-v0y*sx;
-        v[0]=vpx+dvx;
-        v[1]=vpy+dvy;
-        v[2]=vpz+dvz;
-    } else {
-        // Vector: dU = v_i - U_e
-        real dU[3] = { v[0]-Ue[0], v[1]-Ue[1], v[2]-Ue[2] };
-        // Constant: alpha/2 = q*dt/(2*m)
-        const real half_alpha = 0.5*q*Params::dt/m; //***
-        // Vector: W = q*dt*B/(2*m)
-        real b[3] = {half_alpha*B[0], half_alpha*B[1], half_alpha*B[2]};
-        // |W|^2
-        const real b2 = sqr(b[0]) + sqr(b[1]) + sqr(b[2]);
-        // Constant: beta = 2/(1+|b|^2)
-        const real beta = 2.0/(1.0 + b2);
-        // Cross products
-        real dUxb[3],dUxbxb[3];
-        crossProduct(dU,b,dUxb);
-        crossProduct(dUxb,b,dUxbxb);
-        // Add velocity components
-        v[0] += beta*( dUxb[0] + dUxbxb[0] );
-        v[1] += beta*( dUxb[1] + dUxbxb[1] );
-        v[2] += beta*( dUxb[2] + dUxbxb[2] );
     }
-    // Gravity correction
+#else
+    // (SPHERICAL) Gravity correction
     if(Params::useGravitationalAcceleration == true) {
-        real rLength = abs(x);                 //***
+        real rLength = abs(r[0]);
         real s = -Params::GMdt/cube(rLength);
-        v[0] += s*x;                           //***
+        v[0] += s*r[0];
     }
     // To calculate v2 in real space we need to transform velocities and positions from hybrid to shperical coordinates
     sph_transf_H2S_R(r);
     sph_transf_H2S_V(v);
-    //const real v2 = sqr(v[0]) + sqr(v[1]) + sqr(v[2]);
     const real v2 = sqr(v[0]) + sqr(r[0]*v[1]) + sqr(r[0]*sin(r[1])*v[2]);
     // Check particle maximum speed (CONSTRAINT)
     if (v2 > Params::vi_max2) {
@@ -1628,19 +2266,24 @@ void TestParticle::PropagateV(void)
         v[0] *= norm;
         v[1] *= norm;
         v[2] *= norm;
-        // Increase particle speed cutting rate counter
-        //Params::pops[part.popid]->counter.cutRateV += 1.0; //***
     }
     // Back to hybrid coordinates and velocities
     sph_transf_S2H_R(r);
     sph_transf_S2H_V(v);
-    x = r[0];
-    y = r[1];
-    z = r[2];
-    vx = v[0]; //***
-    vy = v[1]; //***
-    vz = v[2]; //***
+#endif
 }
 
+//! Move a test particle (r = v*dt)
+static void testParticleX(gridreal r[3], const gridreal v[3], real dt)
+{
+    r[0] += v[0]*dt;
+    r[1] += v[1]*dt;
+    r[2] += v[2]*dt;
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+    // Cyclic condition for phi
+    sph_transf_H2S_R(r);
+    if (r[2] < 0.0)    r[2] = r[2] + 2.0*pi;
+    if (r[2] > 2.0*pi) r[2] = r[2] - 2.0*pi;
+    sph_transf_S2H_R(r);
 #endif
-
+}
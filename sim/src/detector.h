@@ -76,20 +76,6 @@ public:
     virtual ~PartDetect();
 };
 
-//! Test particle for tracing
-class TestParticle
-{
-public:
-    gridreal x,y,z,vx,vy,vz; //!< Position and velocity
-    real q,m; //!< Charge and mass
-    bool propagate; //!< Propagate or not
-    TestParticle(gridreal r[3], gridreal v[3], real charge, real mass);
-    inline bool run(void);
-private:
-    inline bool boundaries(void);
-    void PropagateV(void);
-};
-
 //! Particle and field detectors
 class Detector
 {
@@ -100,9 +86,9 @@ public:
     real maxCounts;
     std::string detectorType;
     virtual ~Detector();
-    void runFieldDetects();
+    virtual void runFieldDetects();
     void runPartDetects(const TLinkedParticle* part, const gridreal r_new[3]);
-    void runTestParticles();
+    virtual void runTestParticles();
     std::string toString();
     std::string configDump();
     unsigned int getNumberOfDetects();
@@ -114,11 +100,10 @@ protected:
     std::string detectionFile1st, detectionFile2nd;
     real detectionTime[2];
     real mass, charge;
-    bool stillPropagating;
     std::ofstream *files;
     std::vector<FieldDetect*> fieldDetects;
     std::vector<PartDetect*> partDetects;
-    std::vector<TestParticle*> testParts;
+    unsigned int Ntestparticles; //!< Number of test particles (TestParticleSet)
     std::vector<std::string> detectorFunctionNames;
     std::vector<std::vector<real> > detectorFuncArgs;
     std::vector<std::string> detectionFiles;
@@ -137,6 +122,72 @@ private:
     void readCoordinateFile(const std::string coordinateFile, std::vector<Tgr3v>& coordinateVector);
 };
 
+/** \brief Virtual spacecraft probe set
+ *
+ * All probes of the set are evaluated in one batched pass per time step:
+ * probes are sorted by cell and the cell moments are computed once per cell
+ * (and shared with the other probe sets during the same step). The values
+ * are written to a single buffered binary file. Probes are either fixed
+ * points or one spacecraft moving along a trajectory, whose position is
+ * interpolated linearly in time between the trajectory samples.
+ */
+class ProbeDetectorSet : public Detector
+{
+public:
+    ProbeDetectorSet(DetectorArgs args);
+    virtual ~ProbeDetectorSet();
+    virtual void runFieldDetects();
+private:
+    std::vector<Tgr3v> probePoints; //!< Fixed probe positions
+    std::vector<real> trajectoryTime; //!< Trajectory sample times, empty if the probes are fixed
+    std::vector<Tgr3v> trajectoryPoints; //!< Trajectory sample positions
+    std::vector<int> popIds; //!< Recorded populations
+    std::ofstream *out; //!< Output file, 0 when closed
+    char *outbuf; //!< Stream buffer of out
+    std::vector<float> record; //!< Values of one time step
+    int nrecords; //!< Records written
+    unsigned int Nprobes() const;
+    bool probePosition(unsigned int i, gridreal r[3]);
+    void readCoordinateFile(const std::string fileName);
+    void writeHeader();
+    void close();
+};
+
+/** \brief In-situ plane and line cuts
+ *
+ * Samples the same quantities as ProbeDetectorSet on regular 2-D rasters
+ * (xy, xz and yz planes) and 1-D rasters (lines) every saveInterval
+ * seconds, directly from the grid after the time step. Each cut is
+ * written to its own buffered binary file, so movies and profiles can be
+ * made without saving full 3-D hc files.
+ */
+class SliceDetectorSet : public Detector
+{
+public:
+    SliceDetectorSet(DetectorArgs args);
+    virtual ~SliceDetectorSet();
+    virtual void runFieldDetects();
+private:
+    //! One plane or line cut
+    struct TCut {
+        std::string type; //!< xy, xz, yz or line
+        gridreal origin[3]; //!< First raster point
+        gridreal du[3], dv[3]; //!< Raster steps along the u and v axes
+        int nu, nv; //!< Raster size (nv = 1 for lines)
+        std::string fileName; //!< Output file name
+        std::ofstream *out; //!< Output file
+        char *outbuf; //!< Stream buffer of out
+    };
+    std::vector<TCut> cuts; //!< Cuts of the set
+    std::vector<int> popIds; //!< Recorded populations
+    real saveInterval; //!< Sampling interval [s], 0 = every time step
+    std::vector<float> record; //!< Values of one cut
+    int nrecords; //!< Records written to each cut file
+    bool closed; //!< Files closed
+    void writeHeader(TCut& cut);
+    void close();
+};
+
 //! Particle detector set
 class ParticleDetectorSet : public Detector
 {
@@ -150,13 +201,46 @@ private:
     static std::vector<PartDetect* (*) (std::ofstream*,std::vector<real>)> newPartDetectFuncs;
 };
 
-//! Test particle set
+/** \brief Test particle set
+ *
+ * The test particles are stored as arrays of positions and velocities and
+ * advanced in one batched pass per time step: the active particles are
+ * sorted by cell and the fields of each cell are gathered once for all
+ * particles in it, using the interpolation and Lorentz force scheme of
+ * Simulation::PropagateV. A particle stops when it leaves the box or meets
+ * a termination condition (stopSphere, stopTime or its own flight time
+ * limit), and its final state is written to the end state file. Every
+ * saveEvery steps all particles are written to the binary trajectory file.
+ */
 class TestParticleSet : public Detector
 {
 public:
+    //! State of a test particle
+    enum TStatus {ACTIVE=0, LEFT_BOX=1, HIT_SPHERE=2, FLIGHT_TIME=3};
     TestParticleSet(DetectorArgs args);
+    virtual ~TestParticleSet();
+    virtual void runTestParticles();
 private:
-    std::vector<bool> propagating;
+    std::vector<gridreal> x,y,z,vx,vy,vz; //!< Positions and velocities
+    std::vector<real> tflight; //!< Flight times
+    std::vector<real> maxFlightTime; //!< Flight time limits, 0 if none
+    std::vector<int> status; //!< TStatus of each particle
+    std::vector<unsigned int> active; //!< Active particles, in cell order after each step
+    std::vector<real> stopSpheres; //!< Termination spheres, R x0 y0 z0 each
+    int saveEvery; //!< Trajectory record interval in time steps
+    int nsteps; //!< Propagated time steps
+    std::ofstream *out; //!< Trajectory file, 0 when closed
+    char *outbuf; //!< Stream buffer of out
+    std::ofstream *endout; //!< End state file
+    std::string endFile; //!< Name of the end state file
+    std::vector<float> record; //!< Values of one trajectory record
+    int nrecords; //!< Trajectory records written
+    void readTestParticleFile(const std::string fileName, real stopTime);
+    void propagate();
+    bool terminated(unsigned int i);
+    void writeEndState(unsigned int i);
+    void writeRecord();
+    void close();
 };
 
 //! Class to create detector objects
@@ -169,7 +253,7 @@ public:
     static int getNumberOfDetectors();
     static int getNumberOfDetectors(const std::string detectorType);
 private:
-    static unsigned int numberOfDetectors[3]; //field, particle, and testparticle
+    static unsigned int numberOfDetectors[5]; //field, particle, testparticle, probe and slice
 };
 
 //! Spherical particle detector
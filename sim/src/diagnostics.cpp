@@ -50,6 +50,14 @@ Diagnostics::~Diagnostics()
     plog.clear();
     flog.flush();
     flog.close();
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    cfllog.flush();
+    cfllog.close();
+#endif
+#ifdef USE_PARTICLE_SUBCYCLING
+    slog.flush();
+    slog.close();
+#endif
 }
 
 //! Initialize particle counters and create log files
@@ -72,6 +80,12 @@ void Diagnostics::run()
 {
     logParticles();
     logFields();
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    logCFL();
+#endif
+#ifdef USE_PARTICLE_SUBCYCLING
+    logSubcycling();
+#endif
 }
 
 //! Calculate particle parameters (used when passing through particle list)
@@ -272,6 +286,110 @@ void Diagnostics::logFields()
     Tgrid::fieldCounter.reset();
 }
 
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+//! Write field CFL log file (one row per refinement level, field substep dtField/fieldSubcycles)
+void Diagnostics::logCFL()
+{
+    static bool initDone = false;
+    if(initDone == false) {
+        cfllog.open("cfl.log");
+        cfllog << scientific << showpos;
+        cfllog.precision(10);
+        cfllog
+                << "% field CFL\n"
+                << "% columns = 5\n"
+                << "% 01. Time [s]\n"
+                << "% 02. Refinement level [-]\n"
+                << "% 03. Leaf cells [#]\n"
+                << "% 04. max(dt_f*v_w/dx), v_w = (pi/dx)*B/(mu0*rho_q) whistler phase speed [-]\n"
+                << "% 05. max(dt_f*|Ue|/dx) [-]\n"
+                << flush;
+        initDone = true;
+    }
+    if(Params::propagateField == false) {
+        return;
+    }
+    vector<real> whistler, ue;
+    vector<int> ncells;
+    g.calc_level_CFL(Params::dtField/Params::fieldSubcycles,whistler,ue,ncells);
+    for(unsigned int i = 0; i < ncells.size(); ++i) {
+        if(ncells[i] <= 0) continue;
+        cfllog << Params::t << "\t";
+        cfllog << i << "\t";
+        cfllog << ncells[i] << "\t";
+        cfllog << whistler[i] << "\t";
+        cfllog << ue[i] << "\t";
+        cfllog << "\n";
+    }
+    cfllog << flush;
+}
+#endif
+
+#ifdef USE_PARTICLE_SUBCYCLING
+//! Write particle subcycling log file (one row per populated dtlevel)
+void Diagnostics::logSubcycling()
+{
+    static bool initDone = false;
+    if(initDone == false) {
+        slog.open("subcycle.log");
+        slog << scientific << showpos;
+        slog.precision(10);
+        slog
+                << "% subcycling\n"
+                << "% columns = 4\n"
+                << "% 01. Time [s]\n"
+                << "% 02. dtlevel [-]\n"
+                << "% 03. Macroparticles [#/dt]\n"
+                << "% 04. CPU time of substeps after the first [s/dt]\n"
+                << flush;
+        initDone = true;
+    }
+    sCounter.finalizeCounters();
+    for(int i = 0; i < SubcycleCounter::LEVELS; ++i) {
+        if(sCounter.macroParticles[i] <= 0) continue;
+        slog << Params::t << "\t";
+        slog << i << "\t";
+        slog << sCounter.macroParticles[i] << "\t";
+        slog << sCounter.cputime[i] << "\t";
+        slog << "\n";
+    }
+    slog << flush;
+    sCounter.reset();
+}
+
+//! Constructor
+SubcycleCounter::SubcycleCounter()
+{
+    resetTimestep = 0;
+    reset();
+}
+
+//! Reset subcycling counters
+void SubcycleCounter::reset()
+{
+    for(int i = 0; i < LEVELS; ++i) {
+        macroParticles[i] = 0.0;
+        cputime[i] = 0.0;
+    }
+    resetTimestep = Params::cnt_dt;
+}
+
+//! Finalize subcycling counters (timestep averages)
+void SubcycleCounter::finalizeCounters()
+{
+    const real timeSteps = static_cast<real>(Params::cnt_dt - resetTimestep);
+    for(int i = 0; i < LEVELS; ++i) {
+        if(timeSteps > 0) {
+            macroParticles[i] /= timeSteps;
+            cputime[i] /= timeSteps;
+        } else {
+            macroParticles[i] = 0.0;
+            cputime[i] = 0.0;
+        }
+    }
+}
+#endif
+
 //! Constructor
 ParticleCounter::ParticleCounter(const int populationid) : popid(populationid)
 {
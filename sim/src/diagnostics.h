@@ -25,6 +25,18 @@
 #include "particle.h"
 
 struct ParticleCounter;
+#ifdef USE_PARTICLE_SUBCYCLING
+//! Particle subcycling counters, one entry per dtlevel
+struct SubcycleCounter {
+    enum {LEVELS=256};
+    real macroParticles[LEVELS]; //!< Macroparticles on the level [#/dt]
+    real cputime[LEVELS]; //!< CPU time of the binned substeps on the level [s/dt]
+    int resetTimestep;
+    SubcycleCounter();
+    void reset();
+    void finalizeCounters();
+};
+#endif
 
 //! Simulation diagnostics
 class Diagnostics
@@ -36,11 +48,22 @@ public:
     void run();
     static bool particleAnalyzeFunction(TLinkedParticle& p);
     std::vector<ParticleCounter*> pCounter; //!< Particle counters
+#ifdef USE_PARTICLE_SUBCYCLING
+    SubcycleCounter sCounter; //!< Particle subcycling counters
+#endif
 private:
     std::vector<std::ofstream*> plog; //!< Particle population log files
     std::ofstream flog; //!< Field log file
     void logParticles();
     void logFields();
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    std::ofstream cfllog; //!< Field CFL log file
+    void logCFL();
+#endif
+#ifdef USE_PARTICLE_SUBCYCLING
+    std::ofstream slog; //!< Particle subcycling log file
+    void logSubcycling();
+#endif
 };
 
 //! Particle counters
@@ -20,6 +20,8 @@
 #include <fstream>
 #include <cstdlib>
 #include <cmath>
+#include <algorithm>
+#include <sstream>
 #include "grid.h"
 #include "magneticfield.h"
 #include "random.h"
@@ -37,6 +39,14 @@ using namespace std;
 const char *Tgrid::celldata_names[Tgrid::NCELLDATA] = {"u","ue","j","B"};
 int Tgrid::cell_running_index = 0;
 Tgrid::TPtrHash *Tgrid::hp = 0;
+THREAD_LOCAL Tgrid::TCellPtr Tgrid::saved_cellptr = 0;
+THREAD_LOCAL Tgrid::TCellPtr Tgrid::previous_found_cell = 0;
+#ifdef SAVE_POPULATION_AVERAGES
+Tgrid::TCellSideTable Tgrid::pop_ave_table;
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+Tgrid::TCellSideTable Tgrid::spectra_table;
+#endif
 FieldCounter Tgrid::fieldCounter;
 
 static bool hcFileAsciiFormat = false;
@@ -80,6 +90,14 @@ void Tgrid::init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridreal z
     n_pdftables = 0;
     ave_ntimes = 0;
     previous_found_cell = 0;
+    scheduler.setThreads(Params::threads);
+    pic_stencils_valid = false;
+    pic_tile_cell = 0;
+    grid_version = 0;
+    B0_grid_version = -1;
+    uniform_grid_version = -1;
+    uniform_mesh = false;
+    hcseries_grid_version = -1;
     invbgdx = 1.0/bgdx;
     x_1 = x1 - bgdx;
     y_1 = y1 - bgdx;
@@ -102,6 +120,7 @@ void Tgrid::init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridreal z
             << "| " << Params::box_ymin/1e3 << " km (" << Params::box_ymin/Params::R_P << " R_P) < y < " << Params::box_ymax/1e3 << " km (" << Params::box_ymax/Params::R_P << " R_P)\n"
             << "| " << Params::box_zmin/1e3 << " km (" << Params::box_zmin/Params::R_P << " R_P) < z < " << Params::box_zmax/1e3 << " km (" << Params::box_zmax/Params::R_P << " R_P)\n";
     mainlog << "|-------------------------------------------------|\n";
+    init_side_tables();
     cells = new TCellPtr [N];
     int i,j,k,c;
     // Create cells and faces, set up cell fields but not yet face fields
@@ -115,6 +134,8 @@ void Tgrid::init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridreal z
         cells[c]->level = 0;
         cells[c]->parent = 0;
         cells[c]->running_index = -123456;
+        cells[c]->pic_stencil = -1;
+        cells[c]->pic_regular = 0;
         cells[c]->face[0][0] = (i > 0) ? cells[flatindex(i-1,j,k)]->face[0][1] : TFacePtr(0);
         cells[c]->face[0][1] = (i < nx-1) ? new Tface : 0;
         cells[c]->face[1][0] = (j > 0) ? cells[flatindex(i,j-1,k)]->face[1][1] : TFacePtr(0);
@@ -128,23 +149,7 @@ void Tgrid::init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridreal z
 #ifdef SAVE_PARTICLES_ALONG_ORBIT
         cells[c]->save_particles = false;
 #endif
-#ifdef SAVE_POPULATION_AVERAGES
-        for (int l = 0; l < Params::POPULATIONS; ++l) {
-            cells[c]->pop_ave_n.push_back(0.0);
-            cells[c]->pop_ave_vx.push_back(0.0);
-            cells[c]->pop_ave_vy.push_back(0.0);
-            cells[c]->pop_ave_vz.push_back(0.0);
-        }
-#endif
-#ifdef SAVE_PARTICLE_CELL_SPECTRA
-        for (int l = 0; l < Params::POPULATIONS; ++l) {
-            vector<datareal> temp;
-            cells[c]->spectra.push_back(temp);
-            for (int m = 0; m < Params::spectraNbins; ++m) {
-                cells[c]->spectra[l].push_back(0.0);
-            }
-        }
-#endif
+        cells[c]->alloc_side_records();
         memset(&cells[c]->celldata[0][0],0,sizeof(datareal)*NCELLDATA*3);
         cells[c]->centroid[0] = x_1 + (i+0.5)*bgdx;
         cells[c]->centroid[1] = y_1 + (j+0.5)*bgdx;
@@ -416,34 +421,40 @@ void Tgrid::Tcell::NC_recursive(TNodeDataSelect ns,TCellDataSelect cs)
         int ch;
         for (ch=0; ch<8; ch++) child[0][0][ch]->NC_recursive(ns,cs);
     } else {
-        int dir,d,f,f2;
-        datareal tempx,tempy,tempz;
-        celldata[cs][0]=0.;
-        celldata[cs][1]=0.;
-        celldata[cs][2]=0.;
-        for(dir=0; dir<3; dir++)for(d=0; d<2; d++) {
-                tempx=tempy=tempz=0.;
-                if (isrefined_face(dir,d)) {
-                    for (f=0; f<4; f++) for (f2=0; f2<4; f2++) {
-                            tempx+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][0];
-                            tempy+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][1];
-                            tempz+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][2];
-                        }
-                    tempx*=0.25;
-                    tempy*=0.25;
-                    tempz*=0.25;
-                } else {
-                    for(f=0; f<4; f++) {
-                        tempx+=face[dir][d]->node[f]->nodedata[ns][0];
-                        tempy+=face[dir][d]->node[f]->nodedata[ns][1];
-                        tempz+=face[dir][d]->node[f]->nodedata[ns][2];
+        NC1(ns,cs);
+    }
+}
+
+//! node2cell interpolation in a leaf cell
+void Tgrid::Tcell::NC1(TNodeDataSelect ns,TCellDataSelect cs)
+{
+    int dir,d,f,f2;
+    real tempx,tempy,tempz;
+    celldata[cs][0]=0.;
+    celldata[cs][1]=0.;
+    celldata[cs][2]=0.;
+    for(dir=0; dir<3; dir++)for(d=0; d<2; d++) {
+            tempx=tempy=tempz=0.;
+            if (isrefined_face(dir,d)) {
+                for (f=0; f<4; f++) for (f2=0; f2<4; f2++) {
+                        tempx+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][0];
+                        tempy+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][1];
+                        tempz+=refintf[dir][d]->face[f]->node[f2]->nodedata[ns][2];
                     }
+                tempx*=0.25;
+                tempy*=0.25;
+                tempz*=0.25;
+            } else {
+                for(f=0; f<4; f++) {
+                    tempx+=face[dir][d]->node[f]->nodedata[ns][0];
+                    tempy+=face[dir][d]->node[f]->nodedata[ns][1];
+                    tempz+=face[dir][d]->node[f]->nodedata[ns][2];
                 }
-                celldata[cs][0]+=tempx/24.;
-                celldata[cs][1]+=tempy/24.;
-                celldata[cs][2]+=tempz/24.;
             }
-    }
+            celldata[cs][0]+=tempx/24.;
+            celldata[cs][1]+=tempy/24.;
+            celldata[cs][2]+=tempz/24.;
+        }
 }
 
 //! node2cell interpolation for smoothing (recursive)
@@ -454,7 +465,7 @@ void Tgrid::Tcell::NC_smoothing_recursive()
         for (ch=0; ch<8; ch++) child[0][0][ch]->NC_smoothing_recursive();
     } else {
         int dir,d,f,f2;
-        datareal tempnc,temprhoq,tempvx,tempvy,tempvz;
+        real tempnc,temprhoq,tempvx,tempvy,tempvz;
         nc=0.;
         rho_q=0.;
         celldata[CELLDATA_Ji][0]=0.;
@@ -649,12 +660,10 @@ void Tgrid::Tnode::set_resistivity(ResistivityProfile res)
 void Tgrid::Tnode::calc_E1(void)
 {
     // E = -U_e x (B + B_0) + eta*J
-    real B0[3] = {0.0, 0.0, 0.0};
-    // Add constant magnetic field B0 (centroid = exact node coordinates)
-    addConstantMagneticField(centroid, B0);
-    const real Bx = nodedata[NODEDATA_B][0] + B0[0];
-    const real By = nodedata[NODEDATA_B][1] + B0[1];
-    const real Bz = nodedata[NODEDATA_B][2] + B0[2];
+    // Constant magnetic field B0 was set at the node by Tgrid::update_B0
+    const real Bx = nodedata[NODEDATA_B][0] + nodedata[NODEDATA_B0][0];
+    const real By = nodedata[NODEDATA_B][1] + nodedata[NODEDATA_B0][1];
+    const real Bz = nodedata[NODEDATA_B][2] + nodedata[NODEDATA_B0][2];
     const real uex = nodedata[NODEDATA_UE][0];
     const real uey = nodedata[NODEDATA_UE][1];
     const real uez = nodedata[NODEDATA_UE][2];
@@ -730,6 +739,49 @@ void Tgrid::Tcell::CN_smoothing_recursive()
     }
 }
 
+//! Node weights of the node2cell interpolation of a leaf cell (NC1, NC_smoothing_recursive)
+void Tgrid::Tcell::NC_weights(map<TNodePtr,real>& weights) const
+{
+    int dir,d,f,f2;
+    for(dir=0; dir<3; dir++)for(d=0; d<2; d++) {
+            if (isrefined_face(dir,d)) {
+                for (f=0; f<4; f++) for (f2=0; f2<4; f2++) weights[refintf[dir][d]->face[f]->node[f2]]+= 0.25/24.;
+            } else {
+                for (f=0; f<4; f++) weights[face[dir][d]->node[f]]+= 1/24.;
+            }
+        }
+}
+
+//! Nodes visited by CN_recursive, may contain duplicates (recursive)
+void Tgrid::Tcell::CN_nodes_recursive(vector<TNodePtr>& nodes) const
+{
+    if (haschildren) {
+        int ch;
+        for (ch=0; ch<8; ch++) child[0][0][ch]->CN_nodes_recursive(nodes);
+    } else {
+        int d,f,f2;
+        if (isrefined_face(0,1)) {
+            for (f=0; f<4; f++) for (f2=0; f2<4; f2++) nodes.push_back(refintf[0][1]->face[f]->node[f2]);
+        } else {
+            nodes.push_back(face[0][1]->node[2]);
+        }
+        for (d=1; d<3; d++) if (isrefined_face(d,1)) {
+                for (f=0; f<4; f++) for (f2=0; f2<4; f2++) nodes.push_back(refintf[d][1]->face[f]->node[f2]);
+            }
+    }
+}
+
+//! Collect leaf cells (recursive)
+void Tgrid::Tcell::collect_leaves_recursive(vector<TCellPtr>& leaves)
+{
+    if (haschildren) {
+        int ch;
+        for (ch=0; ch<8; ch++) child[0][0][ch]->collect_leaves_recursive(leaves);
+    } else {
+        leaves.push_back(this);
+    }
+}
+
 //! cell2node interpolation of rho_q (recursive)
 void Tgrid::Tcell::CN_rhoq_recursive()
 {
@@ -831,6 +883,35 @@ void Tgrid::Tcell::zero_rhoq_nc_Vq_recursive()
 }
 
 //! Calculate Ue in a cell (recursive)
+void Tgrid::Tcell::celldata_scale_add_recursive(TCellDataSelect dst, TCellDataSelect src, real factor, bool accumulate)
+{
+    if (haschildren) {
+        for (int ch=0; ch<8; ch++) child[0][0][ch]->celldata_scale_add_recursive(dst,src,factor,accumulate);
+    }
+    for (int d=0; d<3; d++) {
+        celldata[dst][d] = (accumulate ? celldata[dst][d] : 0) + factor*celldata[src][d];
+    }
+}
+
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+void Tgrid::Tcell::calc_level_CFL_recursive(real fdt, vector<real>& whistler, vector<real>& ue, vector<int>& ncells) const
+{
+    if (haschildren) {
+        for (int ch=0; ch<8; ch++) child[0][0][ch]->calc_level_CFL_recursive(fdt,whistler,ue,ncells);
+        return;
+    }
+    if (level >= int(ncells.size())) return;
+    real B[3] = {celldata[CELLDATA_B][0], celldata[CELLDATA_B][1], celldata[CELLDATA_B][2]};
+    addConstantMagneticField(centroid,B);
+    const real rhoq = max(real(rho_q),Params::rho_q_min);
+    const real cw = rhoq > 0 ? fdt*pi*sqrt(vecsqr(B))/(Params::mu_0*rhoq)*sqr(invsize) : 0;
+    const real cu = fdt*sqrt(sqr(celldata[CELLDATA_UE][0]) + sqr(celldata[CELLDATA_UE][1]) + sqr(celldata[CELLDATA_UE][2]))*invsize;
+    if (cw > whistler[level]) whistler[level] = cw;
+    if (cu > ue[level]) ue[level] = cu;
+    ncells[level]++;
+}
+#endif
+
 void Tgrid::Tcell::calc_ue_recursive(void)
 {
     if (haschildren) {
@@ -862,7 +943,7 @@ void Tgrid::Tcell::calc_ue_recursive(void)
             for (int d=0; d<3; d++) ue[d]*= norm;
 #ifndef NO_DIAGNOSTICS
             // Increase counter
-            Tgrid::fieldCounter.cutRateUe += 1.0;
+            TCellBlockScheduler::atomicAdd(Tgrid::fieldCounter.cutRateUe,1.0);
 #endif
         }
         for (int d=0; d<3; d++) celldata[CELLDATA_UE][d] = ue[d];
@@ -961,7 +1042,7 @@ void Tgrid::Tcell::set_resistivity_recursive(ResistivityProfile res)
 }
 
 //! Set magnetic field (B1) on a face (recursive)
-void Tgrid::Tcell::set_B_recursive(void (*func)(const gridreal[3], datareal[3]))
+void Tgrid::Tcell::set_B_recursive(void (*func)(const gridreal[3], real[3]))
 {
     if (haschildren) {
         int ch;
@@ -993,6 +1074,24 @@ void Tgrid::Tcell::set_B_recursive(void (*func)(const gridreal[3], datareal[3]))
     }
 }
 
+//! Set constant magnetic field B0 on the faces and nodes of a cell (recursive)
+void Tgrid::Tcell::set_B0_recursive()
+{
+    if (haschildren) {
+        int ch;
+        for (ch=0; ch<8; ch++) child[0][0][ch]->set_B0_recursive();
+    } else {
+        int d,dir,f;
+        for (d=0; d<3; d++) for (dir=0; dir<2; dir++) {
+                if (isrefined_face(d,dir)) {
+                    for (f=0; f<4; f++) refintf[d][dir]->face[f]->set_B0(d);
+                } else if (face[d][dir]) {
+                    face[d][dir]->set_B0(d);
+                }
+            }
+    }
+}
+
 //! Set background charge density in a cell (recursive)
 void Tgrid::Tcell::set_bgRhoQ_recursive(BackgroundChargeDensityProfile func)
 {
@@ -1232,6 +1331,29 @@ void Tgrid::Tface::NF_rhoq1(void)
     facedata[FACEDATA_MINUSDB] = 0.125*twice_integral;
 }
 
+//! Set constant magnetic field B0 at the nodes of a face and its normal component at the face center
+void Tgrid::Tface::set_B0(int d)
+{
+    int n;
+    for (n=0; n<4; n++) {
+        if (!node[n]) return;
+    }
+    gridreal r[3] = {0.0, 0.0, 0.0};
+    for (n=0; n<4; n++) {
+        real B0[3] = {0.0, 0.0, 0.0};
+        addConstantMagneticField(node[n]->centroid, B0);
+        node[n]->nodedata[NODEDATA_B0][0] = B0[0];
+        node[n]->nodedata[NODEDATA_B0][1] = B0[1];
+        node[n]->nodedata[NODEDATA_B0][2] = B0[2];
+        r[0] += 0.25*node[n]->centroid[0];
+        r[1] += 0.25*node[n]->centroid[1];
+        r[2] += 0.25*node[n]->centroid[2];
+    }
+    real B0[3] = {0.0, 0.0, 0.0};
+    addConstantMagneticField(r, B0);
+    facedata[FACEDATA_B0] = B0[d];
+}
+
 //! face2r interpolation
 void Tgrid::faceintpol(const shortreal r[3], TFaceDataSelect s, real result[3])
 {
@@ -1259,10 +1381,141 @@ void Tgrid::faceintpol(const shortreal r[3], TFaceDataSelect s, real result[3])
     saved_cellptr = c;
 }
 
+//! face2r interpolation of the sum of two face quantities (e.g. B1 and B0)
+void Tgrid::faceintpol(const shortreal r[3], TFaceDataSelect s1, TFaceDataSelect s2, real result[3])
+{
+    int d;
+    gridreal t,lowercorner[3];
+    Tcell *const c = findcell(r,lowercorner);
+    if (!c) {
+        errorlog << "ERROR [Tgrid::faceintpol]: findcell returned null for r=" << Tr3v(r).toString() << "\n";
+        doabort();
+    }
+    if (c->anyrefined_face()) {
+        for (d=0; d<3; d++) {
+            t = (r[d] - lowercorner[d])*c->invsize;
+            result[d] = (1-t)*(c->faceave(d,0,s1) + c->faceave(d,0,s2)) + t*(c->faceave(d,1,s1) + c->faceave(d,1,s2));
+        }
+    } else {
+        // faster branch for fully regular case
+        for (d=0; d<3; d++) {
+            const datareal *const f0 = c->face[d][0]->facedata;
+            const datareal *const f1 = c->face[d][1]->facedata;
+            t = (r[d] - lowercorner[d])*c->invsize;
+            result[d] = (1-t)*(f0[s1] + f0[s2]) + t*(f1[s1] + f1[s2]);
+        }
+    }
+    saved_cellptr = c;
+}
+
+/** \brief face2r interpolation of n points inside the same cell
+ *
+ * c and lowercorner are as returned by findcell for the points. The face
+ * values of c are gathered once and result[i] is the same as given by
+ * faceintpol(r[i],s,result[i]).
+ */
+void Tgrid::faceintpol_cell(TCellPtr c, const gridreal lowercorner[3], int n, const shortreal (*r)[3], TFaceDataSelect s, real (*result)[3]) const
+{
+    int d,i;
+    real f[3][2];
+    if (c->anyrefined_face()) {
+        for (d=0; d<3; d++) {
+            f[d][0] = c->faceave(d,0,s);
+            f[d][1] = c->faceave(d,1,s);
+        }
+    } else {
+        for (d=0; d<3; d++) {
+            f[d][0] = c->face[d][0]->facedata[s];
+            f[d][1] = c->face[d][1]->facedata[s];
+        }
+    }
+    const gridreal invsize = c->invsize;
+    for (i=0; i<n; i++) for (d=0; d<3; d++) {
+            const gridreal t = (r[i][d] - lowercorner[d])*invsize;
+            result[i][d] = (1-t)*f[d][0] + t*f[d][1];
+        }
+}
+
+//! face2r interpolation of the sum of two face quantities for n points inside the same cell
+void Tgrid::faceintpol_cell(TCellPtr c, const gridreal lowercorner[3], int n, const shortreal (*r)[3], TFaceDataSelect s1, TFaceDataSelect s2, real (*result)[3]) const
+{
+    int d,i;
+    real f[3][2];
+    if (c->anyrefined_face()) {
+        for (d=0; d<3; d++) {
+            f[d][0] = c->faceave(d,0,s1) + c->faceave(d,0,s2);
+            f[d][1] = c->faceave(d,1,s1) + c->faceave(d,1,s2);
+        }
+    } else {
+        for (d=0; d<3; d++) {
+            const datareal *const f0 = c->face[d][0]->facedata;
+            const datareal *const f1 = c->face[d][1]->facedata;
+            f[d][0] = f0[s1] + f0[s2];
+            f[d][1] = f1[s1] + f1[s2];
+        }
+    }
+    const gridreal invsize = c->invsize;
+    for (i=0; i<n; i++) for (d=0; d<3; d++) {
+            const gridreal t = (r[i][d] - lowercorner[d])*invsize;
+            result[i][d] = (1-t)*f[d][0] + t*f[d][1];
+        }
+}
+
+/** \brief Check whether the grid is a uniform mesh (no root cell has children)
+ *
+ * On a uniform mesh FC, NC, FaceCurl, NF, FacePropagate and the node loops
+ * (CN, CN_donor, CN_rhoq, CN_smoothing, calc_node_E, calc_node_ue), and
+ * their sph_ counterparts in the spherical build, run directly over flat
+ * arrays of cells, faces and nodes collected here in the same i,j,k order as
+ * the generic traversals, skipping the recursion and the
+ * haschildren/isrefined_face tests. Results are identical to the generic
+ * path. The arrays are rebuilt when grid_version changes.
+ */
+bool Tgrid::update_uniform()
+{
+    if (uniform_grid_version == grid_version) return uniform_mesh;
+    const bool was_uniform = uniform_mesh;
+    uniform_grid_version = grid_version;
+    uniform_mesh = true;
+    uniform_nodes.clear();
+    uniform_propfaces.clear();
+    uniform_cells.clear();
+    int i,j,k,c,d;
+    for (d=0; d<3; d++) uniform_curlfaces[d].clear();
+    for (c=0; c<nx*ny*nz; c++) if (cells[c]->haschildren) {
+            uniform_mesh = false;
+            break;
+        }
+    if (uniform_mesh) {
+        for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
+                    Tcell *const cell = cells[flatindex(i,j,k)];
+                    uniform_nodes.push_back(cell->face[0][1]->node[2]);
+                    if (j > 0 && k > 0) uniform_curlfaces[0].push_back(cell->face[0][1]);
+                    if (i > 0 && k > 0) uniform_curlfaces[1].push_back(cell->face[1][1]);
+                    if (i > 0 && j > 0) uniform_curlfaces[2].push_back(cell->face[2][1]);
+                    for (d=0; d<3; d++) uniform_propfaces.push_back(cell->face[d][1]);
+                }
+        ForInterior(i,j,k) uniform_cells.push_back(cells[flatindex(i,j,k)]);
+    }
+    if (uniform_mesh != was_uniform) {
+        mainlog << "Tgrid::update_uniform: uniform mesh fast path " << (uniform_mesh ? "enabled" : "disabled") << " (grid version " << grid_version << ")\n";
+    }
+    return uniform_mesh;
+}
+
 //! face2cell interpolation
 void Tgrid::FC(TFaceDataSelect fs, TCellDataSelect cs)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_cells.size();
+        for (c=0; c<n; c++) {
+            Tcell *const cell = uniform_cells[c];
+            for (i=0; i<3; i++)
+                cell->celldata[cs][i] = 0.5*(cell->face[i][0]->facedata[fs] + cell->face[i][1]->facedata[fs]);
+        }
+        return;
+    }
     ForInterior(i,j,k) {
         c = flatindex(i,j,k);
         cells[c]->FC_recursive(fs,cs);
@@ -1283,6 +1536,11 @@ void Tgrid::NC_smoothing()
 void Tgrid::NC(TNodeDataSelect ns,TCellDataSelect cs)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_cells.size();
+        for (c=0; c<n; c++) uniform_cells[c]->NC1(ns,cs);
+        return;
+    }
     ForInterior(i,j,k) {
         c = flatindex(i,j,k);
         cells[c]->NC_recursive(ns,cs);
@@ -1293,6 +1551,11 @@ void Tgrid::NC(TNodeDataSelect ns,TCellDataSelect cs)
 void Tgrid::CN(TCellDataSelect cs, TNodeDataSelect ns)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->CN1(cs,ns);
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->CN_recursive(cs,ns);
@@ -1303,6 +1566,11 @@ void Tgrid::CN(TCellDataSelect cs, TNodeDataSelect ns)
 void Tgrid::CN_smoothing()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->CN1_smoothing();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->CN_smoothing_recursive();
@@ -1313,6 +1581,11 @@ void Tgrid::CN_smoothing()
 void Tgrid::CN_rhoq()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->CN1_rhoq();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->CN_rhoq_recursive();
@@ -1336,6 +1609,11 @@ void Tgrid::set_resistivity(ResistivityProfile res)
 void Tgrid::CN_donor(TCellDataSelect cs, TNodeDataSelect ns, TNodeDataSelect uns, real dt)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->CN_donor1(cs,ns,uns,dt);
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->CN_donor_recursive(cs,ns,uns,dt);
@@ -1371,7 +1649,7 @@ inline gridreal Tgrid::accumulate_PIC_recursive(const TBoxDef& cloudbox, Tcell *
         // Particle number contribution from a macroparticle to this cell
         register const real accum_w = w*accum;
         // Charge contribution from a macroparticle to this cell
-        datareal charge = accum_w*Params::pops[popid]->q;
+        real charge = accum_w*Params::pops[popid]->q;
         if(Params::pops[popid]->getAccumulate() == true) {
             // Add particle number contribution to the cell
             c->nc += accum_w;
@@ -1389,23 +1667,23 @@ inline gridreal Tgrid::accumulate_PIC_recursive(const TBoxDef& cloudbox, Tcell *
 
         if (Params::averaging == true) {
 #ifdef SAVE_POPULATION_AVERAGES
-            c->pop_ave_n[popid] += accum_w;
-            c->pop_ave_vx[popid] += accum_w*v[0];
-            c->pop_ave_vy[popid] += accum_w*v[1];
-            c->pop_ave_vz[popid] += accum_w*v[2];
+            c->pop_ave_n(popid) += accum_w;
+            c->pop_ave_vx(popid) += accum_w*v[0];
+            c->pop_ave_vy(popid) += accum_w*v[1];
+            c->pop_ave_vz(popid) += accum_w*v[2];
 #endif
 #ifdef SAVE_PARTICLE_CELL_SPECTRA
             const real v2 = vecsqr(v);
             const real spectraAccum = sqrt(v2)*accum_w;
             const unsigned int Nbins = Params::spectraV2BinsPerPop[popid].size() - 1;
             if(v2 < Params::spectraV2BinsPerPop[popid][0] && Params::spectraEminAll == true) {
-                c->spectra[popid][0] += spectraAccum;
+                c->spectra(popid)[0] += spectraAccum;
             } else if(v2 > Params::spectraV2BinsPerPop[popid][Nbins] && Params::spectraEmaxAll == true) {
-                c->spectra[popid][Nbins] += spectraAccum;
+                c->spectra(popid)[Nbins-1] += spectraAccum;
             } else {
                 for(unsigned int i=0; i<Nbins; ++i) {
                     if(v2 >= Params::spectraV2BinsPerPop[popid][i] && v2 < Params::spectraV2BinsPerPop[popid][i+1]) {
-                        c->spectra[popid][i] += spectraAccum;
+                        c->spectra(popid)[i] += spectraAccum;
                         break;
                     }
                 }
@@ -1416,6 +1694,253 @@ inline gridreal Tgrid::accumulate_PIC_recursive(const TBoxDef& cloudbox, Tcell *
     return accum;
 }
 
+//! Reflect a ghost cell to the corresponding interior cell (other cells are returned as is)
+Tgrid::TCellPtr Tgrid::reflect_ghost_cell(TCellPtr c) const
+{
+    // Algorithm: (1) find the cell's i,j,k basegrid indices from its flatindex,
+    // (2) if i=0 set i=1, if i=nx-1 set i=nx-2, etc., (3) reassign it from basegrid.
+    if (c->level != 0) {
+        return c;
+    }
+    int i,j,k;
+    decompose(c->flatind,i,j,k);		// find (i,j,k) indices of the basegrid cell
+    bool anymod = false;
+    if (i==0) {
+        i = 1;    // modify it if needed
+        anymod=true;
+    }
+    if (i==nx-1) {
+        i = nx-2;
+        anymod=true;
+    }
+    if (j==0) {
+        j = 1;
+        anymod=true;
+    }
+    if (j==ny-1) {
+        j = ny-2;
+        anymod=true;
+    }
+    if (k==0) {
+        k = 1;
+        anymod=true;
+    }
+    if (k==nz-1) {
+        k = nz-2;
+        anymod=true;
+    }
+    if (anymod) {
+        return cells[flatindex(i,j,k)];	// compute back the cell from the basegrid
+    }
+    return c;
+}
+
+//! Add PIC contribution of a macroparticle (w times stencil weight) to a leaf cell
+inline void Tgrid::accumulate_PIC_cell(Tcell *c1, real accum_w, const shortreal v[3], int popid)
+{
+    // Charge contribution from a macroparticle to this cell
+    real charge = accum_w*Params::pops[popid]->q;
+    if(Params::pops[popid]->getAccumulate() == true) {
+        // Add particle number contribution to the cell
+        c1->nc += accum_w;
+        // Add charge contribution to the cell
+        c1->rho_q += charge;
+        // Add charge times velocity contribution to the cell
+        for (int d=0; d<3; d++) {
+            c1->celldata[CELLDATA_Ji][d] += charge*v[d];
+        }
+    }
+    accumulate_PIC_averages(c1, accum_w, v, popid);
+}
+
+//! Add population averages and spectra contribution of a macroparticle to a leaf cell
+inline void Tgrid::accumulate_PIC_averages(Tcell *c1, real accum_w, const shortreal v[3], int popid)
+{
+    if(Params::averaging == true) {
+#ifdef SAVE_POPULATION_AVERAGES
+        c1->pop_ave_n(popid) += accum_w;
+        c1->pop_ave_vx(popid) += accum_w*v[0];
+        c1->pop_ave_vy(popid) += accum_w*v[1];
+        c1->pop_ave_vz(popid) += accum_w*v[2];
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+        const real v2 = vecsqr(v);
+        const real spectraAccum = sqrt(v2)*accum_w;
+        const unsigned int Nbins = Params::spectraV2BinsPerPop[popid].size()-1;
+        if(v2 < Params::spectraV2BinsPerPop[popid][0]) {
+            c1->spectra(popid)[0] += spectraAccum;
+        } else if(v2 > Params::spectraV2BinsPerPop[popid][Nbins]) {
+            c1->spectra(popid)[Nbins-1] += spectraAccum;
+        } else {
+            for(unsigned int i=0; i<Nbins; ++i) {
+                if(v2 >= Params::spectraV2BinsPerPop[popid][i] && v2 < Params::spectraV2BinsPerPop[popid][i+1]) {
+                    c1->spectra(popid)[i] += spectraAccum;
+                    break;
+                }
+            }
+        }
+#endif
+    }
+}
+
+/** \brief Accumulate Particle-In-Cell quantities using a precomputed stencil
+ *
+ * Used when all eight cells of the octant are leaf cells of the same level
+ * as c. Then the CIC weights are products of the distances to the centroid
+ * of c along each dimension.
+ */
+inline void Tgrid::accumulate_PIC_stencil(const Tcell *c, int octant, const shortreal r[3], const shortreal v[3], real w, int popid)
+{
+    const TCellPtr *const stencil = &pic_stencil_cells[c->pic_stencil];
+    gridreal t[3][2];       // weight factors for staying (0) and moving (1) along each dimension
+    int step[3];            // stencil index step when moving along each dimension
+    for (int d=0; d<3; d++) {
+        t[d][1] = fabs(r[d] - c->centroid[d])*c->invsize;
+        t[d][0] = 1.0 - t[d][1];
+    }
+    step[0] = ((octant & 1) ? 1 : -1)*9;
+    step[1] = ((octant & 2) ? 1 : -1)*3;
+    step[2] = (octant & 4) ? 1 : -1;
+    // Stencil centre is c itself
+    const int centre = 13;
+    for (int a=0; a<8; a++) {
+        const int ax = a & 1, ay = (a >> 1) & 1, az = (a >> 2) & 1;
+        const gridreal accum1 = t[0][ax]*t[1][ay]*t[2][az];
+        accumulate_PIC_cell(stencil[centre + ax*step[0] + ay*step[1] + az*step[2]], w*accum1, v, popid);
+    }
+}
+
+/** \brief Accumulate Particle-In-Cell quantities in the deposition tile of c
+ *
+ * Like accumulate_PIC_stencil, but nc, rho_q and CELLDATA_Ji are summed in
+ * pic_tile and written to the grid by flush_PIC_tile. Averages and spectra
+ * are added directly.
+ */
+inline void Tgrid::accumulate_PIC_tile(const Tcell *c, int octant, const shortreal r[3], const shortreal v[3], real w, int popid)
+{
+    gridreal t[3][2];
+    int step[3];
+    for (int d=0; d<3; d++) {
+        t[d][1] = fabs(r[d] - c->centroid[d])*c->invsize;
+        t[d][0] = 1.0 - t[d][1];
+    }
+    step[0] = ((octant & 1) ? 1 : -1)*9;
+    step[1] = ((octant & 2) ? 1 : -1)*3;
+    step[2] = (octant & 4) ? 1 : -1;
+    const bool accumulate = Params::pops[popid]->getAccumulate();
+    const real q = Params::pops[popid]->q;
+    const int centre = 13;
+    for (int a=0; a<8; a++) {
+        const int ax = a & 1, ay = (a >> 1) & 1, az = (a >> 2) & 1;
+        const int idx = centre + ax*step[0] + ay*step[1] + az*step[2];
+        const real accum_w = w*t[0][ax]*t[1][ay]*t[2][az];
+        if (accumulate) {
+            const real charge = accum_w*q;
+            TPICTile& tile = pic_tile[idx];
+            tile.nc += accum_w;
+            tile.rho_q += charge;
+            for (int d=0; d<3; d++) tile.Ji[d] += charge*v[d];
+        }
+        accumulate_PIC_averages(pic_stencil_cells[c->pic_stencil + idx], accum_w, v, popid);
+    }
+}
+
+//! Write the deposition tile to the grid and empty it
+void Tgrid::flush_PIC_tile()
+{
+    if (!pic_tile_cell) {
+        return;
+    }
+    const TCellPtr *const stencil = &pic_stencil_cells[pic_tile_cell->pic_stencil];
+    for (int i=0; i<27; i++) {
+        TPICTile& tile = pic_tile[i];
+        if (stencil[i]) {
+            stencil[i]->nc += tile.nc;
+            stencil[i]->rho_q += tile.rho_q;
+            for (int d=0; d<3; d++) {
+                stencil[i]->celldata[CELLDATA_Ji][d] += tile.Ji[d];
+            }
+        }
+        tile.nc = tile.rho_q = 0;
+        tile.Ji[0] = tile.Ji[1] = tile.Ji[2] = 0;
+    }
+    pic_tile_cell = 0;
+}
+
+/** \brief Build the deposition stencils of all interior leaf cells
+ *
+ * For each leaf cell the 3x3x3 neighbourhood (ghost cells reflected to
+ * interior cells) is stored and a bit is set for every octant where
+ * accumulate_PIC can use the regular CIC weights. Called lazily by
+ * accumulate_PIC after the grid has been refined or recoarsened.
+ */
+void Tgrid::build_PIC_stencils()
+{
+    // The tile is empty here since the grid changes only between deposition passes
+    pic_tile_cell = 0;
+    pic_tile_last_cell = 0;
+    for (int i=0; i<27; i++) {
+        pic_tile[i].nc = pic_tile[i].rho_q = 0;
+        pic_tile[i].Ji[0] = pic_tile[i].Ji[1] = pic_tile[i].Ji[2] = 0;
+    }
+    pic_stencil_cells.clear();
+    int i,j,k;
+    ForInterior(i,j,k) {
+        build_PIC_stencil_recursive(cells[flatindex(i,j,k)]);
+    }
+    pic_stencils_valid = true;
+}
+
+//! Build the deposition stencil of a leaf cell (recursive)
+void Tgrid::build_PIC_stencil_recursive(Tcell *c)
+{
+    if (c->haschildren) {
+        for (int ch=0; ch<8; ch++) build_PIC_stencil_recursive(c->child[0][0][ch]);
+        return;
+    }
+    const int first = pic_stencil_cells.size();
+    pic_stencil_cells.resize(first + 27, TCellPtr(0));
+    c->pic_regular = 0;
+    for (int octant=0; octant<8; octant++) {
+        bool movetoright[3];
+        for (int d=0; d<3; d++) movetoright[d] = (octant >> d) & 1;
+        // Same traversal as in accumulate_PIC
+        Tcell *C[8];
+        C[0] = c;
+        C[1] = moveto(c,0,movetoright[0]);
+        C[2] = moveto(c,1,movetoright[1]);
+        C[3] = C[1] ? moveto(C[1],1,movetoright[1]) : TCellPtr(0);
+        C[4] = moveto(c,2,movetoright[2]);
+        C[5] = C[4] ? moveto(C[4],0,movetoright[0]) : TCellPtr(0);
+        C[6] = C[4] ? moveto(C[4],1,movetoright[1]) : TCellPtr(0);
+        C[7] = C[5] ? moveto(C[5],1,movetoright[1]) : TCellPtr(0);
+        bool regular = true;
+        for (int a=1; a<8; a++) {
+            if (!C[a] || C[a]->level != c->level || C[a]->haschildren) {
+                regular = false;
+                break;
+            }
+        }
+        if (!regular) {
+            continue;
+        }
+        c->pic_regular |= 1 << octant;
+        for (int a=0; a<8; a++) {
+            const int ix = 1 + ((a & 1) ? (movetoright[0] ? 1 : -1) : 0);
+            const int iy = 1 + ((a & 2) ? (movetoright[1] ? 1 : -1) : 0);
+            const int iz = 1 + ((a & 4) ? (movetoright[2] ? 1 : -1) : 0);
+            pic_stencil_cells[first + 9*ix + 3*iy + iz] = reflect_ghost_cell(C[a]);
+        }
+    }
+    if (c->pic_regular) {
+        c->pic_stencil = first;
+    } else {
+        // Only refinement interfaces around, no stencil needed
+        pic_stencil_cells.resize(first);
+        c->pic_stencil = -1;
+    }
+}
+
 //! Accumulate Particle-In-Cell quantities in the grid
 void Tgrid::accumulate_PIC(const shortreal r[3], const shortreal v[3], real w, int popid)
 {
@@ -1423,18 +1948,43 @@ void Tgrid::accumulate_PIC(const shortreal r[3], const shortreal v[3], real w, i
     Tcell *const c = findcell(r,centroid);
     if (!c) {
         // Do not abort if no cell is found. Particle removed in pass_with_relocate afterwards.
-        errorlog << "ERROR [Tgrid::accumulate_PIC]: findcell returned null for r="
-                 << Tr3v(r).toString() << "\n"
-                 << "   v=" << Tr3v(v).toString()
-                 << " popIdStr=" << Params::pops[popid]->getIdStr() << endl;
+        static LogRateLimit nullCellLog(errorlog,__FILE__,__LINE__);
+        if (nullCellLog.allow()) {
+            errorlog << "ERROR [Tgrid::accumulate_PIC]: findcell returned null for r="
+                     << Tr3v(r).toString() << "\n"
+                     << "   v=" << Tr3v(v).toString()
+                     << " popIdStr=" << Params::pops[popid]->getIdStr() << endl;
+        }
         return; //doabort();
     }
     const gridreal halfdx = 0.5*size(c);
     bool movetoright[3];        // false if move to left, true if move to right, along dimension d
+    int octant = 0;
     for (int d=0; d<3; d++) {
         centroid[d]+= halfdx;
         //if (r[d]==centroid[d]) errorlog << "Problem:::"<<endl;
         movetoright[d] = (r[d] > centroid[d]);
+        if (movetoright[d]) octant |= 1 << d;
+    }
+    // Regular octant: use the precomputed stencil
+    if (!pic_stencils_valid) {
+        build_PIC_stencils();
+    }
+    if ((c->pic_regular >> octant) & 1) {
+        // Particles are passed cell by cell, so the tile is switched to c
+        // when two successive particles deposit from c. Particles that
+        // have moved out of the cell being passed go directly to the grid.
+        if (c != pic_tile_cell && c == pic_tile_last_cell) {
+            flush_PIC_tile();
+            pic_tile_cell = c;
+        }
+        pic_tile_last_cell = c;
+        if (c == pic_tile_cell) {
+            accumulate_PIC_tile(c,octant,r,v,w,popid);
+        } else {
+            accumulate_PIC_stencil(c,octant,r,v,w,popid);
+        }
+        return;
     }
     Tcell *C[8];        // eight cells that define the stencil, some of them can be refined
     C[0] = c;
@@ -1518,85 +2068,12 @@ void Tgrid::accumulate_PIC(const shortreal r[3], const shortreal v[3], real w, i
             c1 = C[a];
             gridreal accum1 = intersection_volume_samesize_nochecks(r,c1->centroid,cloudsize)*invvol;
             // Handle correctly boundary cases by "reflecting" ghost cell density
-            // into corresponding interior cell. Algorithm:
-            // (1) find the cell's i,j,k basegrid indices from its flatindex,
-            // (2) if i=0 set i=1, if i=nx-1 set i=nx-2, etc., (3) reassign it from basegrid
+            // into corresponding interior cell.
             // Notice that this is in the 'regular grid' branch only, thus it works correctly only if
             // grid refinement does not touch the box boundary (doing so would cause other problems
             // in any case so this is not a new restriction).
-            if (c1->level == 0) {
-                int i,j,k;
-                decompose(c1->flatind,i,j,k);		// find (i,j,k) indices of the basegrid cell
-                bool anymod = false;
-                if (i==0) {
-                    i = 1;    // modify it if needed
-                    anymod=true;
-                }
-                if (i==nx-1) {
-                    i = nx-2;
-                    anymod=true;
-                }
-                if (j==0) {
-                    j = 1;
-                    anymod=true;
-                }
-                if (j==ny-1) {
-                    j = ny-2;
-                    anymod=true;
-                }
-                if (k==0) {
-                    k = 1;
-                    anymod=true;
-                }
-                if (k==nz-1) {
-                    k = nz-2;
-                    anymod=true;
-                }
-                if (anymod) {
-                    c1 = cells[flatindex(i,j,k)];	// compute back the cell from the basegrid
-                }
-            }
-            // Particle number contribution from a macroparticle to this cell
-            register const real accum_w = w*accum1;
-            // Charge contribution from a macroparticle to this cell
-            datareal charge = accum_w*Params::pops[popid]->q;
-            if(Params::pops[popid]->getAccumulate() == true) {
-                // Add particle number contribution to the cell
-                c1->nc += accum_w;
-                // Add charge contribution to the cell
-                c1->rho_q += charge;
-                // Add charge times velocity contribution to the cell
-                for (int d=0; d<3; d++) {
-                    c1->celldata[CELLDATA_Ji][d] += charge*v[d];
-                }
-            } else {
-                accum1 = 0.0;
-            }
-            if(Params::averaging == true) {
-#ifdef SAVE_POPULATION_AVERAGES
-                c1->pop_ave_n[popid] += accum_w;
-                c1->pop_ave_vx[popid] += accum_w*v[0];
-                c1->pop_ave_vy[popid] += accum_w*v[1];
-                c1->pop_ave_vz[popid] += accum_w*v[2];
-#endif
-#ifdef SAVE_PARTICLE_CELL_SPECTRA
-                const real v2 = vecsqr(v);
-                const real spectraAccum = sqrt(v2)*accum_w;
-                const unsigned int Nbins = Params::spectraV2BinsPerPop[popid].size()-1;
-                if(v2 < Params::spectraV2BinsPerPop[popid][0]) {
-                    c1->spectra[popid][0] += spectraAccum;
-                } else if(v2 > Params::spectraV2BinsPerPop[popid][Nbins]) {
-                    c1->spectra[popid][Nbins] += spectraAccum;
-                } else {
-                    for(unsigned int i=0; i<Nbins; ++i) {
-                        if(v2 >= Params::spectraV2BinsPerPop[popid][i] && v2 < Params::spectraV2BinsPerPop[popid][i+1]) {
-                            c1->spectra[popid][i] += spectraAccum;
-                            break;
-                        }
-                    }
-                }
-#endif
-            }
+            c1 = reflect_ghost_cell(c1);
+            accumulate_PIC_cell(c1, w*accum1, v, popid);
             accum += accum1;
         }
     } else {
@@ -1634,7 +2111,7 @@ void Tgrid::finalize_accum_recursive(Tcell *c)
             c->rho_q = Params::rho_q_min;
 #ifndef NO_DIAGNOSTICS
             // Increase counter
-            Tgrid::fieldCounter.cutRateRhoQ += 1.0;
+            TCellBlockScheduler::atomicAdd(Tgrid::fieldCounter.cutRateRhoQ,1.0);
 #endif
         }
         // Averaging
@@ -1659,12 +2136,17 @@ void Tgrid::finalize_accum_recursive(Tcell *c)
 //! Finalize accumulate Particle-In-Cell quantities in the grid
 void Tgrid::finalize_accum()
 {
+    flush_PIC_tile();
     Neumann_rhoq();
-    int i,j,k,c;
-    ForAll(i,j,k) {
-        c = flatindex(i,j,k);
-        finalize_accum_recursive(cells[c]);
-    }
+    // Leaf cells only write to themselves and to their upper faces => concurrent
+    struct Task : public TCellBlockTask {
+        Tgrid *g;
+        void run(const int* c, int n, int) {
+            for (int i = 0; i < n; ++i) g->finalize_accum_recursive(g->cells[c[i]]);
+        }
+    } task;
+    task.g = this;
+    block_pass(task,false,false);
     if (Params::averaging == true) {
         ave_ntimes++;
     }
@@ -1716,17 +2198,56 @@ void Tgrid::copy_smoothing(int cTo, int cFrom)
 void Tgrid::calc_ue(void)
 {
     //! Ue = (Ji - j)/rho_q
+    struct Task : public TCellBlockTask {
+        TCellPtr *cells;
+        void run(const int* c, int n, int) {
+            for (int i = 0; i < n; ++i) cells[c[i]]->calc_ue_recursive();
+        }
+    } task;
+    task.cells = cells;
+    block_pass(task,true,false);
+}
+
+//! dst = factor*src (accumulate=false) or dst += factor*src (accumulate=true), all cells including ghosts
+void Tgrid::celldata_scale_add(TCellDataSelect dst, TCellDataSelect src, real factor, bool accumulate)
+{
+    int i,j,k,c;
+    ForAll(i,j,k) {
+        c = flatindex(i,j,k);
+        cells[c]->celldata_scale_add_recursive(dst,src,factor,accumulate);
+    }
+}
+
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+/** \brief Maximum field CFL numbers of the interior leaf cells on each refinement level
+ *
+ * whistler[l] = fdt*v_w/dx with the grid scale whistler phase speed
+ * v_w = (pi/dx)*|B + B0|/(mu_0*rho_q), and ue[l] = fdt*|U_e|/dx. Uses
+ * CELLDATA_B and CELLDATA_UE from the latest field propagation.
+ */
+void Tgrid::calc_level_CFL(real fdt, vector<real>& whistler, vector<real>& ue, vector<int>& ncells) const
+{
+    whistler.assign(Params::maxGridRefinementLevel+1,0.0);
+    ue.assign(Params::maxGridRefinementLevel+1,0.0);
+    ncells.assign(Params::maxGridRefinementLevel+1,0);
     int i,j,k,c;
     ForInterior(i,j,k) {
         c = flatindex(i,j,k);
-        cells[c]->calc_ue_recursive();
+        cells[c]->calc_level_CFL_recursive(fdt,whistler,ue,ncells);
     }
 }
+#endif
 
 //! Calculate electric field at nodes
 void Tgrid::calc_node_E(void)
 {
+    update_B0();
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->calc_E1();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->calc_node_E_recursive();
@@ -1749,6 +2270,13 @@ void Tgrid::FaceCurl(TNodeDataSelect nsB, TFaceDataSelect fsj, real factor)
     //1. Ampere's law j=curl(B)/mu0  2. Faraday's induction dB/dt=-curl(E)
     // Factor is for case 1: 1/Params::mu_0  and for case 2: 1
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->Curl1(nsB,fsj,i,bgdx,factor);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->FaceCurl_recursive(nsB,fsj,0, factor);
@@ -1761,6 +2289,13 @@ void Tgrid::FaceCurl(TNodeDataSelect nsB, TFaceDataSelect fsj, real factor)
 void Tgrid::NF(TNodeDataSelect ns, TFaceDataSelect fs)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->NF1(ns,fs,i);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->NF_recursive(ns,fs,0);
@@ -1782,7 +2317,7 @@ void Tgrid::NF_rhoq()
 }
 
 //! Set magnetic field in cells and faces
-void Tgrid::set_B(void (*f)(const gridreal r[3], datareal[3]))
+void Tgrid::set_B(void (*f)(const gridreal r[3], real[3]))
 {
     MSGFUNCTIONCALL("Tgrid::set_B");
     // Set B-field at all the faces:
@@ -1796,6 +2331,24 @@ void Tgrid::set_B(void (*f)(const gridreal r[3], datareal[3]))
     MSGFUNCTIONEND("Tgrid::set_B");
 }
 
+/** \brief Set constant magnetic field B0 on nodes (NODEDATA_B0) and faces (FACEDATA_B0)
+ *
+ * B0 does not change in time, so the profiles are evaluated only when the
+ * grid has changed since the previous call.
+ */
+void Tgrid::update_B0()
+{
+    if (B0_grid_version == grid_version) {
+        return;
+    }
+    int i,j,k,c;
+    ForAll(i,j,k) {
+        c = flatindex(i,j,k);
+        cells[c]->set_B0_recursive();
+    }
+    B0_grid_version = grid_version;
+}
+
 //! Set background charge density in cells
 void Tgrid::set_bgRhoQ(BackgroundChargeDensityProfile func)
 {
@@ -1813,6 +2366,11 @@ void Tgrid::set_bgRhoQ(BackgroundChargeDensityProfile func)
 void Tgrid::FacePropagate(TFaceDataSelect Bold, TFaceDataSelect Bnew, real dt)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_propfaces.size();
+        for (c=0; c<n; c++) uniform_propfaces[c]->Propagate1(Bold,Bnew,dt);
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->FacePropagate_recursive(Bold,Bnew,dt);
@@ -1952,29 +2510,346 @@ void Tgrid::Neumann_smoothing()
             copy_smoothing(flatindex(i,j,k),flatindex(i,j,k-1));
 }
 
-//! Smoothing of nc, rho_q and CELLDATA_Ji
-void Tgrid::smoothing()
+//! Constructor
+Tgrid::TSmoothingMatrix::TSmoothingMatrix()
+{
+    const real w1[3] = {0.25, 0.5, 0.25};
+    for (int a=0; a<3; a++) for (int b=0; b<3; b++) for (int c=0; c<3; c++) binomial[(a*3 + b)*3 + c] = w1[a]*w1[b]*w1[c];
+    grid_version = -1;
+    valid = false;
+    rowstart.push_back(0);
+}
+
+//! Remove all rows
+void Tgrid::TSmoothingMatrix::clear()
+{
+    rowstart.assign(1,0);
+    col.clear();
+    wstart.clear();
+    w.clear();
+    valid = false;
+}
+
+/** \brief Append a row
+ *
+ * pos[i] is the position of value i, r0 and h are the position and the cell
+ * size of the row. The row is stored as the binomial stencil if its columns
+ * are the 3x3x3 neighbourhood of r0 with the binomial weights.
+ */
+void Tgrid::TSmoothingMatrix::addrow(const TSmoothingRow& row, const gridreal r0[3], gridreal h, const vector<const gridreal*>& pos)
+{
+    int stencil[27];
+    bool regular = (row.size() == 27);
+    if (regular) {
+        for (int s=0; s<27; s++) stencil[s] = -1;
+        for (TSmoothingRow::const_iterator it = row.begin(); it != row.end() && regular; ++it) {
+            int s = 0;
+            for (int d=0; d<3; d++) {
+                const real offset = (pos[it->first][d] - r0[d])/h;
+                const int ioffset = int(floor(offset + 0.5));
+                if (ioffset < -1 || ioffset > 1 || fabs(offset - ioffset) > 1e-3) {
+                    regular = false;
+                    break;
+                }
+                s = 3*s + ioffset + 1;
+            }
+            if (regular == false || stencil[s] >= 0 || fabs(it->second - binomial[s]) > 1e-12) {
+                regular = false;
+            } else {
+                stencil[s] = it->first;
+            }
+        }
+    }
+    if (regular) {
+        col.insert(col.end(),stencil,stencil+27);
+        wstart.push_back(-1);
+    } else {
+        wstart.push_back(w.size());
+        for (TSmoothingRow::const_iterator it = row.begin(); it != row.end(); ++it) {
+            col.push_back(it->first);
+            w.push_back(it->second);
+        }
+    }
+    rowstart.push_back(col.size());
+}
+
+//! y[r] = sum_i A[r][i]*x[i] for all rows r, x and y hold NCOMP components per value
+template <int NCOMP>
+void Tgrid::TSmoothingMatrix::apply(const real *x, real *y) const
 {
-    for(int n=0; n<Params::densitySmoothingNumber; n++) {
-        Neumann_smoothing();//set up Neumann boundary(can also be other boundary condition) for the particle related quantities
-        CN_smoothing();//Cell to Node interpolation. NODEDATA_UE[0] and NODEDATA_J are used as temporary storage place for node values of rho_q and VQ
-        NC_smoothing();//Node to Cell interpolation. NODEDATA_UE[0] and NODEDATA_J are used as temporary storage place for node values of rho_q and VQ
+    const int nrows = Nrows();
+    for (int r=0; r<nrows; r++) {
+        real sum[NCOMP];
+        for (int k=0; k<NCOMP; k++) sum[k] = 0;
+        const int n = rowstart[r+1] - rowstart[r];
+        const int *const c = &col[rowstart[r]];
+        const real *const wr = (wstart[r] < 0) ? binomial : &w[wstart[r]];
+        for (int i=0; i<n; i++) {
+            const real *const xi = x + NCOMP*c[i];
+            for (int k=0; k<NCOMP; k++) sum[k]+= wr[i]*xi[k];
+        }
+        for (int k=0; k<NCOMP; k++) y[NCOMP*r + k] = sum[k];
     }
-    if(Params::densitySmoothingNumber > 0) {
-        Neumann_smoothing();//set up Neumann boundary(can also be other boundary condition) for the particle related quantities
+}
+
+//! Ghost cell copies (destination, source) in the order of Neumann (and Neumann_smoothing if periodic_y=false)
+void Tgrid::neumann_pairs(vector<pair<int,int> >& pairs, bool periodic_y) const
+{
+    int i,j,k;
+    pairs.clear();
+    for (j=1; j<ny-1; j++) for (k=1; k<nz-1; k++) pairs.push_back(make_pair(flatindex(0,j,k),flatindex(1,j,k)));
+    for (j=1; j<ny-1; j++) for (k=1; k<nz-1; k++) pairs.push_back(make_pair(flatindex(nx-1,j,k),flatindex(nx-2,j,k)));
+    for (i=0; i<nx; i++) for (k=1; k<nz-1; k++) pairs.push_back(make_pair(flatindex(i,0,k),flatindex(i,periodic_y ? ny-2 : 1,k)));
+    for (i=0; i<nx; i++) for (k=1; k<nz-1; k++) pairs.push_back(make_pair(flatindex(i,ny-1,k),flatindex(i,periodic_y ? 1 : ny-2,k)));
+    for (i=0; i<nx; i++) for (j=0; j<ny; j++) pairs.push_back(make_pair(flatindex(i,j,0),flatindex(i,j,1)));
+    for (i=0; i<nx; i++) for (j=0; j<ny; j++) pairs.push_back(make_pair(flatindex(i,j,nz-1),flatindex(i,j,nz-2)));
+}
+
+//! Interior leaf cells and their value array indices
+void Tgrid::smoothing_leaves(vector<TCellPtr>& leaves, TSmoothingIndex& index) const
+{
+    int i,j,k;
+    leaves.clear();
+    index.clear();
+    ForInterior(i,j,k) cells[flatindex(i,j,k)]->collect_leaves_recursive(leaves);
+    for (unsigned int n=0; n<leaves.size(); n++) index[leaves[n]] = n;
+}
+
+//! Add w times the value of leaf or ghost cell c to row
+bool Tgrid::smoothing_expand(const Tcell *c, real w, const TSmoothingIndex& index, const TSmoothingGhosts& ghosts, TSmoothingRow& row)
+{
+    const TSmoothingIndex::const_iterator it = index.find(c);
+    if (it != index.end()) {
+        row[it->second]+= w;
+        return true;
     }
-    return;
+    const TSmoothingGhosts::const_iterator gt = ghosts.find(c);
+    if (gt == ghosts.end()) return false;
+    for (TSmoothingRow::const_iterator jt = gt->second.begin(); jt != gt->second.end(); ++jt) row[jt->first]+= w*jt->second;
+    return true;
+}
+
+/** \brief Ghost cells after the Neumann copies as combinations of interior leaf cells
+ *
+ * A refined source gives the average of its children (copy_celldata,
+ * copy_smoothing). Fails if a ghost cell is refined.
+ */
+bool Tgrid::smoothing_ghosts(const TSmoothingIndex& index, bool periodic_y, TSmoothingGhosts& ghosts) const
+{
+    vector<pair<int,int> > pairs;
+    neumann_pairs(pairs,periodic_y);
+    ghosts.clear();
+    for (unsigned int n=0; n<pairs.size(); n++) {
+        if (cells[pairs[n].first]->haschildren) return false;
+        vector<TCellPtr> leaves;
+        cells[pairs[n].second]->collect_leaves_recursive(leaves);
+        TSmoothingRow row;
+        for (unsigned int m=0; m<leaves.size(); m++) {
+            // childave weight of a leaf at depth l below the source is 0.125^l
+            const real w = pow(leaves[m]->size/cells[pairs[n].second]->size,3);
+            if (smoothing_expand(leaves[m],w,index,ghosts,row) == false) return false;
+        }
+        ghosts[cells[pairs[n].first]] = row;
+    }
+    return true;
+}
+
+//! Add w times the cell2node interpolation (CN1, CN1_smoothing) at node n to row
+bool Tgrid::smoothing_CN_weights(const Tnode *n, real w, const TSmoothingIndex& index, const TSmoothingGhosts& ghosts, TSmoothingRow& row)
+{
+    int a;
+    gridreal weightsum = 0.0;
+    for (a=0; a<8; a++) if (n->cell[0][0][a]) weightsum+= n->cell[0][0][a]->invsize;
+    if (weightsum == 0) return true;
+    for (a=0; a<8; a++) {
+        const Tcell *const c = n->cell[0][0][a];
+        if (c == 0) continue;
+        if (smoothing_expand(c,w*c->invsize/weightsum,index,ghosts,row) == false) return false;
+    }
+    return true;
+}
+
+/** \brief Build smooth_density, one iteration of smoothing() on the interior leaf cells
+ *
+ * Neumann_smoothing + CN_smoothing + NC_smoothing of a leaf cell is a
+ * weighted sum of interior leaf cells, ghost cells are expanded to the
+ * interior cells they are copied from.
+ */
+bool Tgrid::build_smoothing_density()
+{
+    TSmoothingMatrix& m = smooth_density;
+    m.clear();
+    m.grid_version = grid_version;
+    TSmoothingIndex index;
+    TSmoothingGhosts ghosts;
+    smoothing_leaves(smooth_cells,index);
+    if (smoothing_ghosts(index,false,ghosts) == false) return false;
+    vector<const gridreal*> pos(smooth_cells.size());
+    for (unsigned int n=0; n<smooth_cells.size(); n++) pos[n] = smooth_cells[n]->centroid;
+    for (unsigned int n=0; n<smooth_cells.size(); n++) {
+        map<TNodePtr,real> nodes;
+        smooth_cells[n]->NC_weights(nodes);
+        TSmoothingRow row;
+        for (map<TNodePtr,real>::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+            if (smoothing_CN_weights(it->first,it->second,index,ghosts,row) == false) return false;
+        }
+        m.addrow(row,smooth_cells[n]->centroid,smooth_cells[n]->size,pos);
+    }
+    m.valid = true;
+    mainlog << "Tgrid::build_smoothing_density: " << m.Nrows() << " rows, " << int(count(m.wstart.begin(),m.wstart.end(),-1)) << " binomial (grid version " << grid_version << ")\n";
+    return true;
 }
 
-//! Smoothing of electric field
+/** \brief Build smooth_E, one iteration of smoothing_E() on the nodes
+ *
+ * NC + Neumann + CN of a node is a weighted sum of the nodes of the interior
+ * leaf cells. The rows are the nodes visited by CN, nodes which are only
+ * read are appended to smooth_nodes after them.
+ */
+bool Tgrid::build_smoothing_E()
+{
+    TSmoothingMatrix& m = smooth_E;
+    m.clear();
+    m.grid_version = grid_version;
+    vector<TCellPtr> leaves;
+    TSmoothingIndex index;
+    TSmoothingGhosts ghosts;
+    smoothing_leaves(leaves,index);
+#ifdef PERIODIC_FIELDS_Y
+    const bool periodic_y = true;
+#else
+    const bool periodic_y = false;
+#endif
+    if (smoothing_ghosts(index,periodic_y,ghosts) == false) return false;
+    vector<map<TNodePtr,real> > ncweights(leaves.size());
+    for (unsigned int n=0; n<leaves.size(); n++) leaves[n]->NC_weights(ncweights[n]);
+    int i,j,k;
+    vector<TNodePtr> cnnodes;
+    for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) cells[flatindex(i,j,k)]->CN_nodes_recursive(cnnodes);
+    map<const Tnode*,int> nindex;
+    vector<const gridreal*> pos;
+    smooth_nodes.clear();
+    for (unsigned int n=0; n<cnnodes.size(); n++) {
+        if (nindex.insert(make_pair(cnnodes[n],int(smooth_nodes.size()))).second) {
+            smooth_nodes.push_back(cnnodes[n]);
+            pos.push_back(cnnodes[n]->centroid);
+        }
+    }
+    const int nrows = smooth_nodes.size();
+    for (int r=0; r<nrows; r++) {
+        const Tnode *const node = smooth_nodes[r];
+        TSmoothingRow cellrow,row;
+        if (smoothing_CN_weights(node,1.0,index,ghosts,cellrow) == false) return false;
+        for (TSmoothingRow::const_iterator it = cellrow.begin(); it != cellrow.end(); ++it) {
+            const map<TNodePtr,real>& nc = ncweights[it->first];
+            for (map<TNodePtr,real>::const_iterator jt = nc.begin(); jt != nc.end(); ++jt) {
+                const pair<map<const Tnode*,int>::iterator,bool> ins = nindex.insert(make_pair(jt->first,int(smooth_nodes.size())));
+                if (ins.second) {
+                    smooth_nodes.push_back(jt->first);
+                    pos.push_back(jt->first->centroid);
+                }
+                row[ins.first->second]+= it->second*jt->second;
+            }
+        }
+        gridreal h = 0;
+        for (int a=0; a<8; a++) if (node->cell[0][0][a]) h = node->cell[0][0][a]->size;
+        m.addrow(row,node->centroid,h,pos);
+    }
+    m.valid = true;
+    mainlog << "Tgrid::build_smoothing_E: " << m.Nrows() << " rows, " << int(count(m.wstart.begin(),m.wstart.end(),-1)) << " binomial (grid version " << grid_version << ")\n";
+    return true;
+}
+
+/** \brief Smoothing of nc, rho_q and CELLDATA_Ji
+ *
+ * The iterations are fused sweeps of smooth_density over flat value arrays.
+ * The recursive Neumann + CN + NC passes (which use NODEDATA_UE[0] and
+ * NODEDATA_J as temporary storage) are used if the operator cannot be built.
+ */
+void Tgrid::smoothing()
+{
+    const int nsmooth = Params::densitySmoothingNumber;
+    if (nsmooth <= 0) return;
+    if (smooth_density.grid_version != grid_version) {
+        if (build_smoothing_density() == false) {
+            WARNINGMSG("fused density smoothing not supported by the grid, using recursive passes");
+        }
+    }
+    if (smooth_density.valid == false) {
+        for(int n=0; n<nsmooth; n++) {
+            Neumann_smoothing();//set up Neumann boundary(can also be other boundary condition) for the particle related quantities
+            CN_smoothing();//Cell to Node interpolation. NODEDATA_UE[0] and NODEDATA_J are used as temporary storage place for node values of rho_q and VQ
+            NC_smoothing();//Node to Cell interpolation. NODEDATA_UE[0] and NODEDATA_J are used as temporary storage place for node values of rho_q and VQ
+        }
+        Neumann_smoothing();
+        return;
+    }
+    const int n = smooth_cells.size();
+    smooth_x.resize(5*n);
+    smooth_y.resize(5*n);
+    for (int c=0; c<n; c++) {
+        const Tcell *const cell = smooth_cells[c];
+        real *const x = &smooth_x[5*c];
+        x[0] = cell->nc;
+        x[1] = cell->rho_q;
+        x[2] = cell->celldata[CELLDATA_Ji][0];
+        x[3] = cell->celldata[CELLDATA_Ji][1];
+        x[4] = cell->celldata[CELLDATA_Ji][2];
+    }
+    for (int s=0; s<nsmooth; s++) {
+        smooth_density.apply<5>(&smooth_x[0],&smooth_y[0]);
+        smooth_x.swap(smooth_y);
+    }
+    for (int c=0; c<n; c++) {
+        Tcell *const cell = smooth_cells[c];
+        const real *const x = &smooth_x[5*c];
+        cell->nc = x[0];
+        cell->rho_q = x[1];
+        cell->celldata[CELLDATA_Ji][0] = x[2];
+        cell->celldata[CELLDATA_Ji][1] = x[3];
+        cell->celldata[CELLDATA_Ji][2] = x[4];
+    }
+    Neumann_smoothing();//set up Neumann boundary(can also be other boundary condition) for the particle related quantities
+}
+
+/** \brief Smoothing of electric field
+ *
+ * The iterations are fused sweeps of smooth_E over flat value arrays. The
+ * recursive NC + Neumann + CN passes (which use CELLDATA_TEMP1 as temporary
+ * storage) are used if the operator cannot be built.
+ */
 void Tgrid::smoothing_E()
 {
-    for(int n=0; n<Params::electricFieldSmoothingNumber; n++) {
-        NC(NODEDATA_E,CELLDATA_TEMP1);//Node to Cell interpolation. NODEDATA_E is interpolated to CELLDATA_TEMP1. CELLDATA_TEMP1 is used as temporary storage place for cell values of E.
-        Neumann(CELLDATA_TEMP1);//Set up Neumann boundary(can also be other boundary condition) for CELLDATA_TEMP1 (actually saves CELLDATA_E).
-        CN(CELLDATA_TEMP1,NODEDATA_E);//Cell to Node interpolation for E. CELLDATA_TEMP1 is used as temporary storage place for cell values of E.
+    const int nsmooth = Params::electricFieldSmoothingNumber;
+    if (nsmooth <= 0) return;
+    if (smooth_E.grid_version != grid_version) {
+        if (build_smoothing_E() == false) {
+            WARNINGMSG("fused electric field smoothing not supported by the grid, using recursive passes");
+        }
+    }
+    if (smooth_E.valid == false) {
+        for(int n=0; n<nsmooth; n++) {
+            NC(NODEDATA_E,CELLDATA_TEMP1);//Node to Cell interpolation. NODEDATA_E is interpolated to CELLDATA_TEMP1. CELLDATA_TEMP1 is used as temporary storage place for cell values of E.
+            Neumann(CELLDATA_TEMP1);//Set up Neumann boundary(can also be other boundary condition) for CELLDATA_TEMP1 (actually saves CELLDATA_E).
+            CN(CELLDATA_TEMP1,NODEDATA_E);//Cell to Node interpolation for E. CELLDATA_TEMP1 is used as temporary storage place for cell values of E.
+        }
+        return;
+    }
+    const int n = smooth_nodes.size(), nrows = smooth_E.Nrows();
+    smooth_x.resize(3*n);
+    smooth_y.resize(3*n);
+    for (int c=0; c<n; c++) {
+        for (int d=0; d<3; d++) smooth_x[3*c + d] = smooth_nodes[c]->nodedata[NODEDATA_E][d];
+    }
+    // Nodes after the rows are only read
+    copy(smooth_x.begin() + 3*nrows,smooth_x.end(),smooth_y.begin() + 3*nrows);
+    for (int s=0; s<nsmooth; s++) {
+        smooth_E.apply<3>(&smooth_x[0],&smooth_y[0]);
+        smooth_x.swap(smooth_y);
+    }
+    for (int c=0; c<nrows; c++) {
+        for (int d=0; d<3; d++) smooth_nodes[c]->nodedata[NODEDATA_E][d] = smooth_x[3*c + d];
     }
-    return;
 }
 
 //! Field boundary conditions
@@ -2220,6 +3095,77 @@ void Tgrid::Tnode::update_cell_pointers(gridreal size, Tgrid& g)
             }
 }
 
+//! Set the record sizes of the leaf cell side tables and drop all records
+void Tgrid::init_side_tables()
+{
+#ifdef SAVE_POPULATION_AVERAGES
+    pop_ave_table.init(4,Params::POPULATIONS);
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    spectra_table.init(Params::POPULATIONS,Params::spectraNbins);
+#endif
+}
+
+//! Give a leaf cell zeroed population average and spectra records
+void Tgrid::Tcell::alloc_side_records()
+{
+#ifdef SAVE_POPULATION_AVERAGES
+    pop_ave_slot = pop_ave_table.alloc();
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    spectra_slot = spectra_table.alloc();
+#endif
+}
+
+//! Return the side table records of a cell which stops being a leaf
+void Tgrid::Tcell::release_side_records()
+{
+#ifdef SAVE_POPULATION_AVERAGES
+    pop_ave_table.release(pop_ave_slot);
+    pop_ave_slot = -1;
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    spectra_table.release(spectra_slot);
+    spectra_slot = -1;
+#endif
+}
+
+//! Copy the side table records of src (the parent of a new child)
+void Tgrid::Tcell::copy_side_records(const Tcell& src)
+{
+#ifdef SAVE_POPULATION_AVERAGES
+    pop_ave_table.copy(pop_ave_slot,src.pop_ave_slot);
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    spectra_table.copy(spectra_slot,src.spectra_slot);
+#endif
+}
+
+//! Set the side table records of a recoarsened cell to the average of its children
+void Tgrid::Tcell::average_side_records()
+{
+#ifdef SAVE_POPULATION_AVERAGES
+    for (int r = 0; r < 4; ++r) {
+        datareal *ave = pop_ave_table.row(pop_ave_slot,r);
+        for (int i = 0; i < Params::POPULATIONS; ++i) {
+            real sum = 0.0;
+            for (int ch=0; ch<8; ch++) sum += pop_ave_table.row(child[0][0][ch]->pop_ave_slot,r)[i];
+            ave[i] = 0.125*sum;
+        }
+    }
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    for (int i = 0; i < Params::POPULATIONS; ++i) {
+        datareal *spec = spectra(i);
+        for (int j = 0; j < Params::spectraNbins; ++j) {
+            real sum = 0.0;
+            for (int ch=0; ch<8; ch++) sum += child[0][0][ch]->spectra(i)[j];
+            spec[j] = 0.125*sum;
+        }
+    }
+#endif
+}
+
 //! (GRID REFINEMENT) Refine a cell. Fails if any neighbour is larger.
 bool Tgrid::Tcell::refine(Tgrid& g)
 {
@@ -2339,28 +3285,19 @@ bool Tgrid::Tcell::refine(Tgrid& g)
         c->parent = this;
         c->flatind = a;
         c->running_index = -1234;       // arbitrary illegal value to ease debugging (not important though)
+        c->pic_stencil = -1;
+        c->pic_regular = 0;
         c->rho_q_bg = 0.0;
         for (d=0; d<3; d++) c->centroid[d] = centroid[d] + size*(chdir[d] ? +0.25 : -0.25);
         c->r2 = vecsqr(c->centroid);
         c->size = 0.5*size;
         c->invsize = 1.0/c->size;
         c->nc = nc;
+        c->alloc_side_records();
         // Averaging
         if (Params::averaging == true) {
             c->ave_nc = ave_nc;
-#ifdef SAVE_POPULATION_AVERAGES
-            for (int i = 0; i < Params::POPULATIONS; ++i) {
-                c->pop_ave_n.push_back(pop_ave_n[i]);
-                c->pop_ave_vx.push_back(pop_ave_vx[i]);
-                c->pop_ave_vy.push_back(pop_ave_vy[i]);
-                c->pop_ave_vz.push_back(pop_ave_vz[i]);
-            }
-#endif
-#ifdef SAVE_PARTICLE_CELL_SPECTRA
-            for (int i = 0; i < Params::POPULATIONS; ++i) {
-                c->spectra.push_back(spectra[i]);
-            }
-#endif
+            c->copy_side_records(*this);
         }
         for (s=0; s<NCELLDATA; s++) for (d=0; d<3; d++) c->celldata[s][d] = celldata[s][d];
         // set c->face pointers
@@ -2374,6 +3311,7 @@ bool Tgrid::Tcell::refine(Tgrid& g)
     }
     // Mark it that we now have children
     haschildren = true;
+    release_side_records();
     // Set pointers from faces to nodes
     for (d=0; d<3; d++) for (diry=0; diry<2; diry++) for (dirz=0; dirz<2; dirz++) for (a=0; a<3; a++) {
                     gridreal rfacec[3],rnode[3];    // face center, node position
@@ -2549,24 +3487,10 @@ bool Tgrid::Tcell::recoarsen(Tgrid& g)
             ave_nc+= child[0][0][ch]->ave_nc;
         }
         ave_nc*= 0.125;
-#ifdef SAVE_POPULATION_AVERAGES
-        for (int i = 0; i < Params::POPULATIONS; ++i) {
-            pop_ave_n[i] = 0.0;
-            pop_ave_vx[i] = 0.0;
-            pop_ave_vy[i] = 0.0;
-            pop_ave_vz[i] = 0.0;
-            for (ch=0; ch<8; ch++) {
-                pop_ave_n[i] += child[0][0][ch]->pop_ave_n[i];
-                pop_ave_vx[i] += child[0][0][ch]->pop_ave_vx[i];
-                pop_ave_vy[i] += child[0][0][ch]->pop_ave_vy[i];
-                pop_ave_vz[i] += child[0][0][ch]->pop_ave_vz[i];
-            }
-            pop_ave_n[i] *= 0.125;
-            pop_ave_vx[i] *= 0.125;
-            pop_ave_vy[i] *= 0.125;
-            pop_ave_vz[i] *= 0.125;
-        }
-#endif
+    }
+    alloc_side_records();
+    if (Params::averaging == true) {
+        average_side_records();
     }
     for (s=0; s<NCELLDATA; s++) for (d=0; d<3; d++) celldata[s][d] = 0;
     for (ch=0; ch<8; ch++) for (s=0; s<NCELLDATA; s++) for (d=0; d<3; d++) celldata[s][d]+= child[0][0][ch]->celldata[s][d];
@@ -2578,6 +3502,7 @@ bool Tgrid::Tcell::recoarsen(Tgrid& g)
         }
     // Delete children cells
     for (ch=0; ch<8; ch++) {
+        child[0][0][ch]->release_side_records();
         delete child[0][0][ch];
     }
     haschildren = false;
@@ -2801,6 +3726,8 @@ void Tgrid::Refine(GridRefinementProfile refFunc)
     mainlog << "|-----------------------------------------------------------------|\n";
     // reset the cached cell pointer since it may have been invalidated
     previous_found_cell = 0;
+    pic_stencils_valid = false;
+    grid_version++;
     MSGFUNCTIONEND("Tgrid::Refine");
 }
 
@@ -2819,6 +3746,8 @@ void Tgrid::recoarsen(gridreal (*mindx)(const gridreal[]))
         cells[flatindex(i,j,k)]->recoarsen_recursive(*this);
     }
     previous_found_cell = 0;        // reset the cached cell pointer since it may have been invalidated
+    pic_stencils_valid = false;
+    grid_version++;
 }
 
 // =================================================================================
@@ -2890,167 +3819,204 @@ void Tgrid::Tcell::writeMHD(ostream& o,const int filetype,vector<int> popId) con
         } else {
             o << "L " << (parent ? parent->running_index : -1) << ' ';
         }
-        real rho = 0;
-        real rhovx = 0;
-        real rhovy = 0;
-        real rhovz = 0;
-        real U1 = 0;
-        real B1x = 0;
-        real B1y = 0;
-        real B1z = 0;
-        real B0x = 0;
-        real B0y = 0;
-        real B0z = 0;
-        real n=0,vx=0,vy=0,vz=0;
+        real v[11];
+        calcMHD(filetype,popId,v);
+        if (hcFileAsciiFormat == false) {
+            const int n = 11;
+            float xf[n];
+            for (int i = 0; i < n; i++) {
+                xf[i] = v[i];
+            }
+            ByteConversion(sizeof(float),(unsigned char*)xf,n);
+            WriteFloatsToFile(o,xf,n);
+        } else {
+            for (int i = 0; i < 11; i++) {
+                o << v[i] << ' ';
+            }
+            o << '\n';
+        }
+    }
+}
+
+//! Calculate the hc-file quantities of a leaf cell: rho, rhovx, rhovy, rhovz, U1, B1x, B1y, B1z, B0x, B0y, B0z
+void Tgrid::Tcell::calcMHD(const int filetype,vector<int>& popId,real v[11]) const
+{
+    real rho = 0;
+    real rhovx = 0;
+    real rhovy = 0;
+    real rhovz = 0;
+    real U1 = 0;
+    real B1x = 0;
+    real B1y = 0;
+    real B1z = 0;
+    real B0x = 0;
+    real B0y = 0;
+    real B0z = 0;
+    real n=0,vx=0,vy=0,vz=0;
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-        gridreal dV = size*size*size;
+    gridreal dV = size*size*size;
 #else
-        gridreal dV = sph_dV;
-        if (dV<0.0) dV = -dV;  // This because r = x and x can be (and usually is!) negative
+    gridreal dV = sph_metric->dV;
+    if (dV<0.0) dV = -dV;  // This because r = x and x can be (and usually is!) negative
 #endif
-        if(filetype == 0) { // Population(s)
-            // This gives correct mass density, but hcvis may assume that
-            // m = mp and then, e.g., for O+ populations n comes out wrong
-            // in hcvis. The volume weighting (accumulation) is not used!
-            rho = plist.calc_mass(popId)/dV;
-            // This gives correct number density if all the populations
-            // to be saved in this hc-file have the same particle mass
-            // (as should be usually the case)!
-            n = rho/Params::pops[popId[0]]->m;
+    if(filetype == 0) { // Population(s)
+        // This gives correct mass density, but hcvis may assume that
+        // m = mp and then, e.g., for O+ populations n comes out wrong
+        // in hcvis. The volume weighting (accumulation) is not used!
+        rho = plist.calc_mass(popId)/dV;
+        // This gives correct number density if all the populations
+        // to be saved in this hc-file have the same particle mass
+        // (as should be usually the case)!
+        n = rho/Params::pops[popId[0]]->m;
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-            // This is B after the propagations in this timestep
-            B1x = 0.5*(faceave(0,0,FACEDATA_B) + faceave(0,1,FACEDATA_B));
-            B1y = 0.5*(faceave(1,0,FACEDATA_B) + faceave(1,1,FACEDATA_B));
-            B1z = 0.5*(faceave(2,0,FACEDATA_B) + faceave(2,1,FACEDATA_B));
+        // This is B after the propagations in this timestep
+        B1x = 0.5*(faceave(0,0,FACEDATA_B) + faceave(0,1,FACEDATA_B));
+        B1y = 0.5*(faceave(1,0,FACEDATA_B) + faceave(1,1,FACEDATA_B));
+        B1z = 0.5*(faceave(2,0,FACEDATA_B) + faceave(2,1,FACEDATA_B));
 #else
-            B1x = celldata[CELLDATA_B][0];
-            B1y = celldata[CELLDATA_B][1];
-            B1z = celldata[CELLDATA_B][2];
+        B1x = celldata[CELLDATA_B][0];
+        B1y = celldata[CELLDATA_B][1];
+        B1z = celldata[CELLDATA_B][2];
 #endif
-            // Average velocity among the selected populations in the cell.
-            // The volume weighting (accumulation) is not used!
-            plist.calc_avev(vx,vy,vz,popId);
-        } else if(filetype == 1) { // Average
-            // Use proton mass here => rho is generally incorrect, but
-            // hcvis can display correct number density for temporal
-            // average files. Accumulated value!
-            if (Params::bg_in_avehcfile==false) {
-                rho = Params::m_p * ave_nc;
-            } else {
-                rho = Params::m_p * (ave_nc + rho_q_bg/Params::e);
-            }
-            // This is correct temporal average number density. It has little
-            // use, since temporal average files cannot have correct U. To get
-            // correct U, something like CELLDATA_AVE_VQ, CELLDATA_AVE_T etc.
-            // would be needed. Accumulated value!
-            n = ave_nc;
-            // B is correct in temporal average hc-file
-            B1x = 0.5*(faceave(0,0,FACEDATA_AVEB) + faceave(0,1,FACEDATA_AVEB));
-            B1y = 0.5*(faceave(1,0,FACEDATA_AVEB) + faceave(1,1,FACEDATA_AVEB));
-            B1z = 0.5*(faceave(2,0,FACEDATA_AVEB) + faceave(2,1,FACEDATA_AVEB));
-            // At least n (remember to use proton mass for mp in hcvis)
-            // and B come out correct in hcvis when displaying temporal
-            // average hc-files.
-            vx = celldata[CELLDATA_Ji][0]/rho_q;
-            vy = celldata[CELLDATA_Ji][1]/rho_q;
-            vz = celldata[CELLDATA_Ji][2]/rho_q;
-        } else if(filetype == 2) { // Plasma
-            // Total mass density in the cell.
-            // The volume weighting (accumulation) is not used!
-            rho = plist.calc_mass()/dV;
-            // Total particle number density in the cell.
-            // The volume weighting (accumulation) is not used!
-            // Accumulated nc could be used but then rho would
-            // not consistent with this value.
-            n = plist.calc_weight()/dV;
+        // Average velocity among the selected populations in the cell.
+        // The volume weighting (accumulation) is not used!
+        plist.calc_avev(vx,vy,vz,popId);
+    } else if(filetype == 1) { // Average
+        // Use proton mass here => rho is generally incorrect, but
+        // hcvis can display correct number density for temporal
+        // average files. Accumulated value!
+        if (Params::bg_in_avehcfile==false) {
+            rho = Params::m_p * ave_nc;
+        } else {
+            rho = Params::m_p * (ave_nc + rho_q_bg/Params::e);
+        }
+        // This is correct temporal average number density. It has little
+        // use, since temporal average files cannot have correct U. To get
+        // correct U, something like CELLDATA_AVE_VQ, CELLDATA_AVE_T etc.
+        // would be needed. Accumulated value!
+        n = ave_nc;
+        // B is correct in temporal average hc-file
+        B1x = 0.5*(faceave(0,0,FACEDATA_AVEB) + faceave(0,1,FACEDATA_AVEB));
+        B1y = 0.5*(faceave(1,0,FACEDATA_AVEB) + faceave(1,1,FACEDATA_AVEB));
+        B1z = 0.5*(faceave(2,0,FACEDATA_AVEB) + faceave(2,1,FACEDATA_AVEB));
+        // At least n (remember to use proton mass for mp in hcvis)
+        // and B come out correct in hcvis when displaying temporal
+        // average hc-files.
+        vx = celldata[CELLDATA_Ji][0]/rho_q;
+        vy = celldata[CELLDATA_Ji][1]/rho_q;
+        vz = celldata[CELLDATA_Ji][2]/rho_q;
+    } else if(filetype == 2) { // Plasma
+        // Total mass density in the cell.
+        // The volume weighting (accumulation) is not used!
+        rho = plist.calc_mass()/dV;
+        // Total particle number density in the cell.
+        // The volume weighting (accumulation) is not used!
+        // Accumulated nc could be used but then rho would
+        // not consistent with this value.
+        n = plist.calc_weight()/dV;
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-            B1x = 0.5*(faceave(0,0,FACEDATA_B) + faceave(0,1,FACEDATA_B));
-            B1y = 0.5*(faceave(1,0,FACEDATA_B) + faceave(1,1,FACEDATA_B));
-            B1z = 0.5*(faceave(2,0,FACEDATA_B) + faceave(2,1,FACEDATA_B));
+        B1x = 0.5*(faceave(0,0,FACEDATA_B) + faceave(0,1,FACEDATA_B));
+        B1y = 0.5*(faceave(1,0,FACEDATA_B) + faceave(1,1,FACEDATA_B));
+        B1z = 0.5*(faceave(2,0,FACEDATA_B) + faceave(2,1,FACEDATA_B));
 #else
-            gridreal dS0[3] = {sph_dS[0], sph_dS[1], sph_dS[2]};
-            gridreal dS1[3] = {sph_dS_next[0], sph_dS_next[1], sph_dS_next[2]};
-            gridreal dSc[3] = {sph_dS_centroid[0], sph_dS_centroid[1], sph_dS_centroid[2]};
-            B1x = 0.5*(faceave(0,0,FACEDATA_B)*dS0[0] + faceave(0,1,FACEDATA_B)*dS1[0])/dSc[0];
-            B1y = 0.5*(faceave(1,0,FACEDATA_B)*dS0[1] + faceave(1,1,FACEDATA_B)*dS1[1])/dSc[1];
-            B1z = 0.5*(faceave(2,0,FACEDATA_B)*dS0[2] + faceave(2,1,FACEDATA_B)*dS1[2])/dSc[2];
+        gridreal dS0[3] = {sph_metric->dS[0], sph_metric->dS[1], sph_metric->dS[2]};
+        gridreal dS1[3] = {sph_metric->dS_next[0], sph_metric->dS_next[1], sph_metric->dS_next[2]};
+        gridreal dSc[3] = {sph_metric->dS_centroid[0], sph_metric->dS_centroid[1], sph_metric->dS_centroid[2]};
+        B1x = 0.5*(faceave(0,0,FACEDATA_B)*dS0[0] + faceave(0,1,FACEDATA_B)*dS1[0])/dSc[0];
+        B1y = 0.5*(faceave(1,0,FACEDATA_B)*dS0[1] + faceave(1,1,FACEDATA_B)*dS1[1])/dSc[1];
+        B1z = 0.5*(faceave(2,0,FACEDATA_B)*dS0[2] + faceave(2,1,FACEDATA_B)*dS1[2])/dSc[2];
 #endif
-            // Average (MHD single fluid) velocity in the cell.
-            // The volume weighting (accumulation) is not used!
-            plist.calc_U(vx,vy,vz);
-        }
+        // Average (MHD single fluid) velocity in the cell.
+        // The volume weighting (accumulation) is not used!
+        plist.calc_U(vx,vy,vz);
+    }
 #ifdef SAVE_POPULATION_AVERAGES
-        else if(filetype == 3) { // Average population(s)
-            for(unsigned int i=0; i< popId.size(); i++) {
-                int j = popId[i];
-                n += pop_ave_n[j];
-                vx += pop_ave_n[j]*pop_ave_vx[j];
-                vy += pop_ave_n[j]*pop_ave_vy[j];
-                vz += pop_ave_n[j]*pop_ave_vz[j];
-            }
-            real inv_n=0;
-            if(n>0) {
-                inv_n = 1.0/n;
-            }
-            vx *= inv_n;
-            vy *= inv_n;
-            vz *= inv_n;
-            rho = n*Params::pops[popId[0]]->m;
-            B1x = 0.5*(faceave(0,0,FACEDATA_AVEB) + faceave(0,1,FACEDATA_AVEB));
-            B1y = 0.5*(faceave(1,0,FACEDATA_AVEB) + faceave(1,1,FACEDATA_AVEB));
-            B1z = 0.5*(faceave(2,0,FACEDATA_AVEB) + faceave(2,1,FACEDATA_AVEB));
-        }
+    else if(filetype == 3) { // Average population(s)
+        for(unsigned int i=0; i< popId.size(); i++) {
+            int j = popId[i];
+            n += pop_ave_n(j);
+            vx += pop_ave_n(j)*pop_ave_vx(j);
+            vy += pop_ave_n(j)*pop_ave_vy(j);
+            vz += pop_ave_n(j)*pop_ave_vz(j);
+        }
+        real inv_n=0;
+        if(n>0) {
+            inv_n = 1.0/n;
+        }
+        vx *= inv_n;
+        vy *= inv_n;
+        vz *= inv_n;
+        rho = n*Params::pops[popId[0]]->m;
+        B1x = 0.5*(faceave(0,0,FACEDATA_AVEB) + faceave(0,1,FACEDATA_AVEB));
+        B1y = 0.5*(faceave(1,0,FACEDATA_AVEB) + faceave(1,1,FACEDATA_AVEB));
+        B1z = 0.5*(faceave(2,0,FACEDATA_AVEB) + faceave(2,1,FACEDATA_AVEB));
+    }
 #endif
-        else {
-            ERRORMSG("internal error");
-        }
-        // Particle momentum density
-        rhovx = rho*vx;
-        rhovy = rho*vy;
-        rhovz = rho*vz;
-        const real T = 0.5*plist.calc_avemv2(vx,vy,vz,popId);
-        const real P = n*T;
-        // Total energy without constant magnetic field
-        U1 = P/(Params::gamma-1) + 0.5*rho*( sqr(vx) + sqr(vy) + sqr(vz) ) + ( sqr(B1x) + sqr(B1y) + sqr(B1z) )/(2*Params::mu_0);
-        // Constant magnetic field
-        real B0[3] = {0.0, 0.0, 0.0};
-        fastreal r[3] = {centroid[0], centroid[1], centroid[2]};
-        addConstantMagneticField(r, B0);
-        B0x = B0[0];
-        B0y = B0[1];
-        B0z = B0[2];
-        if (hcFileAsciiFormat == false) {
-            const int n = 11;
-            float xf[n];
-            xf[0] = rho;
-            xf[1] = rhovx;
-            xf[2] = rhovy;
-            xf[3] = rhovz;
-            xf[4] = U1;
-            xf[5] = B1x;
-            xf[6] = B1y;
-            xf[7] = B1z;
-            xf[8] = B0x;
-            xf[9] = B0y;
-            xf[10] = B0z;
-            ByteConversion(sizeof(float),(unsigned char*)xf,n);
-            WriteFloatsToFile(o,xf,n);
-        } else {
-            o << rho << ' '
-              << rho*vx << ' '
-              << rho*vy << ' '
-              << rho*vz << ' '
-              << U1 << ' '
-              << B1x << ' '
-              << B1y << ' '
-              << B1z << ' '
-              << B0x << ' '
-              << B0y << ' '
-              << B0z << ' ';
-        }
-        if (hcFileAsciiFormat == true) {
-            o << '\n';
-        }
+    else {
+        ERRORMSG("internal error");
+    }
+    // Particle momentum density
+    rhovx = rho*vx;
+    rhovy = rho*vy;
+    rhovz = rho*vz;
+    const real T = 0.5*plist.calc_avemv2(vx,vy,vz,popId);
+    const real P = n*T;
+    // Total energy without constant magnetic field
+    U1 = P/(Params::gamma-1) + 0.5*rho*( sqr(vx) + sqr(vy) + sqr(vz) ) + ( sqr(B1x) + sqr(B1y) + sqr(B1z) )/(2*Params::mu_0);
+    // Constant magnetic field
+    real B0[3] = {0.0, 0.0, 0.0};
+    fastreal r[3] = {centroid[0], centroid[1], centroid[2]};
+    addConstantMagneticField(r, B0);
+    B0x = B0[0];
+    B0y = B0[1];
+    B0z = B0[2];
+    v[0] = rho;
+    v[1] = rhovx;
+    v[2] = rhovy;
+    v[3] = rhovz;
+    v[4] = U1;
+    v[5] = B1x;
+    v[6] = B1y;
+    v[7] = B1z;
+    v[8] = B0x;
+    v[9] = B0y;
+    v[10] = B0z;
+}
+
+//! Write the cell structure of the children of a cell (recursive)
+void Tgrid::Tcell::writeTopology_children_recursive(ostream& o) const
+{
+    if (haschildren) {
+        int dirx,diry,dirz;
+        for (dirz=0; dirz<2; dirz++) for (diry=0; diry<2; diry++) for (dirx=0; dirx<2; dirx++)
+                    child[dirx][diry][dirz]->writeTopology(o);
+        for (dirz=0; dirz<2; dirz++) for (diry=0; diry<2; diry++) for (dirx=0; dirx<2; dirx++)
+                    child[dirx][diry][dirz]->writeTopology_children_recursive(o);
+    }
+}
+
+//! Write the cell structure of a cell, leaf cells as zero cells ('Z') without data
+void Tgrid::Tcell::writeTopology(ostream& o) const
+{
+    if (haschildren) {
+        o.put('N');
+        WriteInt(o,parent ? parent->running_index : -1);
+        WriteInt(o,child[0][0][0]->running_index);
+    } else {
+        o.put('Z');
+        WriteInt(o,parent ? parent->running_index : -1);
+    }
+}
+
+//! Collect the leaf cells of the children of a cell in the hc-file order (recursive)
+void Tgrid::Tcell::leaves_recursive(vector<const Tcell*>& leaves) const
+{
+    if (haschildren) {
+        int dirx,diry,dirz;
+        for (dirz=0; dirz<2; dirz++) for (diry=0; diry<2; diry++) for (dirx=0; dirx<2; dirx++)
+                    if (!child[dirx][diry][dirz]->haschildren) leaves.push_back(child[dirx][diry][dirz]);
+        for (dirz=0; dirz<2; dirz++) for (diry=0; diry<2; diry++) for (dirx=0; dirx<2; dirx++)
+                    child[dirx][diry][dirz]->leaves_recursive(leaves);
     }
 }
 
@@ -3226,7 +4192,7 @@ void Tgrid::Tcell::writeSPECTRA(ostream& o,vector<int> popId) const
             for(int i=0; i<n; i++) {
                 xf[i] = 0.0;
                 for(unsigned int j=0; j<popId.size(); ++j) {
-                    xf[i] += spectra[popId[j]][i];
+                    xf[i] += spectra(popId[j])[i];
                 }
             }
             ByteConversion(sizeof(float),(unsigned char*)xf,n);
@@ -3236,7 +4202,7 @@ void Tgrid::Tcell::writeSPECTRA(ostream& o,vector<int> popId) const
             for(int i=0; i<n; i++) {
                 real sum = 0.0;
                 for(unsigned int j=0; j<popId.size(); ++j) {
-                    sum += spectra[popId[j]][i];
+                    sum += spectra(popId[j])[i];
                 }
                 o << sum << ' ';
             }
@@ -3356,15 +4322,9 @@ void Tgrid::Tcell::particles_write_recursive()
 
 #endif
 
-//! Write population and plasma hc-file
-bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> popId)
+//! Parse hc-file type (0 = populations, 1 = average, 2 = plasma, 3 = average populations) or return -1
+static int hcFileType(const string& hctype, vector<int>& popId)
 {
-    if(ascbin.compare("binary") == 0) {
-        hcFileAsciiFormat = false;
-    } else if(ascbin.compare("ascii") == 0) {
-        hcFileAsciiFormat = true;
-    }
-    // File types: 0 = populations, 1 = average, 2 = plasma
     int filetype;
     if(hctype.compare("populations") == 0) {
         filetype = 0;
@@ -3380,16 +4340,15 @@ bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> p
 #endif
     else {
         ERRORMSG("hc-file type not recognized");
-        filetype = - 1;
-        return false;
+        return -1;
     }
     if(filetype == 0 && popId.size() <= 0) {
         ERRORMSG("no population ids");
-        return false;
+        return -1;
     }
     if(filetype == 1 && Params::averaging == false) {
         ERRORMSG("averaging turned off");
-        return false;
+        return -1;
     }
     if(filetype == 1 || filetype == 2) {
         popId.clear();
@@ -3397,27 +4356,15 @@ bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> p
 #ifdef SAVE_POPULATION_AVERAGES
     if(filetype == 3 && Params::averaging == 0) {
         ERRORMSG("no averaging used");
-        return false;
+        return -1;
     }
 #endif
-    const int ncells = Ncells_with_ghosts();
-    ofstream o(fn);
-    if (!o.good()) {
-        return false;
-    }
-    const int oldprec = o.precision();
-    o.precision(16);
-    int c;
-    const int Nbase = nx*ny*nz;
-    // Enumerate cells
-    for (c=0; c<Nbase; c++) {
-        cells[c]->running_index = c;
-    }
-    cell_running_index = Nbase;
-    for (c=0; c<Nbase; c++) {
-        if (cells[c]->haschildren) cells[c]->enum_children_recursive();
-    }
-    n_int_bytes = NumberOfBytes(ncells);
+    return filetype;
+}
+
+//! Write the comment lines describing the contents of a population or plasma hc-file
+static bool hcwrite_MHD_comments(ostream& o,const char *fn,const int filetype,const vector<int>& popId)
+{
     o << "# " << Params::codeVersion << "\n";
     o << "# filename: " << fn << "\n";
     o << "# t = " << Params::t << "\n";
@@ -3534,21 +4481,108 @@ bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> p
         ERRORMSG("internal error");
         return false;
     }
+    return true;
+}
+
+//! Enumerate cells in the hc-file order: base grid cells first, then children (recursive)
+void Tgrid::hc_enumerate()
+{
+    int c;
+    const int Nbase = nx*ny*nz;
+    for (c=0; c<Nbase; c++) {
+        cells[c]->running_index = c;
+    }
+    cell_running_index = Nbase;
+    for (c=0; c<Nbase; c++) {
+        if (cells[c]->haschildren) cells[c]->enum_children_recursive();
+    }
+}
+
+//! Write the base grid lines of an hc-file header
+void Tgrid::hcwrite_geometry(ostream& o) const
+{
+    o << "n1 = " << nx << "\n";
+    o << "n2 = " << ny << "\n";
+    o << "n3 = " << nz << "\n";
+    o << "xmin0 = " << x_1+bgdx << "\n";  //real grid limits - not ghost cells
+    o << "xmin1 = " << y_1+bgdx << "\n";
+    o << "xmin2 = " << z_1+bgdx << "\n";
+    o << "xmax0 = " << x_1-bgdx + nx*bgdx << "\n";  // ditto
+    o << "xmax1 = " << y_1-bgdx + ny*bgdx << "\n";
+    o << "xmax2 = " << z_1-bgdx + nz*bgdx << "\n";
+    o << "dx = " << bgdx << "\n";
+}
+
+//! Write the cell info records of an hc-file
+void Tgrid::hcwrite_cellinfo(ostream& o) const
+{
+    int i,j,k,c;
+    ForAll(i,j,k) {
+        // celltype=0: interior, 1: ghost, 2:dead
+        int celltype = (i==0 || i==nx-1) + (j==0 || j==ny-1) + (k==0 || k==nz-1);
+        if (celltype > 2) celltype = 2;
+        c = flatindex(i,j,k);
+        if (hcFileAsciiFormat == false) {
+            o.put(EncodeCellInfo(celltype));
+            o.put((unsigned char)'\0');
+        } else {
+            o << celltype << " 1 1 0\n";
+        }
+    }
+    ForAll(i,j,k) {
+        c = flatindex(i,j,k);
+        if (cells[c]->haschildren) {
+            const int n = cells[c]->Ncells_recursive() - 1;
+            int cnt;
+            if (hcFileAsciiFormat == false) {
+                const unsigned char ch = EncodeCellInfo(0);
+                for (cnt=0; cnt<n; cnt++) {
+                    o.put(ch);
+                    o.put((unsigned char)'\0');
+                }
+            } else {
+                for (cnt=0; cnt<n; cnt++) o << "0 1 1 0\n";
+            }
+        }
+    }
+}
+
+//! Write population and plasma hc-file
+bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> popId)
+{
+    if(ascbin.compare("binary") == 0) {
+        hcFileAsciiFormat = false;
+    } else if(ascbin.compare("ascii") == 0) {
+        hcFileAsciiFormat = true;
+    }
+    // File types: 0 = populations, 1 = average, 2 = plasma, 3 = average populations
+    const int filetype = hcFileType(hctype,popId);
+    if (filetype < 0) {
+        return false;
+    }
+    if(ascbin.compare("series") == 0) {
+        return hcwrite_MHD_series(fn,filetype,popId);
+    }
+    const int ncells = Ncells_with_ghosts();
+    ofstream o(fn);
+    if (!o.good()) {
+        return false;
+    }
+    const int oldprec = o.precision();
+    o.precision(16);
+    int c;
+    const int Nbase = nx*ny*nz;
+    hc_enumerate();
+    n_int_bytes = NumberOfBytes(ncells);
+    if (hcwrite_MHD_comments(o,fn,filetype,popId) == false) {
+        return false;
+    }
     o << "dim = 3\n";
     o << "ncd = 11\n";
     o << "nsd = 0\n";
     o << "maxnc = " << ncells << "\n";
     o << "realformat = " << (hcFileAsciiFormat ? "ascii" : "float") << "\n";
-    o << "n1 = " << nx << "\n";
-    o << "n2 = " << ny << "\n";
-    o << "n3 = " << nz << "\n";
-    o << "xmin0 = " << x_1+bgdx << "\n";  //real grid limits - not ghost cells
-    o << "xmin1 = " << y_1+bgdx << "\n";
-    o << "xmin2 = " << z_1+bgdx << "\n";
-    o << "xmax0 = " << x_1-bgdx + nx*bgdx << "\n";  // ditto
-    o << "xmax1 = " << y_1-bgdx + ny*bgdx << "\n";
-    o << "xmax2 = " << z_1-bgdx + nz*bgdx << "\n";
-    o << "dx = " << bgdx << "\n";
+    hcwrite_geometry(o);
     o << "type = hc\n";
     o << "ncells = " << ncells << "\n";
     o << "nablocks = 0\n";
@@ -3573,39 +4607,163 @@ bool Tgrid::hcwrite_MHD(const char *fn,string ascbin,string hctype,vector<int> p
     for (c=0; c<Nbase; c++) {
         if (cells[c]->haschildren) cells[c]->writeMHD_children_recursive(o,filetype,popId);
     }
-    int i,j,k;
-    ForAll(i,j,k) {
-        // celltype=0: interior, 1: ghost, 2:dead
-        int celltype = (i==0 || i==nx-1) + (j==0 || j==ny-1) + (k==0 || k==nz-1);
-        if (celltype > 2) celltype = 2;
-        c = flatindex(i,j,k);
-        if (hcFileAsciiFormat == false) {
-            o.put(EncodeCellInfo(celltype));
-            o.put((unsigned char)'\0');
-        } else {
-            o << celltype << " 1 1 0\n";
+    hcwrite_cellinfo(o);
+    if (o.good()) {
+        mainlog << "Tgrid::hcwrite_MHD: Wrote \"" << fn << "\"\n";
+    } else {
+        errorlog << "*** Tgrid::hcwrite_MHD: Could not write \"" << fn << "\" completely - disk full?\n";
+    }
+    return o.good();
+}
+
+/** \brief Write the topology file of hc time series snapshots
+ *
+ * The topology file is an ordinary hc-file, whose leaf cells are zero
+ * cells ('Z') without data. The snapshots written by hcwrite_MHD_series
+ * contain only the data of the leaf cells and refer to this file.
+ */
+bool Tgrid::hcwrite_topology(const char *fn)
+{
+    const int ncells = Ncells_with_ghosts();
+    ofstream o(fn);
+    if (!o.good()) {
+        return false;
+    }
+    const int oldprec = o.precision();
+    o.precision(16);
+    int c;
+    const int Nbase = nx*ny*nz;
+    hc_enumerate();
+    n_int_bytes = NumberOfBytes(ncells);
+    hcFileAsciiFormat = false;
+    o << "# " << Params::codeVersion << "\n";
+    o << "# filename: " << fn << "\n";
+    o << "# t = " << Params::t << "\n";
+    o << "# TOPOLOGY FILE OF HC TIME SERIES SNAPSHOTS\n";
+    o << "dim = 3\n";
+    o << "ncd = 11\n";
+    o << "nsd = 0\n";
+    o << "maxnc = " << ncells << "\n";
+    o << "realformat = float\n";
+    hcwrite_geometry(o);
+    o << "type = hc\n";
+    o << "ncells = " << ncells << "\n";
+    o << "nablocks = 0\n";
+    o << "bytes_per_int = " << n_int_bytes << "\n";
+    o << "freelist1 = -1234567\n";
+    o << "freelist2 = -1234567\n";
+    o << "eoh\n";
+    o.precision(oldprec);
+    for (c=0; c<Nbase; c++) {
+        cells[c]->writeTopology(o);
+    }
+    for (c=0; c<Nbase; c++) {
+        if (cells[c]->haschildren) cells[c]->writeTopology_children_recursive(o);
+    }
+    hcwrite_cellinfo(o);
+    // Leaf cells in the same order as the 'Z' records above
+    hcseries_leaves.clear();
+    for (c=0; c<Nbase; c++) {
+        if (!cells[c]->haschildren) hcseries_leaves.push_back(cells[c]);
+    }
+    for (c=0; c<Nbase; c++) {
+        if (cells[c]->haschildren) cells[c]->leaves_recursive(hcseries_leaves);
+    }
+    if (o.good()) {
+        mainlog << "Tgrid::hcwrite_topology: Wrote \"" << fn << "\"\n";
+    } else {
+        errorlog << "*** Tgrid::hcwrite_topology: Could not write \"" << fn << "\" completely - disk full?\n";
+    }
+    return o.good();
+}
+
+/** \brief Write a population or plasma hc time series snapshot (saveHC = 3)
+ *
+ * The topology file is written when the grid has changed since the
+ * previous snapshot. A snapshot contains, after the header, the eleven
+ * quantities of hcwrite_MHD as contiguous big-endian float arrays over the
+ * leaf cells in the order of the topology file. If
+ * Params::hcKeyframeInterval > 1, the arrays between key frames are XORed
+ * with the previous snapshot of the same stream (delta = 1), which leaves
+ * mostly zero bytes for slowly changing quantities such as B0.
+ */
+bool Tgrid::hcwrite_MHD_series(const char *fn,const int filetype,const vector<int>& popId)
+{
+    if (hcseries_topology.empty() || hcseries_grid_version != grid_version) {
+        const string topofn = "topology_hybstate_" + Params::getSimuTimeStr() + ".hc";
+        if (hcwrite_topology(topofn.c_str()) == false) {
+            hcseries_topology.clear();
+            return false;
         }
+        hcseries_topology = topofn;
+        hcseries_grid_version = grid_version;
+        hcseries_streams.clear();
     }
-    ForAll(i,j,k) {
-        c = flatindex(i,j,k);
-        if (cells[c]->haschildren) {
-            const int n = cells[c]->Ncells_recursive() - 1;
-            int cnt;
-            if (hcFileAsciiFormat == false) {
-                const unsigned char ch = EncodeCellInfo(0);
-                for (cnt=0; cnt<n; cnt++) {
-                    o.put(ch);
-                    o.put((unsigned char)'\0');
-                }
-            } else {
-                for (cnt=0; cnt<n; cnt++) o << "0 1 1 0\n";
+    // Streams are identified by the file type and the population ids
+    ostringstream key;
+    key << filetype;
+    for (unsigned int i = 0; i < popId.size(); i++) {
+        key << ' ' << popId[i];
+    }
+    THCSeriesStream& stream = hcseries_streams[key.str()];
+    const bool delta = (Params::hcKeyframeInterval > 1 && stream.nsaved % Params::hcKeyframeInterval != 0);
+    const int nleaves = hcseries_leaves.size();
+    const int n = 11;
+    vector<float> data(n*nleaves);
+    vector<int> ids(popId);
+    real v[n];
+    for (int k = 0; k < nleaves; k++) {
+        hcseries_leaves[k]->calcMHD(filetype,ids,v);
+        for (int a = 0; a < n; a++) {
+            data[a*nleaves + k] = v[a];
+        }
+    }
+    unsigned char *bytes = (unsigned char*)&data[0];
+    const size_t nbytes = data.size()*sizeof(float);
+    ByteConversion(sizeof(float),bytes,data.size());
+    ofstream o(fn);
+    if (!o.good() || nleaves <= 0) {
+        return false;
+    }
+    const int oldprec = o.precision();
+    o.precision(16);
+    if (hcwrite_MHD_comments(o,fn,filetype,popId) == false) {
+        return false;
+    }
+    o << "dim = 3\n";
+    o << "ncd = 11\n";
+    o << "nsd = 0\n";
+    o << "realformat = float\n";
+    o << "type = hcseries\n";
+    o << "topology = " << hcseries_topology << "\n";
+    o << "ncells = " << Ncells_with_ghosts() << "\n";
+    o << "nleaves = " << nleaves << "\n";
+    o << "delta = " << (delta ? 1 : 0) << "\n";
+    if (delta) {
+        o << "reference = " << stream.lastfile << "\n";
+    }
+    o << "eoh\n";
+    o.precision(oldprec);
+    if (Params::hcKeyframeInterval > 1) {
+        if (delta) {
+            vector<unsigned char> xored(bytes,bytes + nbytes);
+            for (size_t b = 0; b < nbytes; b++) {
+                xored[b] ^= stream.lastdata[b];
             }
+            o.write((const char*)&xored[0],nbytes);
+        } else {
+            o.write((const char*)bytes,nbytes);
         }
+        stream.lastdata.assign(bytes,bytes + nbytes);
+    } else {
+        o.write((const char*)bytes,nbytes);
     }
+    stream.lastfile = fn;
+    stream.nsaved++;
     if (o.good()) {
-        mainlog << "Tgrid::hcwrite_MHD: Wrote \"" << fn << "\"\n";
+        mainlog << "Tgrid::hcwrite_MHD_series: Wrote \"" << fn << "\"\n";
     } else {
-        errorlog << "*** Tgrid::hcwrite_MHD: Could not write \"" << fn << "\" completely - disk full?\n";
+        errorlog << "*** Tgrid::hcwrite_MHD_series: Could not write \"" << fn << "\" completely - disk full?\n";
     }
     return o.good();
 }
@@ -4155,6 +5313,142 @@ void Tgrid::addparticle(shortreal x, shortreal y, shortreal z,
     n_particles++;
 }
 
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+
+//! Add particle into a known leaf cell without findcell
+void Tgrid::addparticle(TCellPtr c, shortreal x, shortreal y, shortreal z,
+                        shortreal vx, shortreal vy, shortreal vz,
+                        shortreal w, int popid, bool inject)
+{
+    c->plist.add(x,y,z,vx,vy,vz,w,popid);
+#ifndef NO_DIAGNOSTICS
+    if(inject==true) {
+        Params::diag.pCounter[popid]->increaseInjectCounters(vx,vy,vz,w);
+    }
+#endif
+    n_particles++;
+}
+
+/** \brief Collect the leaf cells crossed by an inflow plane
+ *
+ * The layer is rebuilt only if the plane or the rectangle has changed or
+ * the grid has been refined or recoarsened after the previous call. The
+ * cells are chosen with the same comparisons as in findcell, so a point
+ * on the plane belongs to the cell findcell would return.
+ */
+void Tgrid::update_inflow_layer(TInflowLayer& layer, int dim, gridreal coord, const gridreal lo[2], const gridreal hi[2])
+{
+    if (layer.grid_version == grid_version && layer.dim == dim && layer.coord == coord &&
+            layer.lo[0] == lo[0] && layer.lo[1] == lo[1] && layer.hi[0] == hi[0] && layer.hi[1] == hi[1]) {
+        return;
+    }
+    layer.dim = dim;
+    layer.coord = coord;
+    layer.lo[0] = lo[0];
+    layer.lo[1] = lo[1];
+    layer.hi[0] = hi[0];
+    layer.hi[1] = hi[1];
+    layer.grid_version = grid_version;
+    layer.cells.clear();
+    layer.cumarea.clear();
+    const gridreal low[3] = {x_1, y_1, z_1};
+    const int n[3] = {nx, ny, nz};
+    const int d1 = (dim+1)%3, d2 = (dim+2)%3;
+    int ilo[3], ihi[3];
+    ilo[dim] = ihi[dim] = int((coord - low[dim])*invbgdx);
+    ilo[d1] = int((lo[0] - low[d1])*invbgdx);
+    ihi[d1] = int((hi[0] - low[d1])*invbgdx);
+    ilo[d2] = int((lo[1] - low[d2])*invbgdx);
+    ihi[d2] = int((hi[1] - low[d2])*invbgdx);
+    for (int d=0; d<3; d++) {
+        ilo[d] = max2(ilo[d],1);
+        ihi[d] = min2(ihi[d],n[d]-2);
+    }
+    int i,j,k;
+    for (i=ilo[0]; i<=ihi[0]; i++) for (j=ilo[1]; j<=ihi[1]; j++) for (k=ilo[2]; k<=ihi[2]; k++) {
+                build_inflow_layer_recursive(layer,cells[flatindex(i,j,k)]);
+            }
+    layer.cumarea.resize(layer.cells.size()+1);
+    layer.cumarea[0] = 0;
+    for (unsigned int c=0; c<layer.cells.size(); c++) {
+        layer.cumarea[c+1] = layer.cumarea[c] + real(layer.cells[c].size[0])*layer.cells[c].size[1];
+    }
+    if (layer.cells.empty()) {
+        WARNINGMSG("inflow plane r[" << dim << "] = " << coord << " does not cross the grid");
+    }
+}
+
+//! Collect the leaf cells crossed by an inflow plane (recursive)
+void Tgrid::build_inflow_layer_recursive(TInflowLayer& layer, Tcell *c)
+{
+    const int dim = layer.dim;
+    const int d1 = (dim+1)%3, d2 = (dim+2)%3;
+    if (c->haschildren) {
+        int ch[3];
+        ch[dim] = (layer.coord > c->centroid[dim]);
+        for (ch[d1]=0; ch[d1]<2; ch[d1]++) for (ch[d2]=0; ch[d2]<2; ch[d2]++) {
+                build_inflow_layer_recursive(layer,c->child[ch[0]][ch[1]][ch[2]]);
+            }
+        return;
+    }
+    const gridreal halfsize = 0.5*c->size;
+    TInflowCell ic;
+    ic.cell = c;
+    ic.lo[0] = max2(c->centroid[d1] - halfsize, layer.lo[0]);
+    ic.lo[1] = max2(c->centroid[d2] - halfsize, layer.lo[1]);
+    ic.size[0] = min2(c->centroid[d1] + halfsize, layer.hi[0]) - ic.lo[0];
+    ic.size[1] = min2(c->centroid[d2] + halfsize, layer.hi[1]) - ic.lo[1];
+    if (ic.size[0] > 0 && ic.size[1] > 0) {
+        layer.cells.push_back(ic);
+    }
+}
+
+/** \brief Draw n uniformly distributed points on an inflow layer
+ *
+ * The points are drawn over the whole rectangle of the layer. Points
+ * outside the grid get a null cell. Sorted uniform variates are generated
+ * from exponential spacings, so that the cells are found in one sweep.
+ */
+void Tgrid::sample_inflow_layer(const TInflowLayer& layer, int n, std::vector<TInflowPoint>& points) const
+{
+    points.resize(max2(n,0));
+    if (n <= 0) {
+        return;
+    }
+    const int d1 = (layer.dim+1)%3, d2 = (layer.dim+2)%3;
+    const real A = real(layer.hi[0] - layer.lo[0])*(layer.hi[1] - layer.lo[1]);
+    const real Agrid = layer.cumarea.empty() ? 0 : layer.cumarea.back();
+    // Cumulative sums of n+1 exponential variates
+    std::vector<real> S(n+1);
+    real sum = 0;
+    for (int i=0; i<=n; i++) {
+        sum-= log(1.0 - uniformrnd());
+        S[i] = sum;
+    }
+    const real scale = A/sum;
+    unsigned int c = 0;
+    for (int i=0; i<n; i++) {
+        TInflowPoint& p = points[i];
+        const real a = S[i]*scale;
+        p.r[layer.dim] = layer.coord;
+        if (a >= Agrid) {
+            // Outside the grid
+            p.cell = 0;
+            p.r[d1] = layer.lo[0];
+            p.r[d2] = layer.lo[1];
+            continue;
+        }
+        while (layer.cumarea[c+1] <= a) c++;
+        const TInflowCell& ic = layer.cells[c];
+        const real t = (a - layer.cumarea[c])/(layer.cumarea[c+1] - layer.cumarea[c]);
+        p.cell = ic.cell;
+        p.r[d1] = ic.lo[0] + t*ic.size[0];
+        p.r[d2] = ic.lo[1] + uniformrnd()*ic.size[1];
+    }
+}
+
+#endif
+
 //! Find the particle's list
 TParticleList *Tgrid::find_plist(const TLinkedParticle& p)
 {
@@ -4201,6 +5495,48 @@ int Tgrid::particle_pass(bool (*op)(TLinkedParticle& p, ParticlePassArgs a), boo
     return ndel;
 }
 
+//! Count leaf cells and macro particles (recursive)
+void Tgrid::Tcell::count_recursive(int& nleaves, int& nparticles) const
+{
+    if (haschildren) {
+        int ch;
+        for (ch=0; ch<8; ch++) child[0][0][ch]->count_recursive(nleaves,nparticles);
+    } else {
+        nleaves++;
+        nparticles+= plist.Nparticles();
+    }
+}
+
+/** \brief Pass all (interior=false) or interior root cells to the task
+ *
+ * With several threads the root cells are cut into blocks by cost, which is
+ * the number of leaf cells of the root cell plus, for particle passes,
+ * particleCost per macro particle.
+ */
+void Tgrid::block_pass(TCellBlockTask& task, bool interior, bool particles)
+{
+    //! Cost of a macro particle relative to a leaf cell without particles
+    const real particleCost = 10.0;
+    vector<int>& bcells = block_cells[interior ? 1 : 0];
+    if (bcells.empty()) {
+        int i,j,k;
+        if (interior) {
+            ForInterior(i,j,k) bcells.push_back(flatindex(i,j,k));
+        } else {
+            ForAll(i,j,k) bcells.push_back(flatindex(i,j,k));
+        }
+    }
+    if (scheduler.getThreads() > 1) {
+        block_cost.resize(bcells.size());
+        for (unsigned int n = 0; n < bcells.size(); ++n) {
+            int nleaves = 0, nparticles = 0;
+            cells[bcells[n]]->count_recursive(nleaves,nparticles);
+            block_cost[n] = nleaves + (particles ? particleCost*nparticles : 0);
+        }
+    }
+    scheduler.run(bcells,block_cost,task);
+}
+
 //! Return the number of macro particles (recursive)
 int Tgrid::Tcell::Nparticles_recursive() const
 {
@@ -4256,8 +5592,8 @@ void Tgrid::Tcell::split_and_join_recursive(int& nsplit, int& njoined)
         }
 #else
         for (int d=0; d<3; d++) {
-            mincell[d] = -0.5*abs(sph_dl[d]);
-            maxcell[d] =  0.5*abs(sph_dl[d]);
+            mincell[d] = -0.5*abs(sph_metric->dl[d]);
+            maxcell[d] =  0.5*abs(sph_metric->dl[d]);
         }
 #endif
         if (Params::splitJoinDeviation[1]==1) { // new method
@@ -4408,16 +5744,17 @@ void Tgrid::Tcell::begin_average_recursive()
         }
 #ifdef SAVE_POPULATION_AVERAGES
         for(int i = 0; i < Params::POPULATIONS; i++) {
-            pop_ave_n[i] = 0.0;
-            pop_ave_vx[i] = 0.0;
-            pop_ave_vy[i] = 0.0;
-            pop_ave_vz[i] = 0.0;
+            pop_ave_n(i) = 0.0;
+            pop_ave_vx(i) = 0.0;
+            pop_ave_vy(i) = 0.0;
+            pop_ave_vz(i) = 0.0;
         }
 #endif
 #ifdef SAVE_PARTICLE_CELL_SPECTRA
-        for(unsigned int i=0; i<spectra.size(); ++i) {
-            for(unsigned int j=0; j<spectra[i].size(); ++j) {
-                spectra[i][j] = 0.0;
+        for (int i = 0; i < Params::POPULATIONS; ++i) {
+            datareal *spec = spectra(i);
+            for (int j = 0; j < Params::spectraNbins; ++j) {
+                spec[j] = 0.0;
             }
         }
 #endif
@@ -4446,27 +5783,27 @@ void Tgrid::Tcell::end_average_recursive(real inv_ave_ntimes)
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
         gridreal invvol = 1.0/(size*size*size);
 #else
-        gridreal invvol = 1.0/abs(sph_dV);
+        gridreal invvol = 1.0/abs(sph_metric->dV);
 #endif
 #endif
 #ifdef SAVE_POPULATION_AVERAGES
         for (int i = 0; i < Params::POPULATIONS; ++i) {
             gridreal inv_sum_w = 0;
-            if(pop_ave_n[i] > 0) {
-                inv_sum_w = 1.0/pop_ave_n[i];
+            if(pop_ave_n(i) > 0) {
+                inv_sum_w = 1.0/pop_ave_n(i);
             }
-            pop_ave_n[i] *= invvol;
-            pop_ave_vx[i] *= inv_sum_w;
-            pop_ave_vy[i] *= inv_sum_w;
-            pop_ave_vz[i] *= inv_sum_w;
-            pop_ave_n[i] *= inv_ave_ntimes;
+            pop_ave_n(i) *= invvol;
+            pop_ave_vx(i) *= inv_sum_w;
+            pop_ave_vy(i) *= inv_sum_w;
+            pop_ave_vz(i) *= inv_sum_w;
+            pop_ave_n(i) *= inv_ave_ntimes;
         }
 #endif
 #ifdef SAVE_PARTICLE_CELL_SPECTRA
-        for(unsigned int i=0; i<spectra.size(); ++i) {
-            const real norm = invvol*inv_ave_ntimes/(Params::spectra_dE_eV[i]*4*pi);
-            for(unsigned int j=0; j<spectra[i].size(); ++j) {
-                spectra[i][j] *= norm;
+        for (int i = 0; i < Params::POPULATIONS; ++i) {
+            datareal *spec = spectra(i);
+            for (int j = 0; j < Params::spectraNbins; ++j) {
+                spec[j] *= invvol*inv_ave_ntimes/(Params::spectra_dE_eV[j]*4*pi);
             }
         }
 #endif
@@ -4496,94 +5833,114 @@ bool Tgrid::end_average()
 }
 
 //! Prepare Probability Density Functions in the grid (recursive)
-void Tgrid::Tcell::prepare_PDF_recursive(ScalarField* pdffunc, Tgrid* g)
+void Tgrid::Tcell::prepare_PDF_recursive(ScalarField* pdffunc, std::vector<real>& pdf, std::vector<TCellPtr>* cellptrs)
 {
     if (haschildren) {
         int ch;
-        for (ch=0; ch<8; ch++) child[0][0][ch]->prepare_PDF_recursive(pdffunc,g);
+        for (ch=0; ch<8; ch++) child[0][0][ch]->prepare_PDF_recursive(pdffunc,pdf,cellptrs);
     } else {
         const real fval = pdffunc->getValue(centroid);
-        g->pdftables[g->n_pdftables].cpdf[g->pdftable_iterator] = fval*(size*size*size);
-        g->pdftables[0].cellptrs[g->pdftable_iterator++] = this;
+        pdf.push_back(fval*(size*size*size));
+        if (cellptrs) {
+            cellptrs->push_back(this);
+        }
     }
 }
 
-//! Prepare Probability Density Functions in the grid
-void Tgrid::prepare_PDF(ScalarField* pdffunc, TPDF_ID& pdfid, real& cumsumvalue)
+/** \brief Prepare Probability Density Functions in the grid
+ *
+ * Builds a Walker/Vose alias table over the interior leaf cells with
+ * non-zero probability, so that generate_random_point and
+ * generate_random_cells draw a cell in O(1). cumsumvalue is the
+ * integral of pdffunc over the grid. Cells lying completely inside the
+ * sphere r < rmin are left out of the table but not of cumsumvalue.
+ */
+void Tgrid::prepare_PDF(ScalarField* pdffunc, TPDF_ID& pdfid, real& cumsumvalue, gridreal rmin)
 {
     if (n_pdftables >= MAX_PDFTABLES) {
         errorlog << "ERROR [Tgrid::prepare_PDF]: too many PDF tables already allocated (max is " << MAX_PDFTABLES << ")\n";
         doabort();
     }
     pdfid = n_pdftables;
-    if (n_pdftables == 0) {
-        const int n = Ncells_without_ghosts();
-        pdftables[n_pdftables].n = n;
-        pdftables[n_pdftables].cellptrs = new TCellPtr [n];
-    } else {
-        pdftables[n_pdftables].n = pdftables[0].n;
-        pdftables[n_pdftables].cellptrs = 0;
-    }
-    pdftables[n_pdftables].cpdf = new shortreal [pdftables[n_pdftables].n];
-    pdftable_iterator = 0;
+    TPDFTable& table = pdftables[n_pdftables];
+    std::vector<real> pdf;
+    std::vector<TCellPtr> cellptrs;
+    pdf.reserve(Ncells_without_ghosts());
     int i,j,k,c;
     ForInterior(i,j,k) {
         c = flatindex(i,j,k);
-        cells[c]->prepare_PDF_recursive(pdffunc,this);
+        cells[c]->prepare_PDF_recursive(pdffunc,pdf,(n_pdftables == 0) ? &cellptrs : 0);
     }
-    for (i=0; i<=n_pdftables; i++) pdftables[i].n = pdftable_iterator + 1;
-    // plus 1 because cumsum table contains one more element (because first element is 0)
-    if (pdftable_iterator+1 > pdftables[0].n) {
-        errorlog << "ERROR [Tgrid::prepare_PDF]: internal error in prepare_PDF\n";
-        doabort();
+    const int ncells = pdf.size();
+    table.ncells = ncells;
+    if (n_pdftables == 0) {
+        table.cellptrs = new TCellPtr [ncells];
+        for (c=0; c<ncells; c++) table.cellptrs[c] = cellptrs[c];
+    } else {
+        table.cellptrs = 0;
+        if (ncells != pdftables[0].ncells) {
+            errorlog << "ERROR [Tgrid::prepare_PDF]: internal error in prepare_PDF\n";
+            doabort();
+        }
     }
-    // now cpdf[0..pdftable_iterator-1] contains pdf, cumsum it
     cumsumvalue = 0;
-    for (c=0; c<pdftable_iterator; c++) {
-        cumsumvalue+= pdftables[n_pdftables].cpdf[c];
-        pdftables[n_pdftables].cpdf[c] = cumsumvalue;
-    }
-    // shift one step to right, and set first to 0:
-    for (c=pdftable_iterator; c>=1; c--) pdftables[n_pdftables].cpdf[c] = pdftables[n_pdftables].cpdf[c-1];
-    pdftables[n_pdftables].cpdf[0] = 0;
+    for (c=0; c<ncells; c++) cumsumvalue+= pdf[c];
     if (cumsumvalue <= 0 || !finite(cumsumvalue)) {
         errorlog << "ERROR [Tgrid::prepare_PDF]: bad cumsumvalue (" << cumsumvalue << ")\n";
         doabort();
-    } else {
-        const real coeff = 1/cumsumvalue;
-        for (c=0; c<pdftable_iterator; c++) pdftables[n_pdftables].cpdf[c]*= coeff;
-        // now first entry is 0 and last 1
     }
+    // Table entries: cells with non-zero probability
+    std::vector<int> entries;
+    real sum = 0;
+    for (c=0; c<ncells; c++) {
+        if (pdf[c] <= 0) continue;
+        if (rmin > 0) {
+            const TCellPtr cell = pdftables[0].cellptrs[c];
+            const gridreal halfsize = 0.5*cell->size;
+            real r2 = 0;
+            for (int d=0; d<3; d++) r2+= sqr(fabs(cell->centroid[d]) + halfsize);
+            if (r2 < sqr(rmin)) continue;
+        }
+        entries.push_back(c);
+        sum+= pdf[c];
+    }
+    const int n = entries.size();
+    if (n == 0) {
+        errorlog << "ERROR [Tgrid::prepare_PDF]: no cells with non-zero probability\n";
+        doabort();
+    }
+    table.n = n;
+    table.prob = new shortreal [n];
+    table.alias = new int [n];
+    table.cellindex = new int [n];
+    // Vose's alias method, scaled probabilities have mean 1
+    std::vector<real> scaled(n);
+    std::vector<int> small, large;
+    for (c=0; c<n; c++) {
+        table.cellindex[c] = entries[c];
+        table.alias[c] = c;
+        scaled[c] = pdf[entries[c]]*n/sum;
+        if (scaled[c] < 1) small.push_back(c);
+        else large.push_back(c);
+    }
+    while (!small.empty() && !large.empty()) {
+        const int s = small.back();
+        const int l = large.back();
+        small.pop_back();
+        table.prob[s] = scaled[s];
+        table.alias[s] = l;
+        scaled[l]-= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Remaining entries have probability 1 up to roundoff
+    for (c=0; c<int(large.size()); c++) table.prob[large[c]] = 1;
+    for (c=0; c<int(small.size()); c++) table.prob[small[c]] = 1;
     n_pdftables++;
 }
 
-/** \brief Locate
- *
- * Given array xx[1..n] and given value x, returns value j such that x is between
- * xx[j] and xx[j+1]. xx must be monotonic, either increasing or decreasing.
- * j=0 is returned to indicate that x is out of range.
- */
-static int locate(const shortreal xx[], int n, real x)
-{
-    int ju=n+1,jm,jl=0,result=0;
-    const bool sscnd = (xx[n] >= xx[1]);
-    while (ju-jl > 1) {
-        jm = (ju+jl) >> 1; // compute a midpoint
-        if ((x >= xx[jm]) == sscnd)
-            jl = jm; // replace either the lower limit
-        else
-            ju = jm; // or the upper limit, as appropriate
-    }
-    if (x == xx[1])
-        result = 1;
-    else if (x == xx[n])
-        result = n-1;
-    else
-        result = jl;
-    if (result >= n) result = 0; // always return 0 for out-of-range condition
-    return result;
-}
-
 //! Generate random point in a cell
 void Tgrid::Tcell::generate_random_point(gridreal r[3])
 {
@@ -4593,27 +5950,64 @@ void Tgrid::Tcell::generate_random_point(gridreal r[3])
     }
 }
 
+//! Draw an entry from a Walker/Vose alias table of length n
+static inline int alias_sample(const shortreal prob[], const int alias[], int n)
+{
+    const real u = uniformrnd()*n;
+    const int i = min2(int(u),n-1);
+    return (u - i < prob[i]) ? i : alias[i];
+}
+
+//! Draw a cell according to given PDF
+Tgrid::TCellPtr Tgrid::generate_random_cell(const TPDF_ID& pdfid)
+{
+    if (pdfid < 0 || pdfid >= n_pdftables) {
+        errorlog << "*** Tgrid::generate_random_cell(pdfid=" << pdfid << ") is out of range 0.." << n_pdftables-1 << "\n";
+        return 0;
+    }
+    const TPDFTable& table = pdftables[pdfid];
+    const int j = alias_sample(table.prob,table.alias,table.n);
+    return pdftables[0].cellptrs[table.cellindex[j]];
+}
+
 //! Generate random point according to given PDF
 void Tgrid::generate_random_point(const TPDF_ID& pdfid, gridreal r[3])
 {
-    const real x = uniformrnd();
+    TCellPtr cptr = generate_random_cell(pdfid);
+    if (cptr) {
+        cptr->generate_random_point(r);
+    }
+}
+
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+
+/** \brief Draw n cells according to given PDF
+ *
+ * The cells are returned sorted in the order of the PDF table, so that
+ * particles created in the same cell are added one after another.
+ */
+void Tgrid::generate_random_cells(const TPDF_ID& pdfid, int n, std::vector<TCellPtr>& result)
+{
+    result.clear();
     if (pdfid < 0 || pdfid >= n_pdftables) {
-        errorlog << "*** Tgrid::generate_random_point(pdfid=" << pdfid << ") is out of range 0.." << n_pdftables-1 << "\n";
+        errorlog << "*** Tgrid::generate_random_cells(pdfid=" << pdfid << ") is out of range 0.." << n_pdftables-1 << "\n";
         return;
     }
-    const int j = locate(&pdftables[pdfid].cpdf[-1],pdftables[pdfid].n,x);
-    if (j == 0) {
-        errorlog << "*** Internal error in generate_random_point(), x=" << x << "\n";
+    if (n <= 0) {
         return;
     }
-    TCellPtr cptr = pdftables[0].cellptrs[j-1];
-#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-    cptr->generate_random_point(r);
-#else
-    cptr->generate_random_point(r);
-#endif
+    const TPDFTable& table = pdftables[pdfid];
+    std::vector<int> entries(n);
+    for (int i=0; i<n; i++) {
+        entries[i] = table.cellindex[alias_sample(table.prob,table.alias,table.n)];
+    }
+    std::sort(entries.begin(),entries.end());
+    result.resize(n);
+    for (int i=0; i<n; i++) result[i] = pdftables[0].cellptrs[entries[i]];
 }
 
+#endif
+
 //! NGP interpolation
 void Tgrid::cellintpol(const shortreal r[3], TCellDataSelect s, real result[3])
 {
@@ -4995,6 +6389,11 @@ void Tgrid::Tcell::calc_node_ue_recursive()
 void Tgrid::calc_node_ue()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->calc_ue1();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->calc_node_ue_recursive();
@@ -5023,6 +6422,14 @@ void Tgrid::sph_init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridre
     n_pdftables = 0;
     ave_ntimes = 0;
     previous_found_cell = 0;
+    scheduler.setThreads(Params::threads);
+    pic_stencils_valid = false;
+    pic_tile_cell = 0;
+    grid_version = 0;
+    B0_grid_version = -1;
+    uniform_grid_version = -1;
+    uniform_mesh = false;
+    hcseries_grid_version = -1;
     nx = nx1 + 2;
     ny = ny1 + 2;
     nz = nz1 + 2;
@@ -5101,8 +6508,52 @@ void Tgrid::sph_init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridre
             << "| " << Params::sph_theta_min/pi << " pi < theta < " << Params::sph_theta_max/pi << " pi\n"
             << "| " << Params::sph_phi_min/pi << " pi < phi < " << Params::sph_phi_max/pi << " pi\n";
     mainlog << "|-------------------------------------------------|\n\n";
+    init_side_tables();
     cells = new TCellPtr [N];
     int i,j,k,c;
+    // SC metric coefficients depend only on r and theta, set them once per (i,j)
+    sph_metrics.resize(nx*ny);
+    for (i=0; i<nx; i++) for (j=0; j<ny; j++) {
+            TSphMetric& m = sph_metrics[i*ny + j];
+            const gridreal centroid[2] = {x_1 + (i+0.5)*bgdx, sph_theta_1 + (j+0.5)*sph_bgdtheta};
+            m.coor[0] = x_1     + i*bgdx;
+            m.coor[1] = sph_theta_1 + j*sph_bgdtheta;
+            m.coor_next[0] = x_1     + (i+1)*bgdx;     // r
+            m.coor_next[1] = sph_theta_1 + (j+1)*sph_bgdtheta; // theta
+            m.size[0] = bgdx;     // dr
+            m.size[1] = sph_bgdtheta; // dtheta
+            m.size[2] = sph_bgdphi;   // dphi
+            // SC line grid elements!!
+            m.dl[0] = m.coor_next[0] - m.coor[0];                  // dl_r
+            m.dl[1] = m.coor[0]*(m.coor_next[1] - m.coor[1]);      // dl_theta
+            m.dl[2] = m.coor[0]*sin(m.coor[1])*m.size[2];          // dl_phi
+            m.diag  = sqrt(sqr(m.dl[0]) + sqr(m.dl[1]) + sqr(m.dl[2])); // diagonal
+            // SC areas!!
+            // Area of cell dS _|_ dr dS(0)=r^2*sin(theta)*dtheta*dphi
+            m.dS[0]=sqr(m.coor[0])*sin(m.coor[1])*m.size[1]*m.size[2];
+            // Area of cell dS _|_ dtheta dS(1)=rc*sin(theta)*dr*dphi
+            m.dS[1]=centroid[0]*sin(m.coor[1])*m.size[0]*m.size[2];
+            // Area of cell dS _|_ dphi dS(2)=rc*dr*dtheta
+            m.dS[2]=centroid[0]*m.size[0]*m.size[1];
+            // Area of cell dS _|_ dr dS(0)=r_c^2*sin(theta)*dtheta*dphi
+            m.dS_centroid[0]=sqr(centroid[0])*sin(m.coor[1])*m.size[1]*m.size[2];
+            // Area of cell dS _|_ dtheta dS(1)=rc*sin(theta_c)*dr*dphi
+            m.dS_centroid[1]=centroid[0]*sin(centroid[1])*m.size[0]*m.size[2];
+            // Area of cell dS _|_ dphi dS(2)=rc*dr*dtheta
+            m.dS_centroid[2]=centroid[0]*m.size[0]*m.size[1];
+            // Area of next cell  dS _|_ dr dS(0)=r_next^2*sin(theta)*dtheta*dphi
+            m.dS_next[0]=sqr(m.coor_next[0])*sin(m.coor[1])*m.size[1]*m.size[2];
+            // Area of next cell dS _|_ dtheta dS(1)=rc*sin(theta_next)*dr*dphi
+            m.dS_next[1]=centroid[0]*sin(m.coor_next[1])*m.size[0]*m.size[2];
+            // Area of next cell dS _|_ dphi dS(2)=rc*dr*dtheta
+            m.dS_next[2]=centroid[0]*m.size[0]*m.size[1];
+            // SC volumes!!
+            // Volume of cell dV=r^2*sin(theta)*dr*dtheta*dphi
+            m.dV = sqr(centroid[0])*sin(centroid[1])*m.size[0]*m.size[1]*m.size[2];
+            // Volume of cell dV=dphi*(r2^3-r1^3)*(cos(theta1)-cos(theta2))/3
+            // m.dV = m.size[2]*(pow(m.coor_next[0], 3) - pow(m.coor[0], 3))
+            //        *(cos(m.coor[1]) - cos(m.coor_next[1]))/3.0;
+        }
     // Create cells and faces, set up cell fields but not yet face fields
     ForAll(i,j,k) {
         c = flatindex(i,j,k);
@@ -5114,6 +6565,8 @@ void Tgrid::sph_init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridre
         cells[c]->level = 0;
         cells[c]->parent = 0;
         cells[c]->running_index = -123456;
+        cells[c]->pic_stencil = -1;
+        cells[c]->pic_regular = 0;
         cells[c]->face[0][0] = (i > 0) ? cells[flatindex(i-1,j,k)]->face[0][1] : TFacePtr(0);
         cells[c]->face[0][1] = (i < nx-1) ? new Tface : 0;
         cells[c]->face[1][0] = (j > 0) ? cells[flatindex(i,j-1,k)]->face[1][1] : TFacePtr(0);
@@ -5124,14 +6577,7 @@ void Tgrid::sph_init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridre
         cells[c]->rho_q = 0.0;
         cells[c]->rho_q_bg = 0.0;
         cells[c]->ave_nc = 0.0;
-#ifdef SAVE_POPULATION_AVERAGES
-        for (int l = 0; l < Params::POPULATIONS; ++l) {
-            cells[c]->pop_ave_n.push_back(0.0);
-            cells[c]->pop_ave_vx.push_back(0.0);
-            cells[c]->pop_ave_vy.push_back(0.0);
-            cells[c]->pop_ave_vz.push_back(0.0);
-        }
-#endif
+        cells[c]->alloc_side_records();
         memset(&cells[c]->celldata[0][0],0,sizeof(datareal)*NCELLDATA*3);
         cells[c]->centroid[0] = x_1 + (i+0.5)*bgdx;
         cells[c]->centroid[1] = y_1 + (j+0.5)*sph_bgdy;
@@ -5149,71 +6595,7 @@ void Tgrid::sph_init(int nx1, int ny1, int nz1, gridreal x1, gridreal y1, gridre
         cells[c]->sph_centroid[0] = x_1     + (i+0.5)*bgdx;
         cells[c]->sph_centroid[1] = sph_theta_1 + (j+0.5)*sph_bgdtheta;
         cells[c]->sph_centroid[2] = sph_phi_1   + (k+0.5)*sph_bgdphi;
-        cells[c]->sph_coor[0] = x_1     + i*bgdx;
-        cells[c]->sph_coor[1] = sph_theta_1 + j*sph_bgdtheta;
-        cells[c]->sph_coor[2] = sph_phi_1   + k*sph_bgdphi;
-        ///////////////////////////////////////////////////////////////////////////////////////////
-        // Diagnostic tool. To check the limits for shpherical coordinates theta and phi //
-        ///////////////////////////////////////////////////////////////////////////////////////////
-        /*if (cells[c]->sph_coor[1] < 0.0 || cells[c]->sph_coor[1] > pi)
-           {
-        errorlog << "j = " << j << " theta(j) = " << sph_theta_1 + j*bgdtheta << " sph_theta_1 = " << sph_theta_1 << " bgdtheta = " << bgdtheta << " ny = " << ny << " theta_max = " << sph_theta_1 + ny*bgdtheta << "\n";
-            doabort();
-        }
-            if (cells[c]->sph_coor[2] < -pi - 1e-06 || cells[c]->sph_coor[2] > pi + 1e-06)
-               {
-            	  errorlog << "k = " << k << " phi(k) = " << sph_phi_1 + k*bgdphi << " sph_phi_1 = " << sph_phi_1 << " bgdphi = " << bgdphi << " nz = " << nz << " phi_max = " << sph_phi_1 + ny*bgdphi << "\n";
-                doabort();
-         }*/
-        ///////////////////////////////////////////////////////////////////////////////////////////
-        /*if (cells[c]->sph_coor[1] == 0.1 || cells[c]->sph_coor[1] == pi)
-           {
-        errorlog << "j = " << j << " theta(j) = " << cells[c]->sph_coor[1] << "\n";
-            doabort();
-        }
-            //if (cells[c]->sph_coor[2] == -pi || cells[c]->sph_coor[2] >= pi)
-            if (k == 19)
-               {
-            	  errorlog << "k = " << k << " phi(k) = " << cells[c]->sph_coor[2] << " bgdphi = " << bgdphi << " nz1 = " << nz1 << " nz = " << nz << "\n";
-                doabort();
-         }*/
-        ///////////////////////////////////////////////////////////////////////////////////////////
-        cells[c]->sph_coor_next[0] = x_1     + (i+1)*bgdx;     // r
-        cells[c]->sph_coor_next[1] = sph_theta_1 + (j+1)*sph_bgdtheta; // theta
-        cells[c]->sph_coor_next[2] = sph_phi_1   + (k+1)*sph_bgdphi;   // phi
-        cells[c]->sph_size[0] = bgdx;     // dr
-        cells[c]->sph_size[1] = sph_bgdtheta; // dtheta
-        cells[c]->sph_size[2] = sph_bgdphi;   // dphi
-        // SC line grid elements!!
-        cells[c]->sph_dl[0] = cells[c]->sph_coor_next[0] - cells[c]->sph_coor[0];                                                    // dl_r
-        cells[c]->sph_dl[1] = cells[c]->sph_coor[0]*(cells[c]->sph_coor_next[1] - cells[c]->sph_coor[1]);                            // dl_theta
-        cells[c]->sph_dl[2] = cells[c]->sph_coor[0]*sin(cells[c]->sph_coor[1])*(cells[c]->sph_coor_next[2] - cells[c]->sph_coor[2]); // dl_phi
-        cells[c]->sph_diag  = sqrt(sqr(cells[c]->sph_dl[0]) + sqr(cells[c]->sph_dl[1]) + sqr(cells[c]->sph_dl[2]));                  // diagonal
-        // SC areas!!
-        // Area of cell dS _|_ dr dS(0)=r^2*sin(theta)*dtheta*dphi
-        cells[c]->sph_dS[0]=sqr(cells[c]->sph_coor[0])*sin(cells[c]->sph_coor[1])*cells[c]->sph_size[1]*cells[c]->sph_size[2];
-        // Area of cell dS _|_ dtheta dS(1)=rc*sin(theta)*dr*dphi
-        cells[c]->sph_dS[1]=cells[c]->sph_centroid[0]*sin(cells[c]->sph_coor[1])*cells[c]->sph_size[0]*cells[c]->sph_size[2];
-        // Area of cell dS _|_ dphi dS(2)=rc*dr*dtheta
-        cells[c]->sph_dS[2]=cells[c]->sph_centroid[0]*cells[c]->sph_size[0]*cells[c]->sph_size[1];
-        // Area of cell dS _|_ dr dS(0)=r_c^2*sin(theta)*dtheta*dphi
-        cells[c]->sph_dS_centroid[0]=sqr(cells[c]->sph_centroid[0])*sin(cells[c]->sph_coor[1])*cells[c]->sph_size[1]*cells[c]->sph_size[2];
-        // Area of cell dS _|_ dtheta dS(1)=rc*sin(theta_c)*dr*dphi
-        cells[c]->sph_dS_centroid[1]=cells[c]->sph_centroid[0]*sin(cells[c]->sph_centroid[1])*cells[c]->sph_size[0]*cells[c]->sph_size[2];
-        // Area of cell dS _|_ dphi dS(2)=rc*dr*dtheta
-        cells[c]->sph_dS_centroid[2]=cells[c]->sph_centroid[0]*cells[c]->sph_size[0]*cells[c]->sph_size[1];
-        // Area of next cell  dS _|_ dr dS(0)=r_next^2*sin(theta)*dtheta*dphi
-        cells[c]->sph_dS_next[0]=sqr(cells[c]->sph_coor_next[0])*sin(cells[c]->sph_coor[1])*cells[c]->sph_size[1]*cells[c]->sph_size[2];
-        // Area of next cell dS _|_ dtheta dS(1)=rc*sin(theta_next)*dr*dphi
-        cells[c]->sph_dS_next[1]=cells[c]->sph_centroid[0]*sin(cells[c]->sph_coor_next[1])*cells[c]->sph_size[0]*cells[c]->sph_size[2];
-        // Area of next cell dS _|_ dphi dS(2)=rc*dr*dtheta
-        cells[c]->sph_dS_next[2]=cells[c]->sph_centroid[0]*cells[c]->sph_size[0]*cells[c]->sph_size[1];
-        // SC volumes!!
-        // Volume of cell dV=r^2*sin(theta)*dr*dtheta*dphi
-        cells[c]->sph_dV = sqr(cells[c]->sph_centroid[0])*sin(cells[c]->sph_centroid[1])*cells[c]->sph_size[0]*cells[c]->sph_size[1]*cells[c]->sph_size[2];
-        // Volume of cell dV=dphi*(r2^3-r1^3)*(cos(theta1)-cos(theta2))/3
-        // cells[c]->sph_dV = cells[c]->sph_size[2]*(pow(cells[c]->sph_coor_next[0], 3) - pow(cells[c]->sph_coor[0], 3))
-        //                    *(cos(cells[c]->sph_coor[1]) - cos(cells[c]->sph_coor_next[1]))/3.0;
+        cells[c]->sph_metric = &sph_metrics[i*ny + j];
     }
 
     // Set up neighbour fields
@@ -5280,9 +6662,9 @@ void Tgrid::Tcell::sph_FC_recursive(TFaceDataSelect fs, TCellDataSelect cs, int
     gridreal AF0[3] = {faceave(0,0,fs), faceave(1,0,fs), faceave(2,0,fs)};
     gridreal AF1[3] = {faceave(0,1,fs), faceave(1,1,fs), faceave(2,1,fs)};
     gridreal Ac[3]  = {0, 0, 0};
-    gridreal dS0[3] = {sph_dS[0], sph_dS[1], sph_dS[2]};
-    gridreal dS1[3] = {sph_dS_next[0], sph_dS_next[1], sph_dS_next[2]};
-    gridreal dSc[3] = {sph_dS_centroid[0], sph_dS_centroid[1], sph_dS_centroid[2]};
+    gridreal dS0[3] = {sph_metric->dS[0], sph_metric->dS[1], sph_metric->dS[2]};
+    gridreal dS1[3] = {sph_metric->dS_next[0], sph_metric->dS_next[1], sph_metric->dS_next[2]};
+    gridreal dSc[3] = {sph_metric->dS_centroid[0], sph_metric->dS_centroid[1], sph_metric->dS_centroid[2]};
     if (FC_boundary_flag == 0) {
         //for (d=0; d<3; d++) Ac[d] = 0.5*(AF0[d] + AF1[d]);
         for (d=0; d<3; d++) Ac[d] = 0.5*(AF0[d]*dS0[d] + AF1[d]*dS1[d])/dSc[d];
@@ -5354,19 +6736,19 @@ void Tgrid::Tcell::sph_NC_recursive(TNodeDataSelect ns,TCellDataSelect cs)
 else
    {
     int dir,d,f,f2;
-    datareal tempx,tempy,tempz;
+    real tempx,tempy,tempz;
     gridreal weight = 0.0;
     gridreal weightsum = 0.0;
     celldata[cs][0]=0.;
     celldata[cs][1]=0.;
     celldata[cs][2]=0.;
     gridreal dS[3][2];
-             dS[0][0] = sph_dS[0];
-             dS[0][1] = sph_dS_next[0];
-             dS[1][0] = sph_dS[1];
-             dS[1][1] = sph_dS_next[1];
-             dS[2][0] = sph_dS[2];
-             dS[2][1] = sph_dS_next[2];
+             dS[0][0] = sph_metric->dS[0];
+             dS[0][1] = sph_metric->dS_next[0];
+             dS[1][0] = sph_metric->dS[1];
+             dS[1][1] = sph_metric->dS_next[1];
+             dS[2][0] = sph_metric->dS[2];
+             dS[2][1] = sph_metric->dS_next[2];
 
     for (dir=0; dir<3; dir++) for(d=0; d<2; d++)
       {
@@ -5411,7 +6793,7 @@ else
 void Tgrid::Tcell::sph_NC_smoothing_recursive()
 {
     int dir,d,f,f2;
-    datareal tempnc,temprhoq,tempvx,tempvy,tempvz;
+    real tempnc,temprhoq,tempvx,tempvy,tempvz;
     nc = 0.0;
     rho_q = 0.0;
     celldata[CELLDATA_Ji][0] = 0.0;
@@ -5500,9 +6882,9 @@ void Tgrid::Tnode::sph_CN1(TCellDataSelect cs, TNodeDataSelect ns)
       {
        c = cell[0][0][a];
        if (c == 0) continue;
-       total_areax = abs(c->sph_dS_centroid[0]);
-       total_areay = abs(c->sph_dS_centroid[1]);
-       total_areaz = abs(c->sph_dS_centroid[2]);
+       total_areax = abs(c->sph_metric->dS_centroid[0]);
+       total_areay = abs(c->sph_metric->dS_centroid[1]);
+       total_areaz = abs(c->sph_metric->dS_centroid[2]);
 
        gridreal r[3] = {c->sph_centroid[0], c->sph_centroid[1], c->sph_centroid[2]};
        gridreal A[3] = {c->celldata[cs][0], c->celldata[cs][1], c->celldata[cs][2]};
@@ -5520,9 +6902,9 @@ void Tgrid::Tnode::sph_CN1(TCellDataSelect cs, TNodeDataSelect ns)
       {
        c = cell[0][0][a];
        if (c == 0) continue;
-       areax = abs(c->sph_dS_next[0]);
-       areay = abs(c->sph_dS_next[1]);
-       areaz = abs(c->sph_dS_next[2]);
+       areax = abs(c->sph_metric->dS_next[0]);
+       areay = abs(c->sph_metric->dS_next[1]);
+       areaz = abs(c->sph_metric->dS_next[2]);
 
        if (a <= 3)
           {
@@ -5574,7 +6956,7 @@ void Tgrid::Tnode::sph_CN1_vol(TCellDataSelect cs, TNodeDataSelect ns)
       {
        c = cell[0][0][a];
        if (c == 0) continue;
-       volume = abs(c->sph_dV);
+       volume = abs(c->sph_metric->dV);
        flux[0]+= volume*c->celldata[cs][0];
        flux[1]+= volume*c->celldata[cs][1];
        flux[2]+= volume*c->celldata[cs][2];
@@ -5605,7 +6987,7 @@ void Tgrid::Tnode::sph_CN1_vol(TCellDataSelect cs, TNodeDataSelect ns)
         gridreal A[3] = {c->celldata[cs][0], c->celldata[cs][1], c->celldata[cs][2]};
         sph_transf_H2S_V(A);
         sph_transf_S2C_V(r, A);
-        volume = abs(c->sph_dV);
+        volume = abs(c->sph_metric->dV);
         flux[0]+= volume*A[0];
         flux[1]+= volume*A[1];
         flux[2]+= volume*A[2];
@@ -5680,7 +7062,7 @@ void Tgrid::Tnode::sph_CNb1(TCellDataSelect cs, TNodeDataSelect ns, int sph_CN_b
       // 1 internal region
       if (sph_CN_boundary_flag == 1)
          {
-          gridreal weight = 1.0*c->sph_size[0];
+          gridreal weight = 1.0*c->sph_metric->size[0];
           //gridreal weight = 1.0;
 
           result[0] += weight*A[0];
@@ -5692,7 +7074,7 @@ void Tgrid::Tnode::sph_CNb1(TCellDataSelect cs, TNodeDataSelect ns, int sph_CN_b
       // 6 faces
       if (sph_CN_boundary_flag == 6)
          {
-          gridreal weight = 2.0*c->sph_size[0];
+          gridreal weight = 2.0*c->sph_metric->size[0];
           //gridreal weight = 2.0;
 
           result[0] += weight*A[0];
@@ -5704,7 +7086,7 @@ void Tgrid::Tnode::sph_CNb1(TCellDataSelect cs, TNodeDataSelect ns, int sph_CN_b
       // 12 edges
       if (sph_CN_boundary_flag == 12)
          {
-          gridreal weight = 4.0*c->sph_size[0];
+          gridreal weight = 4.0*c->sph_metric->size[0];
           //gridreal weight = 4.0;
 
           result[0] += weight*A[0];
@@ -5716,7 +7098,7 @@ void Tgrid::Tnode::sph_CNb1(TCellDataSelect cs, TNodeDataSelect ns, int sph_CN_b
        // 8 nodes
       if (sph_CN_boundary_flag == 8)
          {
-          gridreal weight = 8.0*c->sph_size[0];
+          gridreal weight = 8.0*c->sph_metric->size[0];
           //gridreal weight = 8.0;
 
           result[0] += weight*A[0];
@@ -5871,7 +7253,7 @@ void Tgrid::Tnode::sph_CN1_rhoq()
     for (a=0; a<8; a++) {
         c = cell[0][0][a];
         if (c == 0) continue;
-        register const gridreal weight = 1.0/c->sph_dV;
+        register const gridreal weight = 1.0/c->sph_metric->dV;
         chargedensity+=weight*c->rho_q; //charge density
         weightsum+= weight;
     }
@@ -6063,12 +7445,11 @@ void Tgrid::Tnode::sph_CNb_donor1(TCellDataSelect cs, TNodeDataSelect ns, TNodeD
  */
 void Tgrid::Tnode::sph_calc_E1(void)
 {
-    real B0[3] = {0.0, 0.0, 0.0};
     real B[3]  = {0.0, 0.0, 0.0};
     real Ue[3] = {0.0, 0.0, 0.0};
     real E[3]  = {0.0, 0.0, 0.0};
-    // Add constant magnetic field B0 (centroid = exact node coordinates)
-    addConstantMagneticField(centroid, B0);
+    // Constant magnetic field B0 was set at the node by Tgrid::update_B0
+    const datareal *const B0 = nodedata[NODEDATA_B0];
     gridreal R     = sph_centroid[0];
     gridreal theta = sph_centroid[1];
     gridreal phi   = sph_centroid[2];
@@ -6621,9 +8002,9 @@ void Tgrid::Tcell::sph_CalcGradient_rhoq_recursive(void)
         // dLtheta = r_c*dtheta
         // dLphi   =   r_c*sin(theta_c)*dphi
         gridreal dL[3];
-        dL[0] = sph_size[0];
-        dL[1] = sph_centroid[0]*sph_size[1];
-        dL[2] = sph_centroid[0]*sin(sph_centroid[1])*sph_size[2];
+        dL[0] = sph_metric->size[0];
+        dL[1] = sph_centroid[0]*sph_metric->size[1];
+        dL[2] = sph_centroid[0]*sin(sph_centroid[1])*sph_metric->size[2];
         for (int d=0; d<3; d++) {
             celldata[CELLDATA_TEMP1][d]= (faceave(d,1,Tgrid::FACEDATA_MINUSDB) - faceave(d,0,Tgrid::FACEDATA_MINUSDB))/dL[d];
         }
@@ -7300,22 +8681,22 @@ void Tgrid::sph_faceintpol(shortreal r[3], TFaceDataSelect s, real result[3])
     }
     if (c->anyrefined_face()) {
         for (d=0; d<3; d++) {
-            // test: t = (r[d] - lowercorner[d])/c->sph_size[d];
+            // test: t = (r[d] - lowercorner[d])/c->sph_metric->size[d];
             t = (r[d] - lowercorner[d])*c->invsize;
             result[d] = (1-t)*c->faceave(d,0,s) + t*c->faceave(d,1,s);
         }
     } else {
         // faster branch for fully regular case
         // This is face interpolation for spherical coordinates. We use linear interpolation F(t) = (1-t)*F1 + t*F2 but for normalized values with restpect to square F(t) = ((1-t)*F1*S1 + t*F2*S2)/S(t)
-        const gridreal r_sph  = c->sph_coor[0];
-        const gridreal theta1 = c->sph_coor[1];
-        const gridreal theta2 = c->sph_coor_next[1];
-        const gridreal dr     = c->sph_size[0];
-        const gridreal dtheta = c->sph_size[1];
-        const gridreal dphi   = c->sph_size[2];
+        const gridreal r_sph  = c->sph_metric->coor[0];
+        const gridreal theta1 = c->sph_metric->coor[1];
+        const gridreal theta2 = c->sph_metric->coor_next[1];
+        const gridreal dr     = c->sph_metric->size[0];
+        const gridreal dtheta = c->sph_metric->size[1];
+        const gridreal dphi   = c->sph_metric->size[2];
         const gridreal rc     = c->sph_centroid[0];
-        const gridreal dS1[3] = {c->sph_dS[0], c->sph_dS[1], c->sph_dS[2]};
-        const gridreal dS2[3] = {c->sph_dS_next[0], c->sph_dS_next[1], c->sph_dS_next[2]};
+        const gridreal dS1[3] = {c->sph_metric->dS[0], c->sph_metric->dS[1], c->sph_metric->dS[2]};
+        const gridreal dS2[3] = {c->sph_metric->dS_next[0], c->sph_metric->dS_next[1], c->sph_metric->dS_next[2]};
         gridreal dSt[3];
         t = (r[0] - lowercorner[0])*c->invsize;
         //dSt[0] = sqr(r_sph + t*dr)*sin(theta)*dtheta*dphi;
@@ -7395,6 +8776,11 @@ void Tgrid::sph_NC(TNodeDataSelect ns,TCellDataSelect cs)
 void Tgrid::sph_CN(TCellDataSelect cs, TNodeDataSelect ns)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_CN1(cs,ns);
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_CN_recursive(cs,ns);
@@ -7915,6 +9301,11 @@ void Tgrid::sph_YNave_Ji(TNodeDataSelect ns)
 void Tgrid::sph_CN_smoothing()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_CN1_smoothing();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_CN_smoothing_recursive();
@@ -8084,6 +9475,11 @@ void Tgrid::sph_CNb_smoothing()
 void Tgrid::sph_CN_rhoq()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_CN1_rhoq();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_CN_rhoq_recursive();
@@ -8440,6 +9836,11 @@ void Tgrid::sph_CNF_map(TCellDataSelect cs, TNodeDataSelect ns, TFaceDataSelect
 void Tgrid::sph_CN_donor(TCellDataSelect cs, TNodeDataSelect ns, TNodeDataSelect uns, real dt)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_CN_donor1(cs,ns,uns,dt);
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_CN_donor_recursive(cs,ns,uns,dt);
@@ -8624,7 +10025,7 @@ inline gridreal Tgrid::sph_accumulate_PIC_recursive(const TBoxDef& cloudbox, Tce
     // Particle number contribution from a macroparticle to this cell
     register const real accum_w = w*accum;
     // Charge contribution from a macroparticle to this cell
-    datareal charge = accum_w*Params::pops[popid]->q;
+    real charge = accum_w*Params::pops[popid]->q;
     // Add particle number contribution to the cell
     c->nc += accum_w;
     // Add charge contribution to the cell
@@ -8636,10 +10037,10 @@ inline gridreal Tgrid::sph_accumulate_PIC_recursive(const TBoxDef& cloudbox, Tce
     }
 #ifdef SAVE_POPULATION_AVERAGES
     if (Params::averaging == true) {
-        c->pop_ave_n[popid] += accum_w;
-        c->pop_ave_vx[popid] += accum_w*v[0];
-        c->pop_ave_vy[popid] += accum_w*v[1];
-        c->pop_ave_vz[popid] += accum_w*v[2];
+        c->pop_ave_n(popid) += accum_w;
+        c->pop_ave_vx(popid) += accum_w*v[0];
+        c->pop_ave_vy(popid) += accum_w*v[1];
+        c->pop_ave_vz(popid) += accum_w*v[2];
     }
 #endif
     return accum;
@@ -8860,8 +10261,8 @@ void Tgrid::copy_celldata_SCS(int cTo, int cFrom, TCellDataSelect cs)
 //! (SPHERICAL) Spherical version of "copy_rhoq"
 void Tgrid::sph_copy_rhoq(int cTo, int cFrom)
 {
-    gridreal V_from = cells[cFrom]->sph_dV;
-    gridreal V_to   = cells[cTo]->sph_dV;
+    gridreal V_from = cells[cFrom]->sph_metric->dV;
+    gridreal V_to   = cells[cTo]->sph_metric->dV;
     gridreal koeff  = V_from/V_to;
 
 //cells[cTo]->rho_q = cells[cFrom]->rho_q*koeff;
@@ -8913,7 +10314,13 @@ void Tgrid::sph_calc_ue_app(void)
 //! (SPHERICAL) Spherical version of "calc_node_E": Calculate electric field at the nodes (E = -U_e x (B + B_0) + eta*J)
 void Tgrid::sph_calc_node_E(void)
 {
+    update_B0();
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_calc_E1();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_calc_node_E_recursive();
@@ -8957,6 +10364,13 @@ void Tgrid::sph_Node_BC(TNodeDataSelect ns)
 void Tgrid::sph_FaceCurl(TNodeDataSelect ns, TFaceDataSelect fs, real factor)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->sph_Curl1(ns,fs,i,factor);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->sph_FaceCurl_recursive(ns,fs,0, factor);
@@ -8969,6 +10383,13 @@ void Tgrid::sph_FaceCurl(TNodeDataSelect ns, TFaceDataSelect fs, real factor)
 void Tgrid::sph_FaceCurl_2(TNodeDataSelect ns, TFaceDataSelect fs, real factor)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->sph_Curl1_2(ns,fs,i,factor);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->sph_FaceCurl_2_recursive(ns,fs,0, factor);
@@ -8981,6 +10402,13 @@ void Tgrid::sph_FaceCurl_2(TNodeDataSelect ns, TFaceDataSelect fs, real factor)
 void Tgrid::sph_NF(TNodeDataSelect ns, TFaceDataSelect fs)
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->sph_NF1(ns,fs,i);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->sph_NF_recursive(ns,fs,0);
@@ -8993,6 +10421,13 @@ void Tgrid::sph_NF(TNodeDataSelect ns, TFaceDataSelect fs)
 void Tgrid::sph_NF_rhoq()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        for (i=0; i<3; i++) {
+            const int n = uniform_curlfaces[i].size();
+            for (c=0; c<n; c++) uniform_curlfaces[i][c]->sph_NF_rhoq1(i);
+        }
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 if (j > 0 && k > 0) cells[c]->sph_NF_rhoq_recursive(0);
@@ -9379,7 +10814,7 @@ void Tgrid::sph_boundarypass(int dim, bool toRight, void (*funcB)(datareal cdata
 //! (SPHERICAL) Spherical version of "cellintpol_fluid". Calculate fluid parameters in the cell: n, avg(v) and P=nT (use particle mass of the population popID[0])
 void Tgrid::Tcell::sph_cellintpol_fluid(real& n, real& vx, real& vy, real& vz, real& P, vector<int> popId)
 {
-    n = plist.calc_mass(popId)/(Params::pops[popId[0]]->m*sph_dV);
+    n = plist.calc_mass(popId)/(Params::pops[popId[0]]->m*sph_metric->dV);
     vx = vy = vz = 0;
     plist.calc_avev(vx, vy, vz, popId);
     const real T = 0.5*plist.calc_avemv2(vx, vy, vz, popId);
@@ -9500,10 +10935,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  r*dtheta;
             real dL3 =  r*sin(theta2)*dphi;
             real dL4 = -r*dtheta;
-            //real dS00 = cell[1][0][0]->sph_dS_centroid[0];
-            //real dS01 = cell[1][0][1]->sph_dS_centroid[0];
-            //real dS10 = cell[1][1][0]->sph_dS_centroid[0];
-            //real dS11 = cell[1][1][1]->sph_dS_centroid[0];
+            //real dS00 = cell[1][0][0]->sph_metric->dS_centroid[0];
+            //real dS01 = cell[1][0][1]->sph_metric->dS_centroid[0];
+            //real dS10 = cell[1][1][0]->sph_metric->dS_centroid[0];
+            //real dS11 = cell[1][1][1]->sph_metric->dS_centroid[0];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS = r*r*sin(theta1)*dtheta*dphi;
             if (dS<0.0) dS = -dS;
@@ -9530,10 +10965,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  r*dtheta;
             real dL3 =  r*sin(theta2)*dphi;
             real dL4 = -r*dtheta;
-            //real dS00 = cell[0][0][0]->sph_dS_centroid[0];
-            //real dS01 = cell[0][0][1]->sph_dS_centroid[0];
-            //real dS10 = cell[0][1][0]->sph_dS_centroid[0];
-            //real dS11 = cell[0][1][1]->sph_dS_centroid[0];
+            //real dS00 = cell[0][0][0]->sph_metric->dS_centroid[0];
+            //real dS01 = cell[0][0][1]->sph_metric->dS_centroid[0];
+            //real dS10 = cell[0][1][0]->sph_metric->dS_centroid[0];
+            //real dS11 = cell[0][1][1]->sph_metric->dS_centroid[0];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS = r*r*sin(theta1)*dtheta*dphi;
             if (dS<0.0) dS = -dS;
@@ -9562,10 +10997,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  r1*sin(theta)*dphi;
             real dL3 =  dr;
             real dL4 = -r2*sin(theta)*dphi;
-            //real dS00 = cell[0][1][0]->sph_dS_centroid[1];
-            //real dS01 = cell[0][1][1]->sph_dS_centroid[1];
-            //real dS10 = cell[1][1][0]->sph_dS_centroid[1];
-            //real dS11 = cell[1][1][1]->sph_dS_centroid[1];
+            //real dS00 = cell[0][1][0]->sph_metric->dS_centroid[1];
+            //real dS01 = cell[0][1][1]->sph_metric->dS_centroid[1];
+            //real dS10 = cell[1][1][0]->sph_metric->dS_centroid[1];
+            //real dS11 = cell[1][1][1]->sph_metric->dS_centroid[1];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS = 0.5*dr*(r2 + r1)*sin(theta)*dphi;
             if (dS<0.0) dS = -dS;
@@ -9588,10 +11023,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  r1*sin(theta)*dphi;
             real dL3 =  dr;
             real dL4 = -r2*sin(theta)*dphi;
-            //real dS00 = cell[0][0][0]->sph_dS_centroid[1];
-            //real dS01 = cell[0][0][1]->sph_dS_centroid[1];
-            //real dS10 = cell[1][0][0]->sph_dS_centroid[1];
-            //real dS11 = cell[1][0][1]->sph_dS_centroid[1];
+            //real dS00 = cell[0][0][0]->sph_metric->dS_centroid[1];
+            //real dS01 = cell[0][0][1]->sph_metric->dS_centroid[1];
+            //real dS10 = cell[1][0][0]->sph_metric->dS_centroid[1];
+            //real dS11 = cell[1][0][1]->sph_metric->dS_centroid[1];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS = 0.5*dr*(r2 + r1)*sin(theta)*dphi;
             if (dS<0.0) dS = -dS;
@@ -9619,10 +11054,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  dr;
             real dL3 =  r2*dtheta;
             real dL4 = -dr;
-            //real dS00 = cell[0][0][1]->sph_dS_centroid[2];
-            //real dS01 = cell[0][1][1]->sph_dS_centroid[2];
-            //real dS10 = cell[1][0][1]->sph_dS_centroid[2];
-            //real dS11 = cell[1][1][1]->sph_dS_centroid[2];
+            //real dS00 = cell[0][0][1]->sph_metric->dS_centroid[2];
+            //real dS01 = cell[0][1][1]->sph_metric->dS_centroid[2];
+            //real dS10 = cell[1][0][1]->sph_metric->dS_centroid[2];
+            //real dS11 = cell[1][1][1]->sph_metric->dS_centroid[2];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS  = 0.5*(r2*r2 - r1*r1)*dtheta;
             if (dS<0.0) dS = -dS;
@@ -9648,10 +11083,10 @@ real Tgrid::Tnode::sph_jcomponent(int edir)
             real dL2 =  dr;
             real dL3 =  r2*dtheta;
             real dL4 = -dr;
-            //real dS00 = cell[0][0][0]->sph_dS_centroid[2];
-            //real dS01 = cell[0][1][0]->sph_dS_centroid[2];
-            //real dS10 = cell[1][0][0]->sph_dS_centroid[2];
-            //real dS11 = cell[1][1][0]->sph_dS_centroid[2];
+            //real dS00 = cell[0][0][0]->sph_metric->dS_centroid[2];
+            //real dS01 = cell[0][1][0]->sph_metric->dS_centroid[2];
+            //real dS10 = cell[1][0][0]->sph_metric->dS_centroid[2];
+            //real dS11 = cell[1][1][0]->sph_metric->dS_centroid[2];
             //real dS = (abs(dS00) + abs(dS01) + abs(dS10) + abs(dS11))/4;
             real dS  = 0.5*(r2*r2 - r1*r1)*dtheta;
             if (dS<0.0) dS = -dS;
@@ -10086,7 +11521,7 @@ void Tgrid::Tnode::sph_CN1_ne()
     for (int a=0; a<8; a++) {
         c = cell[0][0][a];
         if (c == 0) continue;
-        register const gridreal weight = c->sph_dV;
+        register const gridreal weight = c->sph_metric->dV;
         ne+=weight*c->rho_q;
         weightsum+= weight;
     }
@@ -10377,6 +11812,11 @@ void Tgrid::Tcell::sph_calc_node_ue_recursive()
 void Tgrid::sph_calc_node_ue()
 {
     int i,j,k,c;
+    if (update_uniform()) {
+        const int n = uniform_nodes.size();
+        for (c=0; c<n; c++) uniform_nodes[c]->sph_calc_ue1();
+        return;
+    }
     for (i=0; i<nx-1; i++) for (j=0; j<ny-1; j++) for (k=0; k<nz-1; k++) {
                 c = flatindex(i,j,k);
                 cells[c]->sph_calc_node_ue_recursive();
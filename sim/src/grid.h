@@ -21,8 +21,11 @@
 
 #include <fstream>
 #include <cstring>
+#include <algorithm>
+#include <map>
 #include "definitions.h"
 #include "particle.h"
+#include "scheduler.h"
 #include "atmosphere.h"
 #include "refinement.h"
 #include "resistivity.h"
@@ -62,23 +65,23 @@ class Tgrid
 public:
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
     //! Grid cell face average quantities
-    enum TFaceDataSelect {FACEDATA_B=0, FACEDATA_J=1, FACEDATA_BSTAR=2, FACEDATA_MINUSDB=3, FACEDATA_AVEB=4};
+    enum TFaceDataSelect {FACEDATA_B=0, FACEDATA_J=1, FACEDATA_BSTAR=2, FACEDATA_MINUSDB=3, FACEDATA_AVEB=4, FACEDATA_B0=5};
     //! Grid cell node quantities
-    enum TNodeDataSelect {NODEDATA_B=0, NODEDATA_UE=1, NODEDATA_E=2, NODEDATA_J=3, NODEDATA_Ji=4, NODEDATA_ne=5};
+    enum TNodeDataSelect {NODEDATA_B=0, NODEDATA_UE=1, NODEDATA_E=2, NODEDATA_J=3, NODEDATA_Ji=4, NODEDATA_ne=5, NODEDATA_B0=6};
     //! Grid cell volume average quantities
     enum TCellDataSelect {CELLDATA_Ji=0, CELLDATA_UE=1, CELLDATA_J=2, CELLDATA_B=3, CELLDATA_TEMP1=4, CELLDATA_TEMP2=5};
-    enum {NFACEDATA=5};
+    enum {NFACEDATA=6};
     enum {NCELLDATA=6};
-    enum {NNODEDATA=6};
+    enum {NNODEDATA=7};
 #else
     //! (SPHERICAL) Grid cell face average quantities
-    enum TFaceDataSelect {FACEDATA_B=0, FACEDATA_J=1, FACEDATA_BSTAR=2, FACEDATA_MINUSDB=3, FACEDATA_AVEB=4, FACEDATA_UE=5};
+    enum TFaceDataSelect {FACEDATA_B=0, FACEDATA_J=1, FACEDATA_BSTAR=2, FACEDATA_MINUSDB=3, FACEDATA_AVEB=4, FACEDATA_UE=5, FACEDATA_B0=6};
     //! (SPHERICAL) Grid cell node quantities
-    enum TNodeDataSelect {NODEDATA_B=0, NODEDATA_UE=1, NODEDATA_E=2, NODEDATA_J=3, NODEDATA_Ji=4, NODEDATA_ne=5, NODEDATA_TEMP2=6};
+    enum TNodeDataSelect {NODEDATA_B=0, NODEDATA_UE=1, NODEDATA_E=2, NODEDATA_J=3, NODEDATA_Ji=4, NODEDATA_ne=5, NODEDATA_TEMP2=6, NODEDATA_B0=7};
     //! (SPHERICAL) Grid cell volume average quantities
     enum TCellDataSelect {CELLDATA_Ji=0, CELLDATA_UE=1, CELLDATA_J=2, CELLDATA_B=3, CELLDATA_TEMP1=4, CELLDATA_TEMP2=5, CELLDATA_E=6, CELLDATA_J_TEMP=7, CELLDATA_B_TEMP1=8, CELLDATA_B_TEMP2=9};
-    enum {NFACEDATA=6};
-    enum {NNODEDATA=7};
+    enum {NFACEDATA=7};
+    enum {NNODEDATA=8};
     enum {NCELLDATA=10};
 #endif
     //! Get nth bit of word (n=0 is leftmost)
@@ -102,7 +105,67 @@ private:
     struct Tnode; //!< Grid cell node
     typedef Tnode *TNodePtr; //! Grid node pointer
     typedef Tface *TFacePtr; //! Grid face pointer
+public:
     typedef Tcell *TCellPtr; //! Grid cell pointer
+private:
+#if defined(SAVE_POPULATION_AVERAGES) || defined(SAVE_PARTICLE_CELL_SPECTRA)
+    //! Contiguous nrows x ncols records of leaf cells, addressed by slot number
+    struct TCellSideTable {
+        int nrows, ncols;
+        std::vector<datareal> data;
+        std::vector<int> freeslots; //!< Released slots, reused by alloc
+        void init(int rows, int cols) {
+            nrows = rows;
+            ncols = cols;
+            data.clear();
+            freeslots.clear();
+        }
+        //! Allocate a zeroed record and return its slot
+        int alloc() {
+            const int len = nrows*ncols;
+            int slot;
+            if (freeslots.empty()) {
+                slot = len > 0 ? int(data.size())/len : 0;
+                data.resize(data.size() + len, 0.0);
+            } else {
+                slot = freeslots.back();
+                freeslots.pop_back();
+                std::fill(data.begin() + slot*len, data.begin() + (slot+1)*len, 0.0);
+            }
+            return slot;
+        }
+        void release(int slot) {
+            if (slot >= 0) freeslots.push_back(slot);
+        }
+        datareal *row(int slot, int r) {
+            return &data[(slot*nrows + r)*ncols];
+        }
+        //! Copy record src to record dst
+        void copy(int dst, int src) {
+            const int len = nrows*ncols;
+            std::copy(data.begin() + src*len, data.begin() + (src+1)*len, data.begin() + dst*len);
+        }
+    };
+#endif
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+    /** \brief (SPHERICAL) Metric coefficients of a cell
+     *
+     * The coefficients depend only on the radial and latitudinal indices (i,j),
+     * so they are stored once per (i,j) in Tgrid::sph_metrics and shared by all
+     * cells along phi.
+     */
+    struct TSphMetric {
+        gridreal coor[2]; //!< r and theta of the lower corner
+        gridreal coor_next[2]; //!< r and theta of the upper corner
+        gridreal size[3]; //!< dr, dtheta, dphi
+        gridreal dl[3]; //!< Line elements
+        gridreal diag; //!< Diagonal
+        gridreal dS[3]; //!< Areas of the lower faces
+        gridreal dS_centroid[3]; //!< Areas through the centroid
+        gridreal dS_next[3]; //!< Areas of the upper faces
+        gridreal dV; //!< Cell volume
+    };
+#endif
     //! Grid cell
     struct Tcell PUBLIC_TOBJECT {
         bool haschildren; //!< Has the cell child cells?
@@ -127,6 +190,8 @@ private:
         TCellPtr neighbour[3][2]; //!< Pointers to direct neighbouring cells (without refinement)
         int flatind; //!< Flatindex of the cell (root cell), or childorder (0..7) for non-root cell
         int running_index; //!< Used when saving to file only, need not even be initialized
+        int pic_stencil; //!< Leaf cell: index of the 3x3x3 deposition stencil in Tgrid::pic_stencil_cells, or -1
+        unsigned char pic_regular; //!< Leaf cell: bit n set if the stencil is valid for octant n (see accumulate_PIC)
         //! Def: cell is root cell iff parent==0.
         union {
             TFacePtr face[3][2]; //!< Leaf cell: dim=0,1,2 (x/y/z), direction=0,1 (left/right)
@@ -138,14 +203,35 @@ private:
         datareal rho_q_bg; //!< Background charge density inside the cell [C/m^3]
         datareal ave_nc; //!< Temporally averaged density inside the cell [#/m^3]
 #ifdef SAVE_POPULATION_AVERAGES
-        std::vector<datareal> pop_ave_n; //!< Temporal population average: density
-        std::vector<datareal> pop_ave_vx; //!< Temporal population average: vx
-        std::vector<datareal> pop_ave_vy; //!< Temporal population average: vy
-        std::vector<datareal> pop_ave_vz; //!< Temporal population average: vz
+        int pop_ave_slot; //!< Leaf cell: record in Tgrid::pop_ave_table, or -1
+        //! Temporal population average: density
+        datareal& pop_ave_n(int popid) const {
+            return pop_ave_table.row(pop_ave_slot,0)[popid];
+        }
+        //! Temporal population average: vx
+        datareal& pop_ave_vx(int popid) const {
+            return pop_ave_table.row(pop_ave_slot,1)[popid];
+        }
+        //! Temporal population average: vy
+        datareal& pop_ave_vy(int popid) const {
+            return pop_ave_table.row(pop_ave_slot,2)[popid];
+        }
+        //! Temporal population average: vz
+        datareal& pop_ave_vz(int popid) const {
+            return pop_ave_table.row(pop_ave_slot,3)[popid];
+        }
 #endif
 #ifdef SAVE_PARTICLE_CELL_SPECTRA
-        std::vector< std::vector<datareal> > spectra; //!< Particle cell energy spectra
+        int spectra_slot; //!< Leaf cell: record in Tgrid::spectra_table, or -1
+        //! Particle cell energy spectrum of a population (Params::spectraNbins bins)
+        datareal *spectra(int popid) const {
+            return spectra_table.row(spectra_slot,popid);
+        }
 #endif
+        void alloc_side_records();
+        void release_side_records();
+        void copy_side_records(const Tcell& src);
+        void average_side_records();
         datareal celldata[NCELLDATA][3]; //!< Cell data
         gridreal centroid[3]; //!< Centroid coordinates of the cell
         gridreal r2; //!< Square of the distance to the box origin [m^2]
@@ -159,12 +245,20 @@ private:
         void FC_recursive(TFaceDataSelect fs, TCellDataSelect cs);
         void NC_smoothing_recursive();
         void NC_recursive(TNodeDataSelect ns,TCellDataSelect cs);
+        void NC1(TNodeDataSelect ns,TCellDataSelect cs);
         void CN_recursive(TCellDataSelect cs, TNodeDataSelect ns);
         void CN_smoothing_recursive();
+        void NC_weights(std::map<TNodePtr,real>& weights) const;
+        void CN_nodes_recursive(std::vector<TNodePtr>& nodes) const;
+        void collect_leaves_recursive(std::vector<TCellPtr>& leaves);
         void CN_rhoq_recursive();
         void CN_donor_recursive(TCellDataSelect cs, TNodeDataSelect ns, TNodeDataSelect uns, real dt);
         void zero_rhoq_nc_Vq_recursive();
         void calc_ue_recursive(void);
+        void celldata_scale_add_recursive(TCellDataSelect dst, TCellDataSelect src, real factor, bool accumulate);
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+        void calc_level_CFL_recursive(real fdt, std::vector<real>& whistler, std::vector<real>& ue, std::vector<int>& ncells) const;
+#endif
         void calc_node_E_recursive(void);
         void calc_cell_E_recursive(void);
 #ifdef USE_SPHERICAL_COORDINATE_SYSTEM
@@ -174,16 +268,22 @@ private:
         void NF_recursive(TNodeDataSelect ns, TFaceDataSelect fs, int d);
         void NF_rhoq_recursive(int d);
         void FacePropagate_recursive(TFaceDataSelect Bold, TFaceDataSelect Bnew, real dt);
-        void set_B_recursive(void (*)(const gridreal[3], datareal[3]));
+        void set_B_recursive(void (*)(const gridreal[3], real[3]));
+        void set_B0_recursive();
         void set_bgRhoQ_recursive(BackgroundChargeDensityProfile func);
         void calc_facediv_recursive(TFaceDataSelect fs, MagneticLog& result) const;
         void CalcGradient_rhoq_recursive();
         int Ncells_recursive() const;
         int Nfaces() const;
         int Nparticles_recursive() const;
+        void count_recursive(int& nleaves, int& nparticles) const;
         void enum_children_recursive();
         void writeMHD_children_recursive(std::ostream& o,const int filetype,std::vector<int> popId) const;
         void writeMHD(std::ostream& o,const int filetype,std::vector<int> popId) const;
+        void calcMHD(const int filetype,std::vector<int>& popId,real v[11]) const;
+        void writeTopology_children_recursive(std::ostream& o) const;
+        void writeTopology(std::ostream& o) const;
+        void leaves_recursive(std::vector<const Tcell*>& leaves) const;
         void writeDBUG_children_recursive(std::ostream& o) const;
         void writeDBUG(std::ostream& o) const;
         void writeEXTRA_children_recursive(std::ostream& o,ScalarField* s) const;
@@ -206,7 +306,7 @@ private:
         void begin_average_recursive();
         void end_average_recursive(real inv_ave_ntimes);
         void set_resistivity_recursive(ResistivityProfile res);
-        void prepare_PDF_recursive(ScalarField* pdffunc, Tgrid*);
+        void prepare_PDF_recursive(ScalarField* pdffunc, std::vector<real>& pdf, std::vector<TCellPtr>* cellptrs);
         void generate_random_point(gridreal r[3]);
         void cellintpol_fluid(real& n, real& vx, real& vy, real& vz, real& P, std::vector<int> popId);
 #ifdef SAVE_PARTICLES_ALONG_ORBIT
@@ -222,15 +322,7 @@ private:
         gridreal sph_invsizey; //!< (SPHERICAL) 
         gridreal sph_invsizez; //!< (SPHERICAL) 
         gridreal sph_centroid[3]; //!< (SPHERICAL) 
-        gridreal sph_coor[3]; //!< (SPHERICAL) 
-        gridreal sph_coor_next[3]; //!< (SPHERICAL) 
-        gridreal sph_size[3]; //!< (SPHERICAL) 
-        gridreal sph_dl[3]; //!< (SPHERICAL) 
-        gridreal sph_diag; //!< (SPHERICAL) 
-        gridreal sph_dS[3]; //!< (SPHERICAL) 
-        gridreal sph_dS_centroid[3]; //!< (SPHERICAL) 
-        gridreal sph_dS_next[3]; //!< (SPHERICAL) 
-        gridreal sph_dV; //!< (SPHERICAL) Cell volume
+        const TSphMetric *sph_metric; //!< (SPHERICAL) Metric coefficients, shared by the cells with the same i,j
         void sph_FC_recursive(TFaceDataSelect fs, TCellDataSelect cs, int FC_boundary_flag);
         void FC_copy_recursive(TFaceDataSelect fs, TCellDataSelect cs);
         void sph_NC_smoothing_recursive();
@@ -280,7 +372,7 @@ private:
     struct Tface PUBLIC_TOBJECT {
         TNodePtr node[4]; //!< Pointers to the four corner nodes in (-y,-z),(+y,-z),(+y,+z),(-y,+z) order (cyclic order)
         TNodePtr sidenode[4]; //!< sidenode[0] is between node[0] and node[1], sidenode[1] between node[1] and node[2], etc.
-        datareal facedata[NFACEDATA]; //!< B and j (FACEDATA_B, FACEDATA_J)
+        datareal facedata[NFACEDATA]; //!< B and j (FACEDATA_B, FACEDATA_J), normal component of constant B0 (FACEDATA_B0)
         Tface() {
             memset(facedata,0,sizeof(datareal)*NFACEDATA);
             node[0] = node[1] = node[2] = node[3] = 0;
@@ -290,9 +382,10 @@ private:
         void NF1(TNodeDataSelect ns, TFaceDataSelect fs, int d);
         void NF_rhoq1();
         void Propagate1(TFaceDataSelect Bold, TFaceDataSelect Bnew, real dt);
+        void set_B0(int d);
         //! Set magnetic field (B1) on a face
-        void set_B1(const gridreal r[3], void (*f)(const gridreal[3], datareal[3]), int d) {
-            datareal b[3];
+        void set_B1(const gridreal r[3], void (*f)(const gridreal[3], real[3]), int d) {
+            real b[3];
             (*f)(r, b);
             facedata[FACEDATA_B] = b[d];
         }
@@ -395,9 +488,12 @@ private:
     };
     //! Probability density function (PDF) object associated with Tgrid
     struct TPDFTable {
-        int n; //!< Number of interior cells, length of tables
-        shortreal *cpdf; //!< Cumulative PDF, monotonically increasing from 0 to 1, vector of length n
-        TCellPtr *cellptrs; //!< Pointer to interior cell for each CPDF entry, vector of length n (computed only for the FIRST PDF allocated (pdftables[0]) because it is the same for subsequent ones)
+        int n; //!< Number of cells with non-zero probability, length of prob, alias and cellindex
+        shortreal *prob; //!< Walker/Vose alias table: probability of keeping entry i
+        int *alias; //!< Walker/Vose alias table: entry chosen instead of i
+        int *cellindex; //!< Index of the cell of entry i in pdftables[0].cellptrs
+        int ncells; //!< Number of interior leaf cells, length of cellptrs
+        TCellPtr *cellptrs; //!< Pointer to each interior leaf cell (computed only for the FIRST PDF allocated (pdftables[0]) because it is the same for subsequent ones)
     };
 
     // ---------------- Private data of Tgrid: ------------------
@@ -407,20 +503,92 @@ private:
     gridreal bgdx,invbgdx; //!< Grid spacing (isotropic) and its inverse (invbgdx=1/bgdx)
     real inv_unit; //!< 1/(smallest representable unit wrt. gridreal "epsilon")
     TCellPtr *cells;
-    TCellPtr saved_cellptr; //!< Routines which get r[3] as input saves the found cell here (avoids unnecessary findcell() call)
+    static THREAD_LOCAL TCellPtr saved_cellptr; //!< Routines which get r[3] as input saves the found cell here (avoids unnecessary findcell() call)
     const static char *celldata_names[NCELLDATA];
     static int cell_running_index; //!< Running cell index
     static TPtrHash *hp;
+#ifdef SAVE_POPULATION_AVERAGES
+    static TCellSideTable pop_ave_table; //!< Population averages of leaf cells: rows n,vx,vy,vz, one column per population
+#endif
+#ifdef SAVE_PARTICLE_CELL_SPECTRA
+    static TCellSideTable spectra_table; //!< Spectra of leaf cells: one row per population, one column per bin
+#endif
     int n_particles; //!< Number of macro particles
     int ave_ntimes; //!< Temporal averaging counter
-    TCellPtr previous_found_cell;
+    static THREAD_LOCAL TCellPtr previous_found_cell; //!< Last cell found by findcell (per thread)
+    TCellBlockScheduler scheduler; //!< Scheduler of concurrent root cell passes
+    std::vector<int> block_cells[2]; //!< Flat indices of all (0) and interior (1) root cells for block_pass
+    std::vector<real> block_cost; //!< Cost estimates of the root cells of a block_pass
+    std::vector<TCellPtr> pic_stencil_cells; //!< 3x3x3 neighbourhoods of leaf cells for accumulate_PIC, ghost cells reflected
+    bool pic_stencils_valid; //!< False if the grid has changed after build_PIC_stencils
+    int grid_version; //!< Incremented when the grid is refined or recoarsened
+    int B0_grid_version; //!< grid_version when NODEDATA_B0 and FACEDATA_B0 were set, -1 if never
+    int uniform_grid_version; //!< grid_version when uniform_mesh was determined, -1 if never
+    bool uniform_mesh; //!< True if no root cell has children (see update_uniform)
+    std::vector<TNodePtr> uniform_nodes; //!< Uniform mesh: nodes visited by CN and the other node loops
+    std::vector<TFacePtr> uniform_curlfaces[3]; //!< Uniform mesh: faces normal to d visited by FaceCurl and NF
+    std::vector<TFacePtr> uniform_propfaces; //!< Uniform mesh: faces visited by FacePropagate
+    std::vector<TCellPtr> uniform_cells; //!< Uniform mesh: interior cells visited by FC and NC
+    //! One stream of hc time series snapshots (saveHC = 3), e.g. the plasma files
+    struct THCSeriesStream {
+        std::string lastfile; //!< Previous snapshot, reference of the next delta snapshot
+        std::vector<unsigned char> lastdata; //!< Data arrays of lastfile before delta encoding
+        int nsaved; //!< Snapshots written since the topology file
+        THCSeriesStream() : nsaved(0) { }
+    };
+    std::string hcseries_topology; //!< Topology file of the current grid, empty if not written yet
+    int hcseries_grid_version; //!< grid_version when hcseries_topology was written
+    std::vector<const Tcell*> hcseries_leaves; //!< Leaf cells in the order of the snapshot data arrays
+    std::map<std::string,THCSeriesStream> hcseries_streams; //!< Streams by file type and population ids
+    //! nc, rho_q and CELLDATA_Ji summed over the 3x3x3 stencil of pic_tile_cell
+    struct TPICTile {
+        real nc, rho_q, Ji[3];
+    } pic_tile[27];
+    TCellPtr pic_tile_cell; //!< Cell whose stencil pic_tile covers, or null if the tile is empty
+    TCellPtr pic_tile_last_cell; //!< Cell found by the previous accumulate_PIC call with a regular octant
+    typedef std::map<int,real> TSmoothingRow; //!< Sparse row: value array index -> weight
+    typedef std::map<const Tcell*,int> TSmoothingIndex; //!< Value array index of the interior leaf cells
+    typedef std::map<const Tcell*,TSmoothingRow> TSmoothingGhosts; //!< Ghost cells as combinations of interior leaf cells
+    /** \brief One smoothing iteration as a sparse operator y = A*x on a flat value array
+     *
+     * Rows with the 27-point binomial stencil (1,2,1)^3/64 of a regular
+     * neighbourhood store only the columns, other rows (refinement
+     * interfaces, next to ghost cells) store explicit weights.
+     */
+    struct TSmoothingMatrix {
+        int grid_version; //!< grid_version the operator was built for
+        bool valid; //!< False if the grid is not supported, the recursive passes are used instead
+        std::vector<int> rowstart; //!< Columns of row r are col[rowstart[r]..rowstart[r+1]-1]
+        std::vector<int> col; //!< Value array indices
+        std::vector<int> wstart; //!< Weights of row r start at w[wstart[r]], -1 = binomial stencil
+        std::vector<real> w;
+        real binomial[27]; //!< Binomial stencil weights in the order (dx*3 + dy)*3 + dz
+        TSmoothingMatrix();
+        void clear();
+        int Nrows() const {
+            return rowstart.size() - 1;
+        }
+        void addrow(const TSmoothingRow& row, const gridreal r0[3], gridreal h, const std::vector<const gridreal*>& pos);
+        template <int NCOMP> void apply(const real *x, real *y) const;
+    };
+    TSmoothingMatrix smooth_density; //!< smoothing() operator on smooth_cells
+    TSmoothingMatrix smooth_E; //!< smoothing_E() operator on smooth_nodes, rows are the nodes updated by CN
+    std::vector<TCellPtr> smooth_cells; //!< Interior leaf cells in the value array order of smooth_density
+    std::vector<TNodePtr> smooth_nodes; //!< Nodes in the value array order of smooth_E
+    std::vector<real> smooth_x, smooth_y; //!< Value arrays of the smoothing iterations
     enum {MAX_PDFTABLES = 100};
     TPDFTable pdftables[MAX_PDFTABLES];
     int n_pdftables; //!< Length of entries in pdftables, initially 0
-    int pdftable_iterator; //!< Used only by prepare_PDF, prepare_PDF_recursive
     
     // ---------------- Private functions of Tgrid: --------------
 
+    static void init_side_tables();
+    void hc_enumerate();
+    void hcwrite_geometry(std::ostream& o) const;
+    void hcwrite_cellinfo(std::ostream& o) const;
+    bool hcwrite_topology(const char *fn);
+    bool hcwrite_MHD_series(const char *fn,const int filetype,const std::vector<int>& popId);
+
     //! Compute flat index of a cell
     int flatindex(int i, int j, int k) const {
         return (i*ny + j)*nz + k;
@@ -462,18 +630,36 @@ private:
         return c->neighbour[dim][movetoright];
     }
     gridreal accumulate_PIC_recursive(const TBoxDef& cloudbox, Tcell *c, gridreal invvol, const shortreal v[3], real w, int popid);
+    void accumulate_PIC_cell(Tcell *c, real accum_w, const shortreal v[3], int popid);
+    void accumulate_PIC_stencil(const Tcell *c, int octant, const shortreal r[3], const shortreal v[3], real w, int popid);
+    void accumulate_PIC_averages(Tcell *c, real accum_w, const shortreal v[3], int popid);
+    void accumulate_PIC_tile(const Tcell *c, int octant, const shortreal r[3], const shortreal v[3], real w, int popid);
+    void flush_PIC_tile();
+    TCellPtr reflect_ghost_cell(TCellPtr c) const;
+    void build_PIC_stencils();
+    bool update_uniform();
+    void build_PIC_stencil_recursive(Tcell *c);
     static gridreal intersection_volume(const TBoxDef& boxA, const TBoxDef& boxB);
     static gridreal intersection_volume_samesize_nochecks(const shortreal rA[3], const gridreal rB[3], gridreal size);
     void copy_celldata(int cTo, int cFrom, TCellDataSelect cs);
     void copy_rhoq(int cTo, int cFrom);
     void copy_smoothing(int cTo, int cFrom);
     void finalize_accum_recursive(Tcell *c);
+    void neumann_pairs(std::vector<std::pair<int,int> >& pairs, bool periodic_y) const;
+    void smoothing_leaves(std::vector<TCellPtr>& leaves, TSmoothingIndex& index) const;
+    bool smoothing_ghosts(const TSmoothingIndex& index, bool periodic_y, TSmoothingGhosts& ghosts) const;
+    static bool smoothing_expand(const Tcell *c, real w, const TSmoothingIndex& index, const TSmoothingGhosts& ghosts, TSmoothingRow& row);
+    static bool smoothing_CN_weights(const Tnode *n, real w, const TSmoothingIndex& index, const TSmoothingGhosts& ghosts, TSmoothingRow& row);
+    bool build_smoothing_density();
+    bool build_smoothing_E();
+    void block_pass(TCellBlockTask& task, bool interior, bool particles);
     struct writeParticle;
     struct writeMagneticField;
     struct readMagneticField;
 #ifdef USE_SPHERICAL_COORDINATE_SYSTEM
     gridreal sph_theta_1, sph_phi_1; //!< (SPHERICAL)
     gridreal sph_bgdy, sph_bgdz, sph_bgdtheta, sph_bgdphi, sph_invbgdy, sph_invbgdz; //!< (SPHERICAL)
+    std::vector<TSphMetric> sph_metrics; //!< (SPHERICAL) Metric coefficients indexed by i*ny+j
     //! (SPHERICAL) Get size y
     gridreal sph_sizey(const Tcell *c) const {
         return c->sph_sizey;
@@ -484,7 +670,7 @@ private:
     }
     //! (SPHERICAL) Get volume
     gridreal sph_dV(const Tcell *c) const {
-        return c->sph_dV;
+        return c->sph_metric->dV;
     }
     //! (SPHERICAL) Get volume (check negative value)
     gridreal sph_volume(const Tcell *c) {
@@ -542,8 +728,19 @@ public:
         return bgdx;
     }
     void faceintpol(const shortreal r[3], TFaceDataSelect s, real result[3]);
+    void faceintpol(const shortreal r[3], TFaceDataSelect s1, TFaceDataSelect s2, real result[3]);
     void cellintpol(const shortreal r[3], TCellDataSelect s, real result[3]);
     void cellintpol(TCellDataSelect s, real result[3]) const;
+    void faceintpol_cell(TCellPtr c, const gridreal lowercorner[3], int n, const shortreal (*r)[3], TFaceDataSelect s, real (*result)[3]) const;
+    void faceintpol_cell(TCellPtr c, const gridreal lowercorner[3], int n, const shortreal (*r)[3], TFaceDataSelect s1, TFaceDataSelect s2, real (*result)[3]) const;
+    //! Cell data of cell c (like cellintpol without r)
+    void cellintpol(TCellPtr c, TCellDataSelect s, real result[3]) const {
+        for (int d=0; d<3; d++) result[d] = c->celldata[s][d];
+    }
+    //! Fluid parameters of cell c (like cellintpol_fluid without r)
+    void cellintpol_fluid(TCellPtr c, real& n, real& vx, real& vy, real& vz, real& P, std::vector<int> popId) {
+        c->cellintpol_fluid(n, vx, vy, vz, P, popId);
+    }
     void cellintpol_fluid(const shortreal r[3], real& n, real& vx, real& vy, real& vz, real& P, std::vector<int> popId);
     void cellintpol_fluid(real& n, real& vx, real& vy, real& vz, real& P, std::vector<int> popId);
     void FC(TFaceDataSelect fs, TCellDataSelect cs);
@@ -561,12 +758,17 @@ public:
     void accumulate_PIC(const shortreal r[3], const shortreal v[3], real w, int popid);
     void finalize_accum();
     void calc_ue(void);
+    void celldata_scale_add(TCellDataSelect dst, TCellDataSelect src, real factor, bool accumulate);
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    void calc_level_CFL(real fdt, std::vector<real>& whistler, std::vector<real>& ue, std::vector<int>& ncells) const;
+#endif
     void Neumann(TCellDataSelect cs);
     void Neumann_rhoq();
     void Neumann_smoothing();
     void smoothing();
     void smoothing_E();
-    void set_B(void (*)(const gridreal[3], datareal[3]));
+    void set_B(void (*)(const gridreal[3], real[3]));
+    void update_B0();
     void set_bgRhoQ(BackgroundChargeDensityProfile func);
     void boundarypass(int dim, bool toRight, void (*)(datareal cdata[NCELLDATA][3], int));
     void calc_node_E(void);
@@ -589,7 +791,7 @@ public:
     void calc_facediv(TFaceDataSelect fs, MagneticLog& result) const;
     void CalcGradient_rhoq();
     int approx_bytes_per_cell() {
-        return sizeof(Tcell) + sizeof(Tnode) + 3*sizeof(Tface);
+        return sizeof(Tcell) + sizeof(Tnode) + 3*sizeof(Tface) + 27*sizeof(TCellPtr);
     }
     static size_t bytes_allocated() {
         return 0;
@@ -597,8 +799,42 @@ public:
     void addparticle(shortreal x, shortreal y, shortreal z,
                      shortreal vx,shortreal vy,shortreal vz,
                      shortreal w, int popid, bool inject=true);
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    //! Leaf cell crossed by an inflow plane and its rectangle on the plane
+    struct TInflowCell {
+        TCellPtr cell;
+        gridreal lo[2]; //!< Lower corner along dimensions (dim+1)%3 and (dim+2)%3
+        gridreal size[2]; //!< Rectangle size along the same dimensions
+    };
+    //! Leaf cells crossed by the plane r[dim] = coord inside a rectangle (see update_inflow_layer)
+    struct TInflowLayer {
+        int dim;
+        gridreal coord;
+        gridreal lo[2], hi[2]; //!< Rectangle along dimensions (dim+1)%3 and (dim+2)%3
+        int grid_version; //!< Tgrid::grid_version when the layer was built
+        std::vector<TInflowCell> cells;
+        std::vector<real> cumarea; //!< cumarea[i] = area of cells[0..i-1], cumarea.back() = total area
+        TInflowLayer() : dim(-1), coord(0), grid_version(-1) {
+            lo[0] = lo[1] = hi[0] = hi[1] = 0;
+        }
+    };
+    //! Random point on an inflow layer and the cell containing it
+    struct TInflowPoint {
+        TCellPtr cell; //!< Null if the point is outside the grid
+        shortreal r[3];
+    };
+    void update_inflow_layer(TInflowLayer& layer, int dim, gridreal coord, const gridreal lo[2], const gridreal hi[2]);
+    void sample_inflow_layer(const TInflowLayer& layer, int n, std::vector<TInflowPoint>& points) const;
+    void addparticle(TCellPtr c, shortreal x, shortreal y, shortreal z,
+                     shortreal vx,shortreal vy,shortreal vz,
+                     shortreal w, int popid, bool inject=true);
+private:
+    void build_inflow_layer_recursive(TInflowLayer& layer, Tcell *c);
+public:
+#endif
     template <class Func> int particle_pass(Func op, bool relocate=false);
     int particle_pass(bool (*op)(TLinkedParticle& p, ParticlePassArgs a), bool relocate=false);
+    template <class Func> int particle_pass_concurrent(Func op);
     template <class Func> void cellPass(Func op);
     /** \brief Call operator for all particles in the grid
      *
@@ -611,12 +847,24 @@ public:
         return particle_pass(op,true);
     }
     int Nparticles() const;
+    //! Scheduler of concurrent passes (threads and stealing statistics)
+    const TCellBlockScheduler& getScheduler() const {
+        return scheduler;
+    }
     void split_and_join(int& nsplit, int& njoined);
     int forbid_split_and_join(ForbidSplitAndJoinProfile forb);
     void begin_average();
     bool end_average();
-    void prepare_PDF(ScalarField* pdffunc, TPDF_ID& pdfid, real& cumsumvalue);
+    void prepare_PDF(ScalarField* pdffunc, TPDF_ID& pdfid, real& cumsumvalue, gridreal rmin=0);
+    TCellPtr generate_random_cell(const TPDF_ID& pdfid);
     void generate_random_point(const TPDF_ID& pdfid, gridreal r[3]);
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    void generate_random_cells(const TPDF_ID& pdfid, int n, std::vector<TCellPtr>& result);
+    //! Generate random point in a cell returned by generate_random_cell(s)
+    void generate_random_point(TCellPtr c, gridreal r[3]) const {
+        c->generate_random_point(r);
+    }
+#endif
     void boundary_faces(TFaceDataSelect cs);
     void CN_ne();
     void calc_node_j();
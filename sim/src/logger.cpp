@@ -28,12 +28,17 @@ using namespace std;
 
 unsigned long int Logger::totalLogLines = 1;
 int Logger::lineHeaderChars = 14;
+Logger* Logger::firstLogger = 0;
+LogRateLimit* LogRateLimit::firstSite = 0;
+unsigned long int LogRateLimit::maxPerInterval = 10;
 
 //! Constructor
 Logger::Logger(const char* filename, const unsigned long int maxLines, const bool headerAndLineNumberingg) : logName(filename)
 {
     maxLogLines = maxLines;
     logfile = new std::fstream(NULL,std::fstream::out);
+    nextLogger = Logger::firstLogger;
+    Logger::firstLogger = this;
     if (headerAndLineNumberingg == true) {
         headerAndLineNumbering = true;
     } else {
@@ -168,20 +173,18 @@ Logger& Logger::operator<<(std::ostream& (*pf)(std::ostream& ))
     if(checkCounter() == false) {
         return *this;
     }
-    // Check whether the stream manipulator is std::endl
+    // Check whether the stream manipulator is std::endl (written without flushing, see flushAll)
     if (pf == static_cast<std::ostream& (*)(std::ostream&)>(std::endl)) {
         (*logfile) << insertLineHeaders("\n");
     } else {
         (*logfile) << pf;
     }
-    (*logfile) << std::flush;
     return *this;
 }
 
 Logger& Logger::operator<<(std::ios_base& (*pf)(std::ios_base& ))
 {
     (*logfile) << pf;
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -195,7 +198,6 @@ Logger& Logger::operator<<(const char msg)
     // Construct a string from char
     string msgStr(1, msg);
     (*logfile) << insertLineHeaders(msgStr);
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -208,7 +210,6 @@ Logger& Logger::operator<<(const char* msg)
     }
     string msgStr(msg);
     (*logfile) << insertLineHeaders(msgStr);
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -220,7 +221,6 @@ Logger& Logger::operator<<(const string msg)
         return *this;
     }
     (*logfile) << insertLineHeaders(msg);
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -232,7 +232,6 @@ Logger& Logger::operator<<(const float val)
         return *this;
     }
     (*logfile) << val;
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -244,7 +243,6 @@ Logger& Logger::operator<<(const double val)
         return *this;
     }
     (*logfile) << val;
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -256,7 +254,6 @@ Logger& Logger::operator<<(const unsigned long int val)
         return *this;
     }
     (*logfile) << val;
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -268,7 +265,6 @@ Logger& Logger::operator<<(const int val)
         return *this;
     }
     (*logfile) << val;
-    (*logfile) << std::flush;
     return *this;
 }
 
@@ -277,6 +273,38 @@ void Logger::flush()
     logfile->flush();
 }
 
+/** \brief Flush all loggers
+ *
+ * Loggers write through the file buffer without flushing after each
+ * operand or std::endl. This is called once per timestep and by doabort().
+ */
+void Logger::flushAll()
+{
+    for(Logger* l = Logger::firstLogger; l != 0; l = l->nextLogger) {
+        l->flush();
+    }
+}
+
+//! Constructor (registers the call site for writeSummaries)
+LogRateLimit::LogRateLimit(Logger& logger, const char* fileName, const int lineNumber) : log(logger), file(fileName), line(lineNumber)
+{
+    count = 0;
+    next = LogRateLimit::firstSite;
+    LogRateLimit::firstSite = this;
+}
+
+//! Write the number of messages suppressed at each call site since the previous call and reset the counts
+void LogRateLimit::writeSummaries()
+{
+    for(LogRateLimit* s = LogRateLimit::firstSite; s != 0; s = s->next) {
+        if(s->count > maxPerInterval) {
+            s->log << "WARNING [" << s->file << "/" << s->line << "]: " << s->count - maxPerInterval
+                   << " repeated messages suppressed (" << s->count << " in total since the previous log interval)\n";
+        }
+        s->count = 0;
+    }
+}
+
 void Logger::doChecks()
 {
     checkFirstLine();
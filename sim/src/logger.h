@@ -21,11 +21,15 @@
 
 #define MAX_COUNTERS 20
 
+class LogRateLimit;
+
 //! Log file writer
 class Logger
 {
 private:
     static unsigned long int totalLogLines; //!< Number of total counted log lines
+    static Logger* firstLogger; //!< All constructed loggers, linked by nextLogger
+    Logger* nextLogger;
     static int lineHeaderChars; //!< Number of header chars in each line
     const char* logName; //!< Log file name
     std::fstream* logfile; //!< Log file stream
@@ -68,6 +72,7 @@ public:
     std::streamsize width() const;
     std::streamsize width(std::streamsize wide);
     void flush();
+    static void flushAll();
     void setCounterInterval(const int);
     void zeroCounter();
     void zeroAllCounters();
@@ -91,5 +96,30 @@ public:
     Logger& operator<<(const unsigned long int);
 };
 
+/** \brief Rate limit of a log message call site
+ *
+ * Use as a function-local static (see ERRORMSG_LIMITED). At most
+ * maxPerInterval messages per log interval are written, the rest are
+ * counted and reported by writeSummaries().
+ */
+class LogRateLimit
+{
+private:
+    static LogRateLimit* firstSite; //!< All constructed call sites, linked by next
+    LogRateLimit* next;
+    Logger& log;
+    const char* file;
+    const int line;
+    unsigned long int count; //!< Messages since the previous writeSummaries call
+public:
+    static unsigned long int maxPerInterval;
+    LogRateLimit(Logger& logger, const char* fileName, const int lineNumber);
+    //! Count a message, return true if it should be written
+    bool allow() {
+        return ++count <= maxPerInterval;
+    }
+    static void writeSummaries();
+};
+
 #endif
 
@@ -34,7 +34,7 @@ VectorField::VectorField() { }
 VectorField::~VectorField() { }
 
 //! Dummy implementation for a virtual interface function
-void VectorField::getValue(const gridreal r[3],datareal V[3])
+void VectorField::getValue(const gridreal r[3],real V[3])
 {
     WARNINGMSG("dummy implementation function called");
 }
@@ -98,13 +98,13 @@ MagneticFieldProfile::MagneticFieldProfile(string funcName,vector<real> args)
 MagneticFieldProfile::~MagneticFieldProfile() { }
 
 //! Returns the magnetic field value at point r
-void MagneticFieldProfile::getValue(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::getValue(const gridreal r[3],real B[3])
 {
     (this->*ptr)(r,B);
 }
 
 //! Default function, which aborts the program if called
-void MagneticFieldProfile::defaultFunction(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::defaultFunction(const gridreal r[3],real B[3])
 {
     ERRORMSG("function pointer not set");
     doabort();
@@ -142,7 +142,7 @@ void MagneticFieldProfile::setArgs_constantB()
 }
 
 //! Constant homogeneous B field
-void MagneticFieldProfile::constantB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::constantB(const gridreal r[3],real B[3])
 {
     B[0] += Bx;
     B[1] += By;
@@ -164,7 +164,7 @@ void MagneticFieldProfile::setArgs_constantBx()
     Bx = args[0];
 }
 //! Constant homogeneous Bx field
-void MagneticFieldProfile::constantBx(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::constantBx(const gridreal r[3],real B[3])
 {
     B[0] += Bx;
 }
@@ -214,7 +214,7 @@ void MagneticFieldProfile::setArgs_laminarFlowAroundSphereB()
 }
 
 //! General potential flow field around a sphere
-void MagneticFieldProfile::laminarFlowAroundSphereB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::laminarFlowAroundSphereB(const gridreal r[3],real B[3])
 {
     /*
      Components of the magnetic field:
@@ -251,9 +251,9 @@ void MagneticFieldProfile::laminarFlowAroundSphereB(const gridreal r[3],datareal
     z1 = -x*sinTheta + z*cosTheta;
     // laminar flow in X direction
     real coeff = -1.5 * Btot * R3 * x1 / r5;
-    datareal B_x = coeff * x1 + Btot * (1 + 0.5 * R3 / r3);
-    datareal B_y = coeff * y1;
-    datareal B_z = coeff * z1;
+    real B_x = coeff * x1 + Btot * (1 + 0.5 * R3 / r3);
+    real B_y = coeff * y1;
+    real B_z = coeff * z1;
     // Rotation of vector field (opposite direction)
     B_x1 = B_x*cosTheta - B_z*sinTheta;
     B_y1 = B_y;
@@ -282,7 +282,7 @@ void MagneticFieldProfile::setArgs_laminarFlowAroundSphereBx()
 }
 
 //! Potential flow field around a sphere in x-direction
-void MagneticFieldProfile::laminarFlowAroundSphereBx(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::laminarFlowAroundSphereBx(const gridreal r[3],real B[3])
 {
     real rr = normvec(r);
     // Laminar solution is valid outside the radius R, otherwise don't add the laminar field
@@ -319,7 +319,7 @@ void MagneticFieldProfile::setArgs_dipoleB()
 }
 
 //! Dipole field in the z-direction located at (0,0,0)
-void MagneticFieldProfile::dipoleB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::dipoleB(const gridreal r[3],real B[3])
 {
     const gridreal x = r[0];
     const gridreal y = r[1];
@@ -362,7 +362,7 @@ void MagneticFieldProfile::setArgs_translateDipoleB()
 }
 
 //! Dipole field in the z-direction located at (x0,y0,z0)
-void MagneticFieldProfile::translateDipoleB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::translateDipoleB(const gridreal r[3],real B[3])
 {
     const gridreal x = r[0] - xOrigin;
     const gridreal y = r[1] - yOrigin;
@@ -435,7 +435,7 @@ void MagneticFieldProfile::setArgs_generalDipoleB()
 }
 
 //! Rotated dipole field located at (x0,y0,z0)
-void MagneticFieldProfile::generalDipoleB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::generalDipoleB(const gridreal r[3],real B[3])
 {
     const gridreal x = r[0] - xOrigin;
     const gridreal y = r[1] - yOrigin;
@@ -468,9 +468,9 @@ void MagneticFieldProfile::generalDipoleB(const gridreal r[3],datareal B[3])
     const real yyy = yy*cosPhi - zz*sinPhi;
     const real zzz = yy*sinPhi + zz*cosPhi;
     // Dipole in z-direction
-    const datareal Bx = coeff * xxx * zzz;
-    const datareal By = coeff * yyy * zzz;
-    const datareal Bz = coeff * (sqr(zzz) - r2/3.0);
+    const real Bx = coeff * xxx * zzz;
+    const real By = coeff * yyy * zzz;
+    const real Bz = coeff * (sqr(zzz) - r2/3.0);
     // Rotation of field
     // B_ = R_x(-phi) B
     const real Bxx = Bx;
@@ -512,7 +512,7 @@ void MagneticFieldProfile::setArgs_hemisphericDipoleB()
 }
 
 //! Hemispheric multipole field located at (x0,y0,z0)
-void MagneticFieldProfile::hemisphericDipoleB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::hemisphericDipoleB(const gridreal r[3],real B[3])
 {
     const gridreal x = r[0] - xOrigin;
     const gridreal y = r[1] - yOrigin;
@@ -555,7 +555,7 @@ void MagneticFieldProfile::setArgs_dipoleCuspB()
 }
 
 //! Dipole field in the x-direction located at (x0,y0,z0)
-void MagneticFieldProfile::dipoleCuspB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::dipoleCuspB(const gridreal r[3],real B[3])
 {
     const gridreal x = r[0] - xOrigin;
     const gridreal y = r[1] - yOrigin;
@@ -576,7 +576,7 @@ void MagneticFieldProfile::dipoleCuspB(const gridreal r[3],datareal B[3])
 }
 
 //! Add constant magnetic field in B
-void addConstantMagneticField(const gridreal r[3], datareal B[3])
+void addConstantMagneticField(const gridreal r[3], real B[3])
 {
     // Go thru the constant magnetic field function calls (pointers actually)
     for(unsigned int i=0; i < Params::constantMagneticFieldProfile.size(); ++i) {
@@ -585,7 +585,7 @@ void addConstantMagneticField(const gridreal r[3], datareal B[3])
 }
 
 //! Set initial magnetic field in B
-void setInitialMagneticField(const gridreal r[3], datareal B[3])
+void setInitialMagneticField(const gridreal r[3], real B[3])
 {
     B[0] = 0;
     B[1] = 0;
@@ -668,7 +668,7 @@ void MagneticFieldProfile::setArgs_sph_laminarFlowAroundSphereBx()
 }
 
 //! (SPHERICAL) Spherical version of "laminarFlowAroundSphereBx"
-void MagneticFieldProfile::sph_laminarFlowAroundSphereBx(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::sph_laminarFlowAroundSphereBx(const gridreal r[3],real B[3])
 {
 // Laminar solution is valid outside the radius R, otherwise don't add the laminar field
     if (r[0] <= R) {
@@ -705,7 +705,7 @@ void MagneticFieldProfile::setArgs_sph_laminarFlowAroundSphereBz()
 }
 
 //! (SPHERICAL) Spherical version of "laminarFlowAroundSphereBx"
-void MagneticFieldProfile::sph_laminarFlowAroundSphereBz(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::sph_laminarFlowAroundSphereBz(const gridreal r[3],real B[3])
 {
 // Laminar solution is valid outside the radius R, otherwise don't add the laminar field
     if (r[0] <= R) {
@@ -750,10 +750,10 @@ void MagneticFieldProfile::setArgs_sph_dipoleB()
 }
 
 //! (SPHERICAL)
-void MagneticFieldProfile::sph_dipoleB(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::sph_dipoleB(const gridreal r[3],real B[3])
 {
     gridreal r1[3] = {r[0], r[1], r[2]};
-    datareal B_dipole[3] = {0.0 , 0.0, 0.0};
+    real B_dipole[3] = {0.0 , 0.0, 0.0};
     sph_transf_H2S_R(r1);
     sph_transf_S2C_R(r1);
     real r2 = sqr(r1[0]) + sqr(r1[1]) + sqr(r1[2]);
@@ -805,7 +805,7 @@ void MagneticFieldProfile::setArgs_sph_Br()
 }
 
 //! (SPHERICAL) Br function: Br = B0*(R0/r)^d, B0 = magnetic field at the obstacle, R0 =  Radius of the obstacle, d - index of power
-void MagneticFieldProfile::sph_Br(const gridreal r[3],datareal B[3])
+void MagneticFieldProfile::sph_Br(const gridreal r[3],real B[3])
 {
     //Hybrid to spherical coordinate transformation
     gridreal r_sph[3] = {r[0],r[1],r[2]};
@@ -29,7 +29,7 @@ class VectorField
 public:
     VectorField();
     virtual ~VectorField();
-    virtual void getValue(const gridreal r[],datareal V[]);
+    virtual void getValue(const gridreal r[],real V[]);
     bool isDefined();
 protected:
     std::string name; //!< Name of the the vector field
@@ -43,28 +43,28 @@ public:
     MagneticFieldProfile();
     MagneticFieldProfile(std::string funcName,std::vector<real> args);
     ~MagneticFieldProfile();
-    void getValue(const gridreal r[], datareal B[]);
+    void getValue(const gridreal r[], real B[]);
 private:
-    void (MagneticFieldProfile::*ptr)(const gridreal r[],datareal B[]);
-    void defaultFunction(const gridreal r[],datareal B[]);
+    void (MagneticFieldProfile::*ptr)(const gridreal r[],real B[]);
+    void defaultFunction(const gridreal r[],real B[]);
     // MAGNETIC FIELD PROFILES
-    void constantB(const gridreal r[],datareal B[]);
+    void constantB(const gridreal r[],real B[]);
     void setArgs_constantB();
-    void constantBx(const gridreal r[],datareal B[]);
+    void constantBx(const gridreal r[],real B[]);
     void setArgs_constantBx();
-    void laminarFlowAroundSphereB(const gridreal r[],datareal B[]);
+    void laminarFlowAroundSphereB(const gridreal r[],real B[]);
     void setArgs_laminarFlowAroundSphereB();
-    void laminarFlowAroundSphereBx(const gridreal r[],datareal B[]);
+    void laminarFlowAroundSphereBx(const gridreal r[],real B[]);
     void setArgs_laminarFlowAroundSphereBx();
-    void dipoleB(const gridreal r[],datareal B[]);
+    void dipoleB(const gridreal r[],real B[]);
     void setArgs_dipoleB();
-    void translateDipoleB(const gridreal r[],datareal B[]);
+    void translateDipoleB(const gridreal r[],real B[]);
     void setArgs_translateDipoleB();
-    void generalDipoleB(const gridreal r[],datareal B[]);
+    void generalDipoleB(const gridreal r[],real B[]);
     void setArgs_generalDipoleB();
-    void hemisphericDipoleB(const gridreal r[],datareal B[]);
+    void hemisphericDipoleB(const gridreal r[],real B[]);
     void setArgs_hemisphericDipoleB();
-    void dipoleCuspB(const gridreal r[],datareal B[]);
+    void dipoleCuspB(const gridreal r[],real B[]);
     void setArgs_dipoleCuspB();
     // MAGNETIC FIELD PARAMETERS
     void resetParameters();
@@ -73,20 +73,20 @@ private:
     real dipSurfB,dipSurfR,dipMomCoeff,dipRmin2,hemiCoeffDip,hemiCoeffQuad;
 #ifdef USE_SPHERICAL_COORDINATE_SYSTEM
     int  sph_dipole_dir;
-    void sph_laminarFlowAroundSphereBx(const gridreal r[],datareal B[]);
+    void sph_laminarFlowAroundSphereBx(const gridreal r[],real B[]);
     void setArgs_sph_laminarFlowAroundSphereBx();
-    void sph_laminarFlowAroundSphereBz(const gridreal r[],datareal B[]);
+    void sph_laminarFlowAroundSphereBz(const gridreal r[],real B[]);
     void setArgs_sph_laminarFlowAroundSphereBz();
-    void sph_dipoleB(const gridreal r[],datareal B[]);
+    void sph_dipoleB(const gridreal r[],real B[]);
     void setArgs_sph_dipoleB();
-    void sph_Br(const gridreal r[],datareal B[]);
+    void sph_Br(const gridreal r[],real B[]);
     void setArgs_sph_Br();
     real sph_B0, sph_R0, sph_d;
 #endif
 };
 
-void setInitialMagneticField(const gridreal r[], datareal B[]);
-void addConstantMagneticField(const gridreal r[], datareal B[]);
+void setInitialMagneticField(const gridreal r[], real B[]);
+void addConstantMagneticField(const gridreal r[], real B[]);
 void initializeMagneticField();
 
 #endif
@@ -23,6 +23,7 @@
 #include <cmath>
 #include <iomanip>
 #include <sstream>
+#include <sys/stat.h>
 #include "params.h"
 #include "simulation.h"
 #include "chemistry.h"
@@ -79,6 +80,18 @@ bool Params::readingDetector = false;
 //! Indicated whether the class is reading process config information
 bool Params::readingProcess = false;
 
+//! Modification time of the config file at the latest read
+time_t Params::configFileMTime = 0;
+
+//! Size of the config file at the latest read
+off_t Params::configFileSize = -1;
+
+//! Hash of the config file contents at the latest read
+unsigned long Params::configFileHash = 0;
+
+//! Indicates whether the config file has expressions referring to variables (re-evaluated every update)
+bool Params::configFileDynamic = false;
+
 //! Indicates whether the program execution is to be terminated
 bool Params::stoppingPhase = false;
 
@@ -588,6 +601,12 @@ real Params::rho_q_min = 0;
 //! Use predictor corrector scheme in Faraday's law [-]
 bool Params::fieldPredCor = 0;
 
+//! Number of field propagation substeps (dtField/fieldSubcycles each) per timestep [-]
+int Params::fieldSubcycles = 1;
+
+//! Number of threads of concurrent grid and particle passes (needs USE_THREADS) [-]
+int Params::threads = 1;
+
 //! Include electron pressure term in the electric field [-]
 bool Params::electronPressure = 0;
 //! Electron temperature [K]
@@ -602,6 +621,9 @@ bool Params::useJstag = false;
 //! Calculation of Ue separately in nodes [-]
 bool Params::useNodeUe = false;
 
+//! Interpolate constant field B0 to particles from face values instead of evaluating the profiles [-]
+bool Params::useFaceB0 = false;
+
 //! Parameter for gravitational acceleration
 real Params::GMdt = 0;
 
@@ -620,9 +642,12 @@ int Params::cnt_dt;
 //! Save interval for output files [s]
 real Params::saveInterval = 0;
 
-//! Whether to save HC files (0 = no, 1 = binary, 2 = ascii) [-]
+//! Whether to save HC files (0 = no, 1 = binary, 2 = ascii, 3 = binary time series) [-]
 int Params::saveHC = 0;
 
+//! HC time series: key frame interval of snapshots, XOR deltas between key frames (0 or 1 = no deltas) [-]
+int Params::hcKeyframeInterval = 0;
+
 //! Whether to save VTK files (0 = no, 1 = binary, 2 = ascii) [-]
 int Params::saveVTK = 0;
 
@@ -999,6 +1024,26 @@ void Params::updateDependantParameters()
     } else {
         propagateField = true;
     }
+    if(fieldSubcycles < 1) {
+        WARNINGMSG2("fieldSubcycles must be at least 1, setting it to 1",fieldSubcycles);
+        fieldSubcycles = 1;
+    }
+#ifndef USE_THREADS
+    if(threads > 1) {
+        WARNINGMSG2("threads > 1 needs compiling with USE_THREADS, setting threads to 1",threads);
+        threads = 1;
+    }
+#endif
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+    if(useFaceB0 == true) {
+        WARNINGMSG("face B0 interpolation is not implemented in the spherical coordinate system, setting useFaceB0 to 0");
+        useFaceB0 = false;
+    }
+    if(fieldSubcycles > 1) {
+        WARNINGMSG2("field subcycling is not implemented in the spherical coordinate system, setting fieldSubcycles to 1",fieldSubcycles);
+        fieldSubcycles = 1;
+    }
+#endif
 #ifdef SAVE_PARTICLE_CELL_SPECTRA
     // set spectra energy bins
     if(spectraNbins > 0 && spectraEmax_eV > 0 && spectraEmin_eV >=0  && spectraEmax_eV > spectraEmin_eV) {
@@ -1308,11 +1353,15 @@ void Params::initVariables()
     ADD_REAL(R_zeroFields, "Fields U_e and U are put explicitly to zero inside this radius [m]");
     ADD_REAL(R_zeroPolarizationField, "Polarization electric field is neglected inside this radius [m]");
     ADD_BOOL(fieldPredCor, "Field propagation using predictor corrector scheme []");
+    ADD_INT(fieldSubcycles, "Field propagation substeps of dtField/fieldSubcycles per timestep, ion moments frozen [-]");
+    ADD_INT(threads, "Number of threads of concurrent grid and particle passes (needs USE_THREADS) [-]");
+    makeInitConstant("threads");
     ADD_BOOL(electronPressure, "Include electron pressure term in the electric field []");
     ADD_REAL(Te, "Electron temperature [K]");
     ADD_BOOL(useGravitationalAcceleration, "Gravitational acceleration for ions [-]");
     ADD_BOOL(useJstag, "Calculation of J using jstag scheme [-]");
     ADD_BOOL(useNodeUe, "Calculation of Ue separately in nodes [-]");
+    ADD_BOOL(useFaceB0, "Interpolate constant field B0 to particles from face values instead of evaluating the profiles [-]");
     ADD_REAL(dt, "Simulation timestep [s]");
     ADD_REAL(dx, "Base grid cell size [m]");
     makeInitConstant("dx");
@@ -1322,8 +1371,9 @@ void Params::initVariables()
     ADD_REAL(rho_q_min, "Constraint: minimum charge density in a cell, rho_q = max(rho_q, rho_q_min) [C/m^3]");
     ADD_REAL(t_max, "Duration of simulation run [s]");
     ADD_REAL(saveInterval, "Save interval for output files [s]");
-    ADD_INT(saveHC, "Whether to save HC files (0 = no, 1 = binary, 2 = ascii) [-]");
-    ADD_INT(saveVTK, "Whether to save VTK files (0 = no, 1 = binary, 2 = ascii) [-]");
+    ADD_INT(saveHC, "Whether to save HC files (0 = no, 1 = binary, 2 = ascii, 3 = binary time series) [-]");
+    ADD_INT(hcKeyframeInterval, "HC time series: key frame interval of snapshots, XOR deltas between key frames (0 or 1 = no deltas) [-]");
+    ADD_INT(saveVTK, "Whether to save VTK files (0 = no, 1 = binary, 2 = ascii, 3 = XML binary, 4 = XML multiblock) [-]");
     ADD_BOOL(averaging, "Whether to save (1) or not (0) temporally averaged parameters [-]");
     ADD_BOOL(plasma_hcfile, "Whether to save (1) or not (0) plasma hc-file [-]");
     ADD_BOOL(dbug_hcfile, "Whether to save (1) or not (0) dbug hc-file [-]");
@@ -1518,6 +1568,7 @@ void Params::addVariable(void *ptr, DATATYPE type, const char *name, const char
     newVar->initconstant = 0;
     newVar->dumpping = true;
     newVar->updatedFromFile = false;
+    newVar->changed = false;
     newVar->action = (void(*)(void*))0;
     newVar->expressions = new char*[tableSize];
     last = getLast();
@@ -2248,6 +2299,11 @@ void Params::readAndUpdateVariables(const char *dumpFile)
     varDump.open(dumpFile);
     if (varDump.is_open()) {
         resetUpdatedFromFileFlags();
+        // Reset dirty flags and time dependence of the file
+        for (var = varList; var; var = var->next) {
+            var->changed = false;
+        }
+        configFileDynamic = false;
         // Reset population and process id string lists (used when checking the population or process has not been read twice)
         idStrTbl.clear();
         procIdStrTbl.clear();
@@ -2304,7 +2360,8 @@ void Params::readAndUpdateVariables(const char *dumpFile)
                             break;
                         }
                     }
-                    if(detIdStrFound == false) {
+                    // popIdStr is optional, "-" means all populations
+                    if(detIdStrFound == false && popIdStr.compare("") != 0 && popIdStr.compare("-") != 0) {
                         ERRORMSG2("population not found for particle detectors",popIdStr);
                         doabort();
                     }
@@ -2355,6 +2412,7 @@ void Params::readAndUpdateVariables(const char *dumpFile)
                         changed |= readAndUpdateVariable(varDump, var, ii);
                     }
                     if (changed) {
+                        var->changed = true;
                         // Execute action only if not in initial phase
                         if (var->action && initPhase == false) {
                             var->action(var->varPtr.ptr_void);
@@ -2386,12 +2444,92 @@ void Params::readAndUpdateVariables(const char *dumpFile)
         }
         // Write parameter log
         outParams();
+        saveConfigFileState(dumpFile);
     } else {
         errorlog << "ERROR [Params::readAndUpdateVariables]: no config file available (" << dumpFile << ")\n";
         doabort();
     }
 }
 
+/** \brief Update variables only if the config file has changed since the latest read
+ *
+ * The file is considered unchanged if its modification time and size are
+ * the same or its contents hash to the same value. Config files with
+ * expressions referring to other variables (e.g. t) are always read.
+ * Returns true if the file was read, after which variableChanged() tells
+ * which variables got new values.
+ */
+bool Params::updateVariablesIfChanged(const char *dumpFile)
+{
+    if (configFileDynamic == false && configFileUnchanged(dumpFile) == true) {
+        outParams();
+        return false;
+    }
+    readAndUpdateVariables(dumpFile);
+    return true;
+}
+
+//! Returns true if value of the variable changed in the latest config file read
+bool Params::variableChanged(const char varName[])
+{
+    struct dynamicVar *var = lookupVar(varName);
+    if (!var) {
+        ERRORMSG2("variable not found",varName);
+        doabort();
+    }
+    return var->changed;
+}
+
+//! FNV-1a hash of the file contents (0 if the file cannot be read)
+unsigned long Params::hashFile(const char *fileName)
+{
+    ifstream in(fileName, ios::binary);
+    if (!in.is_open()) {
+        return 0;
+    }
+    unsigned long hash = 2166136261UL;
+    char buf[4096];
+    while (in) {
+        in.read(buf, sizeof(buf));
+        for (streamsize i = 0; i < in.gcount(); ++i) {
+            hash ^= static_cast<unsigned char>(buf[i]);
+            hash *= 16777619UL;
+        }
+    }
+    return hash;
+}
+
+//! Check whether the config file is the same as in the latest read
+bool Params::configFileUnchanged(const char *dumpFile)
+{
+    struct stat st;
+    if (stat(dumpFile, &st) != 0) {
+        return false;
+    }
+    if (st.st_mtime == configFileMTime && st.st_size == configFileSize) {
+        return true;
+    }
+    // Touched or rewritten: compare contents
+    if (st.st_size == configFileSize && hashFile(dumpFile) == configFileHash) {
+        configFileMTime = st.st_mtime;
+        return true;
+    }
+    return false;
+}
+
+//! Save modification time, size and hash of the config file
+void Params::saveConfigFileState(const char *dumpFile)
+{
+    struct stat st;
+    if (stat(dumpFile, &st) != 0) {
+        configFileSize = -1;
+        return;
+    }
+    configFileMTime = st.st_mtime;
+    configFileSize = st.st_size;
+    configFileHash = hashFile(dumpFile);
+}
+
 void Params::resetUpdatedFromFileFlags()
 {
     struct dynamicVar *next = varList;
@@ -2529,6 +2667,8 @@ double Params::readAndEvaluateRPNExpression(const char *expression)
                     //    = exp(stack[stackI]);
                 } else if(lookupVar(tempStr)) {
                     stack[++stackI] = getRealValue(tempStr);
+                    // Value may change without the file changing
+                    configFileDynamic = true;
                 } else {
                     errorlog << "ERROR [Params::readAndEvaluateRPNExpression(\"" << expression  << ")]: parse error (stack other)\n";
                     doabort();
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <vector>
+#include <sys/types.h>
 #include "definitions.h"
 #include "population.h"
 #include "detector.h"
@@ -100,6 +101,7 @@ struct dynamicVar {
     bool initconstant;
     bool dumpping;
     bool updatedFromFile;
+    bool changed;               //!< value changed in the latest config file read
     void (*action)(void *);
     char **expressions; 		//ptr to tbl of expressions
     struct dynamicVar *next;
@@ -303,6 +305,7 @@ public:
     static int cnt_dt;
     static real saveInterval;
     static int saveHC;
+    static int hcKeyframeInterval;
     static int saveVTK;
     static bool averaging;
     static bool plasma_hcfile;
@@ -330,6 +333,8 @@ public:
     static std::vector< std::vector<real> > spectraV2BinsPerPop;
 #endif
     static bool fieldPredCor;
+    static int fieldSubcycles;
+    static int threads;
     static bool electronPressure;
     static real Te;
     static bool useGravitationalAcceleration;
@@ -359,6 +364,7 @@ public:
     // jstag
     static bool useJstag;
     static bool useNodeUe;
+    static bool useFaceB0;
     // Titan specific
     static real SaturnLocalTime;
     static real SubSolarLatitude;
@@ -370,6 +376,8 @@ public:
     void setVarDumppingOff(const char varName[]);
     void readAndUpdateVariables(const char *dumpFile);
     void readAndInitVariables(const char *dumpFile);
+    bool updateVariablesIfChanged(const char *dumpFile);
+    bool variableChanged(const char varName[]);
     void dumpVars(const char *dumpFile);
     void outParams();
     bool getFunctionNamesAndArgs(const char varName[], std::vector<std::string> &funcNames, std::vector< std::vector<real> > &args);
@@ -402,6 +410,13 @@ private:
     static bool readingPopulation;
     static bool readingDetector;
     static bool readingProcess;
+    static time_t configFileMTime;
+    static off_t configFileSize;
+    static unsigned long configFileHash;
+    static bool configFileDynamic;
+    static unsigned long hashFile(const char *fileName);
+    bool configFileUnchanged(const char *dumpFile);
+    void saveConfigFileState(const char *dumpFile);
     struct dynamicVar * getLast();
     struct dynamicVar * lookupVar(const char *name);
     static void setInitialValues();
@@ -45,6 +45,7 @@ void TParticleList::add(shortreal x, shortreal y, shortreal z, shortreal vx, sho
     n_part++;
 #ifdef USE_PARTICLE_SUBCYCLING
     p->dtlevel = 0;
+    p->lost = false;
     p->accumed = 1;
 #endif
 }
@@ -99,7 +100,7 @@ int TParticleList::pass_with_relocate(bool (*op)(TLinkedParticle& p,ParticlePass
             }
             // Remove the particle if no particle list found (=out of box)
             else if(newplist == NULL) {
-                ERRORMSG("no particle list found, removing particle");
+                ERRORMSG_LIMITED("no particle list found, removing particle");
                 q = p;
                 if (prev) prev->next = p->next;
                 else first = p->next;
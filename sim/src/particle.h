@@ -32,6 +32,7 @@ struct TLinkedParticle {
     TLinkedParticle *next; //!< Next particle in linked list
 #ifdef USE_PARTICLE_SUBCYCLING
     uint8_t dtlevel;
+    bool lost; //!< Removed by a binned substep, deleted by the next particle pass
     real accumed; //!< debug var
 #endif
 };
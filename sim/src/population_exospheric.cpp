@@ -46,6 +46,7 @@ PopulationExospheric::PopulationExospheric(PopulationArgs args) : Population(arg
     }
     // Initialize variable values
     R = 0;
+    pdfR = 0;
     totalRate = 0;
     //distFunc = NULL;
     distFuncId = -1;
@@ -71,8 +72,11 @@ void PopulationExospheric::initialize()
         tempFuncs.push_back( SpatialDistribution(args.distFunc.name[i],args.distFunc.funcArgs[i],popid) );
     }
     this->distFunc = MultipleProductDistribution(tempFuncs);
-    // Prepare discretized distribution function
-    g.prepare_PDF(&distFunc,distFuncId,totalRate);
+    // Prepare discretized distribution function, leave out cells inside the exobase
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    pdfR = args.R.value;
+#endif
+    g.prepare_PDF(&distFunc,distFuncId,totalRate,pdfR);
     updateArgs();
     // Write parameter log
     if(logParams == true && Params::t <= 0) {
@@ -83,13 +87,17 @@ void PopulationExospheric::initialize()
 //! Create exospheric population particles
 void PopulationExospheric::createParticles()
 {
-    for (int i = 0; i < probround(macroParticlesPerDt); ++i) {
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-        newParticle();
+    const int N = probround(macroParticlesPerDt);
+    g.generate_random_cells(distFuncId,N,newCells);
+    for (unsigned int i = 0; i < newCells.size(); ++i) {
+        newParticle(newCells[i]);
+    }
 #else
+    for (int i = 0; i < probround(macroParticlesPerDt); ++i) {
         sph_newParticle();
-#endif
     }
+#endif
 }
 
 //! Get the neutral density related to the population
@@ -155,6 +163,9 @@ void PopulationExospheric::updateArgs()
     if(args.R.given == true) {
         if(args.R.value >= 0) {
             this->R = args.R.value;
+            if(R < pdfR) {
+                WARNINGMSG2("R smaller than when the PDF table was prepared, no particles created in cells inside the original R",idStr);
+            }
         } else {
             ERRORMSG2("trying to set R < 0",idStr);
             doabort();
@@ -194,23 +205,29 @@ void PopulationExospheric::updateArgs()
     }
 }
 
-//! New exospheric population particle
-void PopulationExospheric::newParticle()
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+
+//! New exospheric population particle in cell c drawn from the PDF
+void PopulationExospheric::newParticle(Tgrid::TCellPtr c)
 {
     gridreal r[3];
-    // This loop is executed only once in 99.999.. % of the cases
-    do {
-        g.generate_random_point(distFuncId,r);
-    } while ( sqr(r[0]) + sqr(r[1]) + sqr(r[2]) <= sqr(R) );
+    g.generate_random_point(c,r);
+    // Only cells crossing the exobase can give points inside, draw a new cell then
+    while ( sqr(r[0]) + sqr(r[1]) + sqr(r[2]) <= sqr(R) ) {
+        c = g.generate_random_cell(distFuncId);
+        g.generate_random_point(c,r);
+    }
     const shortreal x = r[0];
     const shortreal y = r[1];
     const shortreal z = r[2];
     const shortreal vx = vth*gaussrnd();
     const shortreal vy = vth*gaussrnd();
     const shortreal vz = vth*gaussrnd();
-    g.addparticle(x,y,z,vx,vy,vz,macroParticleStatisticalWeight,popid);
+    g.addparticle(c,x,y,z,vx,vy,vz,macroParticleStatisticalWeight,popid);
 }
 
+#endif
+
 //! Write distribution function into hc-file
 void PopulationExospheric::writeExtraHcFile()
 {
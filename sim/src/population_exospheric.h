@@ -19,6 +19,8 @@
 #ifndef POPULATION_EXOSPHERIC_H
 #define POPULATION_EXOSPHERIC_H
 
+#include "grid.h"
+
 //! Exospheric population
 class PopulationExospheric : public Population
 {
@@ -34,12 +36,15 @@ public:
     std::string toString();
 private:
     real R;
+    real pdfR; //!< Exobase radius used to leave cells out of the PDF table
     real totalRate;
     MultipleProductDistribution distFunc;
     TPDF_ID distFuncId;
-    void newParticle();
     void writeLog();
-#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    std::vector<Tgrid::TCellPtr> newCells;
+    void newParticle(Tgrid::TCellPtr c);
+#else
     void sph_newParticle();
 #endif
 };
@@ -164,9 +164,65 @@ bool PopulationIMF::updateDistributions()
 void PopulationIMF::createParticles()
 {
     if(Params::t > t0) {
-        for (int i = 0; i < probround(macroParticlesPerDt); ++i) {
-            newParticle();
+        const int N = probround(macroParticlesPerDt);
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+        // Velocities, weights and launch walls of all new particles
+        newWall.resize(N);
+        newV.resize(N);
+        newWeight.resize(N);
+        int wallCount[6] = {0,0,0,0,0,0};
+        for (int i = 0; i < N; ++i) {
+            newWall[i] = newParticle(newV[i],newWeight[i]);
+            if(newWall[i] >= 0) {
+                wallCount[newWall[i]]++;
+            }
+        }
+        // Positions on each wall, drawn in one pass over the wall cells
+        const gridreal boxMin[3] = {gridreal(xmin), gridreal(ymin), gridreal(zmin)};
+        const gridreal boxMax[3] = {gridreal(xmax), gridreal(ymax), gridreal(zmax)};
+        int wallNext[6] = {0,0,0,0,0,0};
+        for (int wall = 0; wall < 6; ++wall) {
+            if(wallCount[wall] == 0) {
+                continue;
+            }
+            const int dim = wall/2;
+            const int d1 = (dim+1)%3, d2 = (dim+2)%3;
+            const gridreal lo[2] = {boxMin[d1], boxMin[d2]};
+            const gridreal hi[2] = {boxMax[d1], boxMax[d2]};
+            g.update_inflow_layer(wallLayers[wall],dim,(wall%2 == 1) ? boxMax[dim] : boxMin[dim],lo,hi);
+            g.sample_inflow_layer(wallLayers[wall],wallCount[wall],wallPoints[wall]);
+        }
+        for (int i = 0; i < N; ++i) {
+            const int wall = newWall[i];
+            if(wall < 0) {
+                continue;
+            }
+            const Tgrid::TInflowPoint& p = wallPoints[wall][wallNext[wall]++];
+            if(p.cell) {
+                g.addparticle(p.cell,p.r[0],p.r[1],p.r[2],newV[i](0),newV[i](1),newV[i](2),newWeight[i],popid);
+            } else {
+                errorlog << "WARNING: PopulationIMF::createParticles" << Tr3v(p.r).toString()
+                         << " idStr=" << idStr << " out of box (not created)\n";
+            }
         }
+#else
+        for (int i = 0; i < N; ++i) {
+            Tr3v v;
+            real weight;
+            const int wall = newParticle(v,weight);
+            if(wall < 0) {
+                continue;
+            }
+            real r[3];
+            const real boxMin[3] = {xmin, ymin, zmin};
+            const real boxSize[3] = {box_x, box_y, box_z};
+            for (int d = 0; d < 3; ++d) {
+                r[d] = boxMin[d] + uniformrnd()*boxSize[d];
+            }
+            r[wall/2] = (wall%2 == 1) ? boxMin[wall/2] + boxSize[wall/2] : boxMin[wall/2];
+            g.addparticle(r[0],r[1],r[2],v(0),v(1),v(2),weight,popid);
+        }
+#endif
     }
 }
 
@@ -375,16 +431,18 @@ void PopulationIMF::updateArgs()
     }
 }
 
-//! New imf population particle
-void PopulationIMF::newParticle()
+/** \brief New imf population particle
+ *
+ * Sets the velocity and weight of the particle and returns the wall it
+ * is launched from (WALL_XMIN...WALL_ZMAX), or -1 if it is not created.
+ */
+int PopulationIMF::newParticle(Tr3v& v, real& weight)
 {
-    real x,y,z;
     real XYa, YZa, XZa, Atot, rndPitch = 0, rndClock = 0;	// face areas and random numbers
     real BxExtra;
     Tr3v vVec_tmp, vVec;
     double a, b, V_tmp, v0, randomn;
     v0 = 0;
-    real weight;
     weight = 1;
     // Launch ion along B_sw from front and side walls
     // create appropriate vel distr and rotate
@@ -451,68 +509,30 @@ void PopulationIMF::newParticle()
     XZa /= Atot;
     // choose face
     weight *= macroParticleStatisticalWeight;
-    if(conserveE) {
-        randomn = uniformrnd();
-        if(randomn < XYa) {
-            if(vVec(2) < 0) {
-                z = zmax;
-            } else {
-                z = zmin;
-            }
-            y = ymin + uniformrnd()*box_y;
-            x = xmin + uniformrnd()*box_x;
-        } else if(randomn < XYa + YZa) {
-            if(vVec(0) < 0) {
-                x = xmax;
-            } else {
-                x =xmin;
-            }
-            y = ymin + uniformrnd()*box_y;
-            z = zmin + uniformrnd()*box_z;
+    int wall;
+    randomn = uniformrnd();
+    if(randomn < XYa) {
+        wall = (vVec(2) < 0) ? WALL_ZMAX : WALL_ZMIN;
+    } else if(randomn < XYa + YZa) {
+        if(vVec(0) < 0) {
+            wall = WALL_XMAX;
         } else {
-            if(vVec(1) < 0) {
-                y = ymax;
-            } else {
-                y = ymin;
+            wall = WALL_XMIN;
+            if(conserveE == false && backWallWeight == 0) {
+                return -1;
             }
-            z = zmin + uniformrnd()*box_z;
-            x = xmin + uniformrnd()*box_x;
         }
+    } else {
+        wall = (vVec(1) < 0) ? WALL_YMAX : WALL_YMIN;
+    }
+    if(conserveE) {
         weight *= Atot/A0;
     } else {
-        randomn = uniformrnd();
-        if(randomn < XYa) {
-            if(vVec(2) < 0) {
-                z = zmax;
-            } else {
-                z = zmin;
-            }
-            y = ymin + uniformrnd()*box_y;
-            x = xmin + uniformrnd()*box_x;
-        } else if(randomn < XYa + YZa) {
-            if(vVec(0) < 0) {
-                x = xmax;
-            } else {
-                x = xmin;
-                if(backWallWeight == 0) {
-                    return;
-                }
-            }
-            y = ymin + uniformrnd()*box_y;
-            z = zmin + uniformrnd()*box_z;
-        } else {
-            if(vVec(1) < 0) {
-                y = ymax;
-            } else {
-                y = ymin;
-            }
-            z = zmin + uniformrnd()*box_z;
-            x = xmin + uniformrnd()*box_x;
-        }
         v0 = vVec.magn()/vVec_tmp.magn();
         weight *= Atot/A0 * v0;
     }
-    g.addparticle(x,y,z,vVec(0),vVec(1),vVec(2),weight,popid);
+    v = vVec;
+    return wall;
 }
 
 //! Nothing to write
@@ -20,6 +20,7 @@
 #define POPULATION_IMF_H
 
 #include "definitions.h"
+#include "grid.h"
 
 //! IMF-directed population
 class PopulationIMF : public Population
@@ -43,7 +44,9 @@ private:
     real rotAngle;
     real backWallWeight;
     bool negativeV, conserveE;
-    void newParticle();
+    //! Launch walls, WALL_XMIN + 2*d is the min wall and WALL_XMIN + 2*d + 1 the max wall of dimension d
+    enum {WALL_XMIN=0, WALL_XMAX=1, WALL_YMIN=2, WALL_YMAX=3, WALL_ZMIN=4, WALL_ZMAX=5};
+    int newParticle(Tr3v& v, real& weight);
     void writeLog();
     real t0;
     int E_distr_type;
@@ -54,6 +57,13 @@ private:
     real EnergyPitchIntegrator(Tr3v uswVec,real parkerAngle,real clockAngle), vf(real v, real pitch);
     real pitchf(real pitch);
     int dtlevel;
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    Tgrid::TInflowLayer wallLayers[6]; //!< Cells at the launch walls
+    std::vector<Tgrid::TInflowPoint> wallPoints[6];
+    std::vector<int> newWall;
+    std::vector<Tr3v> newV;
+    std::vector<real> newWeight;
+#endif
 };
 
 #endif
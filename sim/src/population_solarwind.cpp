@@ -64,13 +64,49 @@ void PopulationSolarWind::initialize()
 //! Create solar wind population particles
 void PopulationSolarWind::createParticles()
 {
-    for (int i = 0; i < probround(macroParticlesPerDt); ++i) {
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-        newParticle();
+    const int N = probround(macroParticlesPerDt);
+    const gridreal lo[2] = {Params::box_ymin_tight, Params::box_zmin_tight};
+    const gridreal hi[2] = {Params::box_ymin_tight + Params::box_Y_tight, Params::box_zmin_tight + Params::box_Z_tight};
+    if(negativeV == false) {
+        // from the front wall
+        g.update_inflow_layer(inflowLayer,0,Params::box_xmax_tight - V*Params::dt,lo,hi);
+    } else {
+        // from the back wall
+        g.update_inflow_layer(inflowLayer,0,Params::box_xmin_tight + V*Params::dt,lo,hi);
+    }
+    g.sample_inflow_layer(inflowLayer,N,inflowPoints);
+    const shortreal vxSign = negativeV ? 1 : -1;
+    for (int i = 0; i < N; ++i) {
+        const Tgrid::TInflowPoint& p = inflowPoints[i];
+        const shortreal vx = vxSign*vth*derivgaussrnd(V/vth);
+        const shortreal vy = vth*gaussrnd();
+        const shortreal vz = vth*gaussrnd();
+        if (p.cell) {
+            g.addparticle(p.cell,p.r[0],p.r[1],p.r[2],vx,vy,vz,macroParticleStatisticalWeight,popid);
+        }
+    }
+    // Back wall flow for cases with high thermal velocity.
+    if (backWallWeight > 0) {
+        // uniform distribution
+        g.update_inflow_layer(backWallLayer,0,Params::box_xmin_tight + 0.05*Params::dx,lo,hi);
+        g.sample_inflow_layer(backWallLayer,N,inflowPoints);
+        for (int i = 0; i < N; ++i) {
+            const Tgrid::TInflowPoint& p = inflowPoints[i];
+            // vx > 0
+            const shortreal vx = vth*derivgaussrnd(-V/vth);
+            const shortreal vy = vth*gaussrnd();
+            const shortreal vz = vth*gaussrnd();
+            if (p.cell) {
+                g.addparticle(p.cell,p.r[0],p.r[1],p.r[2],vx,vy,vz,macroParticleStatisticalWeight*backWallWeight,popid);
+            }
+        }
+    }
 #else
+    for (int i = 0; i < probround(macroParticlesPerDt); ++i) {
         sph_newParticle();
-#endif
     }
+#endif
 }
 
 //! Example addParticle function, which can be called from the main code
@@ -146,38 +182,6 @@ void PopulationSolarWind::updateArgs()
     }
 }
 
-//! New solar wind population particle
-void PopulationSolarWind::newParticle()
-{
-    shortreal y = Params::box_ymin_tight + uniformrnd()*Params::box_Y_tight;
-    shortreal z = Params::box_zmin_tight + uniformrnd()*Params::box_Z_tight;
-    shortreal x,vx;
-    if(negativeV == false) {
-        // from the front wall
-        x = Params::box_xmax_tight - V*Params::dt;
-        vx = -vth*derivgaussrnd(V/vth);
-    } else {
-        // from the back wall
-        x = Params::box_xmin_tight + V*Params::dt;
-        vx = vth*derivgaussrnd(V/vth);
-    }
-    shortreal vy = vth*gaussrnd();
-    shortreal vz = vth*gaussrnd();
-    g.addparticle(x,y,z,vx,vy,vz,macroParticleStatisticalWeight,popid);
-    // Back wall flow for cases with high thermal velocity.
-    if (backWallWeight > 0) {
-        // uniform distribution
-        x = Params::box_xmin_tight + 0.05*Params::dx;
-        y = Params::box_ymin_tight + uniformrnd()*Params::box_Y_tight;
-        z = Params::box_zmin_tight + uniformrnd()*Params::box_Z_tight;
-        // vx > 0
-        vx = vth*derivgaussrnd(-V/vth);
-        vy = vth*gaussrnd();
-        vz = vth*gaussrnd();
-        g.addparticle(x,y,z,vx,vy,vz,macroParticleStatisticalWeight*backWallWeight,popid);
-    }
-}
-
 //! Nothing to write
 void PopulationSolarWind::writeExtraHcFile() { }
 
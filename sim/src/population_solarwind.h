@@ -19,6 +19,8 @@
 #ifndef POPULATION_SOLARWIND_H
 #define POPULATION_SOLARWIND_H
 
+#include "grid.h"
+
 //! Solar wind population
 class PopulationSolarWind : public Population
 {
@@ -37,9 +39,12 @@ private:
     real V;
     real backWallWeight;
     bool negativeV;
-    void newParticle();
     void writeLog();
-#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+    Tgrid::TInflowLayer inflowLayer; //!< Cells at the injection plane
+    Tgrid::TInflowLayer backWallLayer; //!< Cells at the back wall injection plane
+    std::vector<Tgrid::TInflowPoint> inflowPoints;
+#else
     void sph_newParticle();
 #endif
 };
@@ -0,0 +1,214 @@
+/** This file is part of the HYB simulation platform.
+ *
+ *  Copyright 2014- Finnish Meteorological Institute
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+#include <algorithm>
+#include "scheduler.h"
+#include "simulation.h"
+
+using namespace std;
+
+#ifdef USE_THREADS
+
+namespace
+{
+
+//! Blocks [head,tail) of one thread
+struct TBlockDeque {
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+};
+
+//! State shared by the threads of one scheduler run
+struct TBlockRun {
+    const int* cells;
+    vector<int> start; //!< Blocks are cells[start[b]..start[b+1]-1]
+    vector<TBlockDeque> deques;
+    TCellBlockTask* task;
+    int steals;
+};
+
+//! Arguments of a worker thread
+struct TWorkerArgs {
+    TBlockRun* r;
+    int worker;
+};
+
+//! Take the first block of q
+bool popFront(TBlockDeque& q, int& b)
+{
+    bool result = false;
+    pthread_mutex_lock(&q.lock);
+    if (q.head < q.tail) {
+        b = q.head++;
+        result = true;
+    }
+    pthread_mutex_unlock(&q.lock);
+    return result;
+}
+
+//! Take the last block of q
+bool popBack(TBlockDeque& q, int& b)
+{
+    bool result = false;
+    pthread_mutex_lock(&q.lock);
+    if (q.head < q.tail) {
+        b = --q.tail;
+        result = true;
+    }
+    pthread_mutex_unlock(&q.lock);
+    return result;
+}
+
+//! Number of blocks left in q
+int blocksLeft(TBlockDeque& q)
+{
+    pthread_mutex_lock(&q.lock);
+    const int n = q.tail - q.head;
+    pthread_mutex_unlock(&q.lock);
+    return n;
+}
+
+//! Run own blocks, then steal from the other threads until all deques are empty
+void* workerMain(void* p)
+{
+    TBlockRun& r = *static_cast<TWorkerArgs*>(p)->r;
+    const int w = static_cast<TWorkerArgs*>(p)->worker;
+    const int nthreads = r.deques.size();
+    int b;
+    for (;;) {
+        if (popFront(r.deques[w],b) == false) {
+            // Blocks are never added, so the run is over when all deques are empty
+            int victim = -1, most = 0;
+            for (int v = 0; v < nthreads; ++v) {
+                if (v == w) continue;
+                const int n = blocksLeft(r.deques[v]);
+                if (n > most) {
+                    most = n;
+                    victim = v;
+                }
+            }
+            if (victim < 0) break;
+            if (popBack(r.deques[victim],b) == false) continue;
+            __sync_fetch_and_add(&r.steals,1);
+        }
+        r.task->run(r.cells + r.start[b], r.start[b+1] - r.start[b], w);
+    }
+    return 0;
+}
+
+//! Mutex of TCellBlockScheduler::atomicAdd
+pthread_mutex_t addLock = PTHREAD_MUTEX_INITIALIZER;
+
+}
+
+#endif
+
+//! Constructor
+TCellBlockScheduler::TCellBlockScheduler()
+{
+    nthreads = 1;
+    steals = 0;
+}
+
+//! Set the number of threads (1 without USE_THREADS)
+void TCellBlockScheduler::setThreads(int n)
+{
+#ifdef USE_THREADS
+    nthreads = (n < 1) ? 1 : n;
+#else
+    nthreads = 1;
+#endif
+}
+
+/** \brief Pass the root cells to the task
+ *
+ * cost[i] is the estimated cost of cells[i]. The task is called once per
+ * block and concurrently from several threads, so it must only write to the
+ * given cells (or use atomicAdd).
+ */
+void TCellBlockScheduler::run(const vector<int>& cells, const vector<real>& cost, TCellBlockTask& task)
+{
+    const int ncells = cells.size();
+    if (ncells == 0) return;
+#ifdef USE_THREADS
+    if (nthreads > 1) {
+        TBlockRun r;
+        r.cells = &cells[0];
+        r.task = &task;
+        r.steals = 0;
+        // Cut the cells into blocks of about total/nblocks cost each
+        real total = 0;
+        for (int i = 0; i < ncells; ++i) total += cost[i];
+        const int nblocks = min(ncells, int(BLOCKS_PER_THREAD)*nthreads);
+        real acc = 0;
+        r.start.push_back(0);
+        for (int i = 0; i < ncells - 1 && int(r.start.size()) < nblocks; ++i) {
+            acc += cost[i];
+            if (acc*nblocks >= total*r.start.size()) r.start.push_back(i+1);
+        }
+        r.start.push_back(ncells);
+        // Deal consecutive blocks to the threads
+        const int nb = r.start.size() - 1;
+        r.deques.resize(nthreads);
+        for (int w = 0; w < nthreads; ++w) {
+            r.deques[w].head = w*nb/nthreads;
+            r.deques[w].tail = (w+1)*nb/nthreads;
+            pthread_mutex_init(&r.deques[w].lock,0);
+        }
+        vector<TWorkerArgs> args(nthreads);
+        vector<pthread_t> threads(nthreads);
+        vector<bool> started(nthreads,false);
+        for (int w = 0; w < nthreads; ++w) {
+            args[w].r = &r;
+            args[w].worker = w;
+        }
+        // The calling thread is worker 0, blocks of threads that failed to start are stolen
+        for (int w = 1; w < nthreads; ++w) {
+            started[w] = (pthread_create(&threads[w],0,workerMain,&args[w]) == 0);
+            if (started[w] == false) {
+                WARNINGMSG2("failed to start a worker thread",w);
+            }
+        }
+        workerMain(&args[0]);
+        for (int w = 1; w < nthreads; ++w) {
+            if (started[w] == true) pthread_join(threads[w],0);
+        }
+        for (int w = 0; w < nthreads; ++w) pthread_mutex_destroy(&r.deques[w].lock);
+        steals += r.steals;
+        return;
+    }
+#endif
+    task.run(&cells[0],ncells,0);
+}
+
+//! x += dx, safe to call from the tasks of concurrent passes
+void TCellBlockScheduler::atomicAdd(real& x, real dx)
+{
+#ifdef USE_THREADS
+    pthread_mutex_lock(&addLock);
+    x += dx;
+    pthread_mutex_unlock(&addLock);
+#else
+    x += dx;
+#endif
+}
+
@@ -0,0 +1,73 @@
+/** This file is part of the HYB simulation platform.
+ *
+ *  Copyright 2014- Finnish Meteorological Institute
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <vector>
+#include "definitions.h"
+
+//! Storage class of per-thread state (caches of the grid etc.)
+#ifdef USE_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+//! Work of a block pass, called for one block of root cells at a time
+class TCellBlockTask
+{
+public:
+    virtual ~TCellBlockTask() {}
+    //! Process root cells cells[0..n-1] in the calling thread (0 <= worker < number of threads)
+    virtual void run(const int* cells, int n, int worker) = 0;
+};
+
+/** \brief Work-stealing scheduler of root cell blocks
+ *
+ * The root cells of a pass are cut into contiguous blocks of about equal
+ * estimated cost (macroparticles and leaf cells in the root cell) and the
+ * blocks are dealt in order to per-thread deques, so that every thread starts
+ * with a contiguous, cost-balanced piece of the grid. A thread takes blocks
+ * from the front of its own deque and, when it runs dry, steals from the back
+ * of the deque with most blocks left.
+ *
+ * Without USE_THREADS, or with one thread, all cells are given to the task
+ * in a single call in the original order.
+ */
+class TCellBlockScheduler
+{
+public:
+    enum {BLOCKS_PER_THREAD=16}; //!< Blocks per thread, more blocks = finer stealing granularity
+    TCellBlockScheduler();
+    void setThreads(int n);
+    int getThreads() const {
+        return nthreads;
+    }
+    void run(const std::vector<int>& cells, const std::vector<real>& cost, TCellBlockTask& task);
+    int getSteals() const {
+        return steals;
+    }
+    static void atomicAdd(real& x, real dx);
+private:
+    int nthreads; //!< Number of threads (including the calling thread)
+    int steals;   //!< Number of stolen blocks, summed over all runs
+};
+
+#endif
+
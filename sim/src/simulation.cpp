@@ -59,6 +59,12 @@ Tgrid g;
 //! Simulation parameters
 Params simuConfig;
 
+#ifdef USE_PARTICLE_SUBCYCLING
+vector<TLinkedParticle*> Simulation::subcycleBins[Simulation::SUBCYCLE_LEVELS];
+int Simulation::subcycleLevelCount[Simulation::SUBCYCLE_LEVELS];
+int Simulation::subcycleLost = 0;
+#endif
+
 //! Output file pointer
 FILE *outputfp;
 
@@ -169,6 +175,11 @@ Simulation::~Simulation()
         delete *visDB;
     }
     delete visDataSourceImpl;
+    // Detectors close their files
+    for (unsigned int i=0; i < Params::detectors.size(); ++i) {
+        delete Params::detectors[i];
+    }
+    Params::detectors.clear();
     MSGFUNCTIONEND("Simulation::~Simulation");
 }
 
@@ -331,6 +342,10 @@ void Simulation::initializeSimulation()
         visWriters.push_back(&(VisDBFactory::getVisDB(VTK_LEGACY_BINARY, *visDataSourceImpl)));
     } else if(Params::saveVTK == 2) {
         visWriters.push_back(&(VisDBFactory::getVisDB(VTK_LEGACY_ASCII, *visDataSourceImpl)));
+    } else if(Params::saveVTK == 3) {
+        visWriters.push_back(&(VisDBFactory::getVisDB(VTK_XML_BINARY, *visDataSourceImpl)));
+    } else if(Params::saveVTK == 4) {
+        visWriters.push_back(&(VisDBFactory::getVisDB(VTK_XML_MULTIBLOCK, *visDataSourceImpl)));
     }
     MSGFUNCTIONEND("Simulation::initializeSimulation");
 }
@@ -381,25 +396,40 @@ void Simulation::stepForward()
         Params::pops[i]->createParticles();
     }
     timepool("Field");
+    g.update_B0();
     if(Params::propagateField == true) {
         g.zero_rhoq_nc_Vq();
     }
     timepool("Xpropag");
 #ifndef USE_PARTICLE_SUBCYCLING
     g.particle_pass(&PropagateX);
+    g.particle_pass_with_relocation(&AlwaysTrue);
 #else
     g.particle_pass(&PropagatePart1);
+    subcycleBinsPart1();
+    g.particle_pass_with_relocation(&NotLost);
 #endif
-    g.particle_pass_with_relocation(&AlwaysTrue);
     timepool("Field");
     if(Params::propagateField == true) {
         g.finalize_accum();
         g.smoothing();//smooth the particle related variables before propagating the field.
-        if (Params::fieldPredCor == false) {
-            fieldpropagate(Tgrid::FACEDATA_B, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B,Params::dtField,true);
-        } else {
-            fieldpropagate(Tgrid::FACEDATA_BSTAR, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B,Params::dtField/2,false);
-            fieldpropagate(Tgrid::FACEDATA_B, Tgrid::FACEDATA_B, Tgrid::FACEDATA_BSTAR,Params::dtField,true);
+        // Field subcycling: ion moments are frozen over the substeps and the particle
+        // push uses the substep average of U_e (accumulated in CELLDATA_TEMP2)
+        const int nsub = Params::fieldSubcycles;
+        const real fdt = Params::dtField/nsub;
+        for (int n = 0; n < nsub; ++n) {
+            if (Params::fieldPredCor == false) {
+                fieldpropagate(Tgrid::FACEDATA_B, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B,fdt,true);
+            } else {
+                fieldpropagate(Tgrid::FACEDATA_BSTAR, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B,fdt/2,false);
+                fieldpropagate(Tgrid::FACEDATA_B, Tgrid::FACEDATA_B, Tgrid::FACEDATA_BSTAR,fdt,true);
+            }
+            if (nsub > 1) {
+                g.celldata_scale_add(Tgrid::CELLDATA_TEMP2,Tgrid::CELLDATA_UE,1.0/nsub,n > 0);
+            }
+        }
+        if (nsub > 1) {
+            g.celldata_scale_add(Tgrid::CELLDATA_UE,Tgrid::CELLDATA_TEMP2,1.0,false);
         }
         if(Params::electronPressure==true) {
             g.FC(Tgrid::FACEDATA_B,Tgrid::CELLDATA_B);//update cell-data B to calculate E for particle acceleration.
@@ -412,9 +442,13 @@ void Simulation::stepForward()
     }
     timepool("Vpropag");
 #ifndef USE_PARTICLE_SUBCYCLING
-    g.particle_pass(&PropagateV);
+    g.particle_pass_concurrent(&PropagateV);
 #else
     g.particle_pass(&PropagatePart2);
+    subcycleBinsPart2();
+    if (subcycleLost > 0) {
+        g.particle_pass(&NotLost);
+    }
 #endif
     timepool("splitjoin");
     if(Params::useMacroParticleSplitting == true || Params::useMacroParticleJoining == true) {
@@ -483,6 +517,10 @@ bool Simulation::finalizeTimestep(bool doBreakpointing)
         Params::diag.run();
     }
 #endif
+    if (Params::logInterval > 0 && (Params::cnt_dt % int(Params::logInterval/Params::dt+0.5) == 0)) {
+        LogRateLimit::writeSummaries();
+    }
+    Logger::flushAll();
     // Check program termination flag
     if (Params::stoppingPhase == true) {
         mainlog << "STOPPING: program termination flag detected\n";
@@ -502,8 +540,14 @@ bool Simulation::finalizeTimestep(bool doBreakpointing)
 //! Update simulation input parameters
 void Simulation::updateParams()
 {
-    simuConfig.readAndUpdateVariables(Params::configFileName);
-    setResistivity();
+    // Nothing to do if the config file has not changed
+    if (simuConfig.updateVariablesIfChanged(Params::configFileName) == false) {
+        return;
+    }
+    // Set resistivity in the grid only if the function changed
+    if (simuConfig.variableChanged("resistivityFUNC") == true) {
+        setResistivity();
+    }
 }
 
 //! Do save step 
@@ -544,6 +588,8 @@ void Simulation::saveVisualizationFiles()
             hcFileFormat = "binary";
         } else if(Params::saveHC == 2) {
             hcFileFormat = "ascii";
+        } else if(Params::saveHC == 3) {
+            hcFileFormat = "series";
         } else {
             hcFileFormat = "binary";
         }
@@ -639,9 +685,13 @@ int Simulation::finalize()
     const double cpu = timepool.cputime();
     mainlog << "|-------------------------------------------\n"
             << "| " << macroParticlePropagations << " macroparticles propagated in " << cpu << " seconds\n"
-            << "| " << macroParticlePropagations/cpu << " macros/second\n"
-            << "|-------------------------------------------\n";
+            << "| " << macroParticlePropagations/cpu << " macros/second\n";
+    if (g.getScheduler().getThreads() > 1) {
+        mainlog << "| " << g.getScheduler().getThreads() << " threads, " << g.getScheduler().getSteals() << " cell blocks stolen\n";
+    }
+    mainlog << "|-------------------------------------------\n";
     //portrand.save("portrand.state");
+    LogRateLimit::writeSummaries();
     MSGFUNCTIONEND("Simulation::finalize");
     return 0;
 }
@@ -703,85 +753,136 @@ void Simulation::BoundaryB(datareal celldata[Tgrid::NCELLDATA][3], int dim)
 
 #ifdef USE_PARTICLE_SUBCYCLING
 
-//! (SUBCYCLING)
+/** \brief (SUBCYCLING) First half of the particle push
+ *
+ * Sets the dtlevel of the particle and makes its first substep. Particles
+ * with dtlevel >= 1 are put in subcycleBins and their remaining substeps
+ * are run by subcycleBinsPart1, so that all particles of a bin do the same
+ * number of substeps with the same dt_psub and accum_psubfactor.
+ */
 bool Simulation::PropagatePart1(TLinkedParticle& part, ParticlePassArgs a)
 {
     if(Params::pops[part.popid]->getPropagateV() == false) {
         return true;
     }
-    bool part_kept = false;
     // Check Particle dtlevel here
-    int popstep;
-    popstep = Params::pops[part.popid]->subcycleSteps;
-    real pv, dv;
-    pv = sqrt(part.vx*part.vx + part.vy*part.vy + part.vz*part.vz);
-    dv = a.size/Params::dt;
+    const real popstep = Params::pops[part.popid]->subcycleSteps;
+    const real pv = sqrt(part.vx*part.vx + part.vy*part.vy + part.vz*part.vz);
+    const real dv = a.size/Params::dt;
+    const real steps = pv/dv*popstep;
+    int level = 0;
+    int maxLevel = min(Params::subcycleMaxLevel,SUBCYCLE_LEVELS-1);
     if(Params::subcycleType == 1) {
-        part.dtlevel = floor(pv/dv*popstep);
+        level = int(floor(steps));
     } else if(Params::subcycleType == 2) {
-        part.dtlevel = max((int)floor( log( pv/dv*popstep ) /log(2)),0);
+        // 2^(level-1) substeps
+        if(steps >= 1) level = int(floor(log(steps)/log(2.0)));
+        maxLevel = min(maxLevel,30);
     } else {
         ERRORMSG2("Invalid substepping scheme", Params::subcycleType);
         doabort();
     }
-    if(part.dtlevel < 0) part.dtlevel = 0;
-    if(part.dtlevel > Params::subcycleMaxLevel) {
-        part.dtlevel = Params::subcycleMaxLevel;
-    }
+    if(level > maxLevel) level = maxLevel;
+    part.dtlevel = level;
+    subcycleLevelCount[level]++;
     real tol = 1e-5;
     if(abs(part.accumed - 1) > tol) {
-        errorlog << "Particle pop: " << part.popid << " Particle dtlevel: " << part.dtlevel << " steps/cell:" << (int)(a.size/pv/Params::dt_psub[part.dtlevel]) << " weight accumed: " << part.accumed << "\n";
+        static LogRateLimit accumedLog(errorlog,__FILE__,__LINE__);
+        if(accumedLog.allow() == true) {
+            errorlog << "Particle pop: " << part.popid << " Particle dtlevel: " << int(part.dtlevel) << " steps/cell:" << (int)(a.size/pv/Params::dt_psub[part.dtlevel]) << " weight accumed: " << part.accumed << "\n";
+        }
     }
     part.accumed = 0;
-    part_kept = PropagateX(part);
-    if(!part_kept) return part_kept;
+    part.lost = false;
+    if(PropagateX(part) == false) return false;
     if(part.dtlevel >= 1) {
         PropagateV(part);
-        if(Params::subcycleType == 1) {
-            for(int i = 1; i <= part.dtlevel/2; i++) {
-                part_kept = PropagateX(part);
-                if(!part_kept) return part_kept;
-                PropagateV(part);
-            }
-        } else if(Params::subcycleType == 2) {
-            for(int lev = 2; lev <= part.dtlevel; lev++)
-                for(int i = 0; i < pow(2,lev-2); i++) {
-                    part_kept = PropagateX(part);
-                    if(!part_kept) return part_kept;
-                    PropagateV(part);
-                }
-        }
+        subcycleBins[part.dtlevel].push_back(&part);
     }
-    return part_kept;
+    return true;
 }
 
-//! (SUBCYCLING)
+//! (SUBCYCLING) Second half of the particle push, binned like PropagatePart1
 bool Simulation::PropagatePart2(TLinkedParticle& part)
 {
     if(Params::pops[part.popid]->getPropagateV() == false) {
         return true;
     }
-    bool part_kept = true;
     if(part.dtlevel >= 1) {
-        part_kept = PropagateX(part);
-        if(!part_kept) return part_kept;
-        if(Params::subcycleType == 1) {
-            for(int i = 1; i <= (part.dtlevel-(1-part.dtlevel%2))/2 ; i++) {
+        if(PropagateX(part) == false) return false;
+        subcycleBins[part.dtlevel].push_back(&part);
+    } else {
+        PropagateV(part);
+    }
+    return true;
+}
+
+//! (SUBCYCLING) Keep particles not lost in the binned substeps
+bool Simulation::NotLost(TLinkedParticle& part)
+{
+    return part.lost == false;
+}
+
+//! (SUBCYCLING) Remaining substeps of the first half push: (X,V) pairs
+void Simulation::subcycleBinsPart1()
+{
+    for(int lev = 1; lev < SUBCYCLE_LEVELS; ++lev) {
+        vector<TLinkedParticle*>& bin = subcycleBins[lev];
+        if(bin.empty()) continue;
+        const double t0 = timepool.cputime();
+        const int nsteps = (Params::subcycleType == 1) ? lev/2 : (1 << (lev-1)) - 1;
+        for(unsigned int i = 0; i < bin.size(); ++i) {
+            TLinkedParticle& part = *bin[i];
+            for(int n = 0; n < nsteps; ++n) {
+                if(PropagateX(part) == false) {
+                    part.lost = true;
+                    subcycleLost++;
+                    break;
+                }
                 PropagateV(part);
-                part_kept = PropagateX(part);
-                if(!part_kept) return part_kept;
             }
-        } else if(Params::subcycleType == 2) {
-            for(unsigned char lev = 2; lev <= part.dtlevel; lev++)
-                for(unsigned char i = 0; i < pow(2,lev-2); i++) {
-                    PropagateV(part);
-                    part_kept = PropagateX(part);
-                    if(!part_kept) return part_kept;
-                }
         }
+#ifndef NO_DIAGNOSTICS
+        Params::diag.sCounter.cputime[lev] += timepool.cputime() - t0;
+#endif
+        bin.clear();
+    }
+#ifndef NO_DIAGNOSTICS
+    for(int lev = 0; lev < SUBCYCLE_LEVELS; ++lev) {
+        Params::diag.sCounter.macroParticles[lev] += subcycleLevelCount[lev];
+    }
+#endif
+    memset(subcycleLevelCount,0,sizeof(subcycleLevelCount));
+}
+
+//! (SUBCYCLING) Remaining substeps of the second half push: (V,X) pairs and the last V
+void Simulation::subcycleBinsPart2()
+{
+    subcycleLost = 0;
+    for(int lev = 1; lev < SUBCYCLE_LEVELS; ++lev) {
+        vector<TLinkedParticle*>& bin = subcycleBins[lev];
+        if(bin.empty()) continue;
+        const double t0 = timepool.cputime();
+        const int nsteps = (Params::subcycleType == 1) ? (lev-(1-lev%2))/2 : (1 << (lev-1)) - 1;
+        for(unsigned int i = 0; i < bin.size(); ++i) {
+            TLinkedParticle& part = *bin[i];
+            int n;
+            for(n = 0; n < nsteps; ++n) {
+                PropagateV(part);
+                if(PropagateX(part) == false) break;
+            }
+            if(n < nsteps) {
+                part.lost = true;
+                subcycleLost++;
+            } else {
+                PropagateV(part);
+            }
+        }
+#ifndef NO_DIAGNOSTICS
+        Params::diag.sCounter.cputime[lev] += timepool.cputime() - t0;
+#endif
+        bin.clear();
     }
-    PropagateV(part);
-    return part_kept;
 }
 
 #endif
@@ -829,19 +930,21 @@ bool Simulation::PropagateV(TLinkedParticle& part)
         return true;
     }
 #ifndef USE_PARTICLE_SUBCYCLING
-    static real pdt;
-    pdt = Params::dt;
+    const real pdt = Params::dt;
 #else
-    real pdt;
-    pdt = Params::dt_psub[part.dtlevel];
+    const real pdt = Params::dt_psub[part.dtlevel];
 #endif
     // Particle's centroid coordinates and velocity vectors
     const fastreal r[3] = {part.x, part.y, part.z};
     fastreal v[3] = {part.vx, part.vy, part.vz};
     real B[3],Ue[3];
     // Self-consistent B1 field from cell faces + constant B0 field => B(r) = B1(r) + B0(r)
-    g.faceintpol(r, Tgrid::FACEDATA_B, B);
-    addConstantMagneticField(r, B);
+    if (Params::useFaceB0 == true) {
+        g.faceintpol(r, Tgrid::FACEDATA_B, Tgrid::FACEDATA_B0, B);
+    } else {
+        g.faceintpol(r, Tgrid::FACEDATA_B, B);
+        addConstantMagneticField(r, B);
+    }
     // Velocity field of the electron fluid from cells
     // Do not pass r => uses saved_cellptr and avoids findcell call
     g.cellintpol(Tgrid::CELLDATA_UE,Ue);
@@ -918,7 +1021,7 @@ bool Simulation::PropagateV(TLinkedParticle& part)
         v[2] *= norm;
 #ifndef NO_DIAGNOSTICS
         // Increase particle speed cutting rate counter
-        Params::diag.pCounter[part.popid]->cutRateV += 1.0;
+        TCellBlockScheduler::atomicAdd(Params::diag.pCounter[part.popid]->cutRateV,1.0);
 #endif
     }
     part.vx = v[0];
@@ -71,8 +71,15 @@ private:
     void sph_fieldpropagate(Tgrid::TFaceDataSelect fsBnew, Tgrid::TFaceDataSelect fsBold,Tgrid::TFaceDataSelect fsBrhs,real fp_dt, bool do_upwinding);
 #endif
 #ifdef USE_PARTICLE_SUBCYCLING
+    enum {SUBCYCLE_LEVELS=256}; //!< Length of Params::dt_psub and Params::accum_psubfactor
+    static std::vector<TLinkedParticle*> subcycleBins[SUBCYCLE_LEVELS]; //!< Particles with dtlevel >= 1 waiting for their remaining substeps
+    static int subcycleLevelCount[SUBCYCLE_LEVELS]; //!< Particles found on each dtlevel by PropagatePart1
+    static int subcycleLost; //!< Particles flagged lost by the binned substeps
     static bool PropagatePart1(TLinkedParticle&, ParticlePassArgs);
     static bool PropagatePart2(TLinkedParticle&);
+    static bool NotLost(TLinkedParticle&);
+    void subcycleBinsPart1();
+    void subcycleBinsPart2();
 #endif
 };
 
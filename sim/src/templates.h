@@ -57,6 +57,33 @@ int Tgrid::particle_pass(Func op, bool relocate)
     return ndel;
 }
 
+/** \brief Pass all particles in the grid to the function op concurrently
+ *
+ * Like particle_pass without relocation, but blocks of root cells are passed
+ * by the threads of the grid scheduler, so op must be thread-safe and may
+ * only change the particle it gets.
+ */
+template <class Func>
+int Tgrid::particle_pass_concurrent(Func op)
+{
+    struct Task : public TCellBlockTask {
+        TCellPtr *cells;
+        Func *op;
+        std::vector<int> ndel;
+        void run(const int* c, int n, int worker) {
+            for (int i = 0; i < n; ++i) ndel[worker]+= cells[c[i]]->particle_pass_recursive(*op,false);
+        }
+    } task;
+    task.cells = cells;
+    task.op = &op;
+    task.ndel.assign(scheduler.getThreads(),0);
+    block_pass(task,false,true);
+    int ndel = 0;
+    for (unsigned int w = 0; w < task.ndel.size(); ++w) ndel+= task.ndel[w];
+    n_particles-= ndel;
+    return ndel;
+}
+
 //! Pass cells (recursive)
 template <class Func>
 void Tgrid::Tcell::cellPassRecursive(Func& op)
@@ -163,10 +163,10 @@ struct CellFormulas {
             real n=0,vx=0,vy=0,vz=0;
             for(unsigned int i=0; i< popId.size(); i++) {
                 int j = popId[i];
-                n += cell.pop_ave_n[j];
-                vx += cell.pop_ave_n[j]*cell.pop_ave_vx[j];
-                vy += cell.pop_ave_n[j]*cell.pop_ave_vy[j];
-                vz += cell.pop_ave_n[j]*cell.pop_ave_vz[j];
+                n += cell.pop_ave_n(j);
+                vx += cell.pop_ave_n(j)*cell.pop_ave_vx(j);
+                vy += cell.pop_ave_n(j)*cell.pop_ave_vy(j);
+                vz += cell.pop_ave_n(j)*cell.pop_ave_vz(j);
             }
             real inv_n=0;
             if(n>0) {
@@ -187,7 +187,7 @@ struct CellFormulas {
             real n=0;
             for(unsigned int i=0; i< popId.size(); i++) {
                 int j = popId[i];
-                n += cell.pop_ave_n[j];
+                n += cell.pop_ave_n(j);
             }
             return vector<real> (1,n);
         }
@@ -400,7 +400,7 @@ struct CellFormulas {
     struct sph_nFormula {
         vector<real> operator()(const GridPriv::Tcell& cell,
                                 const vector<int>& popId) {
-            return vector<real> (1, cell.plist.calc_weight(popId)/(cell.sph_dV));
+            return vector<real> (1, cell.plist.calc_weight(popId)/(cell.sph_metric->dV));
             //return vector<real> (1, cell.nc);
         }
     };
@@ -408,14 +408,14 @@ struct CellFormulas {
     struct sph_rhoFormula {
         vector<real> operator()(const GridPriv::Tcell& cell,
                                 const vector<int>& popId) {
-            return vector<real> (1, cell.plist.calc_mass(popId)/(cell.sph_dV));
+            return vector<real> (1, cell.plist.calc_mass(popId)/(cell.sph_metric->dV));
         }
     };
     // rho_q calculation.
     struct sph_rhoqFormula {
         vector<real> operator()(const GridPriv::Tcell& cell,
                                 const vector<int>& popId) {
-            return vector<real> (1, cell.plist.calc_charge(popId)/(cell.sph_dV));
+            return vector<real> (1, cell.plist.calc_charge(popId)/(cell.sph_metric->dV));
             //return vector<real> (1, cell.rho_q);
         }
     };
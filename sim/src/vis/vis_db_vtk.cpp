@@ -21,6 +21,11 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <map>
+#ifdef USE_VTK_ZLIB
+#include <zlib.h>
+#endif
 #include "cpp_utils.h"
 #include "container.h"
 #include "vis_db_vtk.h"
@@ -558,6 +563,492 @@ void writeParticlesAsUnstructuredGrid(VisData& data, ostream& os,
     }
 }
 
+//! Header type of the VTK XML appended data arrays
+typedef unsigned long XMLHeader;
+
+const char* getXMLType(float)
+{
+    return "Float32";
+}
+
+const char* getXMLType(double)
+{
+    return "Float64";
+}
+
+const char* getXMLType(int)
+{
+    return "Int32";
+}
+
+const char* getXMLType(unsigned char)
+{
+    return "UInt8";
+}
+
+const char* getXMLType(unsigned long)
+{
+    return sizeof(unsigned long) == 8 ? "UInt64" : "UInt32";
+}
+
+//! Byte order of this machine (XML files are written in native order)
+const char* getXMLByteOrder()
+{
+    const unsigned short one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1 ?
+           "LittleEndian" : "BigEndian";
+}
+
+/** \brief Raw appended data block of a VTK XML file.
+ *
+ * Arrays are encoded whole when added and the XML tag referring to their
+ * offset is returned, so the XML part can be written before the binary
+ * block. With USE_VTK_ZLIB arrays are compressed in 64 kB blocks in the
+ * layout of vtkZLibDataCompressor.
+ */
+class XMLAppendedData
+{
+public:
+    template <class T>
+    string add(const string& name, const vector<T>& values,
+               unsigned int nComponents = 1) {
+        ostringstream tag;
+        tag << "<DataArray type=\"" << getXMLType(T()) << "\"";
+        if (name.empty() == false)
+            tag << " Name=\"" << name << "\"";
+        if (nComponents > 1)
+            tag << " NumberOfComponents=\"" << nComponents << "\"";
+        tag << " format=\"appended\" offset=\"" << m_block.size() << "\"/>";
+        encode(values.empty() ? 0 : reinterpret_cast<const char*>(&values[0]),
+               values.size() * sizeof(T));
+        return tag.str();
+    }
+    //! Adds floating point array with requested binary precision
+    string addFloating(const string& name, const vector<real>& values,
+                       unsigned int nComponents,
+                       DB::FloatingPrecision binFloatingPrec) {
+        switch (binFloatingPrec) {
+        case DB::FLOAT:
+            return add(name, vector<float>(values.begin(), values.end()),
+                       nComponents);
+        case DB::DOUBLE:
+            return add(name, vector<double>(values.begin(), values.end()),
+                       nComponents);
+        case DB::SAME:
+            break;
+        }
+        return add(name, values, nComponents);
+    }
+    //! Writes appended data section and closes the VTK XML file
+    void write(ostream& os) const {
+        os << "  <AppendedData encoding=\"raw\">\n   _";
+        os.write(m_block.data(), m_block.size());
+        os << "\n  </AppendedData>\n</VTKFile>\n";
+    }
+private:
+    string m_block;
+    void appendHeader(XMLHeader value) {
+        m_block.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+#ifndef USE_VTK_ZLIB
+    void encode(const char* bytes, std::size_t nBytes) {
+        appendHeader(nBytes);
+        m_block.append(bytes, nBytes);
+    }
+#else
+    void encode(const char* bytes, std::size_t nBytes) {
+        const std::size_t blockSize = 1 << 16;
+        const std::size_t nBlocks = (nBytes + blockSize - 1) / blockSize;
+        vector<XMLHeader> blockSizes(nBlocks);
+        vector<Bytef> buffer(compressBound(blockSize));
+        string compressed;
+        for (std::size_t b = 0; b < nBlocks; ++b) {
+            const std::size_t n = std::min(blockSize, nBytes - b * blockSize);
+            uLongf len = buffer.size();
+            if (compress2(&buffer[0], &len,
+                          reinterpret_cast<const Bytef*>(bytes + b * blockSize),
+                          n, Z_DEFAULT_COMPRESSION) != Z_OK)
+                throw runtime_error("zlib compression failed");
+            blockSizes[b] = len;
+            compressed.append(reinterpret_cast<const char*>(&buffer[0]), len);
+        }
+        appendHeader(nBlocks);
+        appendHeader(blockSize);
+        appendHeader(nBytes % blockSize);
+        for (std::size_t b = 0; b < nBlocks; ++b)
+            appendHeader(blockSizes[b]);
+        m_block.append(compressed);
+    }
+#endif
+};
+
+//! Writes start of a VTK XML file
+void writeXMLHeader(ostream& os, const string& type, bool compressed = true)
+{
+    os << "<?xml version=\"1.0\"?>\n";
+    os << "<VTKFile type=\"" << type << "\" version=\"1.0\" byte_order=\""
+       << getXMLByteOrder() << "\" header_type=\"" << getXMLType(XMLHeader())
+       << "\"";
+#ifdef USE_VTK_ZLIB
+    if (compressed)
+        os << " compressor=\"vtkZLibDataCompressor\"";
+#endif
+    os << ">\n";
+}
+
+//! Edge length of a multiblock piece in root cells
+const std::size_t rootBlockSize = 8;
+
+//! Gathers values of a cell variable in given patches to one array
+vector<real> getCellValues(VisData& data, const VisData::VectorVariable& var,
+                           const vector<unsigned int>& patchIdxs)
+{
+    const std::size_t nComps = var.components.size();
+    std::size_t nValues = 0;
+    for (unsigned int i = 0; i < patchIdxs.size(); ++i)
+        nValues += data.patches[patchIdxs[i]].cells.size();
+    vector<real> values(nValues * nComps);
+    std::size_t idx = 0;
+    for (unsigned int i = 0; i < patchIdxs.size(); ++i) {
+        const std::size_t nCells = data.patches[patchIdxs[i]].cells.size();
+        for (std::size_t comp = 0; comp < nComps; ++comp) {
+            const real* src = var.components[comp].values[patchIdxs[i]];
+            for (std::size_t valIdx = 0; valIdx < nCells; ++valIdx)
+                values[idx + valIdx * nComps + comp] = src[valIdx];
+        }
+        idx += nCells * nComps;
+    }
+    return values;
+}
+
+/** \brief Encodes cell variables of given pieces to appended data blocks.
+ *
+ * Each piece consists of patches. Variables are traversed in the outer
+ * loop, since each of them is generated for all patches at once.
+ */
+void addCellVariables(VisData& data,
+                      const vector<vector<unsigned int> >& pieces,
+                      vector<XMLAppendedData>& appended,
+                      vector<vector<string> >& arrays,
+                      DB::FloatingPrecision binFloatingPrec)
+{
+    for (ConstSequenceHandle<VisData::VectorVariable>::const_iterator var
+         = data.cellVectorVariables.begin();
+         var != data.cellVectorVariables.end(); ++var)
+        for (unsigned int piece = 0; piece < pieces.size(); ++piece)
+            arrays[piece].push_back(appended[piece].addFloating
+                                    (var->name, getCellValues(data, *var, pieces[piece]),
+                                     var->components.size(), binFloatingPrec));
+}
+
+//! Writes cell data arrays of a VTK XML piece
+void writeXMLCellData(ostream& os, const vector<string>& arrays)
+{
+    os << "      <CellData>\n";
+    for (vector<string>::const_iterator a = arrays.begin(); a != arrays.end();
+         ++a)
+        os << "        " << *a << "\n";
+    os << "      </CellData>\n";
+}
+
+/** \brief Writes cells as image data in VTK XML format.
+ *
+ * Cannot be used with AMR mesh.
+ */
+void writeCellsAsXMLImageData(VisData& data, ostream& os,
+                              DB::FloatingPrecision binFloatingPrec)
+{
+    const CommonDataSourceData::Patch& patch = data.patches[0];
+    real cellSize[] = { data.refRatio1CellSize[0] / patch.refinementRatio,
+                        data.refRatio1CellSize[1] / patch.refinementRatio,
+                        data.refRatio1CellSize[2] / patch.refinementRatio
+                      };
+    ostringstream extent;
+    extent << patch.startCoordinates[0] << " " << patch.endCoordinates[0] + 1
+           << " " << patch.startCoordinates[1] << " "
+           << patch.endCoordinates[1] + 1 << " " << patch.startCoordinates[2]
+           << " " << patch.endCoordinates[2] + 1;
+    vector<vector<unsigned int> > pieces(1, vector<unsigned int>(1, 0));
+    vector<XMLAppendedData> appended(1);
+    vector<vector<string> > arrays(1);
+    addCellVariables(data, pieces, appended, arrays, binFloatingPrec);
+    writeXMLHeader(os, "ImageData");
+    os << "  <ImageData WholeExtent=\"" << extent.str() << "\" Origin=\""
+       << data.startCoordinates[0] << " " << data.startCoordinates[1] << " "
+       << data.startCoordinates[2] << "\" Spacing=\"" << cellSize[0] << " "
+       << cellSize[1] << " " << cellSize[2] << "\">\n";
+    os << "    <Piece Extent=\"" << extent.str() << "\">\n";
+    writeXMLCellData(os, arrays[0]);
+    os << "    </Piece>\n";
+    os << "  </ImageData>\n";
+    appended[0].write(os);
+}
+
+//! Corners of a VTK voxel/hexahedron as offsets from the lower corner
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+const unsigned int cellCorners[8][3] = {
+    {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+    {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+const unsigned char vtkCellType = 12;  // VTK_HEXAHEDRON
+#else
+const unsigned int cellCorners[8][3] = {
+    {0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0},
+    {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}
+};
+const unsigned char vtkCellType = 11;  // VTK_VOXEL
+#endif
+
+/** \brief Unstructured grid piece in VTK XML format.
+ *
+ * Points, cells and cell variables of the piece are encoded to the
+ * appended data block before the XML part is written.
+ */
+struct XMLUnstructuredPiece {
+    std::size_t nPoints;
+    std::size_t nCells;
+    vector<string> geometry;   //! Points, connectivity, offsets and types
+    void write(ostream& os, const vector<string>& arrays,
+               const XMLAppendedData& appended) const {
+        writeXMLHeader(os, "UnstructuredGrid");
+        os << "  <UnstructuredGrid>\n";
+        os << "    <Piece NumberOfPoints=\"" << nPoints
+           << "\" NumberOfCells=\"" << nCells << "\">\n";
+        os << "      <Points>\n        " << geometry[0] << "\n      </Points>\n";
+        os << "      <Cells>\n";
+        for (unsigned int i = 1; i < geometry.size(); ++i)
+            os << "        " << geometry[i] << "\n";
+        os << "      </Cells>\n";
+        writeXMLCellData(os, arrays);
+        os << "    </Piece>\n";
+        os << "  </UnstructuredGrid>\n";
+        appended.write(os);
+    }
+};
+
+/** \brief Encodes points and cells of given patches as unstructured grid.
+ *
+ * Same point layout as in the legacy writer. Duplicate coordinates are
+ * removed if coordIndexes is given (then patches must be all patches).
+ */
+XMLUnstructuredPiece addUnstructuredGeometry
+(VisData& data, const vector<unsigned int>& patchIdxs,
+ SharedPtr<std::map<Coordinates<3>, std::size_t> > coordIndexes,
+ XMLAppendedData& appended, DB::FloatingPrecision binFloatingPrec)
+{
+    unsigned int maxRefRatio
+        = data.patches[data.patches.size() - 1].refinementRatio;
+    real spacing[] = { data.refRatio1CellSize[0] / maxRefRatio,
+                       data.refRatio1CellSize[1] / maxRefRatio,
+                       data.refRatio1CellSize[2] / maxRefRatio
+                     };
+    XMLUnstructuredPiece piece;
+    piece.nCells = 0;
+    for (unsigned int i = 0; i < patchIdxs.size(); ++i)
+        piece.nCells += data.patches[patchIdxs[i]].cells.size();
+    vector<real> points;
+    vector<int> connectivity;
+    connectivity.reserve(8 * piece.nCells);
+    if (coordIndexes                 // don't remove duplicate coordinates
+        == SharedPtr<std::map<Coordinates<3>, std::size_t> >(0)) {
+        int firstPatchPointIdx = 0;
+        for (unsigned int i = 0; i < patchIdxs.size(); ++i) {
+            const VisData::Patch& patch = data.patches[patchIdxs[i]];
+            vector<std::size_t> dims = getPatchDimensions(patch);
+            const unsigned int coordRatio = maxRefRatio / patch.refinementRatio;
+            for (std::size_t z = patch.startCoordinates[2] * coordRatio;
+                 z <= (patch.endCoordinates[2] + 1) * coordRatio; z += coordRatio)
+                for (std::size_t y = patch.startCoordinates[1] * coordRatio;
+                     y <= (patch.endCoordinates[1] + 1) * coordRatio;
+                     y += coordRatio)
+                    for (std::size_t x = patch.startCoordinates[0] * coordRatio;
+                         x <= (patch.endCoordinates[0] + 1) * coordRatio;
+                         x += coordRatio) {
+                        gridreal crd[3];
+                        crd[0] = x*spacing[0] + data.startCoordinates[0];
+                        crd[1] = y*spacing[1] + data.startCoordinates[1];
+                        crd[2] = z*spacing[2] + data.startCoordinates[2];
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+                        sph_transf_H2S_VTK(crd);
+#endif
+                        points.insert(points.end(), crd, crd + 3);
+                    }
+            const int jump[] = { 1, int(dims[0] + 1),
+                                 int((dims[0] + 1) * (dims[1] + 1))
+                               };
+            for (std::size_t z = 0; z < dims[2]; ++z)
+                for (std::size_t y = 0; y < dims[1]; ++y)
+                    for (std::size_t x = 0; x < dims[0]; ++x) {
+                        const int cornerIdx = firstPatchPointIdx
+                                              + x * jump[0] + y * jump[1] + z * jump[2];
+                        for (int c = 0; c < 8; ++c)
+                            connectivity.push_back(cornerIdx
+                                                   + cellCorners[c][0] * jump[0]
+                                                   + cellCorners[c][1] * jump[1]
+                                                   + cellCorners[c][2] * jump[2]);
+                    }
+            firstPatchPointIdx += jump[2] * (dims[2] + 1);
+        }
+    } else {           // remove duplicate coordinates
+        points.reserve(3 * coordIndexes->size());
+        std::size_t idx = 0;
+        for (std::map<Coordinates<3>, std::size_t>::iterator coords
+             = coordIndexes->begin(); coords != coordIndexes->end(); ++coords) {
+            coords->second = idx++;
+            gridreal crd[3];
+            for(int i=0; i<3; ++i) {
+                crd[i] = coords->first[i] * spacing[i] + data.startCoordinates[i];
+            }
+#ifdef USE_SPHERICAL_COORDINATE_SYSTEM
+            sph_transf_H2S_VTK(crd);
+#endif
+            points.insert(points.end(), crd, crd + 3);
+        }
+        for (unsigned int i = 0; i < patchIdxs.size(); ++i) {
+            const VisData::Patch& patch = data.patches[patchIdxs[i]];
+            const unsigned int coordRatio = maxRefRatio / patch.refinementRatio;
+            Interval<3> patchInterval
+                = getNodeIntervalFromPatch<3>(patch, 1, false);
+            for (Interval<3>::const_iterator coords
+                 = patchInterval.begin(); coords != patchInterval.end();
+                 ++coords) {
+                Coordinates<3> co = (*coords) * coordRatio;
+                for (int c = 0; c < 8; ++c)
+                    connectivity.push_back
+                    ((*coordIndexes)[co + Coordinates<3>
+                                     (cellCorners[c][0] * coordRatio,
+                                      cellCorners[c][1] * coordRatio,
+                                      cellCorners[c][2] * coordRatio)]);
+            }
+        }
+    }
+    piece.nPoints = points.size() / 3;
+    vector<int> offsets(piece.nCells);
+    for (std::size_t cellIdx = 0; cellIdx < piece.nCells; ++cellIdx)
+        offsets[cellIdx] = 8 * (cellIdx + 1);
+    piece.geometry.push_back(appended.addFloating("", points, 3,
+                             binFloatingPrec));
+    piece.geometry.push_back(appended.add("connectivity", connectivity));
+    piece.geometry.push_back(appended.add("offsets", offsets));
+    piece.geometry.push_back(appended.add
+                             ("types", vector<unsigned char>(piece.nCells,
+                                     vtkCellType)));
+    return piece;
+}
+
+/** \brief Writes cells as unstructured grid in VTK XML format.
+ *
+ * Can be used with AMR mesh.
+ */
+void writeCellsAsXMLUnstructuredGrid
+(VisData& data, ostream& os,
+ SharedPtr<std::map<Coordinates<3>, std::size_t> > coordIndexes,
+ DB::FloatingPrecision binFloatingPrec)
+{
+    vector<vector<unsigned int> > pieces(1);
+    for (unsigned int patchIdx = 0; patchIdx < data.patches.size(); ++patchIdx)
+        pieces[0].push_back(patchIdx);
+    vector<XMLAppendedData> appended(1);
+    vector<vector<string> > arrays(1);
+    XMLUnstructuredPiece piece = addUnstructuredGeometry
+                                 (data, pieces[0], coordIndexes, appended[0], binFloatingPrec);
+    addCellVariables(data, pieces, appended, arrays, binFloatingPrec);
+    piece.write(os, arrays[0], appended[0]);
+}
+
+/** \brief Writes cells as VTK XML multiblock data set.
+ *
+ * Patches are grouped by the block of rootBlockSize^3 root cells their
+ * first cell belongs to. Every block is written as its own unstructured
+ * grid file (filename_blockN.vtu) listed in filename.vtm, so readers can
+ * load the blocks in parallel.
+ */
+void writeCellsAsXMLMultiBlock(VisData& data, const string& filename,
+                               DB::FloatingPrecision binFloatingPrec)
+{
+    std::map<Coordinates<3>, unsigned int> blockIdxs;
+    vector<vector<unsigned int> > pieces;
+    for (unsigned int patchIdx = 0; patchIdx < data.patches.size(); ++patchIdx) {
+        const VisData::Patch& patch = data.patches[patchIdx];
+        const std::size_t blockCells = rootBlockSize * patch.refinementRatio;
+        Coordinates<3> block(patch.startCoordinates[0] / blockCells,
+                             patch.startCoordinates[1] / blockCells,
+                             patch.startCoordinates[2] / blockCells);
+        std::map<Coordinates<3>, unsigned int>::iterator b = blockIdxs.find(block);
+        if (b == blockIdxs.end()) {
+            b = blockIdxs.insert(make_pair(block, pieces.size())).first;
+            pieces.push_back(vector<unsigned int>());
+        }
+        pieces[b->second].push_back(patchIdx);
+    }
+    vector<XMLAppendedData> appended(pieces.size());
+    vector<vector<string> > arrays(pieces.size());
+    vector<XMLUnstructuredPiece> geometry;
+    for (unsigned int piece = 0; piece < pieces.size(); ++piece)
+        geometry.push_back(addUnstructuredGeometry
+                           (data, pieces[piece],
+                            SharedPtr<std::map<Coordinates<3>, std::size_t> >(0),
+                            appended[piece], binFloatingPrec));
+    addCellVariables(data, pieces, appended, arrays, binFloatingPrec);
+    const string baseName = filename.substr(filename.find_last_of('/') + 1);
+    string fName = filename + ".vtm";
+    ofstream of(fName.c_str());
+    writeXMLHeader(of, "vtkMultiBlockDataSet", false);
+    of << "  <vtkMultiBlockDataSet>\n";
+    for (unsigned int piece = 0; piece < pieces.size(); ++piece) {
+        ostringstream pieceName;
+        pieceName << "_block" << piece << ".vtu";
+        ofstream pof((filename + pieceName.str()).c_str(), ios::binary);
+        geometry[piece].write(pof, arrays[piece], appended[piece]);
+        pof.close();
+        // release encoded data of written piece
+        appended[piece] = XMLAppendedData();
+        of << "    <DataSet index=\"" << piece << "\" file=\""
+           << baseName << pieceName.str() << "\"/>\n";
+    }
+    of << "  </vtkMultiBlockDataSet>\n";
+    of << "</VTKFile>\n";
+    of.close();
+}
+
+//! Writes particles as unstructured grid in VTK XML format
+void writeParticlesAsXMLUnstructuredGrid(VisData& data, ostream& os,
+        DB::FloatingPrecision binFloatingPrec)
+{
+    const std::size_t nParticles = data.particles.size();
+    vector<real> points(3 * nParticles);
+    vector<int> connectivity(nParticles), offsets(nParticles);
+    for (std::size_t i = 0; i < nParticles; ++i) {
+        for (int dim = 0; dim < 3; ++dim)
+            points[3 * i + dim] = data.particles[i].coordinates[dim];
+        connectivity[i] = i;
+        offsets[i] = i + 1;
+    }
+    XMLAppendedData appended;
+    XMLUnstructuredPiece piece;
+    piece.nPoints = piece.nCells = nParticles;
+    piece.geometry.push_back(appended.addFloating("", points, 3,
+                             binFloatingPrec));
+    piece.geometry.push_back(appended.add("connectivity", connectivity));
+    piece.geometry.push_back(appended.add("offsets", offsets));
+    piece.geometry.push_back(appended.add   // VTK_VERTEX
+                             ("types", vector<unsigned char>(nParticles, 1)));
+    vector<string> arrays;
+    for (ConstSequenceHandle<VisData::VectorVariable>::const_iterator var
+         = data.particleVectorVariables.begin();
+         var != data.particleVectorVariables.end(); ++var) {
+        const std::size_t nComps = var->components.size();
+        vector<real> values(nParticles * nComps);
+        for (std::size_t comp = 0; comp < nComps; ++comp)
+            for (std::size_t valIdx = 0; valIdx < nParticles; ++valIdx)
+                values[valIdx * nComps + comp]
+                    = var->components[comp].values[0][valIdx];
+        arrays.push_back(appended.addFloating(var->name, values, nComps,
+                                              binFloatingPrec));
+    }
+    piece.write(os, arrays, appended);
+}
+
 }
 
 VTKVisDB::VTKVisDB(const VisDataSource& dataSource, FileFormat format,
@@ -583,19 +1074,47 @@ void VTKVisDB::writeVisValues(const std::string& filename,
         m_coordIndexes = getCoordinatesWithoutDuplicates<3>(data);
         break;
     }
-    string fName = filename + ".vtk";
-    ofstream of(fName.c_str());
-    // If data has only one AMR patch, write as structured points
+    string extension = ".vtk";
+    switch (m_format) {
+    case LEGACY_ASCII:
+    case LEGACY_BINARY: {
+        string fName = filename + extension;
+        ofstream of(fName.c_str());
+        // If data has only one AMR patch, write as structured points
 #ifndef USE_SPHERICAL_COORDINATE_SYSTEM
-    if (data.patches.size() == 1) {
-        writeCellsAsStructuredPoints(data, of, m_format, binFloatingPrec);
-    } else {
+        if (data.patches.size() == 1) {
+            writeCellsAsStructuredPoints(data, of, m_format, binFloatingPrec);
+        } else {
+            writeCellsAsUnstructuredGrid(data, of, m_format, m_coordIndexes, binFloatingPrec);
+        }
+#else
         writeCellsAsUnstructuredGrid(data, of, m_format, m_coordIndexes, binFloatingPrec);
+#endif
+        of.close();
+        break;
     }
-#else
-    writeCellsAsUnstructuredGrid(data, of, m_format, m_coordIndexes, binFloatingPrec);
+    case XML_MULTIBLOCK:
+        extension = ".vtu";
+        writeCellsAsXMLMultiBlock(data, filename, binFloatingPrec);
+        break;
+    case XML_BINARY: {
+        extension = ".vtu";
+#ifndef USE_SPHERICAL_COORDINATE_SYSTEM
+        if (data.patches.size() == 1) {
+            string fName = filename + ".vti";
+            ofstream of(fName.c_str(), ios::binary);
+            writeCellsAsXMLImageData(data, of, binFloatingPrec);
+            of.close();
+            break;
+        }
 #endif
-    of.close();
+        string fName = filename + extension;
+        ofstream of(fName.c_str(), ios::binary);
+        writeCellsAsXMLUnstructuredGrid(data, of, m_coordIndexes, binFloatingPrec);
+        of.close();
+        break;
+    }
+    }
     // write particles
     for (vector<Particles>::const_iterator particles = writeParticles.begin();
          particles != writeParticles.end(); ++particles) {
@@ -612,9 +1131,12 @@ void VTKVisDB::writeVisValues(const std::string& filename,
         else
             pFilename << particles->startParticleIdx << "-"
                       << particles->endParticleIdx;
-        pFilename << ".vtk";
-        ofstream pof(pFilename.str().c_str());
-        writeParticlesAsUnstructuredGrid(data, pof, *particles);
+        pFilename << extension;
+        ofstream pof(pFilename.str().c_str(), ios::binary);
+        if (m_format == LEGACY_ASCII || m_format == LEGACY_BINARY)
+            writeParticlesAsUnstructuredGrid(data, pof, *particles);
+        else
+            writeParticlesAsXMLUnstructuredGrid(data, pof, binFloatingPrec);
         pof.close();
         // save memory by removing unneeded reference
         if (m_duplMode == CALCULATE_ALWAYS)
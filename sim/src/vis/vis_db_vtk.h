@@ -28,7 +28,17 @@
 class VTKVisDB : public VisDB
 {
 public:
-    enum FileFormat {LEGACY_ASCII, LEGACY_BINARY};
+    /** \brief Output file format
+     *
+     * LEGACY_ASCII:   legacy VTK format, ASCII (.vtk)
+     * LEGACY_BINARY:  legacy VTK format, big-endian binary (.vtk)
+     * XML_BINARY:     VTK XML format with raw appended data, image data
+     *                 (.vti) for single patch meshes and unstructured grid
+     *                 (.vtu) otherwise
+     * XML_MULTIBLOCK: VTK XML multiblock (.vtm), one unstructured grid
+     *                 piece (.vtu) per block of root cells
+     */
+    enum FileFormat {LEGACY_ASCII, LEGACY_BINARY, XML_BINARY, XML_MULTIBLOCK};
     /** \brief How to remove duplicate coordinates
      *
      * DONT_REMOVE: don't remove duplicate coordinates.
@@ -0,0 +1,494 @@
+/** This file is part of the HYB simulation platform.
+ *
+ *  Copyright 2014- Finnish Meteorological Institute
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <variables.H>
+#include <byteconv.H>
+#include "gridcache.H"
+using namespace std;
+
+enum TFormat {VTK, VTKBIN, GRIDXYZ, TECPLOT, PPM};
+
+TFormat format = VTK;
+int workers = 0;
+string outdir = ".";
+vector<string> files;
+vector<string> vars;
+vector<string> extraargs;
+bool verbose = false;
+const char *default_vars[] = {"rho","rhovx","rhovy","rhovz","U1","Bx1","By1","Bz1","Bx0","By0","Bz0",NULL};
+
+void usage()
+{
+    cerr << "usage: hcbatch [-j workers] [-F format] [-o outdir] [-v varlist] hcfiles..." << endl;
+    cerr << "       -j workers  number of worker processes (default: number of CPUs)" << endl;
+    cerr << "       -F format   vtk (ASCII VTK as hc2vtk, default), vtkbin (binary VTK)," << endl;
+    cerr << "                   gridxyz (as hc2gridxyz), tecplot (runs hc2tecplot)" << endl;
+    cerr << "                   or ppm (runs hc2ppm)" << endl;
+    cerr << "       -o outdir   directory of the output files (default: .)" << endl;
+    cerr << "       -v varlist  comma separated list of variables (see: hcintpol -fullhelp)" << endl;
+    cerr << "       -x args     extra arguments given to hc2tecplot or hc2ppm" << endl;
+    cerr << "       -V          verbose" << endl;
+    cerr << "       -h          help" << endl;
+    cerr
+     << "hcbatch converts many HC files, e.g. the snapshots of a run, with" << endl
+     << "one file per worker process at a time. A file argument containing" << endl
+     << "wildcards is expanded by hcbatch, so that a quoted pattern can be" << endl
+     << "used for more files than fit on the command line. The output of" << endl
+     << "file dir/name.hc is outdir/name.vtk, outdir/name.xyz or outdir/name.dat" << endl
+     << "(tecplot); hc2ppm writes dir/name.ppm. The mesh of the VTK and gridxyz" << endl
+     << "output is computed once for the snapshots of an HC time series that" << endl
+     << "share a topology file." << endl;
+    exit(0);
+}
+
+void terminate(const char *err)
+{
+    cerr << "Error: " << err << endl;
+    exit(-1);
+}
+
+void parseList(char* list, const char *sep, vector<string>& result)
+{
+    char *item = strtok(list,sep);
+    while(item)
+    {
+        result.push_back(item);
+        item = strtok(NULL,sep);
+    }
+}
+
+// add an input file argument, expanding wildcards
+void addFiles(const char *arg)
+{
+    if(!strpbrk(arg,"*?["))
+    {
+        files.push_back(arg);
+        return;
+    }
+    glob_t g;
+    if(glob(arg,0,NULL,&g) == 0)
+        for(size_t i=0; i<g.gl_pathc; i++)
+            files.push_back(g.gl_pathv[i]);
+    else
+        cerr << "Warning: no files match \"" << arg << "\"" << endl;
+    globfree(&g);
+}
+
+void options(int argc, char**argv)
+{
+    int c;
+    opterr = 0;
+    while((c=getopt(argc,argv,"hj:F:o:v:x:V")) != -1)
+    {
+        switch (c)
+        {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 'F':
+                if(!strcmp(optarg,"vtk")) format = VTK;
+                else if(!strcmp(optarg,"vtkbin")) format = VTKBIN;
+                else if(!strcmp(optarg,"gridxyz")) format = GRIDXYZ;
+                else if(!strcmp(optarg,"tecplot")) format = TECPLOT;
+                else if(!strcmp(optarg,"ppm")) format = PPM;
+                else terminate("unknown format");
+                break;
+            case 'o':
+                outdir = optarg;
+                break;
+            case 'v':
+                parseList(optarg,",",vars);
+                break;
+            case 'x':
+                parseList(optarg," ",extraargs);
+                break;
+            case 'V':
+                verbose = true;
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                terminate("unknown option");
+        }
+    }
+    for(int a=optind; a<argc; a++)
+        addFiles(argv[a]);
+    if(files.empty())
+        usage();
+    if(vars.empty() and format != TECPLOT)
+        for(int i=0;default_vars[i];i++)
+            vars.push_back(default_vars[i]);
+    if(workers <= 0)
+        workers = int(sysconf(_SC_NPROCESSORS_ONLN));
+    if(workers > int(files.size()))
+        workers = files.size();
+    if(workers <= 0)
+        workers = 1;
+}
+
+// output file name: outdir/basename with .hc replaced by ext
+string outputName(const string& hcfile, const char *ext)
+{
+    string base = hcfile.substr(hcfile.rfind('/') == string::npos ? 0 : hcfile.rfind('/')+1);
+    if(base.size() > 3 and base.compare(base.size()-3,3,".hc") == 0)
+        base.erase(base.size()-3);
+    return outdir + "/" + base + ext;
+}
+
+inline string coord2str(const double &X, const double &Y, const double &Z)
+{
+    std::ostringstream o;
+    o.precision(5);
+    if (!(o << X <<' '<< Y <<' '<< Z))
+        throw runtime_error("cord2str: could not convert coordinate to string");
+    return o.str();
+}
+
+inline bool isExtra(Tmetagrid &g, TGridIndex &c)
+{
+    const TCellType ct = g.celltype(c);
+    if(ct == DEAD_CELL or ct == GHOST_CELL or ct == REMOVED_CELL)
+        return true;
+    return false;
+}
+
+// Leaf cells and the VTK mesh of a grid. Snapshots of an HC time series that
+// share the topology file have the same mesh, which is then built only once.
+struct TMesh
+{
+    string topology;                // topology file, empty if not from a time series
+    vector<TGridIndex> leaves;      // leaf cells in grid order
+    vector<double> centroids;       // 3 per leaf
+    vector<int> reflevel;           // hc2gridxyz refinement level column
+    vector<char> extra;             // ghost, dead or removed leaf
+    int ncells;                     // VTK cells, i.e. leaves that are not extra
+    vector<string> points;          // VTK points as hc2vtk writes them
+    vector<float> xyz;              // the same points for binary VTK
+    vector<int> corners;            // 8 point indices per VTK cell
+    TMesh() {ncells = 0;}
+};
+
+void buildMesh(Tmetagrid &g, TMesh &m)
+{
+    map<string,int> table;
+    TGridIndex c;
+    Tdimvec Xc;
+    int reflevel = 0;
+    m.leaves.clear(); m.centroids.clear(); m.reflevel.clear(); m.extra.clear();
+    m.points.clear(); m.xyz.clear(); m.corners.clear();
+    m.ncells = 0;
+    m.topology = g.topologyfile() ? g.topologyfile() : "";
+    const bool vtk = (format == VTK or format == VTKBIN);
+    for (c=g.first(); !g.isover(c); c=g.next(c))
+    {
+        if(!g.isleaf(c)) { reflevel++; continue; }
+        g.centroid(c,Xc);
+        m.leaves.push_back(c);
+        m.centroids.push_back(Xc[0]); m.centroids.push_back(Xc[1]); m.centroids.push_back(Xc[2]);
+        m.reflevel.push_back(reflevel);
+        reflevel = 0;
+        m.extra.push_back(isExtra(g,c));
+        if(!vtk or m.extra.back())
+            continue;
+        // corners in VTK_VOXEL order: x changes fastest, then y, then z
+        m.ncells++;
+        const double halfdx = 0.5*g.cellsize(c);
+        for(int k=0; k<8; k++)
+        {
+            const double X = Xc[0] + ((k & 1) ? halfdx : -halfdx);
+            const double Y = Xc[1] + ((k & 2) ? halfdx : -halfdx);
+            const double Z = Xc[2] + ((k & 4) ? halfdx : -halfdx);
+            const string key = coord2str(X,Y,Z);
+            map<string,int>::iterator it = table.find(key);
+            if(it == table.end())
+            {
+                it = table.insert(make_pair(key,int(m.points.size()))).first;
+                m.points.push_back(key);
+                m.xyz.push_back(X); m.xyz.push_back(Y); m.xyz.push_back(Z);
+            }
+            m.corners.push_back(it->second);
+        }
+    }
+}
+
+// values[v*nleaves+l] of variable v at the centroid of leaf l, extra leaves
+// are skipped (left zero) for VTK
+void interpolate(Tmetagrid &g, const TMesh &m, Tvariable *tv, vector<double> &values)
+{
+    const size_t nleaves = m.leaves.size();
+    const bool vtk = (format == VTK or format == VTKBIN);
+    Tdimvec Xc;
+    values.assign(vars.size()*nleaves,0.0);
+    for(size_t l=0; l<nleaves; l++)
+    {
+        if(vtk and m.extra[l])
+            continue;
+        Xc[0] = m.centroids[3*l]; Xc[1] = m.centroids[3*l+1]; Xc[2] = m.centroids[3*l+2];
+        g.intpol(Xc,0,true);
+        for(size_t v=0; v<vars.size(); v++)
+            values[v*nleaves+l] = tv[v].get(g,Xc);
+    }
+}
+
+void writeVTK(ostream &o, const TMesh &m, const vector<double> &values)
+{
+    const size_t nleaves = m.leaves.size();
+    o.precision(5);
+    o << "# vtk DataFile Version 2.0" << endl;
+    o << "HC file grid" << endl;
+    o << "ASCII" << endl;
+    o << "DATASET UNSTRUCTURED_GRID" << endl;
+    o << "POINTS " << m.points.size() << " float " << endl;
+    for(size_t i=0; i<m.points.size(); i++)
+        o << m.points[i] << '\n';
+    o << "CELLS " << m.ncells << " " << 9*m.ncells << endl;
+    for(int i=0; i<m.ncells; i++)
+    {
+        o << "8 ";
+        for(int k=0; k<8; k++)
+            o << m.corners[8*i+k] << ' ';
+        o << '\n';
+    }
+    o << "CELL_TYPES " << m.ncells << endl;
+    for(int i=0; i<m.ncells; i++)
+        o << "11" << '\n';
+    o << "CELL_DATA " << m.ncells << endl;
+    for(size_t v=0; v<vars.size(); v++)
+    {
+        o << "SCALARS " << vars[v] << " float 1" << endl;
+        o << "LOOKUP_TABLE default" << endl;
+        for(size_t l=0; l<nleaves; l++)
+            if(!m.extra[l])
+                o << values[v*nleaves+l] << '\n';
+    }
+}
+
+// write n values in the big-endian byte order of binary VTK files
+template <class T>
+void writeBigEndian(ostream &o, vector<T> &buf)
+{
+    if(buf.empty())
+        return;
+    ByteConversion(sizeof(T),(unsigned char *)&buf[0],buf.size());
+    o.write((const char *)&buf[0],buf.size()*sizeof(T));
+}
+
+void writeVTKBinary(ostream &o, const TMesh &m, const vector<double> &values)
+{
+    const size_t nleaves = m.leaves.size();
+    o << "# vtk DataFile Version 2.0" << endl;
+    o << "HC file grid" << endl;
+    o << "BINARY" << endl;
+    o << "DATASET UNSTRUCTURED_GRID" << endl;
+    o << "POINTS " << m.points.size() << " float" << endl;
+    vector<float> fbuf(m.xyz);
+    writeBigEndian(o,fbuf);
+    o << endl << "CELLS " << m.ncells << " " << 9*m.ncells << endl;
+    vector<int> ibuf(9*m.ncells);
+    for(int i=0; i<m.ncells; i++)
+    {
+        ibuf[9*i] = 8;
+        for(int k=0; k<8; k++)
+            ibuf[9*i+1+k] = m.corners[8*i+k];
+    }
+    writeBigEndian(o,ibuf);
+    o << endl << "CELL_TYPES " << m.ncells << endl;
+    ibuf.assign(m.ncells,11);
+    writeBigEndian(o,ibuf);
+    o << endl << "CELL_DATA " << m.ncells << endl;
+    for(size_t v=0; v<vars.size(); v++)
+    {
+        o << "SCALARS " << vars[v] << " float 1" << endl;
+        o << "LOOKUP_TABLE default" << endl;
+        fbuf.clear();
+        for(size_t l=0; l<nleaves; l++)
+            if(!m.extra[l])
+                fbuf.push_back(values[v*nleaves+l]);
+        writeBigEndian(o,fbuf);
+        o << endl;
+    }
+}
+
+void writeGridXYZ(ostream &o, const TMesh &m, const vector<double> &values)
+{
+    const size_t nleaves = m.leaves.size();
+    o << scientific;
+    o.precision(5);
+    for(size_t l=0; l<nleaves; l++)
+    {
+        o << m.centroids[3*l] << " " << m.centroids[3*l+1] << " " << m.centroids[3*l+2] << " " << m.reflevel[l] << " ";
+        for(size_t v=0; v<vars.size(); v++)
+            o << values[v*nleaves+l] << " ";
+        o << '\n';
+    }
+}
+
+// run hc2tecplot or hc2ppm on one file
+bool runConverter(const string &hcfile)
+{
+    vector<string> args;
+    if(format == TECPLOT)
+    {
+        args.push_back("hc2tecplot");
+        if(!vars.empty())
+        {
+            string list = vars[0];
+            for(size_t v=1; v<vars.size(); v++)
+                list += "," + vars[v];
+            args.push_back("-l"); args.push_back(list);
+        }
+        args.push_back("-o"); args.push_back(outputName(hcfile,".dat"));
+    }
+    else
+        args.push_back("hc2ppm");
+    args.insert(args.end(),extraargs.begin(),extraargs.end());
+    args.push_back(hcfile);
+    vector<char *> argv;
+    for(size_t i=0; i<args.size(); i++)
+        argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(NULL);
+    const pid_t pid = fork();
+    if(pid < 0)
+        return false;
+    if(pid == 0)
+    {
+        execvp(argv[0],&argv[0]);
+        cerr << "Error: cannot run " << argv[0] << endl;
+        _exit(127);
+    }
+    int status;
+    while(waitpid(pid,&status,0) < 0)
+        if(errno != EINTR) return false;
+    return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+}
+
+// Convert one file. The grid cache of the worker keeps only the grid being
+// converted, and reuses it for the next snapshot of the same topology.
+bool convert(TGridCache &gridcache, TMesh &mesh, Tvariable *tv, const string &hcfile)
+{
+    if(format == TECPLOT or format == PPM)
+        return runConverter(hcfile);
+    double Gamma, Invmu0, Mass; bool Pseudobackground;
+    Tmetagrid* gp = gridcache.open(hcfile.c_str(),Gamma,Invmu0,Mass,Pseudobackground);
+    if(!gp) {cerr << "*** hcbatch: cannot open HC file \"" << hcfile << "\"\n"; return false;}
+    Tmetagrid& g = *gp;
+    for(size_t v=0; v<vars.size(); v++)
+        if(!tv[v].select(vars[v].c_str(),Gamma,Invmu0,Mass))
+        {
+            cerr << "*** hcbatch: unknown variable \"" << vars[v] << "\"\n";
+            gridcache.close(gp);
+            return false;
+        }
+    if(mesh.topology.empty() or !g.topologyfile() or mesh.topology != g.topologyfile())
+        buildMesh(g,mesh);
+    else if(verbose)
+        cerr << "hcbatch: reusing mesh of " << mesh.topology << " for " << hcfile << endl;
+    vector<double> values;
+    interpolate(g,mesh,tv,values);
+    gridcache.close(gp);
+
+    const string outfile = outputName(hcfile,format == GRIDXYZ ? ".xyz" : ".vtk");
+    ofstream o(outfile.c_str(),ios::out | ios::binary);
+    if(!o.good()) {cerr << "*** hcbatch: cannot write \"" << outfile << "\"\n"; return false;}
+    if(format == VTK)
+        writeVTK(o,mesh,values);
+    else if(format == VTKBIN)
+        writeVTKBinary(o,mesh,values);
+    else
+        writeGridXYZ(o,mesh,values);
+    o.close();
+    if(!o.good()) {cerr << "*** hcbatch: error writing \"" << outfile << "\"\n"; return false;}
+    if(verbose)
+        cerr << "hcbatch: " << hcfile << " -> " << outfile << endl;
+    return true;
+}
+
+// Take files from the shared counter until they run out, return the number of failures
+int work(int *next)
+{
+    TGridCache gridcache;
+    gridcache.setbudget(0);
+    TMesh mesh;
+    Tvariable *tv = new Tvariable[vars.size() > 0 ? vars.size() : 1];
+    int i, failed = 0;
+    while((i = __sync_fetch_and_add(next,1)) < int(files.size()))
+        if(!convert(gridcache,mesh,tv,files[i]))
+            failed++;
+    delete [] tv;
+    return failed;
+}
+
+// Convert the files with forked worker processes. Like in the iontracer,
+// processes are used instead of threads because Tmetagrid keeps its
+// interpolation state inside the grid object and the HC library uses
+// static work buffers.
+int main(int argc, char **argv)
+{
+    options(argc,argv);
+    int *next = (int *)mmap(NULL,sizeof(int),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(next == MAP_FAILED)
+        terminate("cannot create shared file counter");
+    *next = 0;
+    if(verbose)
+        cerr << "hcbatch: " << files.size() << " files, " << workers << " workers" << endl;
+    if(workers == 1)
+        return work(next) == 0 ? 0 : 1;
+
+    cout.flush(), cerr.flush();
+    vector<pid_t> pids(workers);
+    for(int w=0; w<workers; w++)
+    {
+        pids[w] = fork();
+        if(pids[w] < 0)
+            terminate("cannot fork worker");
+        if(pids[w] == 0)
+        {
+            const int failed = work(next);
+            cout.flush(), cerr.flush();
+            _exit(failed == 0 ? 0 : 1);
+        }
+    }
+    bool ok = true;
+    for(int w=0; w<workers; w++)
+    {
+        int status;
+        while(waitpid(pids[w],&status,0) < 0)
+            if(errno != EINTR) terminate("waitpid failed");
+        if(!WIFEXITED(status) or WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+    if(!ok)
+        cerr << "*** hcbatch: some files could not be converted" << endl;
+    return ok ? 0 : 1;
+}
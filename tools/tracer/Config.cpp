@@ -33,7 +33,7 @@ using namespace std;
 
 // Trace variables that are not interpolated:
 const char* other_vars[] = {"bunEk","bunVx","bunVy","bunVz","parID",NULL};
-const char* formats[] = {"vtk","3D","matlab",NULL};
+const char* formats[] = {"vtk","3D","matlab","vtp",NULL};
 
 
 Config::Config()
@@ -43,6 +43,9 @@ Config::Config()
     //Default values:
     maxsteps = 2000;
     stepsize_p = 0.3;
+    tolerance = 1e-3;
+    gyrofraction = 0.05;
+    cellfraction = 0.5;
     tracetype = "particle";
     bunemanversion = "U";
     direction = "forward";
@@ -50,6 +53,8 @@ Config::Config()
     overwrite = true;
     endpts = false;
     intpolorder = 1;    
+    workers = 1;
+    decimate_angle = 0.;
     xmin = -numeric_limits<double>::max();
     ymin = -numeric_limits<double>::max();
     zmin = -numeric_limits<double>::max();
@@ -250,6 +255,13 @@ void Config::readCfg(const char* fname)
                 cerr << "Error: intpolorder must be 0 or 1 " << verbose << endl,exit(-1);
             continue;
         }
+        if(var == "WORKERS") 
+        {
+            workers = atoi(value.c_str());
+            if(workers <= 0)
+                cerr << "Error: workers must be positive: workers = " << workers << endl,exit(-1);
+            continue;
+        }
         if(var == "STEPSIZE") 
         {
             stepsize_p = strtod(value.c_str(),NULL);
@@ -257,6 +269,27 @@ void Config::readCfg(const char* fname)
                 cerr << "Error: stepsize must be positive: stepsize_p = " << stepsize_p  << endl,exit(-1);
             continue;
         }
+        if(var == "TOLERANCE") 
+        {
+            tolerance = strtod(value.c_str(),NULL);
+            if(tolerance <= 0)
+                cerr << "Error: tolerance must be positive: tolerance = " << tolerance << endl,exit(-1);
+            continue;
+        }
+        if(var == "GYROFRACTION") 
+        {
+            gyrofraction = strtod(value.c_str(),NULL);
+            if(gyrofraction <= 0)
+                cerr << "Error: gyrofraction must be positive: gyrofraction = " << gyrofraction << endl,exit(-1);
+            continue;
+        }
+        if(var == "CELLFRACTION") 
+        {
+            cellfraction = strtod(value.c_str(),NULL);
+            if(cellfraction <= 0)
+                cerr << "Error: cellfraction must be positive: cellfraction = " << cellfraction << endl,exit(-1);
+            continue;
+        }
         if(var == "ENDPOINTSONLY") 
         {
             endpts = atoi(value.c_str());
@@ -352,6 +385,13 @@ void Config::readCfg(const char* fname)
             fill_file_formats(value);
             continue;
         }
+        if(var == "DECIMATE_ANGLE")
+        {
+            decimate_angle = strtod(value.c_str(),NULL);
+            if(decimate_angle < 0)
+                cerr << "Error: decimate_angle must not be negative: decimate_angle = " << decimate_angle << endl,exit(-1);
+            continue;
+        }
         if(var == "OUT_DIR")
         {
             while(isspace(*(value.end()-1)))  // remove trailing whitespace
@@ -364,8 +404,8 @@ void Config::readCfg(const char* fname)
             while(isspace(*(value.end()-1)))  // remove trailing whitespace
                 value.erase(value.end()-1);
 
-            if( value != "E" and value != "U" and value != "ExB")
-                cerr << "Error: bunemanversion should be either E, U or ExB. bunemanversion = " << bunemanversion << endl,exit(-1);
+            if( value != "E" and value != "U" and value != "ExB" and value != "A")
+                cerr << "Error: bunemanversion should be either E, U, ExB or A. bunemanversion = " << value << endl,exit(-1);
 
             bunemanversion = value;
             continue;
@@ -418,9 +458,16 @@ void Config::writeDefaultCfg()
         << "# NOTE: comment out if there is no electron pressure term." << endl
         << "# PRESSURE_TERM_FILE " << endl << endl
 
-        << "# File formats specifies the output file format (values: vtk, matlab, 3D)." << endl
+        << "# File formats specifies the output file format (values: vtk, matlab, 3D, vtp)." << endl
+        << "# vtp is binary VTK XML PolyData written while tracing: finished tracks are streamed to disk" << endl
+        << "# and freed, so memory does not grow with the number of tracks if vtp is the only format." << endl
+        << "# Tracks are in the order they were finished (use parID to identify them)." << endl
         << "FORMATS " << file_formats[0] << endl << endl
 
+        << "# vtp output only: drop track points until the track has turned by more than" << endl
+        << "# DECIMATE_ANGLE degrees since the last written point (0 writes all points)." << endl
+        << "DECIMATE_ANGLE " << decimate_angle << endl << endl
+
         << "# Out put dir specifies a directory where trace files are written. " << endl
         << "OUT_DIR " << out_dir << endl << endl
 
@@ -434,6 +481,7 @@ void Config::writeDefaultCfg()
         << "# Buneman version: specifies tracing method." << endl
         << "# The alternatives are the two propagators from hyb code or ExB drift (values: E, U or ExB)." << endl
         << "# NOTE: you have to use E if elctron pressure term is included. ExB stands for tracing using ExB drift." << endl
+        << "# A is the E propagator with an adaptive step size (see TOLERANCE)." << endl
         << "BUNEMANVERSION " << bunemanversion << endl << endl
 
         << "# Direction of trace (values: forward, backward, both)" << endl
@@ -445,9 +493,20 @@ void Config::writeDefaultCfg()
         << "# Step size (dt) when doing a particle trace (in seconds)." << endl
         << "STEPSIZE " << stepsize_p << endl << endl
 
+        << "# Adaptive tracing (BUNEMANVERSION A): STEPSIZE is the maximum step. The step of each particle" << endl
+        << "# is limited to GYROFRACTION of the local gyroperiod and to CELLFRACTION of the time to cross" << endl
+        << "# the local cell, and it is adjusted by step doubling so that the local error per step" << endl
+        << "# (position relative to cell size, velocity relative to speed) stays below TOLERANCE." << endl
+        << "TOLERANCE " << tolerance << endl
+        << "GYROFRACTION " << gyrofraction << endl
+        << "CELLFRACTION " << cellfraction << endl << endl
+
         << "# Interpolation order (0 or 1. 0 gives zero interpolation and 1 linear interpolation.)" << endl
         << "INTPOLORDER " << intpolorder << endl << endl
 
+        << "# Number of parallel worker processes tracing the particles (integer)" << endl
+        << "WORKERS " << workers << endl << endl
+
         << "# Verbose output messages (0 or 1)" << endl
         << "VERBOSE " << verbose << endl << endl
 
@@ -554,12 +613,17 @@ void Config::writeCfg(ostream &of)
     of   << "OUT_DIR              " << out_dir << endl
          << "MAXSTEPS             " << maxsteps << endl
          << "STEPSIZE             " << stepsize_p << endl
+         << "TOLERANCE            " << tolerance << endl
+         << "GYROFRACTION         " << gyrofraction << endl
+         << "CELLFRACTION         " << cellfraction << endl
          << "BUNEMANVERSION       " << bunemanversion << endl
          << "DIRECTION            " << direction << endl
          << "VERBOSE              " << verbose << endl
          << "OVERWRITE            " << overwrite << endl
          << "ENDPOINTSONLY        " << endpts << endl
          << "INTPOLORDER          " << intpolorder << endl
+         << "WORKERS              " << workers << endl
+         << "DECIMATE_ANGLE       " << decimate_angle << endl
          << "XMIN                 " << xmin << endl
          << "XMAX                 " << xmax << endl
          << "YMIN                 " << ymin << endl
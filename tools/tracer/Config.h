@@ -49,7 +49,10 @@ class Config{
         vector<double> hcf_charge;
         vector<string> file_formats; 
         int maxsteps;
-        double stepsize_p;       // stepsize for particle trace.
+        double stepsize_p;       // stepsize for particle trace (maximum step in adaptive tracing).
+        double tolerance;        // local error tolerance per step in adaptive tracing.
+        double gyrofraction;     // maximum adaptive step as a fraction of the local gyroperiod.
+        double cellfraction;     // maximum adaptive step as a fraction of cell crossing time.
         string tracetype;
 
         /* Arrays for trace variables. There are two kinds those that are interpolated and those that are not. */
@@ -63,6 +66,8 @@ class Config{
         bool overwrite;
         bool endpts;
         int intpolorder;
+        int workers;             // number of parallel tracing processes.
+        double decimate_angle;   // vtp output: minimum turning angle (degrees) between kept points.
         string out_dir;
         string version;
 
@@ -23,6 +23,12 @@
 #include <string.h> 
 #include <math.h> 
 #include <stdlib.h> 
+#include <errno.h> 
+#include <unistd.h> 
+#include <poll.h> 
+#include <sys/mman.h> 
+#include <sys/time.h> 
+#include <sys/wait.h> 
 #include "Ptracer.h"
 #include "Config.h"
 #include "Track.h"
@@ -70,6 +76,23 @@ Ptracer::Ptracer(Config *conf)
         if(cfg->verbose) cout << "Opened grid for pressure term file " << cfg->pressuretermfile << endl;
     }
 
+    /* Select variables once, Tvariable::select does a name lookup. */
+    const char *bnames[3] = {"Bx","By","Bz"};
+    const char *b0names[3] = {"Bx0","By0","Bz0"};
+    const char *vnames[3] = {"vx","vy","vz"};
+    for(int k=0; k<3; k++)
+    {
+        varB[k].select(bnames[k],Gamma,Invmu0,Mass);
+        varB0[k].select(b0names[k],Gamma,Invmu0,Mass);
+        varV[k].select(vnames[k],Gamma,Invmu0,Mass);
+    }
+    varN.select("n",Gamma,Invmu0,Mass);
+    for(int k=0; k < cfg->tvi_len; k++)
+        if(!varTrace[k].select(cfg->tvars_intpol[k],Gamma,Invmu0,Mass))
+            cerr << "Error: invalid trace variable: " << cfg->tvars_intpol[k] << endl
+                 << "       Change the value of TRACEVARS to a correct value.", exit(-1);
+    tracedTracks = 0;
+
     /* Setup boundaries */
     if( cfg->xmin > cfg->xmax or cfg->ymin > cfg->ymax or cfg->zmin > cfg->zmax)
         cerr << "Error: minimum is bigger than maximum. Check boundary limits in confguration file." << endl
@@ -85,6 +108,9 @@ Ptracer::Ptracer(Config *conf)
     if(cfg->xmax < simBox[0] or cfg->xmax > simBox[1]) cfg->xmax = simBox[1];
     if(cfg->ymax < simBox[2] or cfg->ymax > simBox[3]) cfg->ymax = simBox[3];
     if(cfg->zmax < simBox[4] or cfg->zmax > simBox[5]) cfg->zmax = simBox[5];
+
+    /* Writer is needed while tracing for streamed output. */
+    writer = new TrackWriter(cfg,gridDims,simBox,cellWidth);
 }
 
 
@@ -122,21 +148,56 @@ inline void crossProd(double *a, double *b, double *c)
 }
 
 
-inline bool Ptracer::addPressureTerm(Tdimvec &X, double *E)
+// Buneman-Boris velocity update with fields E and B, qmideltT2 = 0.5*dt*q/m.
+inline void borisPush(double *v, double *E, double *B, double qmideltT2)
 {
-    Tvariable var;
+    double t[3], s[3], dv[3], vm[3], v0[3], vp[3], t2, b2;
+
+    dv[0] = qmideltT2 * E[0];
+    dv[1] = qmideltT2 * E[1];
+    dv[2] = qmideltT2 * E[2];
+
+    t[0] = qmideltT2 * B[0];
+    t[1] = qmideltT2 * B[1];
+    t[2] = qmideltT2 * B[2];
 
+    t2 = t[0]*t[0] + t[1]*t[1] + t[2]*t[2];
+    b2 = 2./(1.+t2);
+    
+    s[0] = b2 * t[0];
+    s[1] = b2 * t[1];
+    s[2] = b2 * t[2];
+
+    vm[0] = v[0] + dv[0];
+    vm[1] = v[1] + dv[1];
+    vm[2] = v[2] + dv[2];
+
+    crossProd(vm,t,v0);
+    v0[0] += vm[0];
+    v0[1] += vm[1];
+    v0[2] += vm[2];
+    
+    crossProd(v0,s,vp);
+    vp[0] += vm[0];
+    vp[1] += vm[1];
+    vp[2] += vm[2];
+
+    v[0] = vp[0] + dv[0];
+    v[1] = vp[1] + dv[1];
+    v[2] = vp[2] + dv[2];
+}
+
+
+inline bool Ptracer::addPressureTerm(Tdimvec &X, double *E)
+{
     if(!pgrid) // no pressure term file
         return true;
 
     if(!pgrid->intpol(X,cfg->intpolorder,true))
         return false; 
-    var.select("Bx0",Gamma,Invmu0,Mass);
-    E[0] += var.get(*pgrid,X);
-    var.select("By0",Gamma,Invmu0,Mass);
-    E[1] += var.get(*pgrid,X);
-    var.select("Bz0",Gamma,Invmu0,Mass);
-    E[2] += var.get(*pgrid,X);
+    E[0] += varB0[0].get(*pgrid,X);
+    E[1] += varB0[1].get(*pgrid,X);
+    E[2] += varB0[2].get(*pgrid,X);
     return true;
 }
 
@@ -173,7 +234,6 @@ inline double Ptracer::getOtherVar(int id, double *v, vector<Track>::iterator &i
 
 inline void Ptracer::saveVars( int n, Tdimvec &X, vector<Track>::iterator &it, Tmetagrid& g, double *v)
 {
-    Tvariable var;
     int k;
 
     if(cfg->endpts and n>0) n = 1; 
@@ -184,47 +244,42 @@ inline void Ptracer::saveVars( int n, Tdimvec &X, vector<Track>::iterator &it, T
     it->used = n+1;
 
     for(k=0; k < cfg->tvi_len; k++)
-    {
-        if(!var.select(cfg->tvars_intpol[k],Gamma,Invmu0,Mass))
-            cerr << "Error: invalid trace variable: " << cfg->tvars_intpol[k] << endl
-                 << "       Change the value of TRACEVARS to a correct value.", exit(-1);
-        it->data[k][n] = var.get(g,X);
-    }
+        it->data[k][n] = varTrace[k].get(g,X);
 
     for(int l=0; l < cfg->tvo_len; l++)
         it->data[k+l][n] = getOtherVar(cfg->tvo_flags[l],v,it);
 }
 
 
-inline bool Ptracer::getUe(Tdimvec &X, double *ue)
+// Magnetic field and electron velocity at X. Expects grids[0] to be 
+// interpolated at X already, other hc files are interpolated once here.
+// U_e = (sum_s q_s n_s v_s - j)/(sum_s q_s n_s).
+inline bool Ptracer::getFields(Tdimvec &X, double *B, double *ue)
 {
-    double dnq=0, apu_dnq=0, j[3], dnqu[3]={0.,0.,0.};
-    Tvariable var;
+    double dnq=0, apu_dnq=0, dnqu[3]={0.,0.,0.};
+    real j[3];
 
-    var.select("jx",Gamma,Invmu0,Mass);
-    j[0] = var.get(*grids[0],X);
-    var.select("jy",Gamma,Invmu0,Mass);
-    j[1] = var.get(*grids[0],X);
-    var.select("jz",Gamma,Invmu0,Mass);
-    j[2] = var.get(*grids[0],X);
+    B[0] = varB[0].get(*grids[0],X);
+    B[1] = varB[1].get(*grids[0],X);
+    B[2] = varB[2].get(*grids[0],X);
+
+    // One curl evaluation for all three components (ComputeCurl restores the CT table).
+    ComputeCurl(*grids[0],X,5,j[0],j[1],j[2]);
+    j[0] *= Invmu0;
+    j[1] *= Invmu0;
+    j[2] *= Invmu0;
 
     for(int l=0; grids[l]; l++)
     {
-        if(!grids[l]->intpol(X,cfg->intpolorder,true))
+        if(l>0 and !grids[l]->intpol(X,cfg->intpolorder,true))
             return false; 
 
-        var.select("n",Gamma,Invmu0,Mass);
-        apu_dnq = var.get(*grids[l],X)*cfg->hcf_charge[l]/cfg->hcf_mass[l];
+        apu_dnq = varN.get(*grids[l],X)*cfg->hcf_charge[l]/cfg->hcf_mass[l];
         dnq += apu_dnq;
 
-        var.select("vx",Gamma,Invmu0,Mass);
-        dnqu[0] += var.get(*grids[l],X)*apu_dnq;
-
-        var.select("vy",Gamma,Invmu0,Mass);
-        dnqu[1] += var.get(*grids[l],X)*apu_dnq;
-
-        var.select("vz",Gamma,Invmu0,Mass);
-        dnqu[2] += var.get(*grids[l],X)*apu_dnq;
+        dnqu[0] += varV[0].get(*grids[l],X)*apu_dnq;
+        dnqu[1] += varV[1].get(*grids[l],X)*apu_dnq;
+        dnqu[2] += varV[2].get(*grids[l],X)*apu_dnq;
     }
     ue[0] = 1./dnq * (dnqu[0]-j[0]);
     ue[1] = 1./dnq * (dnqu[1]-j[1]);
@@ -233,215 +288,460 @@ inline bool Ptracer::getUe(Tdimvec &X, double *ue)
 }
 
 
+// Electric and magnetic field at X, E = -U_e x B (+ pressure term).
+inline bool Ptracer::getEB(Tdimvec &X, double *E, double *B)
+{
+    double Ue[3];
+
+    if(!grids[0]->intpol(X,cfg->intpolorder,true)) return false;
+    if(!getFields(X,B,Ue)) return false;
+    crossProd(B,Ue,E);
+    addPressureTerm(X,E);
+    return true;
+}
+
+
 // Particle trace using E and Buneman scheme. (Used when E is not -UexB). 
 // Main part copied (more or less) straight from Hybrid simulation code: HybridSimulation::PropagateV
 // NOTE: Use this when the electron pressure is included in the simulation.
-void Ptracer::trace_BxUe_gradpe(bool bw)
+void Ptracer::track_BxUe_gradpe(vector<Track>::iterator &it, double ds)
 {
-    Tvariable var;
     Tmetagrid& g = *grids[0];
     Tdimvec X(0,0,0);
-    double ds = cfg->stepsize_p;
-    vector<Track>::iterator it, it_end;
+    double Efield[3], B[3], Ue[3]={0.,0.,0.};
+    double v[3] = {it->v0[0], it->v0[1], it->v0[2]};
+    double qmideltT2 = 0.5*ds*it->charge/it->mass;
+    X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
 
-    setDirection(bw,it,it_end,ds);
+    if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
 
-    for(;it!=it_end;it++)    
+    int n;
+    for(n=0;n < cfg->maxsteps-1; n++)
     {
-        double Efield[3], B[3], Ue[3]={0.,0.,0.}, t[3], s[3], dv[3], vm[3], v0[3], vp[3], t2, b2;
-        double v[3] = {it->v0[0], it->v0[1], it->v0[2]};
-        double qmideltT2 = 0.5*ds*it->charge/it->mass;
-        X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
+        if(!g.intpol(X,cfg->intpolorder,true)) break;
+        saveVars( n,X,it,g,v);
+        if(!getFields(X,B,Ue)) break;
 
-        if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
+        crossProd(B,Ue,Efield);
+        addPressureTerm(X,Efield);
 
-        int n;
-        for(n=0;n < cfg->maxsteps-1; n++)
-        {
-            if(!g.intpol(X,cfg->intpolorder,true)) break;
-            saveVars( n,X,it,g,v);
-            if(!getUe(X,Ue)) break;
-
-            var.select("Bx",Gamma,Invmu0,Mass);
-            B[0] = var.get(g,X);
-            var.select("By",Gamma,Invmu0,Mass);
-            B[1] = var.get(g,X);
-            var.select("Bz",Gamma,Invmu0,Mass);
-            B[2] = var.get(g,X);
-
-            crossProd(B,Ue,Efield);
-            addPressureTerm(X,Efield);
-
-            dv[0] = qmideltT2 * Efield[0];
-            dv[1] = qmideltT2 * Efield[1];
-            dv[2] = qmideltT2 * Efield[2];
-
-            t[0] = qmideltT2 * B[0];
-            t[1] = qmideltT2 * B[1];
-            t[2] = qmideltT2 * B[2];
-
-            t2 = t[0]*t[0] + t[1]*t[1] + t[2]*t[2];
-            b2 = 2./(1.+t2);
-            
-            s[0] = b2 * t[0];
-            s[1] = b2 * t[1];
-            s[2] = b2 * t[2];
-
-            vm[0] = v[0] + dv[0];
-            vm[1] = v[1] + dv[1];
-            vm[2] = v[2] + dv[2];
-
-            crossProd(vm,t,v0);
-            v0[0] += vm[0];
-            v0[1] += vm[1];
-            v0[2] += vm[2];
-            
-            crossProd(v0,s,vp);
-            vp[0] += vm[0];
-            vp[1] += vm[1];
-            vp[2] += vm[2];
-
-            v[0] = vp[0] + dv[0];
-            v[1] = vp[1] + dv[1];
-            v[2] = vp[2] + dv[2];
-
-            X[0] = X(0)+ds*v[0];
-            X[1] = X(1)+ds*v[1];
-            X[2] = X(2)+ds*v[2];
-
-            if(!boundaryCheck(X)) break;
-        }
-        if(cfg->verbose) 
-            cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
-                 << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
+        borisPush(v,Efield,B,qmideltT2);
+
+        X[0] = X(0)+ds*v[0];
+        X[1] = X(1)+ds*v[1];
+        X[2] = X(2)+ds*v[2];
+
+        if(!boundaryCheck(X)) break;
     }
+    if(cfg->verbose) 
+        cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
+             << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
 }
 
 
-void Ptracer::trace_ExB_drift(bool bw)
+void Ptracer::track_ExB_drift(vector<Track>::iterator &it, double ds)
 {
-    Tvariable var;
     Tmetagrid& g = *grids[0];
     Tdimvec X(0,0,0);
-    double ds = cfg->stepsize_p;
-    vector<Track>::iterator it, it_end;
+    double E[3], B[3], Ue[3]={0.,0.,0.};
+    double v[3] = {it->v0[0], it->v0[1], it->v0[2]};
+    double B2 = 0.;
+    X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
 
-    setDirection(bw,it,it_end,ds);
+    if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
 
-    for(;it!=it_end;it++)    
+    int n;
+    for(n=0;n < cfg->maxsteps-1; n++)
     {
-        double E[3], B[3], Ue[3]={0.,0.,0.}; // t[3], s[3], dv[3], vm[3], v0[3], vp[3], t2, b2;
-        double v[3] = {it->v0[0], it->v0[1], it->v0[2]};
-        double B2 = 0.;
-        X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
+        if(!g.intpol(X,cfg->intpolorder,true)) break;
+        saveVars( n,X,it,g,v);
+        if(!getFields(X,B,Ue)) break;
 
-        if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
+        crossProd(B,Ue,E);
+        addPressureTerm(X,E);
+        crossProd(E,B,v);
 
-        int n;
-        for(n=0;n < cfg->maxsteps-1; n++)
-        {
-            if(!g.intpol(X,cfg->intpolorder,true)) break;
-            saveVars( n,X,it,g,v);
-            if(!getUe(X,Ue)) break;
-
-            var.select("Bx",Gamma,Invmu0,Mass);
-            B[0] = var.get(g,X);
-            var.select("By",Gamma,Invmu0,Mass);
-            B[1] = var.get(g,X);
-            var.select("Bz",Gamma,Invmu0,Mass);
-            B[2] = var.get(g,X);
-
-            crossProd(B,Ue,E);
-            addPressureTerm(X,E);
-            crossProd(E,B,v);
-
-            B2 = B[0]*B[0] + B[1]*B[1] + B[2]*B[2];
-            v[0] /= B2;
-            v[1] /= B2;
-            v[2] /= B2;
-
-            X[0] = X(0)+ds*v[0];
-            X[1] = X(1)+ds*v[1];
-            X[2] = X(2)+ds*v[2];
-
-            if(!boundaryCheck(X)) break;
-        }
-        if(cfg->verbose) 
-            cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
-                 << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
+        B2 = B[0]*B[0] + B[1]*B[1] + B[2]*B[2];
+        v[0] /= B2;
+        v[1] /= B2;
+        v[2] /= B2;
+
+        X[0] = X(0)+ds*v[0];
+        X[1] = X(1)+ds*v[1];
+        X[2] = X(2)+ds*v[2];
+
+        if(!boundaryCheck(X)) break;
     }
+    if(cfg->verbose) 
+        cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
+             << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
 }
 
 
 // Particle trace using U_e and Buneman scheme. 
 // U_e is calculated from several hc files...
-void Ptracer::trace_BxUe(bool bw)
+void Ptracer::track_BxUe(vector<Track>::iterator &it, double ds)
 {
-    Tvariable var;
     Tmetagrid& g = *grids[0];
     Tdimvec X(0,0,0);
+    double v1[3] = {it->v0[0], it->v0[1], it->v0[2]};
+    double B[3],om[3],w[3],wXom[3],wXomXom[3],ue[3]={0.,0.,0.};
+    double o2;
+    double a = ds*it->charge/it->mass;
+    X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
+
+    if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
+
+    int n;
+    for(n=0;n < cfg->maxsteps-1; n++)
+    {
+        if(!g.intpol(X,cfg->intpolorder,true)) break;
+        if(!getFields(X,B,ue)) break;
+
+        om[0] = 0.5*a*B[0];
+        om[1] = 0.5*a*B[1];
+        om[2] = 0.5*a*B[2];
+
+        /* Save orbit data */
+        saveVars(n,X,it,g,v1);
+
+        /* Propagate velocity */
+        o2 = om[0]*om[0] + om[1]*om[1] + om[2]*om[2];
+
+        /* W = v_n-u_e */
+        w[0] = v1[0]-ue[0];
+        w[1] = v1[1]-ue[1];
+        w[2] = v1[2]-ue[2];
+
+        crossProd(w,om,wXom);
+        crossProd(wXom,om,wXomXom);
+        
+        w[0] = wXom[0] + wXomXom[0];
+        w[1] = wXom[1] + wXomXom[1];
+        w[2] = wXom[2] + wXomXom[2];
+
+        v1[0] = v1[0] + (2./(1.+o2)) * w[0];
+        v1[1] = v1[1] + (2./(1.+o2)) * w[1];
+        v1[2] = v1[2] + (2./(1.+o2)) * w[2];
+
+        /* propagate particle. */ 
+        X[0] = X(0)+ds*v1[0];
+        X[1] = X(1)+ds*v1[1];
+        X[2] = X(2)+ds*v1[2];
+
+        if(!boundaryCheck(X)) break;
+    }
+    if(cfg->verbose) 
+        cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
+             << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
+}
+
+
+// Particle trace using E and Buneman scheme with an adaptive step size.
+// The step is limited by the local gyroperiod, the cell crossing time and
+// the maximum step |ds|. The local error is estimated by step doubling: one
+// full step is compared with two half steps, the two half steps are
+// accepted when the difference is below cfg->tolerance, otherwise the step
+// is shortened and retried. The scheme is second order, so the step is
+// scaled by (tolerance/error)^(1/3).
+void Ptracer::track_adaptive(vector<Track>::iterator &it, double ds)
+{
+    Tmetagrid& g = *grids[0];
+    Tdimvec X(0,0,0), Xh(0,0,0);
+    double E[3], B[3], Eh[3], Bh[3];
+    double v[3] = {it->v0[0], it->v0[1], it->v0[2]};
+    double v1[3], vh[3], X1[3];
+    const double qm = it->charge/it->mass;
+    const double sgn = ds < 0 ? -1. : 1.;
+    const double hmax = fabs(ds);
+    const double hmin = 1e-6*hmax;
+    double h = hmax;
+    X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
+
+    if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
+
+    int n;
+    for(n=0;n < cfg->maxsteps-1; n++)
+    {
+        if(!g.intpol(X,cfg->intpolorder,true)) break;
+        saveVars( n,X,it,g,v);
+        const double dx = g.cellsize(g.find(X));
+        if(!getEB(X,E,B)) break;
+
+        /* step limits from the gyroperiod and the cell crossing time */
+        const double absB = sqrt(B[0]*B[0] + B[1]*B[1] + B[2]*B[2]);
+        const double absv = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        double hlim = hmax;
+        if(absB > 0) hlim = min(hlim, cfg->gyrofraction*2*M_PI/(fabs(qm)*absB));
+        if(absv > 0) hlim = min(hlim, cfg->cellfraction*dx/absv);
+        h = min(2*h, hlim);
+
+        for(;;)
+        {
+            /* one full step */
+            for(int k=0; k<3; k++) v1[k] = v[k];
+            borisPush(v1,E,B,0.5*sgn*h*qm);
+            for(int k=0; k<3; k++) X1[k] = X(k) + sgn*h*v1[k];
+
+            /* two half steps */
+            for(int k=0; k<3; k++) vh[k] = v[k];
+            borisPush(vh,E,B,0.25*sgn*h*qm);
+            for(int k=0; k<3; k++) Xh[k] = X(k) + 0.5*sgn*h*vh[k];
+            if(!getEB(Xh,Eh,Bh))
+            {
+                /* half step left the grid, let boundary check stop the track */
+                for(int k=0; k<3; k++) v[k] = v1[k], X[k] = X1[k];
+                break;
+            }
+            borisPush(vh,Eh,Bh,0.25*sgn*h*qm);
+            for(int k=0; k<3; k++) Xh[k] = Xh(k) + 0.5*sgn*h*vh[k];
+
+            /* local error relative to cell size and speed */
+            double ex = 0, ev = 0, vnorm = 0;
+            for(int k=0; k<3; k++)
+            {
+                ex += (X1[k]-Xh(k))*(X1[k]-Xh(k));
+                ev += (v1[k]-vh[k])*(v1[k]-vh[k]);
+                vnorm += vh[k]*vh[k];
+            }
+            double err = sqrt(ex)/dx;
+            if(vnorm > 0) err = max(err, sqrt(ev/vnorm));
+
+            /* NaN fields (e.g. no ions) are accepted, boundaryCheck stops the track */
+            const double fac = err > 0 ? 0.9*pow(cfg->tolerance/err,1./3.) : 2.;
+            if(err <= cfg->tolerance or h <= hmin or isnan(err))
+            {
+                for(int k=0; k<3; k++) v[k] = vh[k], X[k] = Xh(k);
+                h = max(hmin, min(2., fac)*h);
+                break;
+            }
+            h = max(hmin, max(0.2, fac)*h);
+        }
+
+        if(!boundaryCheck(X)) break;
+    }
+    if(cfg->verbose) 
+        cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
+             << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
+}
+
+
+void Ptracer::trace_BxUe_gradpe(bool bw)
+{
+    traceTracks(&Ptracer::track_BxUe_gradpe,bw);
+}
+
+
+void Ptracer::trace_ExB_drift(bool bw)
+{
+    traceTracks(&Ptracer::track_ExB_drift,bw);
+}
+
+
+void Ptracer::trace_BxUe(bool bw)
+{
+    traceTracks(&Ptracer::track_BxUe,bw);
+}
+
+
+void Ptracer::trace_adaptive(bool bw)
+{
+    traceTracks(&Ptracer::track_adaptive,bw);
+}
+
+
+// Trace all tracks of one direction with the given track function.
+void Ptracer::traceTracks(TTrackFunc f, bool bw)
+{
     double ds = cfg->stepsize_p;
     vector<Track>::iterator it, it_end;
 
     setDirection(bw,it,it_end,ds);
+    int N = it_end-it;
+    tracedTracks += N;
 
-    for(;it!=it_end;it++)    
+    if(cfg->workers <= 1 or N < 2)
     {
-        double v1[3] = {it->v0[0], it->v0[1], it->v0[2]};
-        double om[3],w[3],wXom[3],wXomXom[3],ue[3]={0.,0.,0.};
-        double o2;
-        double a = ds*it->charge/it->mass;
-        X[0]=it->x[0], X[1]=it->y[0], X[2]=it->z[0];
+        for(;it!=it_end;it++)
+        {
+            it->reserve();
+            (this->*f)(it,ds);
+            finishTrack(*it);
+        }
+        return;
+    }
+    traceWorkers(f,it,N,ds);
+}
 
-        if(cfg->verbose) cout << "Tracing particle: mass=" << it->mass << " charge=" << it->charge << ".";
 
-        int n;
-        for(n=0;n < cfg->maxsteps-1; n++)
-        {
-            if(!g.intpol(X,cfg->intpolorder,true)) break;
+// Stream a traced track to the writer and free it if no other output needs it.
+void Ptracer::finishTrack(Track &tr)
+{
+    writer->streamTrack(tr);
+    if(not writer->retainTracks())
+        tr.release();
+}
+
+
+// Write all of buf to fd, return false on error.
+static bool writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while(len > 0)
+    {
+        ssize_t r = write(fd,p,len);
+        if(r < 0 and errno == EINTR) continue;
+        if(r <= 0) return false;
+        p += r, len -= r;
+    }
+    return true;
+}
 
-            var.select("Bx",Gamma,Invmu0,Mass);
-            om[0] = 0.5*a*var.get(*grids[0],X);
-            var.select("By",Gamma,Invmu0,Mass);
-            om[1] = 0.5*a*var.get(*grids[0],X);
-            var.select("Bz",Gamma,Invmu0,Mass);
-            om[2] = 0.5*a*var.get(*grids[0],X);
 
-            if(!getUe(X,ue)) break;
+// Read exactly len bytes from fd, return false on error or end of file.
+static bool readAll(int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    while(len > 0)
+    {
+        ssize_t r = read(fd,p,len);
+        if(r < 0 and errno == EINTR) continue;
+        if(r <= 0) return false;
+        p += r, len -= r;
+    }
+    return true;
+}
 
-            /* Save orbit data */
-            saveVars(n,X,it,g,v1);
 
-            /* Propagate velocity */
-            o2 = om[0]*om[0] + om[1]*om[1] + om[2]*om[2];
+// Send one traced track through fd.
+bool Ptracer::sendTrack(int fd, int i, Track &tr)
+{
+    const int ndata = cfg->tvi_len + cfg->tvo_len;
+    bool ok = writeAll(fd,&i,sizeof(int))
+        and writeAll(fd,&tr.used,sizeof(int))
+        and writeAll(fd,tr.x,tr.used*sizeof(double))
+        and writeAll(fd,tr.y,tr.used*sizeof(double))
+        and writeAll(fd,tr.z,tr.used*sizeof(double));
+    for(int d=0; ok and d<ndata; d++)
+        ok = writeAll(fd,tr.data[d],tr.used*sizeof(double));
+    return ok;
+}
+
 
-            /* W = v_n-u_e */
-            w[0] = v1[0]-ue[0];
-            w[1] = v1[1]-ue[1];
-            w[2] = v1[2]-ue[2];
+// Receive the track sent by sendTrack() after its index has been read.
+bool Ptracer::receiveTrack(int fd, Track &tr)
+{
+    const int ndata = cfg->tvi_len + cfg->tvo_len;
+    int used;
 
-            crossProd(w,om,wXom);
-            crossProd(wXom,om,wXomXom);
-            
-            w[0] = wXom[0] + wXomXom[0];
-            w[1] = wXom[1] + wXomXom[1];
-            w[2] = wXom[2] + wXomXom[2];
+    if(not readAll(fd,&used,sizeof(int)) or used < 1 or used > tr.size)
+        return false;
+    tr.reserve();
+    tr.used = used;
+    bool ok = readAll(fd,tr.x,used*sizeof(double))
+        and readAll(fd,tr.y,used*sizeof(double))
+        and readAll(fd,tr.z,used*sizeof(double));
+    for(int d=0; ok and d<ndata; d++)
+        ok = readAll(fd,tr.data[d],used*sizeof(double));
+    return ok;
+}
 
-            v1[0] = v1[0] + (2./(1.+o2)) * w[0];
-            v1[1] = v1[1] + (2./(1.+o2)) * w[1];
-            v1[2] = v1[2] + (2./(1.+o2)) * w[2];
 
-            /* propagate particle. */ 
-            X[0] = X(0)+ds*v1[0];
-            X[1] = X(1)+ds*v1[1];
-            X[2] = X(2)+ds*v1[2];
+// Trace N tracks starting from it with cfg->workers forked processes. 
+// Tmetagrid keeps its interpolation state (CT table, corner cache) inside
+// the grid object, so every worker gets a private copy-on-write image of
+// the grids instead of sharing one between threads. Workers take chunks of
+// tracks from a shared counter and send each traced track back through a
+// pipe as soon as it is finished.
+void Ptracer::traceWorkers(TTrackFunc f, vector<Track>::iterator it, int N, double ds)
+{
+    const int nw = cfg->workers < N ? cfg->workers : N;
+    const int chunk = N/(8*nw) > 0 ? N/(8*nw) : 1;
+    vector<struct pollfd> fds(nw);
+    vector<pid_t> pids(nw);
+
+    int *next = (int *)mmap(NULL,sizeof(int),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(next == MAP_FAILED)
+        cerr << "Error: cannot create shared track counter" << endl, exit(-1);
+    *next = 0;
+
+    cout.flush(), cerr.flush();
+    for(int w=0; w<nw; w++)
+    {
+        int fd[2];
+        if(pipe(fd) != 0)
+            cerr << "Error: cannot create pipe for worker " << w << endl, exit(-1);
+        pids[w] = fork();
+        if(pids[w] < 0)
+            cerr << "Error: cannot fork worker " << w << endl, exit(-1);
+        if(pids[w] == 0)
+        {
+            /* worker: trace chunks until the counter runs out */
+            for(int v=0; v<w; v++) close(fds[v].fd);
+            close(fd[0]);
+            bool ok = true;
+            int i0;
+            while(ok and (i0 = __sync_fetch_and_add(next,chunk)) < N)
+            {
+                for(int i=i0; ok and i<i0+chunk and i<N; i++)
+                {
+                    vector<Track>::iterator t = it+i;
+                    t->reserve();
+                    (this->*f)(t,ds);
+                    ok = sendTrack(fd[1],i,*t);
+                    t->release();
+                }
+            }
+            cout.flush(), cerr.flush();
+            close(fd[1]);
+            _exit(ok ? 0 : 1);
+        }
+        close(fd[1]);
+        fds[w].fd = fd[0];
+        fds[w].events = POLLIN;
+    }
 
-            if(!boundaryCheck(X)) break;
+    /* collect traced tracks from whichever worker has one ready */
+    int received = 0, open = nw;
+    while(open > 0)
+    {
+        if(poll(&fds[0],nw,-1) < 0)
+        {
+            if(errno == EINTR) continue;
+            cerr << "Error: poll failed while collecting tracks" << endl, exit(-1);
         }
-        if(cfg->verbose) 
-            cerr << "  Stopped. Step = " << n << ", point: (" << it->x[it->used-1] 
-                 << "," << it->y[it->used-1] << "," << it->z[it->used-1] << ")" <<endl;
+        for(int w=0; w<nw; w++)
+        {
+            if(fds[w].fd < 0 or fds[w].revents == 0)
+                continue;
+            int i;
+            if(not readAll(fds[w].fd,&i,sizeof(int)))
+            {
+                /* end of file: worker is done */
+                close(fds[w].fd);
+                fds[w].fd = -1;
+                open--;
+                continue;
+            }
+            if(i < 0 or i >= N)
+                cerr << "Error: invalid track index from worker " << w << endl, exit(-1);
+            Track &tr = *(it+i);
+            if(not receiveTrack(fds[w].fd,tr))
+                cerr << "Error: invalid track data from worker " << w << endl, exit(-1);
+            finishTrack(tr);
+            received++;
+        }
+    }
+    for(int w=0; w<nw; w++)
+    {
+        int status;
+        waitpid(pids[w],&status,0);
+        if(!WIFEXITED(status) or WEXITSTATUS(status) != 0)
+            cerr << "Error: tracing worker " << w << " failed" << endl, exit(-1);
     }
+    munmap(next,sizeof(int));
+    if(received != N)
+        cerr << "Error: received " << received << " tracks from workers, expected " << N << endl, exit(-1);
 }
 
 
@@ -449,6 +749,10 @@ void Ptracer::trace()
 {
     bool bw = not (cfg->direction == "forward");
     bool fw = not (cfg->direction == "backward");
+    struct timeval t0, t1;
+
+    tracedTracks = 0;
+    gettimeofday(&t0,NULL);
 
     if(cfg->bunemanversion == "U")
     {        
@@ -465,12 +769,23 @@ void Ptracer::trace()
         if(bw) trace_ExB_drift(true);
         if(fw) trace_ExB_drift(false);
     }
+    else if(cfg->bunemanversion == "A") // adaptive step size.
+    {
+        if(bw) trace_adaptive(true);
+        if(fw) trace_adaptive(false);
+    }
+
+    gettimeofday(&t1,NULL);
+    double secs = (t1.tv_sec-t0.tv_sec) + 1e-6*(t1.tv_usec-t0.tv_usec);
+    cout << "Traced " << tracedTracks << " tracks in " << secs << " s";
+    if(secs > 0) cout << " (" << tracedTracks/secs << " tracks/s, " << cfg->workers << " workers)";
+    cout << endl;
 }
 
 
 void Ptracer::write()
 {
-    TrackWriter tw(cfg,gridDims,simBox,cellWidth);
+    TrackWriter &tw = *writer;
 
     for(unsigned int i=0; i < cfg->file_formats.size(); i++)
     {
@@ -482,9 +797,18 @@ void Ptracer::write()
 
         if(cfg->file_formats[i] == "matlab")
             tw.writeMatlab(plist,plist_bw);
+
+        if(cfg->file_formats[i] == "vtp")
+            tw.writeVTP();
     }
     tw.writeCfg(plist,plist_bw);
 }
 
 
+Ptracer::~Ptracer()
+{
+    delete writer;
+}
+
+
 
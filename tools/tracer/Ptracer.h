@@ -24,9 +24,13 @@
 #include "variables.H" 
 #include "Config.h"
 #include "gridcache.H" 
+#include "TrackWriter.h"
 using namespace std;
 
 
+class Ptracer;
+typedef void (Ptracer::*TTrackFunc)(vector<Track>::iterator &it, double ds);
+
 class Ptracer{
     private:
         vector<Track> plist;       // particle orbits forward or stream(field)line forward.
@@ -45,22 +49,44 @@ class Ptracer{
         double Gamma, Invmu0, Mass;
         bool Pseudobackground;
 
+        // variables selected once in the constructor, not on every step
+        Tvariable varB[3];       // Bx, By, Bz
+        Tvariable varB0[3];      // Bx0, By0, Bz0 (pressure term file)
+        Tvariable varN, varV[3]; // n, vx, vy, vz
+        Tvariable varTrace[ORBIT_DATA_MAX]; // cfg->tvars_intpol
+
+        int tracedTracks;        // number of tracks traced by trace()
+        TrackWriter *writer;
+
         inline bool boundaryCheck(Tdimvec &X);
         inline void setDirection( bool bw, vector<Track>::iterator &it, 
                                 vector<Track>::iterator &it_end, double &ds);
-        inline bool getUe(Tdimvec &X, double *ue);
+        inline bool getFields(Tdimvec &X, double *B, double *ue);
         inline void saveVars( int n, Tdimvec &X, vector<Track>::iterator &it, Tmetagrid& g, double *v);
         inline bool addPressureTerm(Tdimvec &X, double *E);
+        inline bool getEB(Tdimvec &X, double *E, double *B);
         inline double getOtherVar(int id, double *v, vector<Track>::iterator &it);
 
+        void traceTracks(TTrackFunc f, bool bw);
+        void finishTrack(Track &tr);
+        bool sendTrack(int fd, int i, Track &tr);
+        bool receiveTrack(int fd, Track &tr);
+        void traceWorkers(TTrackFunc f, vector<Track>::iterator it, int N, double ds);
+        void track_BxUe_gradpe(vector<Track>::iterator &it, double ds);
+        void track_BxUe(vector<Track>::iterator &it, double ds);
+        void track_ExB_drift(vector<Track>::iterator &it, double ds);
+        void track_adaptive(vector<Track>::iterator &it, double ds);
+
     public:
         Ptracer(Config *);
+        ~Ptracer();
         void readInitialPoints(const char* fname, bool iscfg);
         void write();
         void trace();
         void trace_BxUe_gradpe(bool bw); // tracer for simulation with pressure term.
         void trace_BxUe(bool bw);        // tracer E(lorentz) = -UexB.
         void trace_ExB_drift(bool bw);
+        void trace_adaptive(bool bw);    // E tracer with adaptive step size.
 };
 
 #define PTRACER_H
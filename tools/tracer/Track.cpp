@@ -27,6 +27,7 @@ using namespace std;
 Track::Track(double x0, double y0, double z0, int l, int Id)
 {
     size = l;
+    alloc = l;
     x = new double[l];
     y = new double[l];
     z = new double[l];
@@ -55,16 +56,17 @@ Track::Track(double x0, double y0, double z0, double vx, double vy, double vz, d
          char** tvars_intpol, int tvi_len, char** tvars_other, int tvo_len, int Id)
 {
     size = l;
-    x = new double[l];
-    y = new double[l];
-    z = new double[l];
+    alloc = 1;    // full length is allocated by reserve() when the track is traced
+    x = new double[alloc];
+    y = new double[alloc];
+    z = new double[alloc];
     x[0] = x0;
     y[0] = y0;
     z[0] = z0;
 
     for(int i=0;i<ORBIT_DATA_MAX;i++)
     {
-        data[i] = new double[l];
+        data[i] = new double[alloc];
         data[i][0] = 0.;
     }
 
@@ -94,16 +96,17 @@ Track::Track(const Track &other)
 {
     size = other.size;
     used = other.used;
-    x = new double[size];
-    y = new double[size];
-    z = new double[size];
+    alloc = other.alloc;
+    x = new double[alloc];
+    y = new double[alloc];
+    z = new double[alloc];
     memcpy(x, other.x, used*sizeof(double));
     memcpy(y, other.y, used*sizeof(double));
     memcpy(z, other.z, used*sizeof(double));
 
     for(int i=0;i<ORBIT_DATA_MAX;i++)
     {
-        data[i] = new double[size];
+        data[i] = new double[alloc];
         memcpy(data[i], other.data[i], used*sizeof(double));
     }
     data_names = other.data_names;
@@ -136,16 +139,17 @@ Track& Track::operator=(const Track& other)
 
         size = other.size;
         used = other.used;
-        x = new double[size];
-        y = new double[size];
-        z = new double[size];
+        alloc = other.alloc;
+        x = new double[alloc];
+        y = new double[alloc];
+        z = new double[alloc];
         memcpy(x, other.x, used*sizeof(double));
         memcpy(y, other.y, used*sizeof(double));
         memcpy(z, other.z, used*sizeof(double));
 
         for(int i=0;i<ORBIT_DATA_MAX;i++)
         {
-            data[i] = new double[size];
+            data[i] = new double[alloc];
             memcpy(data[i], other.data[i], used*sizeof(double));
         }
 
@@ -162,6 +166,43 @@ Track& Track::operator=(const Track& other)
 }
 
 
+// Reallocate the arrays to length l keeping the first used points.
+static void resizeArray(double *&a, int l, int used)
+{
+    double *b = new double[l];
+    memcpy(b, a, used*sizeof(double));
+    delete [] a;
+    a = b;
+}
+
+
+void Track::reserve()
+{
+    if(alloc == size)
+        return;
+    resizeArray(x, size, used);
+    resizeArray(y, size, used);
+    resizeArray(z, size, used);
+    for(int i=0;i<ORBIT_DATA_MAX;i++)
+        resizeArray(data[i], size, used);
+    alloc = size;
+}
+
+
+void Track::release()
+{
+    used = 1;
+    if(alloc == 1)
+        return;
+    resizeArray(x, 1, 1);
+    resizeArray(y, 1, 1);
+    resizeArray(z, 1, 1);
+    for(int i=0;i<ORBIT_DATA_MAX;i++)
+        resizeArray(data[i], 1, 1);
+    alloc = 1;
+}
+
+
 Track::~Track()
 {
     size = 0;
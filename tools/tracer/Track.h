@@ -35,6 +35,7 @@ class Track{
         vector<string>  data_names;     // names for variables in data.
         int used;                       // how many used of size.
         int size;                       // maxlength.
+        int alloc;                      // allocated length, 1 (start point only) or size.
         int id;                         // id number for particle.
 
         /* Used only by particle tracing. */
@@ -49,6 +50,8 @@ class Track{
               char** tvars_intpol, int tvi_len, char** tvars_other, int tvo_len, int Id);
         Track(const Track &other);
         Track& operator=(const Track& other);
+        void reserve();                 // allocate full length before tracing.
+        void release();                 // free all but the start point after writing.
         ~Track();
 };
 
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <stdio.h>
@@ -45,6 +46,36 @@ TrackWriter::TrackWriter(Config *c, int *gd, double *sb, double cw)
 
     memcpy( gridDims, gd, sizeof(int)*3);
     memcpy( simBox, sb, sizeof(double)*6);
+
+    streamVTP = false;
+    keepTracks = false;
+    for(unsigned int i=0; i < cfg->file_formats.size(); i++)
+    {
+        if(cfg->file_formats[i] == "vtp")
+            streamVTP = true;
+        else
+            keepTracks = true;
+    }
+
+    spoolPoints = 0;
+    for(int k=0; k <= ORBIT_DATA_MAX; k++)
+        spool[k] = NULL;
+    if(streamVTP)
+    {
+        for(int k=0; k <= cfg->tvi_len+cfg->tvo_len; k++)
+        {
+            spool[k] = tmpfile();
+            if(!spool[k])
+                cerr << "Error: cannot create spool file for vtp output." << endl, exit(-1);
+        }
+    }
+}
+
+
+TrackWriter::~TrackWriter()
+{
+    for(int k=0; k <= ORBIT_DATA_MAX; k++)
+        if(spool[k]) fclose(spool[k]);
 }
 
 
@@ -385,3 +416,158 @@ void TrackWriter::writeVTK( vector<Track> &plist, vector<Track> &plist_bw)
 }
 
 
+
+
+// Select the points of a track to be written. With cfg->decimate_angle > 0
+// interior points are dropped until the direction of the track has turned
+// by more than decimate_angle degrees since the last kept point. The first
+// and the last point are always kept.
+void TrackWriter::decimate( Track &tr, vector<int> &keep)
+{
+    keep.clear();
+    keep.push_back(0);
+    if(tr.used < 3 or cfg->decimate_angle <= 0)
+    {
+        for(int i=1; i<tr.used; i++)
+            keep.push_back(i);
+        return;
+    }
+
+    const double cosmax = cos(cfg->decimate_angle*M_PI/180.);
+    int last = 0;
+    for(int i=1; i<tr.used-1; i++)
+    {
+        double a[3] = {tr.x[i]-tr.x[last], tr.y[i]-tr.y[last], tr.z[i]-tr.z[last]};
+        double b[3] = {tr.x[i+1]-tr.x[i], tr.y[i+1]-tr.y[i], tr.z[i+1]-tr.z[i]};
+        double ab = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+        double aa = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+        double bb = b[0]*b[0] + b[1]*b[1] + b[2]*b[2];
+        if(aa > 0 and bb > 0 and ab < cosmax*sqrt(aa*bb))
+        {
+            keep.push_back(i);
+            last = i;
+        }
+    }
+    keep.push_back(tr.used-1);
+}
+
+
+void TrackWriter::streamTrack( Track &tr)
+{
+    if(!streamVTP)
+        return;
+
+    vector<int> keep;
+    decimate(tr,keep);
+    const int nk = keep.size();
+    const int ndata = cfg->tvi_len+cfg->tvo_len;
+    vector<double> buf(3*nk);
+
+    for(int i=0; i<nk; i++)
+    {
+        buf[3*i]   = tr.x[keep[i]];
+        buf[3*i+1] = tr.y[keep[i]];
+        buf[3*i+2] = tr.z[keep[i]];
+    }
+    bool ok = fwrite(&buf[0],sizeof(double),3*nk,spool[0]) == (size_t)(3*nk);
+    for(int k=0; ok and k<ndata; k++)
+    {
+        for(int i=0; i<nk; i++)
+            buf[i] = tr.data[k][keep[i]];
+        ok = fwrite(&buf[0],sizeof(double),nk,spool[k+1]) == (size_t)nk;
+    }
+    if(!ok)
+        cerr << "Error: cannot write vtp spool file." << endl, exit(-1);
+
+    spoolCounts.push_back(nk);
+    spoolPoints += nk;
+}
+
+
+// Copy the contents of a spool file to of as one raw appended data block.
+static void appendSpool( ofstream &of, FILE *f)
+{
+    char buf[1<<16];
+    size_t n;
+    unsigned long long bytes = ftell(f);
+    of.write((const char *)&bytes,sizeof(bytes));
+    rewind(f);
+    while((n = fread(buf,1,sizeof(buf),f)) > 0)
+        of.write(buf,n);
+}
+
+
+// VTK XML PolyData with one polyline per track and raw appended data
+// (UInt64 block headers, native byte order).
+void TrackWriter::writeVTP()
+{
+    if(!streamVTP)
+        return;
+
+    string fn;
+    outFilename(fn,"vtp");
+    ofstream of(fn.c_str(), ios::out | ios::binary);
+    if(!of.good())
+    {
+        cerr << "Error: Cannot open VTP file " << fn << " for output." <<endl;
+        return;
+    }
+
+    const int ntracks = spoolCounts.size();
+    const int ndata = cfg->tvi_len+cfg->tvo_len;
+    const unsigned long long hdr = sizeof(unsigned long long);
+    const unsigned long long ptsBytes = 3*spoolPoints*sizeof(double);
+    const unsigned long long dataBytes = spoolPoints*sizeof(double);
+    const unsigned long long lineBytes = ntracks*sizeof(long long);
+    unsigned long long offset = 0;
+    const unsigned int one = 1;
+    const char *byteorder = *(const char *)&one ? "LittleEndian" : "BigEndian";
+
+    of << "<?xml version=\"1.0\"?>" << endl
+       << "<!-- iontracer " << cfg->version << " trace file -->" << endl
+       << "<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\"" << byteorder << "\" header_type=\"UInt64\">" << endl
+       << "  <PolyData>" << endl
+       << "    <Piece NumberOfPoints=\"" << spoolPoints << "\" NumberOfVerts=\"0\" NumberOfLines=\"" << ntracks
+       << "\" NumberOfStrips=\"0\" NumberOfPolys=\"0\">" << endl;
+
+    of << "      <PointData>" << endl;
+    for(int k=0; k<ndata; k++)
+    {
+        const char *name = k < cfg->tvi_len ? cfg->tvars_intpol[k] : cfg->tvars_other[k-cfg->tvi_len];
+        of << "        <DataArray type=\"Float64\" Name=\"" << name << "\" format=\"appended\" offset=\"" << offset << "\"/>" << endl;
+        offset += hdr + dataBytes;
+    }
+    of << "      </PointData>" << endl
+       << "      <Points>" << endl
+       << "        <DataArray type=\"Float64\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << offset << "\"/>" << endl
+       << "      </Points>" << endl;
+    offset += hdr + ptsBytes;
+    of << "      <Lines>" << endl
+       << "        <DataArray type=\"Int64\" Name=\"connectivity\" format=\"appended\" offset=\"" << offset << "\"/>" << endl;
+    offset += hdr + spoolPoints*sizeof(long long);
+    of << "        <DataArray type=\"Int64\" Name=\"offsets\" format=\"appended\" offset=\"" << offset << "\"/>" << endl
+       << "      </Lines>" << endl
+       << "    </Piece>" << endl
+       << "  </PolyData>" << endl
+       << "  <AppendedData encoding=\"raw\">" << endl << "   _";
+
+    for(int k=0; k<ndata; k++)
+        appendSpool(of,spool[k+1]);
+    appendSpool(of,spool[0]);
+
+    /* connectivity is 0..spoolPoints-1, offsets are the cumulative track lengths */
+    unsigned long long bytes = spoolPoints*sizeof(long long);
+    of.write((const char *)&bytes,sizeof(bytes));
+    for(long long i=0; i<spoolPoints; i++)
+        of.write((const char *)&i,sizeof(i));
+    of.write((const char *)&lineBytes,sizeof(lineBytes));
+    long long end = 0;
+    for(int i=0; i<ntracks; i++)
+    {
+        end += spoolCounts[i];
+        of.write((const char *)&end,sizeof(end));
+    }
+
+    of << endl << "  </AppendedData>" << endl << "</VTKFile>" << endl;
+    of.close();
+}
@@ -19,6 +19,7 @@
 #ifndef TRACKWRITER_H
 
 #include <iostream>
+#include <stdio.h>
 #include "Track.h"
 #include "Config.h"
 #include <stdlib.h>
@@ -38,6 +39,16 @@ class TrackWriter{
         void writeVTKtrace( ofstream &of, vector<Track> &plist, vector<Track> &plist_bw);
         void writeASCII( vector<Track> &plist, vector<Track> &plist_bw, string ext);
 
+        /* Streaming VTK XML PolyData (.vtp) output. Finished tracks are
+           appended to one spool file per data array, the .vtp file with
+           raw appended data is assembled from the spool files at the end. */
+        bool streamVTP;           // vtp is one of the output formats.
+        bool keepTracks;          // some other format needs all tracks at the end.
+        FILE *spool[ORBIT_DATA_MAX+1]; // points, then trace variables.
+        vector<int> spoolCounts;  // number of points of each streamed track.
+        long spoolPoints;         // total number of streamed points.
+        void decimate( Track &tr, vector<int> &keep);
+
     public:
         TrackWriter(Config *c, int *gd, double *sb, double cw);
         void writeVTK( vector<Track> &plist, vector<Track> &plist_bw);
@@ -46,6 +57,11 @@ class TrackWriter{
         void writeMatlab( vector<Track> &plist, vector<Track> &plist_bw)
         { string s="m"; writeASCII( plist, plist_bw, s);}
         void writeCfg(vector<Track> &plist, vector<Track> &plist_bw);
+        void streamTrack( Track &tr);   // write a finished track to the stream outputs.
+        void writeVTP();                // assemble the .vtp file from the streamed tracks.
+        bool streaming() const { return streamVTP;}
+        bool retainTracks() const { return keepTracks;}
+        ~TrackWriter();
 };
 
 #define TRACKWRITER_H
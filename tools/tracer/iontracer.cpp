@@ -76,7 +76,7 @@ int main(int argc, char** argv)
     if(cfg.verbose) cfg.writeCfg(cout);
 
     Ptracer tracer(&cfg);
-    if(cfg.pressuretermfile.size() == 0 and cfg.bunemanversion == "E" and cfg.verbose)
+    if(cfg.pressuretermfile.size() == 0 and (cfg.bunemanversion == "E" or cfg.bunemanversion == "A") and cfg.verbose)
         cerr << "\nWARNING!!!: no pressure term file given.\n" <<endl;
 
     if(pointfile == NULL)        